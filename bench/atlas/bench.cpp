@@ -0,0 +1,209 @@
+/*
+ * Atlas sampling benchmark
+ *
+ * Samples a synthetic atlas the way the GPU would when drawing a surface
+ * further and further away, once from level 0 only (what the atlas used to be)
+ * and once trilinearly from the mip chain. Reports the memory touched per
+ * screen pixel, estimated as unique 64-byte cache lines per 8x8 pixel tile,
+ * and the time it takes on the CPU to do the same fetches
+ */
+
+#include "bench.h"
+#include "util.h"
+#include "game/atlas.h"
+
+#include <cstring>
+
+// Screen size, in pixels
+static constexpr u32 SCREEN_SIZE = 256;
+
+// Screen pixels are grouped in tiles, like GPU's do for texture caches
+static constexpr u32 TILE_SIZE = 8;
+
+static constexpr uptr CACHE_LINE = 64;
+
+// Number of minification steps to test, each doubles the previous one
+static constexpr u32 STEP_COUNT = 7;
+
+// Number of times each timed pass is repeated
+static constexpr u32 REPEAT_COUNT = 8;
+
+static atlas_col_t *levels[ATLAS_LEVELS];
+
+// Set of cache lines touched in the current tile
+static constexpr uptr LINESET_SIZE = 1024;
+static uptr lineSet[LINESET_SIZE];
+static u32 lineStamp[LINESET_SIZE], curStamp;
+static uptr lineCount;
+
+static void lineSet_clear() {
+  ++curStamp;
+  lineCount = 0;
+}
+
+static void lineSet_add(const void *addr) {
+  const uptr line = (uptr)addr/CACHE_LINE;
+
+  for (uptr i = (line*2654435761u) % LINESET_SIZE;; i = (i+1) % LINESET_SIZE) {
+    if (lineStamp[i] != curStamp) {
+      lineStamp[i] = curStamp;
+      lineSet[i] = line;
+      ++lineCount;
+      return;
+    }
+
+    if (lineSet[i] == line) return;
+  }
+}
+
+// Bilinear sample from a level, coordinates in level texels, repeats
+template<ubool RECORD>
+static FINLINE u32 sampleLevel(u32 level, f32 u, f32 v) {
+  const u32 w = atlas_levelWidth(level), h = atlas_levelHeight(level);
+  const atlas_col_t *l = levels[level];
+
+  u -= 0.5f;
+  v -= 0.5f;
+
+  const i32 iu = (i32)u - (u < 0.f), iv = (i32)v - (v < 0.f);
+  const u32 fu = (u32)((u-(f32)iu)*256.f), fv = (u32)((v-(f32)iv)*256.f);
+
+  const u32 x0 = (u32)iu & (w-1), x1 = (x0+1) & (w-1);
+  const u32 y0 = (u32)iv & (h-1), y1 = (y0+1) & (h-1);
+
+  const atlas_col_t *t[4] = {
+    l + y0*w + x0, l + y0*w + x1,
+    l + y1*w + x0, l + y1*w + x1
+  };
+
+  if (RECORD) {
+    for (uptr i = 0; i < 4; ++i) lineSet_add(t[i]);
+  }
+
+  // Only blend the first channel, we care about the fetches
+  const u32 top = t[0]->c[0]*(256-fu) + t[1]->c[0]*fu;
+  const u32 bottom = t[2]->c[0]*(256-fu) + t[3]->c[0]*fu;
+
+  return (top*(256-fv) + bottom*fv) >> 16;
+}
+
+// Sample one screen pixel, minified by scale
+template<ubool RECORD, ubool MIPS>
+static FINLINE u32 samplePixel(u32 x, u32 y, f32 scale, u32 lod, f32 lodFrac) {
+  const f32 u = ((f32)x+0.5f)*scale, v = ((f32)y+0.5f)*scale;
+
+  if (!MIPS) return sampleLevel<RECORD>(0, u, v);
+
+  const u32 nextLod = util_min<u32>(lod+1, ATLAS_LEVELS-1);
+
+  const u32 c0 = sampleLevel<RECORD>(lod, u/(f32)(1u << lod), v/(f32)(1u << lod));
+  const u32 c1 = sampleLevel<RECORD>(nextLod, u/(f32)(1u << nextLod), v/(f32)(1u << nextLod));
+
+  return (u32)((f32)c0*(1.f-lodFrac) + (f32)c1*lodFrac);
+}
+
+// Returns bytes of unique cache lines per pixel
+template<ubool MIPS>
+static f64 measureBandwidth(f32 scale, u32 lod, f32 lodFrac) {
+  uptr lines = 0;
+
+  for (u32 ty = 0; ty < SCREEN_SIZE; ty += TILE_SIZE) {
+    for (u32 tx = 0; tx < SCREEN_SIZE; tx += TILE_SIZE) {
+      lineSet_clear();
+
+      for (u32 y = ty; y < ty+TILE_SIZE; ++y) {
+        for (u32 x = tx; x < tx+TILE_SIZE; ++x)
+          bench_keep(samplePixel<true, MIPS>(x, y, scale, lod, lodFrac));
+      }
+
+      lines += lineCount;
+    }
+  }
+
+  return (f64)(lines*CACHE_LINE)/(f64)(SCREEN_SIZE*SCREEN_SIZE);
+}
+
+// Returns nanoseconds per pixel
+template<ubool MIPS>
+static f64 measureTime(countTimer_t &timer, f32 scale, u32 lod, f32 lodFrac) {
+  u32 sum = 0;
+
+  const countTimer_counts_t start = timer.time();
+  for (u32 r = 0; r < REPEAT_COUNT; ++r) {
+    for (u32 y = 0; y < SCREEN_SIZE; ++y) {
+      for (u32 x = 0; x < SCREEN_SIZE; ++x)
+        sum += samplePixel<false, MIPS>(x, y, scale, lod, lodFrac);
+    }
+  }
+  const countTimer_counts_t end = timer.time();
+
+  bench_keep(sum);
+
+  return bench_ns(timer, end-start)/(f64)(REPEAT_COUNT*SCREEN_SIZE*SCREEN_SIZE);
+}
+
+// Fill level 0 with noise, and box filter it down like the atlas generator does
+static void makeAtlas() {
+  u32 s = 0x9e3779b9;
+  for (uptr i = 0; i < ATLAS_WIDTH*ATLAS_HEIGHT; ++i) {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    levels[0][i].p = s;
+  }
+
+  for (u32 l = 1; l < ATLAS_LEVELS; ++l) {
+    const u32 w = atlas_levelWidth(l), h = atlas_levelHeight(l);
+    const u32 srcW = atlas_levelWidth(l-1);
+
+    for (u32 y = 0; y < h; ++y) {
+      for (u32 x = 0; x < w; ++x) {
+        const atlas_col_t *src = levels[l-1] + (y*2)*srcW + x*2;
+
+        for (uptr c = 0; c < 4; ++c) {
+          levels[l][y*w + x].c[c] =
+            (src[0].c[c] + src[1].c[c] + src[srcW].c[c] + src[srcW+1].c[c] + 2) >> 2;
+        }
+      }
+    }
+  }
+}
+
+void bench_main(mem_t &m, file_system_t &f, countTimer_t &timer, int argc, const char *const *argv) {
+  (void)f;
+  (void)argc;
+  (void)argv;
+
+  // Allocate every level
+  uptr size = 0;
+  for (u32 l = 0; l < ATLAS_LEVELS; ++l)
+    size += atlas_levelWidth(l)*atlas_levelHeight(l);
+
+  mem_container_t<atlas_col_t> data(m, size*sizeof(atlas_col_t));
+  if (!data.d) throw log_except("Cannot allocate %u bytes for atlas!", (u32)(size*sizeof(atlas_col_t)));
+
+  levels[0] = data.d;
+  for (u32 l = 1; l < ATLAS_LEVELS; ++l)
+    levels[l] = levels[l-1] + atlas_levelWidth(l-1)*atlas_levelHeight(l-1);
+
+  makeAtlas();
+
+  printf("Sampling %ux%u pixels from a %ux%u atlas\n",
+         SCREEN_SIZE, SCREEN_SIZE, ATLAS_WIDTH, ATLAS_HEIGHT);
+  printf("%8s | %12s %10s | %12s %10s\n",
+         "texel/px", "B/px (lvl0)", "ns/px", "B/px (mips)", "ns/px");
+
+  for (u32 step = 0; step < STEP_COUNT; ++step) {
+    // Use power of 2 scales with a little extra, so trilinear actually
+    // blends 2 levels
+    const u32 lod = step;
+    const f32 lodFrac = 0.5f;
+    const f32 scale = (f32)(1u << step)*1.41421356f;
+
+    printf("%8.2f | %12.2f %10.2f | %12.2f %10.2f\n", scale,
+           measureBandwidth<false>(scale, 0, 0.f),
+           measureTime<false>(timer, scale, 0, 0.f),
+           measureBandwidth<true>(scale, lod, lodFrac),
+           measureTime<true>(timer, scale, lod, lodFrac));
+  }
+}
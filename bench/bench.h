@@ -0,0 +1,40 @@
+/*
+ * Main header for benchmarks, contains helper functions for benchmarks and
+ * the benchmark entry point declaration
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "types.h"
+
+#include "mem.h"
+#include "file.h"
+#include "countTimer.h"
+#include "log.h"
+
+#include <cstdio>
+
+// Keeps the compiler from optimizing out a result that's never used
+template<typename T>
+static FINLINE void bench_keep(const T &v) {
+#ifdef PLAT_C_GNU
+  __asm__ __volatile__("" : : "g"(v) : "memory");
+#else
+  static volatile T sink;
+  sink = v;
+#endif
+}
+
+// Convert timer counts to nanoseconds
+static FINLINE f64 bench_ns(countTimer_t &timer, countTimer_counts_t counts) {
+  return (f64)counts*1000000000.0/(f64)timer.resolution();
+}
+
+// Throws log_except_t on error
+// m: Memory pool provided by platform layer
+// f: File system provided by platform layer
+// timer: Timer provided by platform layer
+// argc, argv: Arguments after the executable name
+void bench_main(mem_t &m, file_system_t &f, countTimer_t &timer, int argc, const char *const *argv);
+
+#endif //BENCH_H
@@ -0,0 +1,102 @@
+/*
+ * Job system benchmark
+ *
+ * Checks every item of a parallelFor runs exactly once when it asks for far more
+ * chunks than the job pool has jobs, and that creating more loose jobs than the
+ * pool holds doesn't reuse ones still in flight. Then times parallelFor with a
+ * few chunk sizes
+ *
+ * Usage: job_bench [items] [workers]
+ */
+
+#include "bench.h"
+#include "util.h"
+#include "str.h"
+#include "atomic.h"
+#include "job.h"
+
+#include <cstring>
+
+// Items split up by default
+static constexpr u32 ITEM_DEFAULT = 1000000;
+
+// Workers by default, a few even on machines with fewer cores, so the checks run jobs on them
+static constexpr u32 WORKER_DEFAULT = 3;
+
+// Items in the checks, chunks of 1 are far more jobs than JOB_POOLSIZE
+static constexpr u32 CHECK_ITEMS = 4*JOB_POOLSIZE + 123;
+
+// Times each chunk size is timed
+static constexpr u32 TIME_RUNS = 16;
+
+struct forData_t {
+  u32 *hits;
+};
+
+static void countItems(uptr begin, uptr end, void *data) {
+  forData_t &d = *(forData_t*)data;
+  for (uptr i = begin; i < end; ++i) atomic_add(d.hits + i, 1u, ATOMIC_RELAXED);
+}
+
+static void countJob(job_system_t &js, job_t *job, const void *data) {
+  (void)js;
+  (void)job;
+
+  u32 *hit = *(u32*const*)data;
+  atomic_add(hit, 1u, ATOMIC_RELAXED);
+}
+
+static void checkHits(const u32 *hits, u32 count, const char *what) {
+  for (u32 i = 0; i < count; ++i) {
+    if (hits[i] != 1) throw log_except("%s ran item %u %u times!", what, i, hits[i]);
+  }
+}
+
+void bench_main(mem_t &m, file_system_t &f, countTimer_t &timer, int argc, const char *const *argv) {
+  (void)f;
+
+  const u32 itemCount = (argc > 0) ? str_strnum_def<u32>(argv[0], ITEM_DEFAULT) : ITEM_DEFAULT;
+  const u32 workerCount = (argc > 1) ? str_strnum_def<u32>(argv[1], WORKER_DEFAULT) : WORKER_DEFAULT;
+  if (!itemCount) throw log_except("Item count must be above 0!");
+
+  job_system_t jobs(m, workerCount);
+
+  mem_container_t<u32> hits(m, util_max(itemCount, CHECK_ITEMS)*sizeof(u32));
+  if (!hits.d) throw log_except("Cannot allocate items!");
+
+  // parallelFor with a chunk per item
+  forData_t d = {hits.d};
+  memset(hits.d, 0, CHECK_ITEMS*sizeof(u32));
+  jobs.parallelFor(CHECK_ITEMS, 1, countItems, &d);
+  checkHits(hits.d, CHECK_ITEMS, "parallelFor");
+
+  // Loose jobs, only the last pool's worth are waited on
+  memset(hits.d, 0, CHECK_ITEMS*sizeof(u32));
+  const job_t *last[JOB_POOLSIZE];
+  for (u32 i = 0; i < CHECK_ITEMS; ++i) {
+    u32 *hit = hits.d + i;
+    job_t *job = jobs.create(countJob, hit);
+    last[i & (JOB_POOLSIZE-1)] = job;
+    jobs.run(job);
+  }
+  for (u32 i = 0; i < JOB_POOLSIZE; ++i) jobs.wait(last[i]);
+  checkHits(hits.d, CHECK_ITEMS, "Loose jobs");
+
+  printf("%u items ran once each, with %u workers\n", CHECK_ITEMS, jobs.workerCount());
+
+  // Timing
+  static const uptr chunks[] = {1, 64, 1024, 16384};
+
+  printf("Splitting %u items %u times\n", itemCount, TIME_RUNS);
+  printf("%8s | %12s\n", "chunk", "us (mean)");
+
+  for (uptr c = 0; c < util_arrlen(chunks); ++c) {
+    const countTimer_counts_t start = timer.time();
+    for (u32 r = 0; r < TIME_RUNS; ++r) jobs.parallelFor(itemCount, chunks[c], countItems, &d);
+    const f64 ns = bench_ns(timer, timer.time()-start);
+
+    printf("%8u | %12.2f\n", (u32)chunks[c], ns/TIME_RUNS/1000.0);
+  }
+
+  bench_keep(hits.d[0]);
+}
@@ -0,0 +1,30 @@
+/*
+ * Linux entry point for benchmarks
+ */
+
+#include "types.h"
+
+#include "bench.h"
+#include "mem.h"
+#include "file.h"
+#include "countTimer.h"
+#include "linux_file.h"
+
+int main(int argc, char **argv) {
+	// Initialize memory pool
+	mem_t mem(32*1024*1024);
+
+	// Initialize file system
+	linux_file_system_t sys(mem);
+
+	// Initialize timer
+	countTimer_t timer;
+
+	try {
+		bench_main(mem, *(file_system_t*)&sys, timer, argc-1, argv+1);
+		return 0;
+	} catch (const log_except_t &err) {
+		log_warning("Benchmark failed: %s", err.str());
+		return 1;
+	}
+}
@@ -0,0 +1,122 @@
+/*
+ * Audio mixer benchmark
+ *
+ * Mixes more and more looping voices into buffers the size the ALSA backend
+ * writes. Reports the time per buffer, voices mixed per millisecond (one voice
+ * for one buffer is one voice), and how many voices one core could mix at 44100 Hz
+ *
+ * Then does the same with streamed voices, decoding sounds/hum.snd from the pak
+ * as they're mixed, if the pak has it
+ *
+ * Usage: mixer_bench [buffer count] [pak file]
+ */
+
+#include "bench.h"
+#include "util.h"
+#include "str.h"
+#include "mixer.h"
+#include "game/pak.h"
+
+// Frames mixed in each call, the per-buffer times are for this many frames
+static constexpr uptr BUFFER_FRAMES = 1024;
+
+// Buffers mixed for each voice count by default
+static constexpr u32 BUFFER_DEFAULT = 2000;
+
+// Length of the sound every voice plays, a second
+static constexpr uptr SOUND_FRAMES = 44100;
+
+static constexpr f64 SAMPLE_RATE = 44100.0;
+
+static void stopAll(mixer_t &mixer) {
+  for (u32 v = 0; v < AUDIO_MAXVOICES; ++v) {
+    audio_cmd_t cmd = {AUDIO_CMD_STOP, v, NULL, 0, false, 0.f, 0.f, NULL};
+    mixer.apply(cmd);
+  }
+}
+
+// Mix bufferCount buffers with whatever voices are playing, and print a row
+static void mixRow(mixer_t &mixer, countTimer_t &timer, audio_frame_t *out, u32 voices, u32 bufferCount) {
+  const countTimer_counts_t start = timer.time();
+  for (u32 b = 0; b < bufferCount; ++b) {
+    mixer.mix(out, BUFFER_FRAMES);
+    bench_keep(out[b % BUFFER_FRAMES].left);
+  }
+  const f64 ns = util_max(bench_ns(timer, timer.time()-start), 1.0);
+
+  const f64 voiceBuffers = (f64)voices*bufferCount;
+  printf("%6u | %10.2f %12.1f | %15.0f\n", voices,
+         ns/1000.0/bufferCount, voiceBuffers*1000000.0/ns,
+         voiceBuffers*BUFFER_FRAMES/SAMPLE_RATE/(ns/1000000000.0));
+}
+
+void bench_main(mem_t &m, file_system_t &f, countTimer_t &timer, int argc, const char *const *argv) {
+  const u32 bufferCount = (argc > 0) ? str_strnum_def<u32>(argv[0], BUFFER_DEFAULT) : BUFFER_DEFAULT;
+  if (!bufferCount) throw log_except("Buffer count must be above 0!");
+
+  mem_container_t<audio_frame_t> sound(m, SOUND_FRAMES*sizeof(audio_frame_t));
+  mem_container_t<audio_frame_t> out(m, BUFFER_FRAMES*sizeof(audio_frame_t));
+  if (!sound.d || !out.d) throw log_except("Cannot allocate sound buffers!");
+
+  // Noise, so nothing about the samples is predictable
+  u32 s = 0x12345678;
+  for (uptr i = 0; i < SOUND_FRAMES; ++i) {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    sound.d[i].left = (i16)s;
+    sound.d[i].right = (i16)(s >> 16);
+  }
+
+  mixer_t mixer(m, BUFFER_FRAMES);
+
+  printf("Mixing %u buffers of %u frames\n", bufferCount, (u32)BUFFER_FRAMES);
+  printf("%6s | %10s %12s | %15s\n", "voices", "us/buffer", "voices/ms", "realtime voices");
+
+  for (u32 voices = 1; voices <= AUDIO_MAXVOICES; voices *= 2) {
+    // Every voice starts somewhere else in the sound, so they don't wrap together
+    for (u32 v = 0; v < voices; ++v) {
+      const uptr offset = (v*4999) % SOUND_FRAMES;
+
+      audio_cmd_t cmd = {AUDIO_CMD_PLAY, v, sound.d + offset, SOUND_FRAMES - offset, true,
+                         0.5f, (f32)v/(f32)AUDIO_MAXVOICES*2.f - 1.f, NULL};
+      mixer.apply(cmd);
+    }
+
+    mixRow(mixer, timer, out.d, voices, bufferCount);
+  }
+
+  stopAll(mixer);
+
+  // Streamed voices, only if there's something to stream
+  const char *pakName = (argc > 1) ? argv[1] : "data.pak";
+  if (!f.fileExists(pakName)) {
+    printf("No %s, skipping streamed voices\n", pakName);
+    return;
+  }
+
+  pak_t pak(m, f, pakName);
+  const pak_entry_t ent = pak.getEntry(str_hash("sounds/hum.snd"));
+  if (ent == PAK_INVALID_ENTRY) {
+    printf("No sounds/hum.snd in %s, skipping streamed voices\n", pakName);
+    return;
+  }
+
+  const sound_t *hum = (const sound_t*)pak.mapEntry(ent);
+  if (!hum) throw log_except("Cannot map sounds/hum.snd!");
+
+  printf("Streaming sounds/hum.snd\n");
+  printf("%6s | %10s %12s | %15s\n", "voices", "us/buffer", "voices/ms", "realtime voices");
+
+  for (u32 voices = 1; voices <= MIXER_MAXSTREAMS; voices *= 2) {
+    for (u32 v = 0; v < voices; ++v) {
+      audio_cmd_t cmd = {AUDIO_CMD_STREAM, v, NULL, 0, true, 0.5f, 0.f, hum};
+      mixer.apply(cmd);
+    }
+
+    mixRow(mixer, timer, out.d, voices, bufferCount);
+  }
+
+  stopAll(mixer);
+  pak.unmapEntry(ent);
+}
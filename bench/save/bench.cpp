@@ -0,0 +1,169 @@
+/*
+ * Save data benchmark
+ *
+ * Fills a save slot with variables and times looking them up through the index
+ * against searching them one by one, the way save_t used to. Then times saving
+ * the slot right away and through a save thread, and checks the slot loads back
+ * with the same values
+ *
+ * Writes save/save<slot>.dat in the working directory
+ *
+ * Usage: save_bench [lookups] [saves]
+ */
+
+#include "bench.h"
+#include "util.h"
+#include "str.h"
+#include "save.h"
+
+// Lookups timed by default
+static constexpr u32 LOOKUP_DEFAULT = 1000000;
+
+// Saves timed by default, each way
+static constexpr u32 SAVE_DEFAULT = 20;
+
+// Variables in the slot, each is 4 u32s
+static constexpr u32 VAR_COUNT = 200;
+
+// Save slot the benchmark uses
+static constexpr u32 BENCH_SLOT = 999;
+
+static u32 rngState = 0x12345678;
+static u32 rngNext() {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+static str_hash_t varName(u32 i) {
+  char name[32];
+  snprintf(name, sizeof(name), "bench.var%u", i);
+  return str_hashR(name);
+}
+
+// What variable i holds after save s
+static void varValue(u32 i, u32 s, u32 out[4]) {
+  for (u32 j = 0; j < 4; ++j) out[j] = i*4 + j + s*0x10000;
+}
+
+// Find a variable the way save_t used to, one by one
+static const save_var_t *findLinear(const save_var_t *vars, u32 count, str_hash_t name) {
+  for (const save_var_t *i = vars; i != vars+count; ++i) {
+    if (i->name == name) return i;
+  }
+
+  return NULL;
+}
+
+static void setAll(save_t &save, u32 s) {
+  for (u32 i = 0; i < VAR_COUNT; ++i) {
+    u32 val[4];
+    varValue(i, s, val);
+    if (!save.set(varName(i), val, 4, false)) throw log_except("Cannot set variable %u!", i);
+  }
+}
+
+void bench_main(mem_t &m, file_system_t &f, countTimer_t &timer, int argc, const char *const *argv) {
+  const u32 lookupCount = (argc > 0) ? str_strnum_def<u32>(argv[0], LOOKUP_DEFAULT) : LOOKUP_DEFAULT;
+  const u32 saveCount = (argc > 1) ? str_strnum_def<u32>(argv[1], SAVE_DEFAULT) : SAVE_DEFAULT;
+  if (!lookupCount || !saveCount) throw log_except("Lookup and save counts must be above 0!");
+
+  str_hash_t names[VAR_COUNT];
+  for (u32 i = 0; i < VAR_COUNT; ++i) names[i] = varName(i);
+
+  // Names looked up, cycled through so the branches aren't predictable
+  mem_container_t<str_hash_t> lookups(m, 4096*sizeof(str_hash_t));
+  if (!lookups.d) throw log_except("Cannot allocate lookups!");
+  for (u32 i = 0; i < 4096; ++i) lookups.d[i] = names[rngNext() % VAR_COUNT];
+
+  {
+    save_t save(m, f);
+    if (!save.load(BENCH_SLOT)) throw log_except("Cannot load slot %u!", BENCH_SLOT);
+    setAll(save, 0);
+
+    // The same variables in a plain array
+    save_var_t linear[VAR_COUNT];
+    u32 vals[VAR_COUNT][4];
+    for (u32 i = 0; i < VAR_COUNT; ++i) {
+      varValue(i, 0, vals[i]);
+      linear[i].val = vals[i];
+      linear[i].size = sizeof(vals[i]);
+      linear[i].name = names[i];
+    }
+
+    u32 keep = 0, out[4];
+
+    countTimer_counts_t start = timer.time();
+    for (u32 i = 0; i < lookupCount; ++i) {
+      const save_var_t *v = findLinear(linear, VAR_COUNT, lookups.d[i & 4095]);
+      memcpy(out, v->val, sizeof(out));
+      keep += out[0];
+    }
+    const f64 linearNs = bench_ns(timer, timer.time()-start)/lookupCount;
+
+    start = timer.time();
+    for (u32 i = 0; i < lookupCount; ++i) {
+      save.get(lookups.d[i & 4095], out, 4, false);
+      keep += out[0];
+    }
+    const f64 indexNs = bench_ns(timer, timer.time()-start)/lookupCount;
+
+    bench_keep(keep);
+
+    printf("Looking up %u variables %u times\n", VAR_COUNT, lookupCount);
+    printf("%12s %12s | %8s\n", "ns (linear)", "ns (index)", "speedup");
+    printf("%12.2f %12.2f | %7.2fx\n", linearNs, indexNs, linearNs/util_max(indexNs, 0.001));
+
+    // Saving right away waits for the disk
+    f64 syncMax = 0, syncTotal = 0;
+    for (u32 s = 0; s < saveCount; ++s) {
+      setAll(save, s);
+
+      start = timer.time();
+      if (!save.save(false)) throw log_except("Cannot save slot %u!", BENCH_SLOT);
+      const f64 ns = bench_ns(timer, timer.time()-start);
+
+      syncTotal += ns;
+      syncMax = util_max(syncMax, ns);
+    }
+
+    // With a save thread, only the copy is left
+    f64 asyncMax = 0, asyncTotal = 0;
+    {
+      save_thread_t thread(m, save);
+
+      for (u32 s = 0; s < saveCount; ++s) {
+        setAll(save, saveCount+s);
+
+        start = timer.time();
+        if (!save.save(false)) throw log_except("Cannot save slot %u!", BENCH_SLOT);
+        const f64 ns = bench_ns(timer, timer.time()-start);
+
+        asyncTotal += ns;
+        asyncMax = util_max(asyncMax, ns);
+      }
+
+      thread.wait();
+    }
+
+    printf("Saving %u times\n", saveCount);
+    printf("%10s | %12s %12s\n", "", "us (mean)", "us (max)");
+    printf("%10s | %12.2f %12.2f\n", "right away", syncTotal/saveCount/1000.0, syncMax/1000.0);
+    printf("%10s | %12.2f %12.2f\n", "thread", asyncTotal/saveCount/1000.0, asyncMax/1000.0);
+  }
+
+  // The last save is what loads back
+  save_t save(m, f);
+  if (!save.load(BENCH_SLOT)) throw log_except("Cannot load slot %u back!", BENCH_SLOT);
+
+  for (u32 i = 0; i < VAR_COUNT; ++i) {
+    u32 val[4], expected[4];
+    varValue(i, 2*saveCount-1, expected);
+
+    if ((save.get(names[i], val, 4, false) != 16) || memcmp(val, expected, sizeof(val)))
+      throw log_except("Variable %u didn't load back!", i);
+  }
+
+  printf("Slot %u loads back with all %u variables\n", BENCH_SLOT, VAR_COUNT);
+}
@@ -0,0 +1,114 @@
+/*
+ * Runtime string hash benchmark
+ *
+ * Checks str_hashR against the hash computed the way str_hash does it (a 64-bit
+ * modulo per character) on random strings of every length up to 256, some with
+ * characters above 127, and against str_hash itself on a few literals. Then times
+ * both on strings as long as pak names and arguments, and longer ones
+ *
+ * Usage: str_bench [hashes per length]
+ */
+
+#include "bench.h"
+#include "util.h"
+#include "str.h"
+
+// Hashes timed for each length by default
+static constexpr u32 HASH_DEFAULT = 1000000;
+
+// Longest string checked
+static constexpr uptr CHECK_LEN = 256;
+
+// Strings checked for each length
+static constexpr u32 CHECK_COUNT = 64;
+
+// Strings timed for each length, cycled through so the branches aren't predictable
+static constexpr uptr STRING_COUNT = 64;
+
+// The hash the way str_hash computes it
+static str_hash_t hashRef(const char *str) {
+  u64 curHash = 0, pow = 1;
+  for (const char *i = str; *i; ++i) {
+    curHash = (curHash + (u64)*i*pow) % 2147483647;
+    pow = (pow*127) % 2147483647;
+  }
+
+  return endian_little32((u32)curHash);
+}
+
+static u32 rngState = 0x12345678;
+static u32 rngNext() {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+// Random string of len characters, printable unless high is set
+static void randomString(char *out, uptr len, ubool high) {
+  for (uptr i = 0; i < len; ++i) {
+    const u32 r = rngNext();
+    out[i] = high ? (char)((r % 255) + 1) : (char)(' ' + r % 95);
+  }
+  out[len] = 0;
+}
+
+template<str_hash_t (*F)(const char*)>
+static f64 timeHashes(countTimer_t &timer, const char *strings, uptr stride, u32 count) {
+  str_hash_t keep = 0;
+
+  const countTimer_counts_t start = timer.time();
+  for (u32 i = 0; i < count; ++i) keep += F(strings + (i % STRING_COUNT)*stride);
+  const f64 ns = bench_ns(timer, timer.time()-start);
+
+  bench_keep(keep);
+  return ns/count;
+}
+
+void bench_main(mem_t &m, file_system_t &f, countTimer_t &timer, int argc, const char *const *argv) {
+  (void)f;
+
+  const u32 hashCount = (argc > 0) ? str_strnum_def<u32>(argv[0], HASH_DEFAULT) : HASH_DEFAULT;
+  if (!hashCount) throw log_except("Hash count must be above 0!");
+
+  // Same hash as str_hash
+  if ((str_hashR("") != str_hash("")) ||
+      (str_hashR("maps/000.map") != str_hash("maps/000.map")) ||
+      (str_hashR("sounds/hum.snd") != str_hash("sounds/hum.snd")) ||
+      (str_hashR("-headless") != str_hash("-headless")) ||
+      (str_hashR("a string long enough to take the SIMD path a few times over") !=
+       str_hash("a string long enough to take the SIMD path a few times over")))
+    throw log_except("str_hashR doesn't match str_hash!");
+
+  // Same hash as the modulo loop
+  char check[CHECK_LEN+1];
+  for (uptr len = 0; len <= CHECK_LEN; ++len) {
+    for (u32 i = 0; i < CHECK_COUNT; ++i) {
+      randomString(check, len, i & 1);
+
+      if (str_hashR(check) != hashRef(check))
+        throw log_except("str_hashR doesn't match on a string of length %u!", (u32)len);
+    }
+  }
+
+  printf("str_hashR matches str_hash on %u strings\n", (u32)((CHECK_LEN+1)*CHECK_COUNT));
+
+  // Timing
+  static const uptr lens[] = {4, 8, 12, 16, 24, 32, 64, 256};
+  const uptr stride = CHECK_LEN+1;
+
+  mem_container_t<char> strings(m, STRING_COUNT*stride);
+  if (!strings.d) throw log_except("Cannot allocate strings!");
+
+  printf("Hashing each length %u times\n", hashCount);
+  printf("%6s | %12s %12s | %8s\n", "length", "ns (modulo)", "ns (now)", "speedup");
+
+  for (uptr l = 0; l < util_arrlen(lens); ++l) {
+    for (uptr i = 0; i < STRING_COUNT; ++i) randomString(strings.d + i*stride, lens[l], false);
+
+    const f64 ref = timeHashes<hashRef>(timer, strings.d, stride, hashCount);
+    const f64 now = timeHashes<str_hashR>(timer, strings.d, stride, hashCount);
+
+    printf("%6u | %12.2f %12.2f | %7.2fx\n", (u32)lens[l], ref, now, ref/util_max(now, 0.001));
+  }
+}
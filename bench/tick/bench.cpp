@@ -0,0 +1,121 @@
+/*
+ * Game tick benchmark
+ *
+ * Runs the game on each map with synthetic input, the same way the headless
+ * window does with -fast, and times every tick. Reports ticks per second and
+ * the median and 99th percentile tick time for each map
+ *
+ * Usage: tick_bench [pak file] [tick count]
+ */
+
+#include "bench.h"
+#include "util.h"
+#include "str.h"
+#include "args.h"
+#include "rng.h"
+#include "job.h"
+#include "interfaces.h"
+#include "game/game.h"
+#include "game/synth.h"
+#include "game/pak.h"
+
+#include <cstdlib>
+#include <cstring>
+
+// Ticks run on each map by default, a minute of game time
+static constexpr u32 TICK_DEFAULT = GAME_TICKRATE*60;
+
+// Maps are probed from maps/000.map up until one is missing
+static constexpr u32 MAP_MAX = 1000;
+
+// Window size the game sees, same as the headless window
+static constexpr u32 TICK_WIDTH = 1280, TICK_HEIGHT = 720;
+
+static int compareCounts(const void *a, const void *b) {
+  const countTimer_counts_t x = *(const countTimer_counts_t*)a, y = *(const countTimer_counts_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Run ticks on a map, filling times with the length of each tick
+// Returns the number of ticks run, less than tickCount if the game stopped
+static u32 runMap(mem_t &m, file_system_t &f, countTimer_t &timer, job_system_t &jobs,
+                  const char *pakName, const char *mapName, countTimer_counts_t *times, u32 tickCount)
+{
+  // The game reads everything from it's arguments, which args_t writes into
+  char pakArg[256], mapArg[256];
+  snprintf(pakArg, sizeof(pakArg), "-pak=%s", pakName);
+  snprintf(mapArg, sizeof(mapArg), "-map=%s", mapName);
+
+  char prog[] = "tick_bench";
+  char *argv[] = {prog, pakArg, mapArg};
+
+  args_t args(util_arrlen(argv), argv, m);
+  game_input_t input;
+  rng_t rng;
+  interfaces_t inter(&m, &f, &timer, &jobs, &args, &input, &rng);
+
+  game_t game(inter, args);
+  game.wstate().width = TICK_WIDTH;
+  game.wstate().height = TICK_HEIGHT;
+
+  game_synth_t synth(1);
+
+  u32 tick;
+  for (tick = 0; tick < tickCount; ++tick) {
+    synth.next(input, TICK_WIDTH, TICK_HEIGHT);
+
+    const countTimer_counts_t start = timer.time();
+    const game_update_ret_t ret = game.update();
+    times[tick] = timer.time()-start;
+
+    input.k.update();
+
+    if (ret != GAME_UPDATE_CONTINUE) break;
+  }
+
+  return tick;
+}
+
+void bench_main(mem_t &m, file_system_t &f, countTimer_t &timer, int argc, const char *const *argv) {
+  const char *pakName = (argc > 0) ? argv[0] : "data.pak";
+  const u32 tickCount = (argc > 1) ? str_strnum_def<u32>(argv[1], TICK_DEFAULT) : TICK_DEFAULT;
+
+  if (!tickCount) throw log_except("Tick count must be above 0!");
+
+  mem_container_t<countTimer_counts_t> times(m, tickCount*sizeof(countTimer_counts_t));
+  if (!times.d) throw log_except("Cannot allocate tick times!");
+
+  // Find which maps there are
+  char mapNames[MAP_MAX][16];
+  u32 mapCount = 0;
+  {
+    pak_t pak(m, f, pakName);
+
+    for (; mapCount < MAP_MAX; ++mapCount) {
+      snprintf(mapNames[mapCount], sizeof(mapNames[0]), "maps/%03u.map", mapCount);
+      if (pak.getEntry(str_hashR(mapNames[mapCount])) == PAK_INVALID_ENTRY) break;
+    }
+  }
+
+  if (!mapCount) throw log_except("There are no maps in %s!", pakName);
+
+  job_system_t jobs(m);
+
+  printf("Running %u ticks on each map in %s\n", tickCount, pakName);
+  printf("%14s | %8s %12s | %10s %10s\n", "map", "ticks", "ticks/s", "p50 us", "p99 us");
+
+  for (u32 i = 0; i < mapCount; ++i) {
+    const u32 ran = runMap(m, f, timer, jobs, pakName, mapNames[i], times.d, tickCount);
+    if (!ran) throw log_except("%s didn't run any ticks!", mapNames[i]);
+
+    countTimer_counts_t total = 0;
+    for (u32 t = 0; t < ran; ++t) total += times.d[t];
+
+    qsort(times.d, ran, sizeof(countTimer_counts_t), compareCounts);
+
+    printf("%14s | %8u %12.1f | %10.2f %10.2f\n", mapNames[i], ran,
+           (double)ran*1000000000.0/util_max(bench_ns(timer, total), 1.0),
+           (double)bench_ns(timer, times.d[ran/2])/1000.0,
+           (double)bench_ns(timer, times.d[util_min(ran*99/100, ran-1)])/1000.0);
+  }
+}
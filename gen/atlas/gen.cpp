@@ -7,6 +7,7 @@
 #include "game/atlas.h"
 
 #include <cstring>
+#include <cmath>
 
 static file_system_t *sys;
 static mem_t *mem;
@@ -23,8 +24,8 @@ struct bmpHdr_t {
   u32 offset; // Offset to pixels from start of file
 
   u32 hdrSize;
-  u32 width; // == ATLAS_WIDTH
-  u32 height; // == ATLAS_HEIGHT
+  u32 width;
+  u32 height; // Must be positive, top-down BMP's aren't supported
   u16 planes; // == 1
   u16 bpp; // == 32
 };
@@ -35,46 +36,78 @@ struct bmpHdr_t {
 struct hdr_t {
   u32 magic;
   endian_u32 imageCount;
-  pak_ptr_t<atlas_col_t> data;
+  endian_u32 levelCount;
+  endian_u32 pageCount;
+  endian_u32 format;
+  pak_ptr_t<u8> data;
   pak_ptr_t<endian_ivec2_2> imgDim;
+  pak_ptr_t<endian_u32> imgPage;
 };
 
 static constexpr uptr MAXIMG = 256;
-static atlas_col_t data[ATLAS_WIDTH*ATLAS_HEIGHT];
+static constexpr uptr MAXPAGES = 16;
+
+// Current page, with every mip level
+static atlas_col_t data[atlas_pageSize(ATLAS_FORMAT_RGBA8)/4];
+
+// Current page, block compressed
+static u8 encoded[atlas_pageSize(ATLAS_FORMAT_BC3)];
+
+// Marks which pixels of level 0 are covered by an image (1) or it's padding (2)
+static u8 covered[ATLAS_WIDTH*ATLAS_HEIGHT];
+
+// Source image of an atlas image
+struct src_t {
+  char path[128];
+  ivec2_2 rect; // Rectangle in source BMP
+  ubool opaque; // Whether every pixel in rect has an alpha of 255
+};
+
 static str_hash_t imgNames[MAXIMG], *curImgName = imgNames;
 static endian_ivec2_2 imgDim[MAXIMG], *curDim = imgDim;
+static endian_u32 imgPage[MAXIMG];
+static src_t imgSrc[MAXIMG];
+
+// Open BMP file, and check it's header
+static file_handle_t *openBMP(const char *path, bmpHdr_t &hdr) {
+  file_handle_t *bmp = sys->open(path, FILE_MODE_READ);
+  if (!bmp) throw log_except("Cannot open %s!", path);
 
-// Read image data from BMP file
-static void readData(file_handle_t *bmp) {
-  bmpHdr_t hdr;
   if (bmp->read(&hdr, sizeof(bmpHdr_t)) < (iptr)sizeof(bmpHdr_t))
-    throw log_except("Cannot read %d bytes from BMP!", (int)sizeof(bmpHdr_t));
+    throw log_except("Cannot read %d bytes from %s!", (int)sizeof(bmpHdr_t), path);
 
   // Input sanitization
   if ((hdr.magic[0] != 'B') ||
       (hdr.magic[1] != 'M') ||
-      (hdr.width != ATLAS_WIDTH) ||
-      (hdr.height != ATLAS_HEIGHT) ||
+      (hdr.height & 0x80000000) ||
       (hdr.planes != 1) ||
-      (hdr.bpp != 32)) throw log_except("Invalid BMP header!");
+      (hdr.bpp != 32)) throw log_except("Invalid BMP header in %s!", path);
+
+  return bmp;
+}
+
+// Copy source image into the current page, at pos
+static void readData(const src_t &src, i32 posX, i32 posY) {
+  bmpHdr_t hdr;
+  file_handle_t *bmp = openBMP(src.path, hdr);
 
   // File seems good, map data
-  file_mapping_t *flippedMapping = bmp->map(FILE_MAP_READ, hdr.offset, ATLAS_WIDTH*ATLAS_HEIGHT*4);
+  file_mapping_t *flippedMapping = bmp->map(FILE_MAP_READ, hdr.offset, hdr.width*hdr.height*4);
   if (!flippedMapping)
-    throw log_except("Cannot map BMP image data!");
+    throw log_except("Cannot map BMP image data from %s!", src.path);
 
   const atlas_col_t *flippedData = (const atlas_col_t*)(flippedMapping->data);
 
   // Flip data vertically
-  for (uptr i = 0; i < ATLAS_HEIGHT; ++i) {
+  for (i32 i = 0; i < src.rect.i[3]; ++i) {
     u8 tmp;
-    atlas_col_t *ptr1 = data + i*ATLAS_WIDTH;
-    const atlas_col_t *ptr2 = flippedData + (ATLAS_HEIGHT-1-i)*ATLAS_WIDTH;
+    atlas_col_t *ptr1 = data + (posY+i)*ATLAS_WIDTH + posX;
+    const atlas_col_t *ptr2 = flippedData + (hdr.height-1-(src.rect.i[1]+i))*hdr.width + src.rect.i[0];
 
-    memcpy(ptr1, ptr2, ATLAS_WIDTH*4);
+    memcpy(ptr1, ptr2, src.rect.i[2]*4);
 
     // Atlas image data is in RGBA, convert BMP's BGRA to RGBA
-    for (uptr x = 0; x < ATLAS_WIDTH; ++x) {
+    for (i32 x = 0; x < src.rect.i[2]; ++x) {
       tmp = ptr1[x].c[0];
       ptr1[x].c[0] = ptr1[x].c[2];
       ptr1[x].c[2] = tmp;
@@ -82,6 +115,509 @@ static void readData(file_handle_t *bmp) {
   }
 
   flippedMapping->unmap();
+  bmp->close();
+}
+
+// Skyline packer
+//
+// Every page keeps the top edge of everything packed so far as a list of
+// horizontal segments, and images are put as low as possible on top of it.
+// Images are packed with ATLAS_PADDING pixels of gutter on each side, which is
+// allowed to go off the edge of the page, so it's as if the page was bigger
+struct skyline_node_t {
+  i32 x, y, w;
+};
+
+static constexpr i32 PACK_WIDTH = ATLAS_WIDTH + 2*ATLAS_PADDING;
+static constexpr i32 PACK_HEIGHT = ATLAS_HEIGHT + 2*ATLAS_PADDING;
+
+static skyline_node_t skyline[MAXPAGES][MAXIMG+1];
+static uptr skylineCount[MAXPAGES];
+static uptr pageCount;
+
+// Returns y position of a w wide rectangle at node i, or -1 if it doesn't fit
+static i32 skyline_fit(uptr page, uptr i, i32 w, i32 h) {
+  const skyline_node_t *nodes = skyline[page];
+  if (nodes[i].x + w > PACK_WIDTH) return -1;
+
+  i32 y = 0;
+  for (i32 left = w; left > 0; left -= nodes[i++].w) {
+    y = util_max<i32>(y, nodes[i].y);
+    if (y + h > PACK_HEIGHT) return -1;
+  }
+
+  return y;
+}
+
+// Put a rectangle on the skyline, at node i
+static void skyline_add(uptr page, uptr i, i32 x, i32 y, i32 w) {
+  skyline_node_t *nodes = skyline[page];
+  uptr &count = skylineCount[page];
+
+  // Insert new node
+  memmove(nodes+i+1, nodes+i, (count-i)*sizeof(skyline_node_t));
+  nodes[i] = {x, y, w};
+  ++count;
+
+  // Shrink or remove the nodes under it
+  for (uptr j = i+1; j < count;) {
+    const i32 over = nodes[i].x + nodes[i].w - nodes[j].x;
+    if (over <= 0) break;
+
+    if (over < nodes[j].w) {
+      nodes[j].x += over;
+      nodes[j].w -= over;
+      break;
+    }
+
+    memmove(nodes+j, nodes+j+1, (count-j-1)*sizeof(skyline_node_t));
+    --count;
+  }
+
+  // Merge neighbours at the same height
+  for (uptr j = 0; j+1 < count;) {
+    if (nodes[j].y == nodes[j+1].y) {
+      nodes[j].w += nodes[j+1].w;
+      memmove(nodes+j+1, nodes+j+2, (count-j-2)*sizeof(skyline_node_t));
+      --count;
+    } else ++j;
+  }
+}
+
+// Start a new, empty page
+static uptr skyline_newPage() {
+  if (pageCount >= MAXPAGES)
+    throw log_except("Too many atlas pages! (increase MAXPAGES in gen/atlas/gen.cpp)");
+
+  skyline[pageCount][0] = {0, 0, PACK_WIDTH};
+  skylineCount[pageCount] = 1;
+
+  return pageCount++;
+}
+
+// Pack every image, setting imgDim and imgPage
+static void packImages() {
+  const uptr imageCount = curDim-imgDim;
+
+  pageCount = 0;
+  skyline_newPage();
+
+  // Pack tallest images first, they waste the least space that way
+  uptr order[MAXIMG];
+  for (uptr i = 0; i < imageCount; ++i) {
+    uptr j = i;
+    for (; j && (imgSrc[order[j-1]].rect.i[3] < imgSrc[i].rect.i[3]); --j)
+      order[j] = order[j-1];
+
+    order[j] = i;
+  }
+
+  for (uptr o = 0; o < imageCount; ++o) {
+    const uptr img = order[o];
+    const i32 w = imgSrc[img].rect.i[2] + 2*ATLAS_PADDING;
+    const i32 h = imgSrc[img].rect.i[3] + 2*ATLAS_PADDING;
+
+    if ((w > PACK_WIDTH) || (h > PACK_HEIGHT))
+      throw log_except("%s is too big for an atlas page!", imgSrc[img].path);
+
+    // Find lowest spot in any page, leftmost on ties
+    uptr bestPage = 0, bestNode = 0;
+    i32 bestY = -1;
+
+    for (uptr page = 0; page < pageCount; ++page) {
+      for (uptr i = 0; i < skylineCount[page]; ++i) {
+        const i32 y = skyline_fit(page, i, w, h);
+        if ((y >= 0) && ((bestY < 0) || (y+h < bestY))) {
+          bestPage = page;
+          bestNode = i;
+          bestY = y+h;
+        }
+      }
+    }
+
+    // Nothing fits, spill into a new page
+    if (bestY < 0) {
+      bestPage = skyline_newPage();
+      bestNode = 0;
+      bestY = h;
+    }
+
+    const i32 x = skyline[bestPage][bestNode].x;
+    const i32 y = bestY-h;
+    skyline_add(bestPage, bestNode, x, bestY, w);
+
+    // The gutter starts ATLAS_PADDING pixels outside the page,
+    // so the image starts right at the packed position
+    imgDim[img] = ivec2_2(x, y, imgSrc[img].rect.i[2], imgSrc[img].rect.i[3]);
+    imgPage[img] = bestPage;
+  }
+}
+
+// Extend the edges of every image in level 0 of a page outwards
+// by ATLAS_PADDING pixels, without overwriting any other image
+static void padImages(uptr page) {
+  memset(covered, 0, sizeof(covered));
+
+  // Mark image pixels first, so padding never bleeds into an image
+  for (const endian_ivec2_2 *d = imgDim; d != curDim; ++d) {
+    if (imgPage[d-imgDim] != page) continue;
+    const ivec2_2 dim = d->v();
+
+    for (i32 y = dim.i[1]; y < dim.i[1]+dim.i[3]; ++y)
+      memset(covered + y*ATLAS_WIDTH + dim.i[0], 1, dim.i[2]);
+  }
+
+  // Fill uncovered pixels around each image with the closest edge pixel
+  for (const endian_ivec2_2 *d = imgDim; d != curDim; ++d) {
+    if (imgPage[d-imgDim] != page) continue;
+    const ivec2_2 dim = d->v();
+
+    const i32 x0 = util_max<i32>(dim.i[0]-ATLAS_PADDING, 0);
+    const i32 y0 = util_max<i32>(dim.i[1]-ATLAS_PADDING, 0);
+    const i32 x1 = util_min<i32>(dim.i[0]+dim.i[2]+ATLAS_PADDING, ATLAS_WIDTH);
+    const i32 y1 = util_min<i32>(dim.i[1]+dim.i[3]+ATLAS_PADDING, ATLAS_HEIGHT);
+
+    for (i32 y = y0; y < y1; ++y) {
+      const i32 srcY = util_max<i32>(util_min<i32>(y, dim.i[1]+dim.i[3]-1), dim.i[1]);
+
+      for (i32 x = x0; x < x1; ++x) {
+        if (covered[y*ATLAS_WIDTH + x]) continue;
+
+        const i32 srcX = util_max<i32>(util_min<i32>(x, dim.i[0]+dim.i[2]-1), dim.i[0]);
+
+        data[y*ATLAS_WIDTH + x] = data[srcY*ATLAS_WIDTH + srcX];
+        covered[y*ATLAS_WIDTH + x] = 2;
+      }
+    }
+  }
+}
+
+// Generate every mip level after level 0 of a page with a 2x2 box filter
+static void makeLevels() {
+  for (u32 l = 1; l < ATLAS_LEVELS; ++l) {
+    const u32 w = atlas_levelWidth(l), h = atlas_levelHeight(l);
+    const u32 srcW = atlas_levelWidth(l-1);
+
+    const atlas_col_t *src = data + atlas_levelOffset(ATLAS_FORMAT_RGBA8, l-1)/4;
+    atlas_col_t *dst = data + atlas_levelOffset(ATLAS_FORMAT_RGBA8, l)/4;
+
+    for (u32 y = 0; y < h; ++y) {
+      for (u32 x = 0; x < w; ++x) {
+        const atlas_col_t *s = src + (y*2)*srcW + x*2;
+
+        for (uptr c = 0; c < 4; ++c) {
+          dst[y*w + x].c[c] =
+            (s[0].c[c] + s[1].c[c] + s[srcW].c[c] + s[srcW+1].c[c] + 2) >> 2;
+        }
+      }
+    }
+  }
+}
+
+// BC1/BC3 block encoder
+//
+// Colors are fit along the principal axis of the block, then refined once with
+// a least squares fit of the endpoints to the chosen indices.
+// Color blocks are always in 4 color mode, so BC1 never turns pixels transparent
+
+// Squared RGB distance
+static FINLINE u32 colDist(atlas_col_t a, atlas_col_t b) {
+  u32 ret = 0;
+  for (uptr c = 0; c < 3; ++c) {
+    const i32 d = (i32)a.c[c] - (i32)b.c[c];
+    ret += d*d;
+  }
+
+  return ret;
+}
+
+// Quantize RGB color to RGB565
+static FINLINE u32 encode565(const f32 *c) {
+  const u32 r = (u32)util_clamp<f32>(c[0]*(31.f/255.f)+0.5f, 0.f, 31.f);
+  const u32 g = (u32)util_clamp<f32>(c[1]*(63.f/255.f)+0.5f, 0.f, 63.f);
+  const u32 b = (u32)util_clamp<f32>(c[2]*(31.f/255.f)+0.5f, 0.f, 31.f);
+
+  return (r << 11) | (g << 5) | b;
+}
+
+// Write color block with endpoints c0, c1, choosing the best indices
+// Returns squared error, and writes the chosen palette weights of c0 to weights
+static u32 writeColor(const atlas_col_t *px, u32 c0, u32 c1, u8 *out, f32 *weights) {
+  // Keep 4 color mode, c0 > c1
+  if (c0 < c1) {
+    const u32 tmp = c0;
+    c0 = c1;
+    c1 = tmp;
+  }
+
+  out[0] = c0;
+  out[1] = c0 >> 8;
+  out[2] = c1;
+  out[3] = c1 >> 8;
+  out[4] = out[5] = out[6] = out[7] = 0;
+
+  // Get palette the same way the decoder would
+  atlas_col_t pal[16];
+  atlas_decodeBlock(ATLAS_FORMAT_BC1, out, pal);
+  if (c0 == c1) pal[1] = pal[2] = pal[3] = pal[0];
+  else {
+    out[4] = 0xe4; // Indices 0, 1, 2, 3
+    atlas_decodeBlock(ATLAS_FORMAT_BC1, out, pal);
+  }
+
+  static const f32 palWeight[4] = {1.f, 0.f, 2.f/3.f, 1.f/3.f};
+
+  u32 ind = 0, err = 0;
+  for (uptr i = 0; i < 16; ++i) {
+    u32 best = 0, bestDist = colDist(px[i], pal[0]);
+
+    for (u32 p = 1; p < 4; ++p) {
+      const u32 dist = colDist(px[i], pal[p]);
+      if (dist < bestDist) {
+        best = p;
+        bestDist = dist;
+      }
+    }
+
+    ind |= best << (i*2);
+    err += bestDist;
+    weights[i] = palWeight[best];
+  }
+
+  out[4] = ind;
+  out[5] = ind >> 8;
+  out[6] = ind >> 16;
+  out[7] = ind >> 24;
+
+  return err;
+}
+
+// Encode BC1 color block
+static void encodeColor(const atlas_col_t *px, u8 *out) {
+  // Mean color
+  f32 mean[3] = {};
+  for (uptr i = 0; i < 16; ++i) {
+    for (uptr c = 0; c < 3; ++c) mean[c] += px[i].c[c]*(1.f/16.f);
+  }
+
+  // Covariance matrix
+  f32 cov[6] = {}; // rr, rg, rb, gg, gb, bb
+  for (uptr i = 0; i < 16; ++i) {
+    const f32 r = px[i].c[0]-mean[0], g = px[i].c[1]-mean[1], b = px[i].c[2]-mean[2];
+    cov[0] += r*r; cov[1] += r*g; cov[2] += r*b;
+    cov[3] += g*g; cov[4] += g*b; cov[5] += b*b;
+  }
+
+  // Principal axis, with power iteration
+  f32 axis[3] = {1.f, 1.f, 1.f};
+  for (uptr it = 0; it < 8; ++it) {
+    const f32 x = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+    const f32 y = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+    const f32 z = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+
+    const f32 len = util_max<f32>(util_max<f32>(fabsf(x), fabsf(y)), fabsf(z));
+    if (len < 1e-6f) break;
+
+    axis[0] = x/len;
+    axis[1] = y/len;
+    axis[2] = z/len;
+  }
+
+  // Use the pixels furthest along the axis as endpoints
+  uptr minI = 0, maxI = 0;
+  f32 minP = FLT_MAX, maxP = -FLT_MAX;
+  for (uptr i = 0; i < 16; ++i) {
+    const f32 p = px[i].c[0]*axis[0] + px[i].c[1]*axis[1] + px[i].c[2]*axis[2];
+    if (p < minP) {minP = p; minI = i;}
+    if (p > maxP) {maxP = p; maxI = i;}
+  }
+
+  f32 e0[3], e1[3];
+  for (uptr c = 0; c < 3; ++c) {
+    e0[c] = px[maxI].c[c];
+    e1[c] = px[minI].c[c];
+  }
+
+  f32 weights[16];
+  u8 best[8];
+  u32 bestErr = writeColor(px, encode565(e0), encode565(e1), best, weights);
+
+  // Refine endpoints with least squares, using the chosen weights
+  f32 aa = 0.f, ab = 0.f, bb = 0.f, ax[3] = {}, bx[3] = {};
+  for (uptr i = 0; i < 16; ++i) {
+    const f32 a = weights[i], b = 1.f-a;
+    aa += a*a;
+    ab += a*b;
+    bb += b*b;
+
+    for (uptr c = 0; c < 3; ++c) {
+      ax[c] += a*px[i].c[c];
+      bx[c] += b*px[i].c[c];
+    }
+  }
+
+  const f32 det = aa*bb - ab*ab;
+  if (fabsf(det) > 1e-6f) {
+    for (uptr c = 0; c < 3; ++c) {
+      e0[c] = (ax[c]*bb - bx[c]*ab)/det;
+      e1[c] = (bx[c]*aa - ax[c]*ab)/det;
+    }
+
+    u8 refined[8];
+    if (writeColor(px, encode565(e0), encode565(e1), refined, weights) < bestErr)
+      memcpy(best, refined, 8);
+  }
+
+  memcpy(out, best, 8);
+}
+
+// Encode BC3 alpha block
+static void encodeAlpha(const atlas_col_t *px, u8 *out) {
+  u32 a0 = 0, a1 = 0xff;
+  for (uptr i = 0; i < 16; ++i) {
+    a0 = util_max<u32>(a0, px[i].c[3]);
+    a1 = util_min<u32>(a1, px[i].c[3]);
+  }
+
+  out[0] = a0;
+  out[1] = a1;
+
+  // Same palette as the decoder, a0 == a1 only uses index 0
+  u8 pal[8] = {(u8)a0, (u8)a1};
+  for (u32 i = 1; i < 7; ++i) pal[i+1] = ((7-i)*a0 + i*a1)/7;
+
+  u64 ind = 0;
+  for (uptr i = 0; (a0 != a1) && (i < 16); ++i) {
+    u32 best = 0, bestDist = 0x100;
+
+    for (u32 p = 0; p < 8; ++p) {
+      const u32 dist = util_abs<i32>((i32)px[i].c[3] - (i32)pal[p]);
+      if (dist < bestDist) {
+        best = p;
+        bestDist = dist;
+      }
+    }
+
+    ind |= (u64)best << (i*3);
+  }
+
+  for (uptr i = 0; i < 6; ++i)
+    out[2+i] = ind >> (i*8);
+}
+
+// Encode a 4x4 block
+static void encodeBlock(atlas_format_t format, const atlas_col_t *px, u8 *out) {
+  if (format == ATLAS_FORMAT_BC3) {
+    encodeAlpha(px, out);
+    encodeColor(px, out+8);
+  } else encodeColor(px, out);
+}
+
+// Compress every level of the current page into encoded
+// Returns PSNR of the images in level 0
+static f64 encodePage(atlas_format_t format) {
+  const uptr blockSize = (format == ATLAS_FORMAT_BC1) ? 8 : 16;
+  const u32 channels = (format == ATLAS_FORMAT_BC1) ? 3 : 4;
+
+  u64 err = 0, pixels = 0;
+
+  for (u32 l = 0; l < ATLAS_LEVELS; ++l) {
+    const atlas_col_t *src = data + atlas_levelOffset(ATLAS_FORMAT_RGBA8, l)/4;
+    u8 *dst = encoded + atlas_levelOffset(format, l);
+
+    const u32 w = atlas_levelWidth(l), h = atlas_levelHeight(l);
+
+    for (u32 by = 0; by < h; by += ATLAS_BLOCK_SIZE) {
+      for (u32 bx = 0; bx < w; bx += ATLAS_BLOCK_SIZE) {
+        // Gather block, levels smaller than a block repeat their edges
+        atlas_col_t px[16], dec[16];
+        for (u32 y = 0; y < 4; ++y) {
+          for (u32 x = 0; x < 4; ++x)
+            px[y*4 + x] = src[util_min<u32>(by+y, h-1)*w + util_min<u32>(bx+x, w-1)];
+        }
+
+        encodeBlock(format, px, dst);
+
+        // Measure error of images in level 0
+        if (!l) {
+          atlas_decodeBlock(format, dst, dec);
+
+          for (uptr i = 0; i < 16; ++i) {
+            if (covered[(by + i/4)*ATLAS_WIDTH + bx + i%4] != 1) continue;
+
+            for (u32 c = 0; c < channels; ++c) {
+              const i32 d = (i32)px[i].c[c] - (i32)dec[i].c[c];
+              err += d*d;
+            }
+            ++pixels;
+          }
+        }
+
+        dst += blockSize;
+      }
+    }
+  }
+
+  if (!err) return 99.0;
+
+  const f64 mse = (f64)err/((f64)pixels*channels);
+  return 10.0*log10(255.0*255.0/mse);
+}
+
+// Check encoder output against known blocks, throws if it's broken
+static void testEncoder() {
+  atlas_col_t px[16], dec[16];
+  u8 block[16];
+
+  // Solid colors should only lose RGB565 precision
+  static const u32 solids[] = {0x00000000, 0xffffffff, 0x123456ff, 0xfedcbaff, 0x7f7f7f80};
+  for (uptr s = 0; s < util_arrlen(solids); ++s) {
+    for (uptr i = 0; i < 16; ++i) px[i].p = endian_big32(solids[s]);
+
+    encodeBlock(ATLAS_FORMAT_BC3, px, block);
+    atlas_decodeBlock(ATLAS_FORMAT_BC3, block, dec);
+
+    for (uptr i = 0; i < 16; ++i) {
+      for (uptr c = 0; c < 4; ++c) {
+        if (util_abs<i32>((i32)px[i].c[c] - (i32)dec[i].c[c]) > 4)
+          throw log_except("BC encoder test failed on solid color %08x!", solids[s]);
+      }
+    }
+  }
+
+  // Two colors that RGB565 represents exactly should round trip exactly,
+  // and BC1 should never use transparent black
+  for (uptr i = 0; i < 16; ++i) {
+    px[i].p = endian_big32(((i*7) & 4) ? 0xff0000ff : 0x0041ffff);
+  }
+
+  encodeBlock(ATLAS_FORMAT_BC1, px, block);
+  atlas_decodeBlock(ATLAS_FORMAT_BC1, block, dec);
+
+  if ((block[0] | (block[1] << 8)) <= (block[2] | (block[3] << 8)))
+    throw log_except("BC encoder test failed, BC1 block isn't in 4 color mode!");
+
+  for (uptr i = 0; i < 16; ++i) {
+    if (dec[i].p != px[i].p)
+      throw log_except("BC encoder test failed on exact colors!");
+  }
+
+  // A gradient should stay within half a palette step
+  for (uptr i = 0; i < 16; ++i) {
+    const u8 v = i*17;
+    px[i].c[0] = px[i].c[1] = px[i].c[2] = px[i].c[3] = v;
+  }
+
+  encodeBlock(ATLAS_FORMAT_BC3, px, block);
+  atlas_decodeBlock(ATLAS_FORMAT_BC3, block, dec);
+
+  for (uptr i = 0; i < 16; ++i) {
+    if (util_abs<i32>((i32)px[i].c[3] - (i32)dec[i].c[3]) > 19)
+      throw log_except("BC encoder test failed on alpha gradient!");
+
+    if (util_abs<i32>((i32)px[i].c[1] - (i32)dec[i].c[1]) > 48)
+      throw log_except("BC encoder test failed on color gradient!");
+  }
 }
 
 // Read line from atlas.txt
@@ -103,18 +639,63 @@ static const char *readLine(file_handle_t *f) {
 
 // Read image from atlas.txt
 static void readImage(file_handle_t *txt) {
-  // Read name
-  *curImgName++ = str_hashR(readLine(txt));
+  // Read name, images are looked up by hash so they can't share one
+  const char *name = readLine(txt);
+  const str_hash_t hash = str_hashR(name);
+  for (const str_hash_t *n = imgNames; n != curImgName; ++n) {
+    if (*n == hash) throw log_except("Image %s has the same hash (%08x) as another image in the atlas!", name, hash);
+  }
+
+  *curImgName++ = hash;
+
+  // Read source image
+  src_t &src = imgSrc[curDim-imgDim];
+
+  const char *path = readLine(txt);
+  if (strlen(path) >= sizeof(src.path)) throw log_except("%s is too long of a path!", path);
+  strcpy(src.path, path);
+
+  // Read source rectangle, zero size means the whole image
+  src.rect.i[0] = str_strnum<i32>(readLine(txt));
+  src.rect.i[1] = str_strnum<i32>(readLine(txt));
+  src.rect.i[2] = str_strnum<i32>(readLine(txt));
+  src.rect.i[3] = str_strnum<i32>(readLine(txt));
+
+  bmpHdr_t hdr;
+  file_handle_t *bmp = openBMP(src.path, hdr);
+
+  if (!src.rect.i[2]) src.rect.i[2] = hdr.width - src.rect.i[0];
+  if (!src.rect.i[3]) src.rect.i[3] = hdr.height - src.rect.i[1];
 
-  // Read dimensions
-  ivec2_2 dim;
+  if ((src.rect.i[0] < 0) || (src.rect.i[1] < 0) ||
+      (src.rect.i[2] <= 0) || (src.rect.i[3] <= 0) ||
+      ((u32)(src.rect.i[0]+src.rect.i[2]) > hdr.width) ||
+      ((u32)(src.rect.i[1]+src.rect.i[3]) > hdr.height))
+    throw log_except("Invalid source rectangle in %s!", src.path);
 
-  dim.i[0] = str_strnum<i32>(readLine(txt));
-  dim.i[1] = str_strnum<i32>(readLine(txt));
-  dim.i[2] = str_strnum<i32>(readLine(txt));
-  dim.i[3] = str_strnum<i32>(readLine(txt));
+  // Check if the image needs an alpha channel
+  file_mapping_t *mapping = bmp->map(FILE_MAP_READ, hdr.offset, hdr.width*hdr.height*4);
+  if (!mapping)
+    throw log_except("Cannot map BMP image data from %s!", src.path);
 
-  *curDim++ = dim;
+  const atlas_col_t *pixels = (const atlas_col_t*)(mapping->data);
+
+  src.opaque = true;
+  for (i32 y = src.rect.i[1]; src.opaque && (y < src.rect.i[1]+src.rect.i[3]); ++y) {
+    const atlas_col_t *row = pixels + (hdr.height-1-y)*hdr.width;
+
+    for (i32 x = src.rect.i[0]; x < src.rect.i[0]+src.rect.i[2]; ++x) {
+      if (row[x].c[3] != 0xff) {
+        src.opaque = false;
+        break;
+      }
+    }
+  }
+
+  mapping->unmap();
+  bmp->close();
+
+  ++curDim;
 }
 
 // Read atlas from atlas.txt
@@ -129,31 +710,40 @@ static void readAtlas(file_handle_t *txt) {
 
   // Read number of images in atlas
   uptr imageCount = str_strnum<uptr>(readLine(txt));
-
-  // Read atlas data
-  const char *tgaName = readLine(txt);
-  file_handle_t *tga = sys->open(tgaName, FILE_MODE_READ);
-  if (!tga) throw log_except("Cannot open %s!", tgaName);
-
-  readData(tga);
-  tga->close();
+  if (imageCount > MAXIMG) throw log_except("Too many images! (increase MAXIMG in gen/atlas/gen.cpp)");
 
   // Read images from atlas
   uptr curImg = imageCount;
   while (curImg--) readImage(txt);
 
+  // Pack images into pages
+  packImages();
+
+  // Only use BC3 if any image actually has alpha
+  atlas_format_t format = ATLAS_FORMAT_BC1;
+  for (uptr i = 0; i < imageCount; ++i) {
+    if (!imgSrc[i].opaque) format = ATLAS_FORMAT_BC3;
+  }
+
   // Output atlas to file
   file_handle_t *out = sys->open(name, FILE_MODE_WRITE);
   if (!out) throw log_except("Cannot write to %s!", name);
 
   hdr_t hdr;
-  const uptr dataOffset = sizeof(hdr) + sizeof(str_hash_t)*imageCount;
-  const uptr imgDimOffset = util_alignUp<uptr>(dataOffset + 4*ATLAS_WIDTH*ATLAS_HEIGHT, 16);
+  const uptr pageSize = atlas_pageSize(format);
+  const uptr namesEnd = sizeof(hdr) + sizeof(str_hash_t)*imageCount;
+  const uptr dataOffset = util_alignUp<uptr>(namesEnd, 16);
+  const uptr imgDimOffset = util_alignUp<uptr>(dataOffset + pageSize*pageCount, 16);
+  const uptr imgPageOffset = imgDimOffset + 32*imageCount;
 
   hdr.magic = ATLAS_MAGIC;
   hdr.imageCount = imageCount;
+  hdr.levelCount = ATLAS_LEVELS;
+  hdr.pageCount = pageCount;
+  hdr.format = format;
   hdr.data.set((u8*)&hdr + dataOffset);
   hdr.imgDim.set((u8*)&hdr + imgDimOffset);
+  hdr.imgPage.set((u8*)&hdr + imgPageOffset);
 
   // Write header
   out->write(&hdr, sizeof(hdr));
@@ -161,15 +751,45 @@ static void readAtlas(file_handle_t *txt) {
   // Write image names
   out->write(imgNames, sizeof(str_hash_t)*(curImgName-imgNames));
 
-  // Write image data
-  out->write(data, ATLAS_WIDTH*ATLAS_HEIGHT*4);
+  // Write padding before image data
+  const u8 zeros[15] = {};
+  out->write(zeros, dataOffset - namesEnd);
+
+  // Write image data, a page at a time
+  for (uptr page = 0; page < pageCount; ++page) {
+    memset(data, 0, sizeof(data));
+
+    u64 used = 0;
+    uptr count = 0;
+    for (uptr i = 0; i < imageCount; ++i) {
+      if (imgPage[i] != page) continue;
+
+      const ivec2_2 dim = imgDim[i].v();
+      readData(imgSrc[i], dim.i[0], dim.i[1]);
+
+      used += (u64)dim.i[2]*dim.i[3];
+      ++count;
+    }
+
+    // Pad images and generate mip chain
+    padImages(page);
+    makeLevels();
+
+    // Compress page
+    const f64 psnr = encodePage(format);
+    out->write(encoded, pageSize);
+
+    log_note("%s page %u: %u images, %u%% occupied, %s with %.1f dB PSNR", name,
+             (u32)page, (u32)count, (u32)(used*100/(ATLAS_WIDTH*ATLAS_HEIGHT)),
+             (format == ATLAS_FORMAT_BC1) ? "BC1" : "BC3", (double)psnr);
+  }
 
   // Write padding before image dimensions
-  const u8 zeros[15] = {};
-  out->write(zeros, imgDimOffset - (dataOffset + 4*ATLAS_WIDTH*ATLAS_HEIGHT));
+  out->write(zeros, imgDimOffset - (dataOffset + pageSize*pageCount));
 
-  // Write image dimensions
+  // Write image dimensions and pages
   out->write(imgDim, 32*(curDim-imgDim));
+  out->write(imgPage, sizeof(endian_u32)*(curDim-imgDim));
 
   // Close output
   out->close();
@@ -181,6 +801,9 @@ void gen_main(mem_t &m, file_system_t &f, const char *txtName, const char *outpu
 
   (void)output;
 
+  // Make sure the block encoder works before using it
+  testEncoder();
+
   file_handle_t *txt = sys->open(txtName, FILE_MODE_READ);
   if (!txt) throw log_except("Can't open %s!", txtName);
 
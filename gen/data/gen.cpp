@@ -189,6 +189,18 @@ void gen_main(mem_t &m, file_system_t &f, const char *txt, const char *output) {
 		curFilename = nextFilename(curFilename);
 	}
 
+	// Entries are looked up by hash, so two names with the same hash can't both be found
+	for (entry_t *e = fileEntries; e != fileEntries+fileCount; ++e) {
+		for (entry_t *o = fileEntries; o != e; ++o) {
+			if (o->hash != e->hash) continue;
+
+			input->close();
+			cleanup();
+			if (!strcmp(o->name, e->name)) throw log_except("%s is in %s twice!", e->name, txt);
+			throw log_except("%s and %s have the same hash (%08x)!", o->name, e->name, e->hash);
+		}
+	}
+
 	if (!writePak(dest)) {
 		input->close();
 		cleanup();
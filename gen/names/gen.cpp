@@ -0,0 +1,184 @@
+// Name generator
+//
+// Finds every str_hash("...") literal in the source files names.txt lists, and
+// writes them into names.h for the name table (see name.h), hashed by str_hash
+// itself so they can't disagree. Fails if two different literals have the same hash.
+//
+// names.h is only rewritten when it changes, so it doesn't rebuild the game every time.
+// Literals with escapes in them are skipped.
+
+#include "gen.h"
+#include "str.h"
+#include "util.h"
+#include "file.h"
+#include "log.h"
+
+#include <cstring>
+
+static file_system_t *sys;
+
+// Names found so far
+#define MAXNAMES 1024
+static const char *names[MAXNAMES];
+static str_hash_t hashes[MAXNAMES];
+static uptr nameCount = 0;
+
+// Name buffer
+#define NAMESLEN (32*1024)
+static char nameBuf[NAMESLEN], *curName = nameBuf;
+
+// Output buffer
+#define OUTLEN (64*1024)
+static char out[OUTLEN];
+static uptr outLen = 0;
+
+static const char *readLine(file_handle_t *f) {
+  static char buf[256];
+  char *p = buf;
+
+  do {
+  l_ignore:
+    if (f->read(p, 1) <= 0) return NULL;
+
+    // Ignore \r
+    if (*p == '\r') goto l_ignore;
+  } while ((*p++ != '\n') && (p < buf+sizeof(buf)-1));
+
+  *--p = 0; // Replace new line with null terminator
+  return buf;
+}
+
+static void addName(const char *name, uptr len, const char *path) {
+  if (curName + len+1 > nameBuf+NAMESLEN)
+    throw log_except("Ran out of name memory! (increase NAMESLEN in gen/names/gen.cpp)");
+
+  memcpy(curName, name, len);
+  curName[len] = 0;
+
+  const str_hash_t hash = str_hashR(curName);
+  for (uptr i = 0; i < nameCount; ++i) {
+    if (hashes[i] != hash) continue;
+    if (!strcmp(names[i], curName)) return;
+
+    throw log_except("%s (in %s) and %s have the same hash (%08x)!", curName, path, names[i], hash);
+  }
+
+  if (nameCount >= MAXNAMES) throw log_except("Too many names! (increase MAXNAMES in gen/names/gen.cpp)");
+
+  names[nameCount] = curName;
+  hashes[nameCount] = hash;
+  ++nameCount;
+
+  curName += len+1;
+}
+
+// Find the literals in a source file
+static void scanFile(const char *path) {
+  file_handle_t *f = sys->open(path, FILE_MODE_READ);
+  if (!f) throw log_except("Cannot open %s!", path);
+
+  const iptr size = f->seek(0, FILE_SEEK_END) ? f->tell() : -1;
+  if (size <= 0) {
+    f->close();
+    if (!size) return;
+    throw log_except("Cannot get the size of %s!", path);
+  }
+
+  file_mapping_t *map = f->map(FILE_MAP_READ, 0, size);
+  if (!map) {
+    f->close();
+    throw log_except("Cannot map %s!", path);
+  }
+
+  static const char prefix[] = "str_hash(\"";
+  const char *src = (const char*)map->data;
+  const char *end = src + size;
+
+  try {
+    for (const char *p = src; p + str_clen(prefix) < end; ++p) {
+      if (memcmp(p, prefix, str_clen(prefix))) continue;
+
+      const char *name = p + str_clen(prefix);
+      const char *q = name;
+      while ((q < end) && (*q != '"') && (*q != '\\') && (*q != '\n')) ++q;
+
+      if ((q < end) && (*q == '"') && (q > name)) addName(name, q-name, path);
+      p = q-1;
+    }
+  } catch (...) {
+    map->unmap();
+    f->close();
+    throw;
+  }
+
+  map->unmap();
+  f->close();
+}
+
+static void put(const char *s) {
+  const uptr len = strlen(s);
+  if (outLen + len > OUTLEN) throw log_except("Ran out of output memory! (increase OUTLEN in gen/names/gen.cpp)");
+
+  memcpy(out+outLen, s, len);
+  outLen += len;
+}
+
+// Whether path already has exactly what's in out
+static ubool sameFile(const char *path) {
+  if (!sys->fileExists(path)) return false;
+
+  file_handle_t *f = sys->open(path, FILE_MODE_READ);
+  if (!f) return false;
+
+  static char old[OUTLEN+1];
+  const iptr len = f->read(old, sizeof(old));
+  f->close();
+
+  return (len == (iptr)outLen) && !memcmp(old, out, outLen);
+}
+
+void gen_main(mem_t &m, file_system_t &f, const char *txtName, const char *output) {
+  (void)m;
+  sys = &f;
+
+  file_handle_t *txt = sys->open(txtName, FILE_MODE_READ);
+  if (!txt) throw log_except("Can't open %s!", txtName);
+
+  try {
+    const char *line;
+    while ((line = readLine(txt))) {
+      if (*line) scanFile(line);
+    }
+  } catch (...) {
+    txt->close();
+    throw;
+  }
+
+  txt->close();
+
+  put("// Generated by gen/names, don't edit\n");
+  put("static const name_lit_t NAME_LITERALS[] = {\n");
+  for (uptr i = 0; i < nameCount; ++i) {
+    put("  {str_hash(\"");
+    put(names[i]);
+    put("\"), \"");
+    put(names[i]);
+    put("\"},\n");
+  }
+  put("  {0, NULL}\n};\n");
+
+  char dest[512];
+  if (strlen(output) + sizeof("names.h") > sizeof(dest)) throw log_except("%s is too long of a path!", output);
+  strcpy(dest, output);
+  strcat(dest, "names.h");
+
+  if (sameFile(dest)) return;
+
+  file_handle_t *h = sys->open(dest, FILE_MODE_WRITE);
+  if (!h) throw log_except("Cannot write %s!", dest);
+
+  const ubool ok = h->write(out, outLen) == (iptr)outLen;
+  h->close();
+
+  if (!ok) throw log_except("Cannot write %s!", dest);
+}
@@ -0,0 +1,325 @@
+// Sound generator
+//
+// Encodes sounds into the stereo IMA-ADPCM format in game/sound.h, one block
+// at a time, so no source is ever loaded whole
+//
+// sound.txt lists the sound count, then for each sound the output file and a source:
+//   tone, then the frequency in Hz and the length in milliseconds
+//   wav, then the path of a 16-bit PCM WAV file at SOUND_SAMPLERATE, mono or stereo
+
+#include "gen.h"
+#include "str.h"
+#include "util.h"
+#include "endianUtil.h"
+#include "file.h"
+#include "log.h"
+#include "game/sound.h"
+
+#include <cstring>
+#include <math.h>
+
+static file_system_t *sys;
+static mem_t *mem;
+
+// Sound source, gives out interleaved stereo frames
+struct src_t {
+  enum {SRC_TONE, SRC_WAV} type;
+  u32 frameCount, pos;
+
+  // Tone
+  f64 freq;
+
+  // WAV
+  file_handle_t *f;
+  u32 channels;
+};
+
+// RIFF chunk header
+struct wavChunk_t {
+  char id[4];
+  u32 size;
+};
+
+struct wavFmt_t {
+  u16 format; // 1 is PCM
+  u16 channels;
+  u32 sampleRate;
+  u32 byteRate;
+  u16 blockAlign;
+  u16 bits;
+};
+
+// Open a WAV file and leave it at the start of it's samples
+static void openWAV(src_t &src, const char *path) {
+  src.f = sys->open(path, FILE_MODE_READ);
+  if (!src.f) throw log_except("Cannot open %s!", path);
+
+  char riff[12];
+  if ((src.f->read(riff, sizeof(riff)) < (iptr)sizeof(riff)) ||
+      memcmp(riff, "RIFF", 4) || memcmp(riff+8, "WAVE", 4)) throw log_except("%s isn't a WAV file!", path);
+
+  // Skip chunks until the samples, the format has to come before them
+  wavFmt_t fmt;
+  ubool hasFmt = false;
+
+  wavChunk_t chunk;
+  for (;;) {
+    if (src.f->read(&chunk, sizeof(chunk)) < (iptr)sizeof(chunk))
+      throw log_except("%s has no samples!", path);
+
+    // Only little endian WAV files exist, the chunk sizes have to match
+    chunk.size = endian_little32(chunk.size);
+
+    if (!memcmp(chunk.id, "fmt ", 4)) {
+      if ((chunk.size < sizeof(fmt)) || (src.f->read(&fmt, sizeof(fmt)) < (iptr)sizeof(fmt)))
+        throw log_except("Invalid WAV format in %s!", path);
+
+      fmt.format = endian_little16(fmt.format);
+      fmt.channels = endian_little16(fmt.channels);
+      fmt.sampleRate = endian_little32(fmt.sampleRate);
+      fmt.bits = endian_little16(fmt.bits);
+
+      hasFmt = true;
+      src.f->seek(util_alignUp<u32>(chunk.size, 2) - sizeof(fmt), FILE_SEEK_REL);
+    } else if (!memcmp(chunk.id, "data", 4)) {
+      break;
+    } else {
+      src.f->seek(util_alignUp<u32>(chunk.size, 2), FILE_SEEK_REL);
+    }
+  }
+
+  if (!hasFmt) throw log_except("%s has samples before it's format!", path);
+
+  if ((fmt.format != 1) || (fmt.bits != 16) || (fmt.channels < 1) || (fmt.channels > 2))
+    throw log_except("%s isn't 16-bit PCM mono or stereo!", path);
+  if (fmt.sampleRate != SOUND_SAMPLERATE)
+    throw log_except("%s is %u Hz, sounds have to be %u Hz!", path, fmt.sampleRate, SOUND_SAMPLERATE);
+
+  src.channels = fmt.channels;
+  src.frameCount = chunk.size/(2*fmt.channels);
+}
+
+// Read up to count frames from a source
+static uptr readSrc(src_t &src, i16 *out, uptr count) {
+  count = util_min<uptr>(count, src.frameCount - src.pos);
+
+  if (src.type == src_t::SRC_TONE) {
+    // Quarter volume, the right side slightly behind so it's not a flat center
+    for (uptr i = 0; i < count; ++i) {
+      const f64 t = (f64)(src.pos+i)*src.freq/SOUND_SAMPLERATE;
+      out[i*2] = (i16)lrint(8192.0*sin(t*2.0*M_PI));
+      out[i*2+1] = (i16)lrint(8192.0*sin((t-0.05)*2.0*M_PI));
+    }
+  } else {
+    if (src.f->read(out, count*2*src.channels) < (iptr)(count*2*src.channels))
+      throw log_except("WAV file ends early!");
+
+    // Spread mono out to both sides, from the end so nothing is overwritten early
+    for (uptr i = count; i--;) {
+      const i16 left = endian_little16i(out[i*src.channels]);
+      const i16 right = endian_little16i(out[i*src.channels + src.channels-1]);
+      out[i*2] = left;
+      out[i*2+1] = right;
+    }
+  }
+
+  src.pos += count;
+  return count;
+}
+
+// Encode a sample, updating the channel's state the same way the decoder will
+static u32 encodeSample(sound_adpcm_t &s, i32 sample) {
+  const i32 step = sound_steps[s.index];
+  i32 diff = sample - s.predictor;
+
+  u32 nibble = 0;
+  if (diff < 0) {
+    nibble = 8;
+    diff = -diff;
+  }
+
+  if (diff >= step) {
+    nibble |= 4;
+    diff -= step;
+  }
+  if (diff >= step >> 1) {
+    nibble |= 2;
+    diff -= step >> 1;
+  }
+  if (diff >= step >> 2) nibble |= 1;
+
+  sound_decodeNibble(s, nibble);
+  return nibble;
+}
+
+// Encode up to SOUND_BLOCKFRAMES frames into a block, the rest of it is zeroed
+// If dec isn't NULL, it gets the samples the decoder will output
+static void encodeBlock(sound_adpcm_t *state, const i16 *in, uptr count, sound_block_t &b, i16 *dec) {
+  memset(&b, 0, sizeof(b));
+
+  for (uptr c = 0; c < 2; ++c) {
+    b.predictor[c] = (i16)state[c].predictor;
+    b.index[c] = (u8)state[c].index;
+  }
+
+  for (uptr i = 0; i < count; ++i) {
+    const u32 left = encodeSample(state[0], in[i*2]);
+    const u32 right = encodeSample(state[1], in[i*2+1]);
+    b.frames[i] = (u8)(left | (right << 4));
+
+    if (dec) {
+      dec[i*2] = (i16)state[0].predictor;
+      dec[i*2+1] = (i16)state[1].predictor;
+    }
+  }
+}
+
+// Check the encoder against the decoder, throws if they don't agree
+static void testEncoder() {
+  static constexpr u32 FRAMES = SOUND_BLOCKFRAMES*3 + 100;
+  static constexpr u32 BLOCKS = (FRAMES+SOUND_BLOCKFRAMES-1)/SOUND_BLOCKFRAMES;
+
+  mem_container_t<i16> in(*mem, FRAMES*2*sizeof(i16));
+  mem_container_t<i16> expect(*mem, FRAMES*2*sizeof(i16));
+  mem_container_t<i16> out(*mem, FRAMES*2*sizeof(i16));
+  mem_container_t<sound_t> s(*mem, sizeof(sound_t) + (BLOCKS-1)*sizeof(sound_block_t));
+  if (!in.d || !expect.d || !out.d || !s.d) throw log_except("Cannot allocate sound encoder test!");
+
+  // A loud sweep on the left, noise on the right
+  u32 rng = 0x12345678;
+  for (u32 i = 0; i < FRAMES; ++i) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+
+    in.d[i*2] = (i16)lrint(30000.0*sin((f64)i*i*0.00002));
+    in.d[i*2+1] = (i16)(rng >> 20);
+  }
+
+  s.d->magic = SOUND_MAGIC;
+  s.d->sampleRate = SOUND_SAMPLERATE;
+  s.d->frameCount = FRAMES;
+  s.d->blockCount = BLOCKS;
+
+  sound_adpcm_t state[2] = {{0, 0}, {0, 0}};
+  for (u32 b = 0; b < BLOCKS; ++b) {
+    const u32 first = b*SOUND_BLOCKFRAMES;
+    encodeBlock(state, in.d + first*2, util_min(SOUND_BLOCKFRAMES, FRAMES-first), s.d->blocks[b], expect.d + first*2);
+  }
+
+  if (!sound_valid(s.d)) throw log_except("Sound encoder test failed, the test sound isn't valid!");
+
+  // Decode in odd sizes, so pieces cross block boundaries
+  sound_decoder_t dec;
+  dec.start(s.d);
+
+  uptr frames = 0;
+  while (!dec.done()) frames += dec.decode(out.d + frames*2, 37);
+
+  if (frames != FRAMES) throw log_except("Sound encoder test failed, decoded %u frames out of %u!", (u32)frames, FRAMES);
+  if (memcmp(out.d, expect.d, FRAMES*2*sizeof(i16))) throw log_except("Sound encoder test failed, decoder doesn't match encoder!");
+
+  // The sweep should come out close to what went in
+  f64 signal = 0.0, noise = 0.0;
+  for (u32 i = 0; i < FRAMES; ++i) {
+    const f64 d = (f64)out.d[i*2] - in.d[i*2];
+    signal += (f64)in.d[i*2]*in.d[i*2];
+    noise += d*d;
+  }
+
+  if (10.0*log10(signal/util_max(noise, 1.0)) < 20.0)
+    throw log_except("Sound encoder test failed, the sweep is too noisy!");
+}
+
+// Read line from sound.txt
+static const char *readLine(file_handle_t *f) {
+  static char buf[256];
+  char *p = buf;
+
+  do {
+  l_ignore:
+    if (f->read(p, 1) <= 0) throw log_except("Cannot read line from sound.txt!");
+
+    // Ignore \r
+    if (*p == '\r') goto l_ignore;
+  } while ((*p++ != '\n') && (p < buf+sizeof(buf)));
+
+  *--p = 0; // Replace new line with null terminator
+  return buf;
+}
+
+// Read a sound from sound.txt and write it
+static void readSound(file_handle_t *txt) {
+  char name[256];
+  strcpy(name, readLine(txt));
+
+  // Make the output directory, it's generated so it might not be there yet
+  char dir[256];
+  strcpy(dir, name);
+  char *slash = strrchr(dir, '/');
+  if (slash) {
+    *slash = 0;
+    if (!sys->makeDir(dir)) throw log_except("Cannot make directory %s!", dir);
+  }
+
+  src_t src;
+  memset(&src, 0, sizeof(src));
+
+  const char *type = readLine(txt);
+  if (!strcmp(type, "tone")) {
+    src.type = src_t::SRC_TONE;
+    src.freq = (f64)str_strnum<u32>(readLine(txt));
+    src.frameCount = (u32)((u64)str_strnum<u32>(readLine(txt))*SOUND_SAMPLERATE/1000);
+  } else if (!strcmp(type, "wav")) {
+    src.type = src_t::SRC_WAV;
+    openWAV(src, readLine(txt));
+  } else {
+    throw log_except("Unknown sound source %s for %s!", type, name);
+  }
+
+  if (!src.frameCount) throw log_except("%s has no frames!", name);
+
+  file_handle_t *out = sys->open(name, FILE_MODE_WRITE);
+  if (!out) throw log_except("Cannot open %s!", name);
+
+  // Header, everything up to the blocks
+  sound_t hdr;
+  hdr.magic = SOUND_MAGIC;
+  hdr.sampleRate = SOUND_SAMPLERATE;
+  hdr.frameCount = src.frameCount;
+  hdr.blockCount = (src.frameCount+SOUND_BLOCKFRAMES-1)/SOUND_BLOCKFRAMES;
+  out->write(&hdr, (uptr)((const u8*)hdr.blocks - (const u8*)&hdr));
+
+  sound_adpcm_t state[2] = {{0, 0}, {0, 0}};
+  i16 in[SOUND_BLOCKFRAMES*2];
+  sound_block_t block;
+
+  while (src.pos < src.frameCount) {
+    const uptr count = readSrc(src, in, SOUND_BLOCKFRAMES);
+    encodeBlock(state, in, count, block, NULL);
+    out->write(&block, sizeof(block));
+  }
+
+  out->close();
+  if (src.f) src.f->close();
+
+  log_note("Wrote %s, %u frames in %u blocks", name, (u32)hdr.frameCount, (u32)hdr.blockCount);
+}
+
+void gen_main(mem_t &m, file_system_t &f, const char *txtName, const char *output) {
+  mem = &m;
+  sys = &f;
+
+  (void)output;
+
+  // Make sure the decoder plays back what the encoder meant
+  testEncoder();
+
+  file_handle_t *txt = sys->open(txtName, FILE_MODE_READ);
+  if (!txt) throw log_except("Can't open %s!", txtName);
+
+  uptr soundCount = str_strnum<uptr>(readLine(txt));
+  while (soundCount--) readSound(txt);
+
+  txt->close();
+}
@@ -0,0 +1,73 @@
+// Atomic operations
+// These work on plain variables, the memory orders are the same as C++11's
+
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include "types.h"
+
+#ifdef PLAT_S_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(PLAT_C_GNU)
+
+enum atomic_order_t : int {
+  ATOMIC_RELAXED = __ATOMIC_RELAXED,
+  ATOMIC_ACQUIRE = __ATOMIC_ACQUIRE,
+  ATOMIC_RELEASE = __ATOMIC_RELEASE,
+  ATOMIC_ACQREL  = __ATOMIC_ACQ_REL,
+  ATOMIC_SEQCST  = __ATOMIC_SEQ_CST
+};
+
+template<typename T>
+FINLINE T atomic_load(const T *p, atomic_order_t order = ATOMIC_SEQCST) {
+  return __atomic_load_n(p, order);
+}
+
+template<typename T>
+FINLINE void atomic_store(T *p, T v, atomic_order_t order = ATOMIC_SEQCST) {
+  __atomic_store_n(p, v, order);
+}
+
+template<typename T>
+FINLINE T atomic_exchange(T *p, T v, atomic_order_t order = ATOMIC_SEQCST) {
+  return __atomic_exchange_n(p, v, order);
+}
+
+// Returns the value before adding/subtracting
+template<typename T>
+FINLINE T atomic_add(T *p, T v, atomic_order_t order = ATOMIC_SEQCST) {
+  return __atomic_fetch_add(p, v, order);
+}
+
+template<typename T>
+FINLINE T atomic_sub(T *p, T v, atomic_order_t order = ATOMIC_SEQCST) {
+  return __atomic_fetch_sub(p, v, order);
+}
+
+// If *p is expected, set it to v and return true,
+// otherwise expected is set to *p and it returns false
+template<typename T>
+FINLINE ubool atomic_cas(T *p, T &expected, T v, atomic_order_t order = ATOMIC_SEQCST) {
+  return __atomic_compare_exchange_n(p, &expected, v, false, order,
+                                     (order == ATOMIC_ACQREL) ? ATOMIC_ACQUIRE :
+                                     (order == ATOMIC_RELEASE) ? ATOMIC_RELAXED : order);
+}
+
+FINLINE void atomic_fence(atomic_order_t order = ATOMIC_SEQCST) {
+  __atomic_thread_fence(order);
+}
+
+#else
+#	error Atomic operations are not implemented for this compiler!
+#endif
+
+// Hint to the CPU that we're spinning
+FINLINE void atomic_pause() {
+#ifdef PLAT_S_SSE2
+  _mm_pause();
+#endif
+}
+
+#endif //ATOMIC_H
@@ -1,5 +1,6 @@
 #include "types.h"
 #include "atlas.h"
+#include "log.h"
 
 atlas_img_t atlas_t::getImg(str_hash_t name) {
   // Search through imgNames
@@ -9,3 +10,85 @@ atlas_img_t atlas_t::getImg(str_hash_t name) {
 
   return ATLAS_INVALID_IMAGE;
 }
+
+// Expand RGB565 color to RGBA8
+static FINLINE atlas_col_t decode565(u32 c) {
+  atlas_col_t ret;
+
+  const u32 r = (c >> 11) & 0x1f, g = (c >> 5) & 0x3f, b = c & 0x1f;
+  ret.c[0] = (r << 3) | (r >> 2);
+  ret.c[1] = (g << 2) | (g >> 4);
+  ret.c[2] = (b << 3) | (b >> 2);
+  ret.c[3] = 0xff;
+
+  return ret;
+}
+
+// Decode BC1 color block, BC3 color blocks are always in 4 color mode
+static void decodeColor(const u8 *block, atlas_col_t *out, ubool alwaysFour) {
+  const u32 c0 = block[0] | (block[1] << 8);
+  const u32 c1 = block[2] | (block[3] << 8);
+  const u32 ind = block[4] | (block[5] << 8) | (block[6] << 16) | ((u32)block[7] << 24);
+
+  atlas_col_t pal[4];
+  pal[0] = decode565(c0);
+  pal[1] = decode565(c1);
+
+  if (alwaysFour || (c0 > c1)) {
+    for (uptr c = 0; c < 3; ++c) {
+      pal[2].c[c] = (2*pal[0].c[c] + pal[1].c[c])/3;
+      pal[3].c[c] = (pal[0].c[c] + 2*pal[1].c[c])/3;
+    }
+    pal[2].c[3] = pal[3].c[3] = 0xff;
+  } else {
+    for (uptr c = 0; c < 3; ++c)
+      pal[2].c[c] = (pal[0].c[c] + pal[1].c[c])/2;
+    pal[2].c[3] = 0xff;
+    pal[3].p = 0; // Transparent black
+  }
+
+  for (uptr i = 0; i < 16; ++i)
+    out[i] = pal[(ind >> (i*2)) & 3];
+}
+
+// Decode BC3 alpha block
+static void decodeAlpha(const u8 *block, atlas_col_t *out) {
+  const u32 a0 = block[0], a1 = block[1];
+
+  u8 pal[8];
+  pal[0] = a0;
+  pal[1] = a1;
+
+  if (a0 > a1) {
+    for (u32 i = 1; i < 7; ++i)
+      pal[i+1] = ((7-i)*a0 + i*a1)/7;
+  } else {
+    for (u32 i = 1; i < 5; ++i)
+      pal[i+1] = ((5-i)*a0 + i*a1)/5;
+    pal[6] = 0;
+    pal[7] = 0xff;
+  }
+
+  u64 ind = 0;
+  for (uptr i = 0; i < 6; ++i)
+    ind |= (u64)block[2+i] << (i*8);
+
+  for (uptr i = 0; i < 16; ++i)
+    out[i].c[3] = pal[(ind >> (i*3)) & 7];
+}
+
+void atlas_decodeBlock(atlas_format_t format, const u8 *block, atlas_col_t *out) {
+  switch (format) {
+    case ATLAS_FORMAT_BC1:
+      decodeColor(block, out, false);
+      break;
+
+    case ATLAS_FORMAT_BC3:
+      decodeColor(block+8, out, true);
+      decodeAlpha(block, out);
+      break;
+
+    default:
+      log_assert(false, "Not a block compressed format!");
+  }
+}
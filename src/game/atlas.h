@@ -14,6 +14,8 @@ enum {
                 * geometry uses texture coordinates that
                 * lookup directly into the atlas
                 */
+  ATLAS_PREV, // Level atlas of the previous map, loaded so it's ready when we go back
+  ATLAS_NEXT, // Level atlas of the next map, loaded so it's ready when we go forward
 
   ATLAS_COUNT,
 };
@@ -29,28 +31,95 @@ union atlas_col_t {
 typedef uptr atlas_img_t;
 static constexpr atlas_img_t ATLAS_INVALID_IMAGE = 0xffffffffu;
 
+// Atlas dimensions
+static constexpr u32 ATLAS_WIDTH = 1024;
+static constexpr u32 ATLAS_HEIGHT = 1024;
+
+// Number of mip levels in a full mip chain, down to 1x1
+static constexpr u32 ATLAS_LEVELS = 11;
+static_assert((ATLAS_WIDTH>>(ATLAS_LEVELS-1)) == 1, "");
+static_assert((ATLAS_HEIGHT>>(ATLAS_LEVELS-1)) == 1, "");
+
+// Pixels of edge padding the generator puts around every image,
+// so the lower mip levels don't bleed neighbouring images together
+static constexpr u32 ATLAS_PADDING = 4;
+
+// Dimensions of an atlas mip level
+constexpr u32 atlas_levelWidth(u32 level) {return util_max<u32>(ATLAS_WIDTH>>level, 1);}
+constexpr u32 atlas_levelHeight(u32 level) {return util_max<u32>(ATLAS_HEIGHT>>level, 1);}
+
+// Atlas pixel data formats
+enum {
+  ATLAS_FORMAT_RGBA8, // Uncompressed atlas_col_t
+  ATLAS_FORMAT_BC1, // S3TC DXT1, 8 bytes per 4x4 block, opaque
+  ATLAS_FORMAT_BC3, // S3TC DXT5, 16 bytes per 4x4 block
+
+  ATLAS_FORMAT_COUNT,
+};
+typedef u32 atlas_format_t;
+
+// Size of a 4x4 block in block compressed formats
+static constexpr u32 ATLAS_BLOCK_SIZE = 4;
+
+// Size of a mip level, in bytes
+constexpr uptr atlas_levelSize(atlas_format_t format, u32 level) {
+  return (format == ATLAS_FORMAT_RGBA8) ?
+    (uptr)atlas_levelWidth(level)*atlas_levelHeight(level)*4 :
+    (uptr)((atlas_levelWidth(level)+ATLAS_BLOCK_SIZE-1)/ATLAS_BLOCK_SIZE)*
+    ((atlas_levelHeight(level)+ATLAS_BLOCK_SIZE-1)/ATLAS_BLOCK_SIZE)*
+    ((format == ATLAS_FORMAT_BC1) ? 8 : 16);
+}
+
+// Offset of a mip level from the start of a page, in bytes
+constexpr uptr atlas_levelOffset(atlas_format_t format, u32 level) {
+  return level ? atlas_levelOffset(format, level-1) + atlas_levelSize(format, level-1) : 0;
+}
+
+// Size of a page, with every mip level, in bytes
+constexpr uptr atlas_pageSize(atlas_format_t format) {
+  return atlas_levelOffset(format, ATLAS_LEVELS);
+}
+
+// Decode a 4x4 block of a block compressed format into RGBA8
+void atlas_decodeBlock(atlas_format_t format, const u8 *block, atlas_col_t *out);
+
 // Image atlas file format
-static constexpr u32 ATLAS_MAGIC = util_magic('A', 'T', 'L', 'S');
+//
+// Revision 2: Contains a mip chain of levelCount levels,
+// with each image's edges padded by ATLAS_PADDING pixels
+//
+// Revision 3: Images are packed into pageCount pages by the generator,
+// every page is stored one after the other, each containing it's mip chain
+//
+// Revision 4: Pixel data is in format, which can be block compressed
+static constexpr u32 ATLAS_MAGIC = util_magic('A', 'T', 'L', '4');
 struct atlas_t {
   u32 magic; // == ATLAS_MAGIC
 
   endian_u32 imageCount; // Number of images in atlas
+  endian_u32 levelCount; // Number of mip levels in each page, == ATLAS_LEVELS
+  endian_u32 pageCount; // Number of pages in atlas
+  endian_u32 format; // Pixel data format, one of ATLAS_FORMAT_*
 
   // Pointer to atlas image data
-  pak_ptr_t<atlas_col_t> data;
+  pak_ptr_t<u8> data;
 
   // Pointer to atlas image dimensions
   pak_ptr_t<endian_ivec2_2> imgDim;
 
+  // Pointer to the page each image is in
+  pak_ptr_t<endian_u32> imgPage;
+
   // Atlas image names
   str_hash_t imgNames[1 /*imageCount*/];
 
   // Get image from atlas, return ATLAS_INVALID_IMAGE if not found
   atlas_img_t getImg(str_hash_t name);
-};
 
-// Atlas dimensions
-static constexpr u32 ATLAS_WIDTH = 1024;
-static constexpr u32 ATLAS_HEIGHT = 1024;
+  // Get mip level of a page
+  FINLINE const u8 *level(u32 page, u32 level) const {
+    return (const u8*)data + page*atlas_pageSize(format) + atlas_levelOffset(format, level);
+  }
+};
 
 #endif //GAME_ATLAS_H
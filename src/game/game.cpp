@@ -1,5 +1,8 @@
 #include "types.h"
 #include "game.h"
+#include "prof.h"
+#include "logbin.h"
+#include "name.h"
 
 #include <math.h>
 
@@ -10,70 +13,116 @@ static constexpr f32 PLAYER_SPD = 4.f;
 static constexpr f32 PLAYER_MAXFALL = -10.f;
 static constexpr f32 PLAYER_JUMPHEIGHT = 4.8f;
 
+#ifndef GAME_STATE_EDITOR
+
+// Get the level atlas name of a map, without loading it
+// Returns 0 if there's no such map
+static str_hash_t mapAtlasName(pak_t &p, str_hash_t mapName) {
+  const pak_entry_t mapEnt = p.getEntry(mapName);
+  if (mapEnt == PAK_INVALID_ENTRY) return 0;
+
+  const map_file_t *map = (const map_file_t*)p.mapEntry(mapEnt);
+  if (!map) return 0;
+
+  const str_hash_t ret = (map->magic == MAP_MAGIC) ? map->levelAtlas : 0;
+  p.unmapEntry(mapEnt);
+
+  return ret;
+}
+
+#endif
+
 // Load map into game and renderer
 static ubool loadMap(mem_t &m, pak_t &p, game_state_t &state, pak_entry_t *atlasEnt, str_hash_t mapName) {
+  PROF_ZONE_NAME("loadMap", mapName);
+
   // Load map into renderer
   state.r.load = true;
 
   // Load map file
   pak_entry_t mapEnt = p.getEntry(mapName);
   if (mapEnt == PAK_INVALID_ENTRY) {
-    log_warning("Cannot find map!");
+    log_warning("Cannot find map %s!", name_str(mapName));
     return false;
   }
 
   const map_file_t *map = (map_file_t*)p.mapEntry(mapEnt);
   if (!map) {
-    log_warning("Cannot map level entry!");
+    log_warning("Cannot map level %s!", name_str(mapName));
     return false;
   }
 
   try {
     state.map.load(m, *map);
   } catch (const log_except_t &err) {
-    log_warning("Cannot load level: %s", err.str());
+    log_warning("Cannot load level %s: %s", name_str(mapName), err.str());
     return false;
   }
 
   p.unmapEntry(mapEnt);
 
-  // Free previous map atlas
-  if (atlasEnt[ATLAS_LEVEL] != PAK_INVALID_ENTRY) p.unmapEntry(atlasEnt[ATLAS_LEVEL]);
-
 #ifndef GAME_STATE_EDITOR
 
-  // Load map atlas
-  atlasEnt[ATLAS_LEVEL] = p.getEntry(state.map.levelAtlas);
-  if (atlasEnt[ATLAS_LEVEL] == PAK_INVALID_ENTRY) {
-    log_warning("Cannot find level atlas!");
-    state.map.free(m);
-    return false;
+  // Map the level atlas, and the atlases of the maps next to it
+  // so the renderer can keep them loaded
+  str_hash_t names[ATLAS_COUNT] = {};
+  names[ATLAS_LEVEL] = state.map.levelAtlas;
+  names[ATLAS_PREV] = mapAtlasName(p, state.map.prevLoad.map);
+  names[ATLAS_NEXT] = mapAtlasName(p, state.map.nextLoad.map);
+
+  pak_entry_t newEnt[ATLAS_COUNT];
+  const atlas_t *newAtlas[ATLAS_COUNT] = {};
+
+  for (atlas_id_t i = ATLAS_LEVEL; i < ATLAS_COUNT; ++i) {
+    newEnt[i] = names[i] ? p.getEntry(names[i]) : PAK_INVALID_ENTRY;
+    if (newEnt[i] != PAK_INVALID_ENTRY) newAtlas[i] = (const atlas_t*)p.mapEntry(newEnt[i]);
+
+    if (!newAtlas[i]) {
+      newEnt[i] = PAK_INVALID_ENTRY;
+
+      // Only the level atlas is required
+      if (i == ATLAS_LEVEL) {
+        log_warning("Cannot load level atlas %s!", name_str(names[i]));
+        state.map.free(m);
+        return false;
+      }
+
+      if (names[i]) log_warning("Cannot load neighbouring level atlas %s!", name_str(names[i]));
+    }
   }
 
-  state.r.atlas[ATLAS_LEVEL] = (atlas_t*)p.mapEntry(atlasEnt[ATLAS_LEVEL]);
-  if (!state.r.atlas[ATLAS_LEVEL]) {
-    log_warning("Cannot map level atlas!");
-    state.map.free(m);
-    return false;
+  // Unmap previous atlases after mapping the new ones,
+  // so atlases shared between them stay mapped
+  for (atlas_id_t i = ATLAS_LEVEL; i < ATLAS_COUNT; ++i) {
+    if (atlasEnt[i] != PAK_INVALID_ENTRY) p.unmapEntry(atlasEnt[i]);
+
+    atlasEnt[i] = newEnt[i];
+    state.r.atlas[i] = newAtlas[i];
+    state.r.atlasName[i] = newAtlas[i] ? names[i] : 0;
   }
 
 #else
 
+  // Free previous map atlas
+  if (atlasEnt[ATLAS_LEVEL] != PAK_INVALID_ENTRY) p.unmapEntry(atlasEnt[ATLAS_LEVEL]);
+
   // Load map atlas
   atlasEnt[ATLAS_LEVEL] = p.getEntry(state.curMap->prop->atlas);
   if (atlasEnt[ATLAS_LEVEL] == PAK_INVALID_ENTRY) {
-    log_warning("Cannot find level atlas!");
+    log_warning("Cannot find level atlas %s!", name_str(state.curMap->prop->atlas));
     state.map.free(m);
     return false;
   }
 
   state.r.atlas[ATLAS_LEVEL] = (atlas_t*)p.mapEntry(atlasEnt[ATLAS_LEVEL]);
   if (!state.r.atlas[ATLAS_LEVEL]) {
-    log_warning("Cannot map level atlas!");
+    log_warning("Cannot map level atlas %s!", name_str(state.curMap->prop->atlas));
     state.map.free(m);
     return false;
   }
 
+  state.r.atlasName[ATLAS_LEVEL] = state.curMap->prop->atlas;
+
   // If map is empty, load map into editor
   if (state.curMap->cubeCount == 0) {
     if (state.map.cubeCount >= 255) {
@@ -90,6 +139,8 @@ static ubool loadMap(mem_t &m, pak_t &p, game_state_t &state, pak_entry_t *atlas
 
     state.curMap->prevLoad = state.map.prevLoad;
     state.curMap->nextLoad = state.map.nextLoad;
+
+    state.curMap->chunks.build(state.curMap->cubes, state.curMap->cubeCount);
   }
 
   // Free map, we don't need it
@@ -100,11 +151,29 @@ static ubool loadMap(mem_t &m, pak_t &p, game_state_t &state, pak_entry_t *atlas
   return true;
 }
 
+// Map the game starts on, -map starts somewhere else
+static str_hash_t firstMap(const args_t &args) {
+  const char *map = args.val(str_hash("-map"));
+  if (!map) return str_hash("maps/000.map");
+
+  // Name it, in case it's not in the pak
+  const str_hash_t hash = str_hashR(map);
+  name_add(hash, map);
+
+  return hash;
+}
+
 game_t::game_t(interfaces_t &i, const args_t &args) :
   m_i(i), m_a(args),
 
   // Check for pak file override
-  m_pak(m_i.mem, m_i.fileSys, m_a.valDef(str_hash("-pak"), "data.pak"))
+  m_pak(m_i.mem, m_i.fileSys, m_a.valDef(str_hash("-pak"), "data.pak")),
+
+  // -record records input, -replay replays it
+  m_replay(m_i.mem, m_i.fileSys, m_i.rng, firstMap(m_a),
+           m_a.val(str_hash("-record")), m_a.val(str_hash("-replay"))),
+
+  m_mapGen(0)
 {
 	// Allocate game state
 	m_state = (game_state_t*)m_i.mem.alloc(sizeof(game_state_t));
@@ -118,6 +187,7 @@ game_t::game_t(interfaces_t &i, const args_t &args) :
   m_state->player.pos = m_state->pos-PLAYER_BBOX*0.5f;
   m_state->yaw = (f32)M_PI*0.5f;
   m_state->pitch = 0.f;
+  game_state_saveView(*m_state);
 
   // Set FOV, based on command-line parameters
   // NOTE: No error checking is done here!
@@ -144,6 +214,8 @@ game_t::game_t(interfaces_t &i, const args_t &args) :
     throw log_except("Cannot map atlases/global.atl!");
   }
 
+  m_state->r.atlasName[ATLAS_GLOBAL] = str_hash("atlases/global.atl");
+
 #ifdef GAME_STATE_EDITOR
 
   // Initialize editor vars
@@ -165,11 +237,11 @@ game_t::game_t(interfaces_t &i, const args_t &args) :
 
 #else
 
-  // Load first map
-  if (!loadMap(m_i.mem, m_pak, *m_state, m_atlasEnt, str_hash("maps/000.map"))) {
+  // Load first map, replays start where they were recorded
+  if (!loadMap(m_i.mem, m_pak, *m_state, m_atlasEnt, m_replay.map())) {
     m_pak.unmapEntry(m_atlasEnt[ATLAS_GLOBAL]);
     m_i.mem.free(m_state);
-    throw log_except("Cannot load map!");
+    throw log_except("Cannot load map %s!", name_str(m_replay.map()));
   }
 
 #endif
@@ -190,6 +262,85 @@ game_t::~game_t() {
 	m_i.mem.free(m_state);
 }
 
+void game_t::snapshot(game_state_snapshot_t &snap, f32 alpha) {
+  PROF_ZONE("snapshot");
+
+  snap.width = m_state->w.width;
+  snap.height = m_state->w.height;
+  snap.view = game_state_view(*m_state, alpha);
+
+  if (m_state->r.load) {
+    ++m_mapGen;
+    m_state->r.load = false;
+  }
+
+#ifdef GAME_STATE_EDITOR
+  // Placed cubes are drawn like a map, so only the chunks edits touch get rebuilt
+  const map_cube_t *cubes = m_state->curMap->cubes;
+  const uptr cubeCount = m_state->curMap->cubeCount;
+  const map_chunks_t &chunks = m_state->curMap->chunks;
+#else
+  const map_cube_t *cubes = m_state->map.cubes;
+  const uptr cubeCount = m_state->map.cubeCount;
+  const map_chunks_t &chunks = m_state->map.chunks;
+#endif
+
+  // The map is copied every time, since the snapshot could be
+  // the first one the renderer sees after a load
+  if (cubeCount > GAME_SNAPSHOT_MAXCUBES)
+    throw log_except("Map has too many cubes! (%u > %u)",
+                     (unsigned)cubeCount, (unsigned)GAME_SNAPSHOT_MAXCUBES);
+
+  snap.mapGen = m_mapGen;
+  snap.cubeCount = cubeCount;
+  if (cubeCount) memcpy((void*)snap.cubes, cubes, cubeCount*sizeof(map_cube_t));
+
+  memcpy((void*)&snap.chunks, &chunks, sizeof(map_chunks_t));
+
+  snap.objCount = 0;
+
+#ifdef GAME_STATE_EDITOR
+
+  // Cube that's being placed
+  snap.objs[snap.objCount].cube = m_state->curMap->cubes[m_state->curMap->cubeCount];
+  snap.objs[snap.objCount++].atlas = ATLAS_LEVEL;
+
+  // Loading zones
+  snap.objs[snap.objCount].cube = m_state->curMap->prevLoad;
+  snap.objs[snap.objCount].cube.img = str_hash("prevLoad");
+  snap.objs[snap.objCount++].atlas = ATLAS_GLOBAL;
+
+  snap.objs[snap.objCount].cube = m_state->curMap->nextLoad;
+  snap.objs[snap.objCount].cube.img = str_hash("nextLoad");
+  snap.objs[snap.objCount++].atlas = ATLAS_GLOBAL;
+
+#endif
+
+  // Map atlases again, so they outlive the game unmapping them
+  for (atlas_id_t i = 0; i < ATLAS_COUNT; ++i) {
+    snap.atlas[i] = NULL;
+    snap.atlasName[i] = 0;
+    snap.atlasEnt[i] = PAK_INVALID_ENTRY;
+
+    if (!m_state->r.atlas[i] || (m_atlasEnt[i] == PAK_INVALID_ENTRY)) continue;
+
+    snap.atlas[i] = (const atlas_t*)m_pak.mapEntry(m_atlasEnt[i]);
+    if (!snap.atlas[i]) continue;
+
+    snap.atlasName[i] = m_state->r.atlasName[i];
+    snap.atlasEnt[i] = m_atlasEnt[i];
+  }
+}
+
+void game_t::releaseSnapshot(game_state_snapshot_t &snap) {
+  for (atlas_id_t i = 0; i < ATLAS_COUNT; ++i) {
+    if (snap.atlas[i]) m_pak.unmapEntry(snap.atlasEnt[i]);
+
+    snap.atlas[i] = NULL;
+    snap.atlasEnt[i] = PAK_INVALID_ENTRY;
+  }
+}
+
 #ifndef GAME_STATE_EDITOR
 
 static ubool cubesIntersect(const map_cube_t &a, const map_cube_t &b) {
@@ -202,13 +353,22 @@ static ubool cubesIntersect(const map_cube_t &a, const map_cube_t &b) {
 }
 
 game_update_ret_t game_t::update() {
+  PROF_ZONE("update");
+
+  if (!m_replay.tick(m_i.input, m_state->w)) return GAME_UPDATE_CLOSE;
+
   if (m_i.input.k.pressed[KEYC_ESCAPE]) return GAME_UPDATE_CLOSE;
 
+  game_state_saveView(*m_state);
+
   // If the player fell out of bounds, put the player back in bounds
+  ubool respawned = false;
   if (m_state->player.pos.f[1] < 0.f) {
     m_state->player.pos = vec4(4096.f, 4096.f, 4096.f, 1.f);
     m_state->player.vspeed = 0.f;
     loadMap(m_i.mem, m_pak, *m_state, m_atlasEnt, str_hash("maps/000.map"));
+
+    respawned = true;
   }
 
   // If we're colliding with a loading zone, load that map into memory
@@ -268,11 +428,15 @@ game_update_ret_t game_t::update() {
 #endif
 
   // Collision detection
+  u32 hits[3] = {0, 0, 0}; // Cubes hit on each axis, for the binary log
+
   pos.min.f[0] += offset.f[0];
   pos.max.f[0] += offset.f[0];
 
   for (uptr i = 0; i < m_state->map.cubeCount; ++i) {
     if (cubesIntersect(m_state->map.cubes[i], pos)) {
+      ++hits[0];
+
       if (offset.f[0] >= 0.f)
         pos.min.f[0] = m_state->map.cubes[i].min.f[0]-PLAYER_BBOX.f[0];
       else
@@ -287,6 +451,8 @@ game_update_ret_t game_t::update() {
 
   for (uptr i = 0; i < m_state->map.cubeCount; ++i) {
     if (cubesIntersect(m_state->map.cubes[i], pos)) {
+      ++hits[2];
+
       if (offset.f[2] >= 0.f)
         pos.min.f[2] = m_state->map.cubes[i].min.f[2]-PLAYER_BBOX.f[2];
       else
@@ -302,6 +468,8 @@ game_update_ret_t game_t::update() {
   m_state->player.onGround = false;
   for (uptr i = 0; i < m_state->map.cubeCount; ++i) {
     if (cubesIntersect(m_state->map.cubes[i], pos)) {
+      ++hits[1];
+
       // Any vertical collision brings our vspeed to a halt
       m_state->player.vspeed = 0.f;
 
@@ -320,10 +488,17 @@ game_update_ret_t game_t::update() {
 
   m_state->player.pos = pos.min;
 
+  log_bin("Collision: %u cubes, hit %u x %u y %u z, on ground %u, at %.1f %.1f %.1f",
+          (u32)m_state->map.cubeCount, hits[0], hits[1], hits[2], (u32)m_state->player.onGround,
+          pos.min.f[0], pos.min.f[1], pos.min.f[2]);
+
   // Set camera position based on player position
   m_state->pos = m_state->player.pos + PLAYER_BBOX*0.5f;
   m_state->pos.f[1] += PLAYER_BBOX.f[1]*0.125f;
 
+  // Don't interpolate from where the player fell out of the map
+  if (respawned) game_state_saveView(*m_state);
+
   return GAME_UPDATE_CONTINUE;
 }
 
@@ -362,8 +537,14 @@ static void writeMap(file_handle_t &out, game_state_t &state) {
 }
 
 game_update_ret_t game_t::update() {
+  PROF_ZONE("update");
+
+  if (!m_replay.tick(m_i.input, m_state->w)) return GAME_UPDATE_CLOSE;
+
 	if (m_i.input.k.pressed[KEYC_ESCAPE]) return GAME_UPDATE_CLOSE;
 
+  game_state_saveView(*m_state);
+
   // Change map
   if (m_i.input.k.pressed[KEYC_RIGHT] && (m_state->curMap < m_state->maps+GAME_STATE_MAPCOUNT-1)) {
     ++m_state->curMap;
@@ -468,7 +649,8 @@ game_update_ret_t game_t::update() {
   }
 
   // Add & remove cubes
-  if (m_i.input.k.pressed[KEYC_M_PRIMARY] && (m_state->curMap->cubeCount < 255)) ++m_state->curMap->cubeCount;
+  if (m_i.input.k.pressed[KEYC_M_PRIMARY] && (m_state->curMap->cubeCount < 255))
+    m_state->curMap->chunks.change(m_state->curMap->cubes[m_state->curMap->cubeCount++]);
   else if (m_i.input.k.pressed[KEYC_M_SECONDARY] && (m_state->curMap->cubeCount > 0)) {
     // Remove cube at cubePos
     for (uptr i = 0; i < m_state->curMap->cubeCount; ++i) {
@@ -476,6 +658,8 @@ game_update_ret_t game_t::update() {
           (m_state->curMap->cubes[i].min.f[1] == cubePos.f[1]) &&
           (m_state->curMap->cubes[i].min.f[2] == cubePos.f[2]))
       {
+        m_state->curMap->chunks.change(m_state->curMap->cubes[i]);
+
         memcpy((void*)(m_state->curMap->cubes+i),
                m_state->curMap->cubes+i+1,
                (--m_state->curMap->cubeCount-i)*sizeof(map_cube_t));
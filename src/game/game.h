@@ -8,6 +8,7 @@
 #include "game/input.h"
 #include "game/state.h"
 #include "game/pak.h"
+#include "game/replay.h"
 
 // Return value of game_t::update
 enum game_update_ret_t {
@@ -17,6 +18,12 @@ enum game_update_ret_t {
 	GAME_UPDATE_FAILED, // The game failed to update and now must close
 };
 
+// Game ticks per second, the game is always updated at this rate
+static constexpr u32 GAME_TICKRATE = 60;
+
+// Maximum number of ticks run at once to catch up after a stall
+static constexpr u32 GAME_MAXTICKS = 8;
+
 class game_t {
 private:
 	interfaces_t m_i; // Interfaces
@@ -25,12 +32,18 @@ private:
   // Pak file
   pak_t m_pak;
 
+  // Input recording or replay
+  replay_t m_replay;
+
 	// Game state
 	game_state_t *m_state;
 
   // Atlas pak entries (used for unmapping atlases)
   pak_entry_t m_atlasEnt[ATLAS_COUNT];
 
+  // Number of maps loaded, for game_state_snapshot_t::mapGen
+  u32 m_mapGen;
+
 public:
 	// i: Interfaces
 	// argc/argv: Command line arguments
@@ -40,6 +53,13 @@ public:
 	// Run game tick
 	game_update_ret_t update();
 
+	// Fill snapshot of the render state, with the view alpha of the way to the next tick
+	// The snapshot must be zeroed before it's first filled, and released before it's refilled
+	void snapshot(game_state_snapshot_t &snap, f32 alpha);
+
+	// Release the atlases a snapshot holds
+	void releaseSnapshot(game_state_snapshot_t &snap);
+
 	// Get game state struct
 	FINLINE const game_state_t &state() const {return *m_state;}
 
@@ -1,6 +1,8 @@
 #include "types.h"
 #include "map.h"
 
+#include <math.h>
+
 // Load map file
 void map_t::load(mem_t &m, const map_file_t &f) {
   if (f.magic != MAP_MAGIC) throw log_except("Invalid map magic!");
@@ -22,4 +24,49 @@ void map_t::load(mem_t &m, const map_file_t &f) {
 
   // Load level atlas
   levelAtlas = f.levelAtlas;
+
+  chunks.build(cubes, cubeCount);
+}
+
+// Get the position of the chunk a cube is in
+static void map_chunkPos(const map_cube_t &c, i32 pos[3]) {
+  for (uptr i = 0; i < 3; ++i) pos[i] = (i32)floorf(c.min.f[i]*(1.f/MAP_CHUNKSIZE));
+}
+
+uptr map_chunks_t::add(const map_cube_t &c) {
+  i32 pos[3];
+  map_chunkPos(c, pos);
+
+  for (uptr i = 0; i < chunkCount; ++i) {
+    if ((chunks[i].x == pos[0]) && (chunks[i].y == pos[1]) && (chunks[i].z == pos[2])) return i;
+  }
+
+  // Out of chunks, the last one gets the rest of the cubes
+  if (chunkCount == MAP_MAXCHUNKS) return MAP_MAXCHUNKS-1;
+
+  map_chunk_t &chunk = chunks[chunkCount];
+  chunk.x = pos[0];
+  chunk.y = pos[1];
+  chunk.z = pos[2];
+  chunk.version = ++version;
+
+  return chunkCount++;
+}
+
+uptr map_chunks_t::find(const map_cube_t &c) const {
+  i32 pos[3];
+  map_chunkPos(c, pos);
+
+  for (uptr i = 0; i < chunkCount; ++i) {
+    if ((chunks[i].x == pos[0]) && (chunks[i].y == pos[1]) && (chunks[i].z == pos[2])) return i;
+  }
+
+  log_assert(chunkCount == MAP_MAXCHUNKS, "Cube isn't in a chunk!");
+  return MAP_MAXCHUNKS-1;
+}
+
+void map_chunks_t::build(const map_cube_t *cubes, uptr cubeCount) {
+  chunkCount = 0;
+
+  for (uptr i = 0; i < cubeCount; ++i) add(cubes[i]);
 }
@@ -48,6 +48,41 @@ struct map_cube_t {
     min(other.min.v()), max(other.max.v()), img(other.img) {}
 };
 
+// Size of a map chunk, cubes are in the chunk their min corner is in
+static constexpr f32 MAP_CHUNKSIZE = 1024.f;
+
+// Maximum number of chunks in a map, once there's this many
+// the last chunk gets every cube that isn't in one
+static constexpr uptr MAP_MAXCHUNKS = 64;
+
+struct map_chunk_t {
+  i32 x, y, z; // Position, in chunks
+  u32 version; // Changed every time a cube in the chunk does
+};
+
+// Map cubes split into spatial chunks, so the renderer can keep a mesh
+// for every chunk and only rebuild the chunks that changed
+struct map_chunks_t {
+  map_chunk_t chunks[MAP_MAXCHUNKS];
+  uptr chunkCount;
+
+  u32 version; // Last chunk version
+
+  // Get the chunk a cube is in, and add the chunk if it's new
+  uptr add(const map_cube_t &c);
+
+  // Get the chunk a cube is in, the chunk has to be added already
+  uptr find(const map_cube_t &c) const;
+
+  // Mark the chunk a cube is in as changed
+  FINLINE void change(const map_cube_t &c) {
+    chunks[add(c)].version = ++version;
+  }
+
+  // Add the chunks of every cube, replacing the previous chunks
+  void build(const map_cube_t *cubes, uptr cubeCount);
+};
+
 // Game map
 struct map_t {
   map_cube_t prevLoad;
@@ -59,6 +94,9 @@ struct map_t {
 
   str_hash_t levelAtlas; // Name of level atlas
 
+  // Chunks of the map cubes
+  map_chunks_t chunks;
+
   // Load map from file
   void load(mem_t &m, const map_file_t &f);
 
@@ -69,6 +107,8 @@ struct map_t {
       cubes = NULL;
       cubeCount = 0;
     }
+
+    chunks.chunkCount = 0;
   }
 };
 
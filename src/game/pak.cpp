@@ -4,6 +4,9 @@
 #include "endianUtil.h"
 #include "mem.h"
 #include "log.h"
+#include "name.h"
+
+#include <cstring>
 
 // Entry memory layout
 struct pak_t::entry_t {
@@ -49,6 +52,10 @@ pak_t::pak_t(mem_t &m, file_system_t &f, const char *filename) :
     e->mapping = NULL;
     e->ref = 0;
     e->nameHash = ent.nameHash;
+
+    // Keep the name for messages, it's only null terminated if it's shorter than the field
+    const char *end = (const char*)memchr(ent.name, 0, sizeof(ent.name));
+    name_add(ent.nameHash, ent.name, end ? end-ent.name : sizeof(ent.name));
   }
 
   // Pak file has been read into memory
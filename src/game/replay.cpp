@@ -0,0 +1,226 @@
+#include "types.h"
+#include "log.h"
+#include "game/replay.h"
+
+#include <cstring>
+
+// Size of the recording buffer
+static constexpr uptr REPLAY_BUFSIZE = 4096;
+
+// Biggest tick there can be
+static constexpr uptr REPLAY_MAXTICK = 2 + 2*KEYC_COUNT + 4 + 4;
+
+static FINLINE void put16(u8 *p, u16 v) {
+  p[0] = (u8)v;
+  p[1] = (u8)(v >> 8);
+}
+
+static FINLINE u16 get16(const u8 *p) {
+  return (u16)(p[0] | (p[1] << 8));
+}
+
+replay_t::replay_t(mem_t &m, file_system_t &f, rng_t &rng, str_hash_t map,
+                   const char *recordPath, const char *replayPath) :
+  m_m(m), m_file(NULL), m_buf(NULL), m_len(0), m_pos(0), m_replaying(false), m_map(map), m_ticks(0),
+  m_mx(-1), m_my(-1), m_width(0), m_height(0)
+{
+  memset(m_keys, 0, sizeof(m_keys));
+
+  if (recordPath && replayPath) throw log_except("Cannot record and replay at the same time!");
+
+  if (recordPath) {
+    m_file = f.open(recordPath, FILE_MODE_WRITE);
+    if (!m_file) throw log_except("Cannot open %s to record into!", recordPath);
+
+    m_buf = (u8*)m_m.alloc(REPLAY_BUFSIZE);
+    if (!m_buf) {
+      m_file->close();
+      throw log_except("Cannot allocate recording buffer!");
+    }
+
+    const u64 seed = rng.get();
+
+    replay_hdr_t hdr;
+    hdr.magic = REPLAY_MAGIC;
+    hdr.map = map;
+    hdr.seedLo = (u32)seed;
+    hdr.seedHi = (u32)(seed >> 32);
+
+    if (m_file->write(&hdr, sizeof(hdr)) != (iptr)sizeof(hdr)) {
+      m_m.free(m_buf);
+      m_file->close();
+      throw log_except("Cannot write to %s!", recordPath);
+    }
+
+    log_note("Recording input into %s", recordPath);
+  } else if (replayPath) {
+    file_handle_t *file = f.open(replayPath, FILE_MODE_READ);
+    if (!file) throw log_except("Cannot open replay %s!", replayPath);
+
+    // Read the whole thing, it's small
+    iptr size = -1;
+    if (file->seek(0, FILE_SEEK_END)) size = file->tell();
+
+    if ((size < (iptr)sizeof(replay_hdr_t)) || !file->seek(0, FILE_SEEK_SET)) {
+      file->close();
+      throw log_except("%s isn't a replay!", replayPath);
+    }
+
+    m_buf = (u8*)m_m.alloc(size);
+    if (!m_buf) {
+      file->close();
+      throw log_except("Cannot allocate replay!");
+    }
+
+    const iptr read = file->read(m_buf, size);
+    file->close();
+
+    replay_hdr_t hdr;
+    memcpy(&hdr, m_buf, sizeof(hdr));
+
+    if ((read != size) || (hdr.magic != REPLAY_MAGIC)) {
+      m_m.free(m_buf);
+      throw log_except("%s isn't a replay!", replayPath);
+    }
+
+    m_len = size;
+    m_pos = sizeof(hdr);
+    m_replaying = true;
+    m_map = hdr.map;
+
+    rng.set((u64)(u32)hdr.seedLo | ((u64)(u32)hdr.seedHi << 32));
+
+    log_note("Replaying input from %s", replayPath);
+  }
+}
+
+replay_t::~replay_t() {
+  if (m_file) {
+    if (!flush()) log_warning("Cannot write the end of the recording!");
+    m_file->close();
+
+    log_note("Recorded %llu ticks", (unsigned long long)m_ticks);
+  }
+
+  if (m_buf) m_m.free(m_buf);
+}
+
+ubool replay_t::flush() {
+  const ubool ok = !m_len || (m_file->write(m_buf, m_len) == (iptr)m_len);
+  m_len = 0;
+
+  return ok;
+}
+
+void replay_t::record(const game_input_t &in, const game_state_win_t &w) {
+  if ((m_len+REPLAY_MAXTICK > REPLAY_BUFSIZE) && !flush())
+    log_warning("Cannot write recording, a part of it is lost!");
+
+  u8 *flags = m_buf+m_len;
+  *flags = 0;
+  m_len += 1;
+
+  // Keys that changed
+  u8 *count = m_buf+m_len;
+  *count = 0;
+  m_len += 1;
+
+  for (uptr k = 0; k < KEYC_COUNT; ++k) {
+    const u8 state = (in.k.down[k] ? REPLAY_KEY_DOWN : 0) |
+                     (in.k.pressed[k] ? REPLAY_KEY_PRESSED : 0) |
+                     (in.k.released[k] ? REPLAY_KEY_RELEASED : 0);
+
+    if (state != m_keys[k]) {
+      m_buf[m_len++] = (u8)k;
+      m_buf[m_len++] = state;
+
+      m_keys[k] = state;
+      ++*count;
+    }
+  }
+
+  if (*count) *flags |= REPLAY_TICK_KEYS;
+  else m_len -= 1;
+
+  if ((in.mx != m_mx) || (in.my != m_my)) {
+    *flags |= REPLAY_TICK_MOUSE;
+
+    put16(m_buf+m_len, (u16)(i16)in.mx);
+    put16(m_buf+m_len+2, (u16)(i16)in.my);
+    m_len += 4;
+
+    m_mx = in.mx;
+    m_my = in.my;
+  }
+
+  if ((w.width != m_width) || (w.height != m_height)) {
+    *flags |= REPLAY_TICK_SIZE;
+
+    put16(m_buf+m_len, (u16)w.width);
+    put16(m_buf+m_len+2, (u16)w.height);
+    m_len += 4;
+
+    m_width = w.width;
+    m_height = w.height;
+  }
+
+  ++m_ticks;
+}
+
+ubool replay_t::replay(game_input_t &in, game_state_win_t &w) {
+  if (m_pos >= m_len) {
+    log_note("Replay finished after %llu ticks", (unsigned long long)m_ticks);
+    m_replaying = false;
+    return false;
+  }
+
+  const u8 flags = m_buf[m_pos++];
+  uptr need = 0;
+
+  if (flags & REPLAY_TICK_KEYS) need += 1 + ((m_pos < m_len) ? 2*m_buf[m_pos] : 0);
+  if (flags & REPLAY_TICK_MOUSE) need += 4;
+  if (flags & REPLAY_TICK_SIZE) need += 4;
+
+  if ((flags & ~(REPLAY_TICK_KEYS | REPLAY_TICK_MOUSE | REPLAY_TICK_SIZE)) || (m_pos+need > m_len)) {
+    log_warning("Replay is broken after %llu ticks!", (unsigned long long)m_ticks);
+    m_replaying = false;
+    return false;
+  }
+
+  if (flags & REPLAY_TICK_KEYS) {
+    const u8 count = m_buf[m_pos++];
+
+    for (u8 i = 0; i < count; ++i, m_pos += 2) {
+      if (m_buf[m_pos] < KEYC_COUNT) m_keys[m_buf[m_pos]] = m_buf[m_pos+1];
+    }
+  }
+
+  if (flags & REPLAY_TICK_MOUSE) {
+    m_mx = (i16)get16(m_buf+m_pos);
+    m_my = (i16)get16(m_buf+m_pos+2);
+    m_pos += 4;
+  }
+
+  if (flags & REPLAY_TICK_SIZE) {
+    m_width = get16(m_buf+m_pos);
+    m_height = get16(m_buf+m_pos+2);
+    m_pos += 4;
+  }
+
+  // Replace the whole state, the platform layer could've pressed keys as well
+  for (uptr k = 0; k < KEYC_COUNT; ++k) {
+    in.k.down[k] = (m_keys[k] & REPLAY_KEY_DOWN) != 0;
+    in.k.pressed[k] = (m_keys[k] & REPLAY_KEY_PRESSED) != 0;
+    in.k.released[k] = (m_keys[k] & REPLAY_KEY_RELEASED) != 0;
+  }
+
+  in.mx = m_mx;
+  in.my = m_my;
+
+  w.width = m_width;
+  w.height = m_height;
+
+  ++m_ticks;
+
+  return true;
+}
@@ -0,0 +1,106 @@
+// Input recording and replay
+// The game only gets input through game_input_t and the window size, so with the
+// same RNG seed and starting map a recording replays the exact same ticks
+
+#ifndef GAME_REPLAY_H
+#define GAME_REPLAY_H
+
+#include "types.h"
+#include "util.h"
+#include "endianUtil.h"
+#include "mem.h"
+#include "file.h"
+#include "rng.h"
+#include "str.h"
+#include "key.h"
+#include "game/input.h"
+#include "game/state.h"
+
+/////////////////////////
+// Replay file format
+//
+// Format:
+//   replay_hdr_t hdr; // hdr.magic == REPLAY_MAGIC
+//   Ticks, until the end of the file:
+//     u8 flags; // REPLAY_TICK_*
+//     REPLAY_TICK_KEYS: u8 count, then count of {u8 key; u8 state;} // state is REPLAY_KEY_*
+//     REPLAY_TICK_MOUSE: i16 mx, my
+//     REPLAY_TICK_SIZE: u16 width, height
+//
+// Ticks only hold what changed since the tick before, everything after the header
+// is little endian and unaligned
+
+static constexpr u32 REPLAY_MAGIC = util_magic('R', 'P', 'L', '1');
+
+struct replay_hdr_t {
+  u32 magic;
+
+  str_hash_t map; // Map the game starts on
+
+  // RNG seed
+  endian_u32 seedLo, seedHi;
+};
+
+// Tick flags
+static constexpr u8 REPLAY_TICK_KEYS  = 0x1;
+static constexpr u8 REPLAY_TICK_MOUSE = 0x2;
+static constexpr u8 REPLAY_TICK_SIZE  = 0x4;
+
+// Key state bits
+static constexpr u8 REPLAY_KEY_DOWN     = 0x1;
+static constexpr u8 REPLAY_KEY_PRESSED  = 0x2;
+static constexpr u8 REPLAY_KEY_RELEASED = 0x4;
+
+class replay_t {
+private:
+  mem_t &m_m;
+
+  file_handle_t *m_file; // Recording file, NULL when reading or not recording
+
+  // Recording: ticks waiting to be written
+  // Replaying: whole replay file
+  u8 *m_buf;
+  uptr m_len, m_pos;
+
+  ubool m_replaying;
+  str_hash_t m_map;
+  u64 m_ticks;
+
+  // Input of the last tick
+  u8 m_keys[KEYC_COUNT];
+  i32 m_mx, m_my;
+  u32 m_width, m_height;
+
+  // Write out ticks in m_buf
+  ubool flush();
+
+  void record(const game_input_t &in, const game_state_win_t &w);
+  ubool replay(game_input_t &in, game_state_win_t &w);
+
+public:
+  // Records into recordPath, or replays replayPath, both can be NULL
+  // When recording map is written as the starting map and the seed is taken from rng,
+  // when replaying rng is seeded from the recording
+  replay_t(mem_t &m, file_system_t &f, rng_t &rng, str_hash_t map,
+           const char *recordPath, const char *replayPath);
+  ~replay_t();
+
+  replay_t(const replay_t &other) = delete;
+
+  FINLINE ubool replaying() const {return m_replaying;}
+
+  // Map the game should start on
+  FINLINE str_hash_t map() const {return m_map;}
+
+  // Run before every tick
+  // Records the input, or replaces it with the next recorded tick
+  // Returns false when the replay has run out
+  FINLINE ubool tick(game_input_t &in, game_state_win_t &w) {
+    if (m_file) record(in, w);
+    else if (m_replaying) return replay(in, w);
+
+    return true;
+  }
+};
+
+#endif //GAME_REPLAY_H
@@ -0,0 +1,56 @@
+#include "types.h"
+#include "game/sound.h"
+
+const i16 sound_steps[SOUND_STEPCOUNT] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+  19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+  130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+  337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+  876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+  2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+  5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+  15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+const i8 sound_indexSteps[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+ubool sound_valid(const sound_t *s) {
+  return s && (s->magic == SOUND_MAGIC) && (s->sampleRate == SOUND_SAMPLERATE) && s->frameCount &&
+    ((u32)s->blockCount == (s->frameCount+SOUND_BLOCKFRAMES-1)/SOUND_BLOCKFRAMES);
+}
+
+void sound_decoder_t::start(const sound_t *s) {
+  m_sound = s;
+  m_frame = 0;
+}
+
+uptr sound_decoder_t::decode(i16 *out, uptr count) {
+  if (!m_sound) return 0;
+
+  const uptr ret = util_min<uptr>(count, m_sound->frameCount - m_frame);
+  const u32 end = m_frame + (u32)ret;
+
+  while (m_frame < end) {
+    const sound_block_t &b = m_sound->blocks[m_frame/SOUND_BLOCKFRAMES];
+    const u32 first = m_frame%SOUND_BLOCKFRAMES;
+
+    // Blocks start with their own state
+    if (!first) {
+      for (uptr c = 0; c < 2; ++c) {
+        m_state[c].predictor = (i16)b.predictor[c];
+        m_state[c].index = util_min<i32>(b.index[c], SOUND_STEPCOUNT-1);
+      }
+    }
+
+    const u32 last = util_min<u32>(SOUND_BLOCKFRAMES, first + (end-m_frame));
+    for (u32 i = first; i < last; ++i) {
+      *out++ = sound_decodeNibble(m_state[0], b.frames[i] & 0xf);
+      *out++ = sound_decodeNibble(m_state[1], b.frames[i] >> 4);
+    }
+
+    m_frame += last-first;
+  }
+
+  return ret;
+}
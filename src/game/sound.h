@@ -0,0 +1,97 @@
+#ifndef GAME_SOUND_H
+#define GAME_SOUND_H
+
+#include "types.h"
+#include "util.h"
+#include "endianUtil.h"
+
+// Sample rate of every sound, the mixer doesn't resample
+static constexpr u32 SOUND_SAMPLERATE = 44100;
+
+// Frames in each block of a sound
+static constexpr u32 SOUND_BLOCKFRAMES = 1024;
+
+// IMA-ADPCM step sizes
+static constexpr i32 SOUND_STEPCOUNT = 89;
+extern const i16 sound_steps[SOUND_STEPCOUNT];
+
+// Step index change of each nibble, without the sign bit
+extern const i8 sound_indexSteps[8];
+
+// ADPCM state of one channel
+struct sound_adpcm_t {
+  i32 predictor; // Last sample
+  i32 index; // Index into sound_steps
+};
+
+// Decode a nibble, updating the channel's state
+// The encoder uses this too, so it tracks exactly what the decoder will output
+static FINLINE i16 sound_decodeNibble(sound_adpcm_t &s, u32 nibble) {
+  const i32 step = sound_steps[s.index];
+
+  i32 diff = step >> 3;
+  if (nibble & 1) diff += step >> 2;
+  if (nibble & 2) diff += step >> 1;
+  if (nibble & 4) diff += step;
+
+  s.predictor = util_min(util_max(s.predictor + ((nibble & 8) ? -diff : diff), -32768), 32767);
+  s.index = util_min(util_max(s.index + sound_indexSteps[nibble & 7], 0), SOUND_STEPCOUNT-1);
+
+  return (i16)s.predictor;
+}
+
+// Sound file format
+//
+// Stereo IMA-ADPCM, split into blocks of SOUND_BLOCKFRAMES frames
+// Each block starts with the ADPCM state of both channels, so decoding can
+// start at any block, then every byte is a frame, with the left sample in the
+// low nibble and the right sample in the high nibble
+// The last block is only filled up to frameCount
+//
+// Sounds are played straight from the pak mapping, the audio thread decodes
+// a little at a time, so they're never decoded whole into memory
+static constexpr u32 SOUND_MAGIC = util_magic('S', 'N', 'D', '1');
+
+struct sound_block_t {
+  endian_i16 predictor[2]; // Left and right sample before the block
+  u8 index[2]; // Left and right step index
+  u8 pad[2];
+
+  u8 frames[SOUND_BLOCKFRAMES];
+};
+
+struct sound_t {
+  u32 magic; // == SOUND_MAGIC
+
+  endian_u32 sampleRate; // == SOUND_SAMPLERATE
+  endian_u32 frameCount;
+  endian_u32 blockCount; // frameCount/SOUND_BLOCKFRAMES, rounded up
+
+  sound_block_t blocks[1 /*blockCount*/];
+};
+
+// Check if a mapped sound can be played
+ubool sound_valid(const sound_t *s);
+
+// Incremental sound decoder
+// Decodes from a sound in order, in whatever sizes it's asked for
+class sound_decoder_t {
+private:
+  const sound_t *m_sound;
+  u32 m_frame; // Next frame
+  sound_adpcm_t m_state[2];
+
+public:
+  FINLINE sound_decoder_t() : m_sound(NULL), m_frame(0) {}
+
+  // Start decoding a sound from the beginning
+  void start(const sound_t *s);
+
+  // Decode up to count frames into out, left and right samples interleaved
+  // Returns the number of frames decoded, less than count at the end of the sound
+  uptr decode(i16 *out, uptr count);
+
+  FINLINE ubool done() const {return !m_sound || (m_frame >= m_sound->frameCount);}
+};
+
+#endif //GAME_SOUND_H
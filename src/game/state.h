@@ -38,6 +38,9 @@ struct game_state_mapState_t {
   map_cube_t cubes[256];
   uptr cubeCount;
 
+  // Chunks of the placed cubes
+  map_chunks_t chunks;
+
   // Loading zones
   map_cube_t prevLoad, nextLoad;
 
@@ -106,6 +109,10 @@ struct game_state_render_t {
 
   // Used to load atlases into renderer
   const atlas_t *atlas[ATLAS_COUNT];
+
+  // Pak entry names of atlases, 0 if there's no atlas
+  // The renderer uses these to tell if an atlas is already loaded
+  str_hash_t atlasName[ATLAS_COUNT];
 };
 
 // Game player
@@ -117,6 +124,62 @@ struct game_state_player_t {
   ubool onGround; // Is the player currently on the ground?
 };
 
+// Camera and player state, the game keeps the state of the previous tick
+// so the renderer can interpolate between it and the current one
+struct game_state_view_t {
+  vec4 pos; // Camera position
+
+  f32 yaw; // Camera yaw
+  f32 pitch; // Camera pitch
+
+  vec4 playerPos; // Bottom of player
+};
+
+// Maximum number of map cubes in a snapshot
+static constexpr uptr GAME_SNAPSHOT_MAXCUBES = 256;
+
+// Maximum number of dynamic objects in a snapshot, the editor's cube and loading zones
+static constexpr uptr GAME_SNAPSHOT_MAXOBJS = 1+2;
+
+// Object that's drawn every frame
+struct game_state_obj_t {
+  map_cube_t cube;
+  atlas_id_t atlas; // Atlas the cube's image is in
+};
+
+// Copy of everything the renderer needs to draw a frame, so it can render
+// on another thread while the game keeps ticking
+// Filled by game_t::snapshot, and it doesn't change until it's released
+struct game_state_snapshot_t {
+  // Window size
+  u32 width, height;
+
+  // View interpolated between the last two ticks
+  game_state_view_t view;
+
+  // Changes every time a map is loaded, the renderer rebuilds every chunk then
+  u32 mapGen;
+
+  // Map cubes, in the editor these are the placed cubes
+  map_cube_t cubes[GAME_SNAPSHOT_MAXCUBES];
+  uptr cubeCount;
+
+  // Map chunks, otherwise the renderer only rebuilds chunks whose version changed
+  map_chunks_t chunks;
+
+  // Dynamic objects
+  game_state_obj_t objs[GAME_SNAPSHOT_MAXOBJS];
+  uptr objCount;
+
+  // Atlases and their names, NULL if there's no atlas
+  const atlas_t *atlas[ATLAS_COUNT];
+  str_hash_t atlasName[ATLAS_COUNT];
+
+  // The snapshot keeps its atlases mapped, so they stay valid
+  // while it's rendered even if the game loads another map
+  pak_entry_t atlasEnt[ATLAS_COUNT];
+};
+
 // Game state struct
 struct game_state_t {
   game_state_win_t w; // Window state
@@ -135,6 +198,9 @@ struct game_state_t {
   f32 yaw; // Camera yaw
   f32 pitch; // Camera pitch
 
+  // View at the previous tick
+  game_state_view_t prev;
+
   // Map editor state
 #ifdef GAME_STATE_EDITOR
 
@@ -154,4 +220,32 @@ struct game_state_t {
 #endif
 };
 
+// Save the current view as the previous tick's, done at the start of a tick,
+// and when the view jumps somewhere so it doesn't get interpolated
+FINLINE void game_state_saveView(game_state_t &s) {
+  s.prev.pos = s.pos;
+  s.prev.yaw = s.yaw;
+  s.prev.pitch = s.pitch;
+  s.prev.playerPos = s.player.pos;
+}
+
+// Get view between the previous and current tick, alpha is the fraction of a tick
+FINLINE game_state_view_t game_state_view(const game_state_t &s, f32 alpha) {
+  static constexpr f32 PI2 = 6.28318531f;
+
+  game_state_view_t ret;
+  ret.pos = s.prev.pos + (s.pos-s.prev.pos)*alpha;
+  ret.playerPos = s.prev.playerPos + (s.player.pos-s.prev.playerPos)*alpha;
+  ret.pitch = s.prev.pitch + (s.pitch-s.prev.pitch)*alpha;
+
+  // Yaw wraps around, so take the short way
+  f32 dyaw = s.yaw-s.prev.yaw;
+  if (dyaw > PI2*0.5f) dyaw -= PI2;
+  else if (dyaw < -PI2*0.5f) dyaw += PI2;
+
+  ret.yaw = s.prev.yaw + dyaw*alpha;
+
+  return ret;
+}
+
 #endif //GAME_STATE_H
@@ -0,0 +1,60 @@
+#ifndef GAME_SYNTH_H
+#define GAME_SYNTH_H
+
+#include "types.h"
+#include "util.h"
+#include "rng.h"
+#include "game/input.h"
+
+// Synthetic player input, so the game can run without anyone playing it
+// Runs around in random directions, turning and jumping now and then
+// The same seed always gives the same input
+class game_synth_t {
+private:
+  rng_t m_rng;
+
+  key_code_t m_move; // Movement key that's held down, KEYC_NONE if none is
+  i32 m_turn; // Mouse movement each tick
+  u32 m_hold; // Ticks left until the keys change
+
+  ubool m_jump; // If jump was pressed last tick
+
+public:
+  FINLINE game_synth_t(u64 seed) : m_move(KEYC_NONE), m_turn(0), m_hold(0), m_jump(false) {
+    m_rng.set(seed ? seed : 1);
+  }
+
+  // Set the input of the next tick, width and height are the window size
+  // Run before every tick, the platform layer still calls in.k.update after it
+  void next(game_input_t &in, u32 width, u32 height) {
+    static const key_code_t moves[] = {KEYC_W, KEYC_W, KEYC_W, KEYC_A, KEYC_D, KEYC_S, KEYC_NONE};
+
+    if (m_jump) {
+      in.k.release(KEYC_SPACE);
+      m_jump = false;
+    }
+
+    if (!m_hold) {
+      if (m_move != KEYC_NONE) in.k.release(m_move);
+
+      m_move = moves[m_rng.rand<u32>() % util_arrlen(moves)];
+      if (m_move != KEYC_NONE) in.k.press(m_move);
+
+      m_turn = (i32)(m_rng.rand<u32>() % 17) - 8;
+      m_hold = 15 + m_rng.rand<u32>() % 90;
+    }
+
+    --m_hold;
+
+    // Jump about twice a second
+    if (!(m_rng.rand<u32>() % 32)) {
+      in.k.press(KEYC_SPACE);
+      m_jump = true;
+    }
+
+    in.mx = (i32)(width/2) + m_turn;
+    in.my = (i32)(height/2);
+  }
+};
+
+#endif //GAME_SYNTH_H
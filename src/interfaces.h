@@ -6,6 +6,7 @@
 #include "mem.h"
 #include "file.h"
 #include "countTimer.h"
+#include "job.h"
 #include "args.h"
 #include "game/input.h"
 #include "rng.h"
@@ -17,12 +18,15 @@ struct interfaces_t {
 	mem_t &mem;
 	file_system_t &fileSys;
 	countTimer_t &timer;
+	job_system_t &jobs;
 	args_t &args;
 	game_input_t &input;
 	rng_t &rng;
 
-	constexpr interfaces_t(void *memp, void *fileSysp, void *timerp, void *argsp, void *inputp, void *rngp) :
+	constexpr interfaces_t(void *memp, void *fileSysp, void *timerp, void *jobsp,
+	                       void *argsp, void *inputp, void *rngp) :
 		mem(*(mem_t*)memp), fileSys(*(file_system_t*)fileSysp), timer(*(countTimer_t*)timerp),
+		jobs(*(job_system_t*)jobsp),
 		args(*(args_t*)argsp), input(*(game_input_t*)inputp), rng(*(rng_t*)rngp) {}
 };
 
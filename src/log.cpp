@@ -1,6 +1,7 @@
 #include "types.h"
 #include "log.h"
 #include "util.h"
+#include "atomic.h"
 
 #include <cstdio>
 #include <cstdlib>
@@ -39,3 +40,296 @@ log_except_t::log_except_t(const char *file, u32 line, const char *s, ...) {
 
 	va_end(args);
 }
+
+// Asynchronous logging
+
+static_assert(LOG_RINGSIZE && !(LOG_RINGSIZE & (LOG_RINGSIZE-1)), "Log ring size must be a power of 2!");
+static_assert(!(sizeof(log_record_t) & 7) && !(sizeof(log_arg_t) & 7), "Log records must keep 8-byte alignment!");
+
+// Ring of one thread, the indices only count up and are masked when used
+// A ring keeps it's indices and contents when it changes hands, so the next owner
+// carries on where the last one stopped, and the log thread doesn't notice
+struct alignas(64) log_ring_t {
+	u32 write; // Only written by the owner
+	u32 pad; // Padding before the reserved record, only used by the owner
+	u32 dropped; // Messages that didn't fit, only written by the owner
+	ubool owned; // Only accessed atomically
+	u8 writePad[64 - 3*sizeof(u32) - sizeof(ubool)];
+
+	u32 read; // Only written by the log thread
+	u8 readPad[64 - sizeof(u32)];
+
+	alignas(8) u8 data[LOG_RINGSIZE];
+};
+
+static log_ring_t log_rings[LOG_MAXTHREADS];
+static u64 log_seq = 0; // Only accessed atomically
+
+// Messages written right away since every ring was taken, only accessed atomically
+static u32 log_ringless = 0;
+
+// Ring of the calling thread, given back when the thread exits
+static thread_local struct log_threadRing_t {
+	log_ring_t *ring;
+
+	~log_threadRing_t() {
+		if (ring) atomic_store(&ring->owned, (ubool)false, ATOMIC_RELEASE);
+		ring = NULL;
+	}
+} log_threadRing = {NULL};
+
+u32 log_level = LOG_LEVEL_COUNT-1;
+ubool log_async = false;
+
+ubool log_ring() {
+	if (log_threadRing.ring) return true;
+
+	for (u32 i = 0; i < LOG_MAXTHREADS; ++i) {
+		ubool expected = false;
+		if (atomic_load(&log_rings[i].owned, ATOMIC_RELAXED) ||
+		    !atomic_cas(&log_rings[i].owned, expected, (ubool)true, ATOMIC_ACQUIRE))
+			continue;
+
+		log_threadRing.ring = log_rings+i;
+		return true;
+	}
+
+	atomic_add(&log_ringless, 1u, ATOMIC_RELAXED);
+	return false;
+}
+
+u8 *log_reserve(u32 size) {
+	log_ring_t *r = log_threadRing.ring;
+
+	const u32 write = r->write;
+	const u32 at = write & (LOG_RINGSIZE-1);
+
+	// Records don't wrap around, the end of the ring is skipped instead
+	const u32 tail = LOG_RINGSIZE - at;
+	r->pad = (tail < size) ? tail : 0;
+
+	if ((size > LOG_RINGSIZE/2) ||
+	    (r->pad + size > LOG_RINGSIZE - (write - atomic_load(&r->read, ATOMIC_ACQUIRE)))) {
+		atomic_store(&r->dropped, r->dropped+1, ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	if (r->pad) {
+		log_record_t &pad = *(log_record_t*)(r->data+at);
+		pad.size = r->pad;
+		pad.level = LOG_LEVEL_COUNT;
+	}
+
+	log_record_t &rec = *(log_record_t*)(r->data + ((write + r->pad) & (LOG_RINGSIZE-1)));
+	rec.seq = atomic_add(&log_seq, (u64)1, ATOMIC_RELAXED);
+
+	return (u8*)&rec;
+}
+
+void log_commit(u32 size) {
+	log_ring_t *r = log_threadRing.ring;
+	atomic_store(&r->write, r->write + r->pad + size, ATOMIC_RELEASE);
+}
+
+uptr log_format(char *out, uptr size, const char *fmt, const u8 *args, u32 argCount) {
+	const u8 *arg = args;
+	u32 left = argCount;
+
+	uptr len = 0;
+#define put(_c) do {if (len+1 < size) out[len++] = (_c);} while (0)
+
+	for (const char *f = fmt; *f;) {
+		if (*f != '%') {
+			put(*f++);
+			continue;
+		}
+
+		if (f[1] == '%') {
+			put('%');
+			f += 2;
+			continue;
+		}
+
+		// Keep the flags, width and precision, the length is picked from the argument
+		char spec[32];
+		uptr specLen = 0;
+
+		spec[specLen++] = *f++;
+		while (*f && strchr("-+ #0123456789.*", *f)) {
+			if (*f == '*') {
+				// Width or precision from an integer argument, put in the spec as a number
+				i64 n = 0;
+				if (left && ((((const log_arg_t*)arg)->type == LOG_ARG_INT) ||
+				             (((const log_arg_t*)arg)->type == LOG_ARG_UINT))) {
+					n = *(const i64*)(arg + sizeof(log_arg_t));
+					arg += sizeof(log_arg_t) + 8;
+					--left;
+				}
+
+				if (specLen < sizeof(spec)-16)
+					specLen += snprintf(spec+specLen, sizeof(spec)-specLen, "%d", (int)n);
+			} else if (specLen < sizeof(spec)-4) spec[specLen++] = *f;
+			++f;
+		}
+		while (*f && strchr("hlLqjzt", *f)) ++f;
+
+		const char conv = *f;
+		if (!conv) break;
+		++f;
+
+		if (!left) {
+			for (const char *s = "<missing>"; *s; ++s) put(*s);
+			continue;
+		}
+
+		const log_arg_t &a = *(const log_arg_t*)arg;
+		const u8 *v = arg + sizeof(log_arg_t);
+		arg += sizeof(log_arg_t) + ((a.size + 7) & ~7u);
+		--left;
+
+		int ret = 0;
+		const ubool intConv = conv && strchr("diouxX", conv);
+
+		switch (a.type) {
+			case LOG_ARG_INT:
+			case LOG_ARG_UINT: {
+				const u64 n = *(const u64*)v;
+
+				if (conv == 'c') {
+					spec[specLen++] = 'c';
+					spec[specLen] = 0;
+					ret = snprintf(out+len, size-len, spec, (int)n);
+				} else {
+					spec[specLen++] = 'l';
+					spec[specLen++] = 'l';
+					spec[specLen++] = intConv ? conv : ((a.type == LOG_ARG_INT) ? 'd' : 'u');
+					spec[specLen] = 0;
+					ret = snprintf(out+len, size-len, spec, (unsigned long long)n);
+				}
+			} break;
+
+			case LOG_ARG_FLOAT:
+				spec[specLen++] = strchr("fFeEgGaA", conv) ? conv : 'g';
+				spec[specLen] = 0;
+				ret = snprintf(out+len, size-len, spec, *(const double*)v);
+				break;
+
+			case LOG_ARG_STR:
+				spec[specLen++] = 's';
+				spec[specLen] = 0;
+				ret = snprintf(out+len, size-len, spec, (const char*)v);
+				break;
+
+			default:
+				ret = snprintf(out+len, size-len, "%p", (void*)(uptr)*(const u64*)v);
+				break;
+		}
+
+		if (ret > 0) len = util_min<uptr>(len + ret, size-1);
+	}
+
+#undef put
+
+	out[len] = 0;
+	return len;
+}
+
+ubool log_drain() {
+	static char buf[16*1024];
+	static u32 reported[LOG_MAXTHREADS]; // Drops already reported
+	static u32 reportedRingless = 0;
+	uptr len = 0;
+
+	// Rings that were never owned are empty, so every ring is looked at
+	const u32 ringCount = LOG_MAXTHREADS;
+	ubool any = false;
+
+	for (;;) {
+		// Write the oldest message of every ring first, so messages stay in order across threads
+		log_ring_t *best = NULL;
+		const log_record_t *bestRec = NULL;
+
+		for (u32 i = 0; i < ringCount; ++i) {
+			log_ring_t &r = log_rings[i];
+			const u32 write = atomic_load(&r.write, ATOMIC_ACQUIRE);
+
+			while (r.read != write) {
+				const log_record_t &rec = *(const log_record_t*)(r.data + (r.read & (LOG_RINGSIZE-1)));
+
+				// Skip padding at the end of the ring
+				if (rec.level == LOG_LEVEL_COUNT) {
+					atomic_store(&r.read, r.read + rec.size, ATOMIC_RELEASE);
+					continue;
+				}
+
+				if (!bestRec || (rec.seq < bestRec->seq)) {
+					best = &r;
+					bestRec = &rec;
+				}
+				break;
+			}
+		}
+
+		if (!best) break;
+
+		// Write out the buffer before it could run out
+		if (len + 1024 > sizeof(buf)) {
+			fwrite(buf, 1, len, stdout);
+			len = 0;
+		}
+
+		const int hdr = snprintf(buf+len, sizeof(buf)-len,
+		                         (bestRec->level == LOG_LEVEL_WARNING) ? "!! %s, %u !!: " : "%s, %u: ",
+		                         bestRec->file, bestRec->line);
+		if (hdr > 0) len = util_min<uptr>(len + hdr, sizeof(buf)-2);
+
+		len += log_format(buf+len, util_min<uptr>(1024, sizeof(buf)-len-1), bestRec->fmt,
+		                  (const u8*)(bestRec+1), bestRec->argCount);
+		buf[len++] = '\n';
+
+		atomic_store(&best->read, best->read + bestRec->size, ATOMIC_RELEASE);
+		any = true;
+	}
+
+	// Report messages that didn't fit
+	for (u32 i = 0; i < ringCount; ++i) {
+		const u32 dropped = atomic_load(&log_rings[i].dropped, ATOMIC_RELAXED);
+		if (dropped == reported[i]) continue;
+
+		if (len + 128 > sizeof(buf)) {
+			fwrite(buf, 1, len, stdout);
+			len = 0;
+		}
+
+		const int ret = snprintf(buf+len, sizeof(buf)-len, "!! %s, %u !!: Dropped %u log messages from ring %u\n",
+		                         __FILE__, __LINE__, dropped - reported[i], i);
+		if (ret > 0) len = util_min<uptr>(len + ret, sizeof(buf)-1);
+
+		reported[i] = dropped;
+		any = true;
+	}
+
+	// Report messages that were written right away, they could be out of order
+	const u32 ringless = atomic_load(&log_ringless, ATOMIC_RELAXED);
+	if (ringless != reportedRingless) {
+		if (len + 128 > sizeof(buf)) {
+			fwrite(buf, 1, len, stdout);
+			len = 0;
+		}
+
+		const int ret = snprintf(buf+len, sizeof(buf)-len,
+		                         "!! %s, %u !!: %u log messages were written right away, every ring was taken\n",
+		                         __FILE__, __LINE__, ringless - reportedRingless);
+		if (ret > 0) len = util_min<uptr>(len + ret, sizeof(buf)-1);
+
+		reportedRingless = ringless;
+		any = true;
+	}
+
+	if (len) {
+		fwrite(buf, 1, len, stdout);
+		fflush(stdout);
+	}
+
+	return any;
+}
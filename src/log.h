@@ -2,18 +2,239 @@
 #define LOG_H
 
 #include "types.h"
+#include "atomic.h"
 
 #include <cassert>
+#include <cstring>
+#include <type_traits>
 
-// TODO: Give log_note and log_warning a file argument
-#define log_note(...) log_note_manual(__FILE__, __LINE__, __VA_ARGS__)
-#define log_warning(...) log_warning_manual(__FILE__, __LINE__, __VA_ARGS__)
+// Log levels, lower levels are more important
+enum log_level_t : u32 {
+	LOG_LEVEL_WARNING = 0,
+	LOG_LEVEL_NOTE,
+
+	LOG_LEVEL_COUNT
+};
+
+// Levels above LOG_LEVEL aren't compiled in at all
+// Build with -DLOG_LEVEL=0 to only keep warnings
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 1
+#endif
+
+// The format has to stay valid until it's written, so it should be a string literal
+// Arguments are copied, strings included
+#define log_note(...)                                                   \
+	do {                                                                \
+		if (LOG_LEVEL >= LOG_LEVEL_NOTE)                                \
+			log_push(LOG_LEVEL_NOTE, __FILE__, __LINE__, __VA_ARGS__);  \
+	} while (0)
+#define log_warning(...)                                                    \
+	do {                                                                    \
+		if (LOG_LEVEL >= LOG_LEVEL_WARNING)                                 \
+			log_push(LOG_LEVEL_WARNING, __FILE__, __LINE__, __VA_ARGS__);   \
+	} while (0)
 #define log_assert(condition, ...) assert(condition) // TODO: Get rid of log_assert
 #define log_except(...) log_except_t(__FILE__, __LINE__, __VA_ARGS__)
 
+// Write a message right away, on the calling thread
 void log_note_manual(const char *file, u32 line, const char *str, ...);
 void log_warning_manual(const char *file, u32 line, const char *str, ...);
 
+// Asynchronous logging
+//
+// While a log thread is running (see log_thread_t), messages aren't formatted by
+// the thread logging them. The format, file and line pointers, and a copy of the
+// arguments are packed into a ring owned by the calling thread, which only it writes,
+// and the log thread formats and writes them later, in order.
+// Pushing never blocks or makes a system call, if a ring is full the message is dropped
+// and counted instead.
+// A thread gives it's ring back when it exits, so threads that come and go keep getting
+// rings. Threads that can't get one write right away like log_*_manual, and are counted.
+// Without a log thread, messages are written right away like log_*_manual.
+
+// Bytes in each thread's ring
+static constexpr u32 LOG_RINGSIZE = 8*1024;
+
+// Most threads that can log asynchronously at once, more write right away
+static constexpr u32 LOG_MAXTHREADS = 32;
+
+// Packed argument types
+enum log_argType_t : u32 {
+	LOG_ARG_INT = 0, // i64
+	LOG_ARG_UINT, // u64
+	LOG_ARG_FLOAT, // double
+	LOG_ARG_STR, // Copied string, null terminated
+	LOG_ARG_PTR // Pointer, only printed
+};
+
+// Message header in a ring, followed by the arguments
+// Everything is 8-byte aligned
+struct log_record_t {
+	u32 size; // Including the header and arguments
+	u32 level; // log_level_t, LOG_LEVEL_COUNT is padding up to the end of the ring
+
+	u64 seq; // Order messages were logged in, across threads
+
+	const char *fmt;
+	const char *file;
+	u32 line;
+	u32 argCount;
+};
+
+// Argument header, followed by the argument and padding up to 8 bytes
+struct log_arg_t {
+	u32 type; // log_argType_t
+	u32 size; // Bytes after the header, before the padding
+};
+
+// Runtime level, anything above it is skipped
+// Only accessed atomically, set it with log_setLevel
+extern u32 log_level;
+
+// True while a log thread is running, only accessed atomically
+extern ubool log_async;
+
+FINLINE void log_setLevel(log_level_t level) {atomic_store(&log_level, (u32)level, ATOMIC_RELAXED);}
+
+// Get a ring for the calling thread if it doesn't have one
+// Returns false if every ring is taken, the thread should write right away then
+ubool log_ring();
+
+// Reserve size bytes in the calling thread's ring, returns NULL if it's full
+// The thread has to have a ring, and every reserved record has to be committed
+u8 *log_reserve(u32 size);
+void log_commit(u32 size);
+
+// Format every message that's waiting, and write them
+// Only called by the log thread, returns false if there was nothing to write
+ubool log_drain();
+
+// Format packed arguments with fmt into out, truncating at size
+// Returns the length written, without the null terminator
+uptr log_format(char *out, uptr size, const char *fmt, const u8 *args, u32 argCount);
+
+// Argument packing
+template<typename T, typename E = void>
+struct log_pack_t;
+
+template<typename T>
+struct log_pack_t<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type> {
+	static FINLINE u32 size(T v) {(void)v; return sizeof(log_arg_t) + 8;}
+	static FINLINE void pack(u8 *&p, T v) {
+		log_arg_t &a = *(log_arg_t*)p;
+		a.size = 8;
+
+		if (std::is_signed<T>::value) {
+			a.type = LOG_ARG_INT;
+			*(i64*)(p + sizeof(log_arg_t)) = (i64)v;
+		} else {
+			a.type = LOG_ARG_UINT;
+			*(u64*)(p + sizeof(log_arg_t)) = (u64)v;
+		}
+
+		p += sizeof(log_arg_t) + 8;
+	}
+};
+
+template<typename T>
+struct log_pack_t<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+	static FINLINE u32 size(T v) {(void)v; return sizeof(log_arg_t) + 8;}
+	static FINLINE void pack(u8 *&p, T v) {
+		log_arg_t &a = *(log_arg_t*)p;
+		a.type = LOG_ARG_FLOAT;
+		a.size = 8;
+		*(double*)(p + sizeof(log_arg_t)) = (double)v;
+
+		p += sizeof(log_arg_t) + 8;
+	}
+};
+
+template<typename T>
+struct log_pack_t<T*, void> {
+	static FINLINE ubool str() {
+		return std::is_same<typename std::remove_cv<T>::type, char>::value;
+	}
+
+	static FINLINE u32 size(T *v) {
+		if (!str() || !v) return sizeof(log_arg_t) + 8;
+		return sizeof(log_arg_t) + (((u32)strlen((const char*)v) + 1 + 7) & ~7u);
+	}
+
+	static FINLINE void pack(u8 *&p, T *v) {
+		log_arg_t &a = *(log_arg_t*)p;
+
+		if (!str() || !v) {
+			a.type = LOG_ARG_PTR;
+			a.size = 8;
+			*(u64*)(p + sizeof(log_arg_t)) = (u64)(uptr)v;
+
+			p += sizeof(log_arg_t) + 8;
+			return;
+		}
+
+		const u32 len = (u32)strlen((const char*)v) + 1;
+		a.type = LOG_ARG_STR;
+		a.size = len;
+		memcpy(p + sizeof(log_arg_t), (const void*)v, len);
+
+		p += sizeof(log_arg_t) + ((len + 7) & ~7u);
+	}
+};
+
+FINLINE u32 log_packSize() {return 0;}
+template<typename T, typename... A>
+FINLINE u32 log_packSize(T v, A... args) {return log_pack_t<T>::size(v) + log_packSize(args...);}
+
+FINLINE void log_pack(u8 *&p) {(void)p;}
+template<typename T, typename... A>
+FINLINE void log_pack(u8 *&p, T v, A... args) {
+	log_pack_t<T>::pack(p, v);
+	log_pack(p, args...);
+}
+
+template<typename... A>
+void log_push(log_level_t level, const char *file, u32 line, const char *fmt, A... args) {
+	if (level > atomic_load(&log_level, ATOMIC_RELAXED)) return;
+
+	if (!atomic_load(&log_async, ATOMIC_ACQUIRE) || !log_ring()) {
+		if (level == LOG_LEVEL_WARNING) log_warning_manual(file, line, fmt, args...);
+		else log_note_manual(file, line, fmt, args...);
+		return;
+	}
+
+	const u32 size = sizeof(log_record_t) + log_packSize(args...);
+	u8 *p = log_reserve(size);
+	if (!p) return;
+
+	log_record_t &r = *(log_record_t*)p;
+	r.size = size;
+	r.level = level;
+	r.fmt = fmt;
+	r.file = file;
+	r.line = line;
+	r.argCount = sizeof...(args);
+
+	p += sizeof(log_record_t);
+	log_pack(p, args...);
+
+	log_commit(size);
+}
+
+// Log thread, defined by the platform layer
+// Logging is asynchronous while one exists, only one should exist at once
+// Everything left is written when it's destroyed
+class log_thread_t {
+private:
+	void *m_plat;
+
+public:
+	log_thread_t();
+	~log_thread_t();
+
+	log_thread_t(const log_thread_t &other) = delete;
+};
+
 // Log exception class, for throwing exceptions with descriptive explanations
 // Example usage: throw log_except("string", value1, value2, ...)
 class log_except_t {
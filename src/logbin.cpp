@@ -0,0 +1,93 @@
+#include "types.h"
+#include "logbin.h"
+#include "log.h"
+#include "util.h"
+
+logbin_t *logbin_cur = NULL;
+
+logbin_t::logbin_t(file_system_t &fileSys, countTimer_t &t, const char *path, uptr size) :
+  m_fileSys(fileSys), m_t(t), m_file(NULL), m_map(NULL), m_hdr(NULL), m_data(NULL)
+{
+  if (!path) return;
+
+  if (atomic_load(&logbin_cur)) throw log_except("A binary log is already recording!");
+  if (size <= sizeof(logbin_hdr_t)) throw log_except("Binary log size %u is too small!", (u32)size);
+
+  size &= ~(uptr)7;
+
+  // Empty the file first, unfinished records are told apart by their size being 0
+  file_handle_t *f = m_fileSys.open(path, FILE_MODE_WRITE);
+  if (!f) throw log_except("Cannot create binary log %s!", path);
+  f->close();
+
+  m_file = m_fileSys.open(path, FILE_MODE_READWRITE);
+  if (!m_file) throw log_except("Cannot open binary log %s!", path);
+
+  // Grow it to size by writing the last byte, the rest reads as zeros
+  const u8 zero = 0;
+  if (!m_file->seek(size-1, FILE_SEEK_SET) || (m_file->write(&zero, 1) != 1)) {
+    m_file->close();
+    throw log_except("Cannot grow binary log %s to %u bytes!", path, (u32)size);
+  }
+
+  m_map = m_file->map(FILE_MAP_READWRITE, 0, size);
+  if (!m_map) {
+    m_file->close();
+    throw log_except("Cannot map binary log %s!", path);
+  }
+
+  m_hdr = (logbin_hdr_t*)m_map->data;
+  m_data = (u8*)(m_hdr+1);
+
+  m_hdr->magic = LOGBIN_MAGIC;
+  m_hdr->version = LOGBIN_VERSION;
+  m_hdr->resolution = m_t.resolution();
+  m_hdr->start = m_t.time();
+  m_hdr->size = size - sizeof(logbin_hdr_t);
+  m_hdr->write = 0;
+  m_hdr->sites = 0;
+  m_hdr->dropped = 0;
+
+  atomic_store(&logbin_cur, this, ATOMIC_RELEASE);
+
+  log_note("Binary logging into %s, %u KiB", path, (u32)(size/1024));
+}
+
+logbin_t::~logbin_t() {
+  if (!m_file) return;
+
+  // Threads that log should be done by now
+  atomic_store(&logbin_cur, (logbin_t*)NULL, ATOMIC_RELEASE);
+
+  const u64 used = util_min(atomic_load(&m_hdr->write), m_hdr->size);
+  const u32 dropped = atomic_load(&m_hdr->dropped);
+
+  log_note("Binary log used %u of %u KiB, %u call sites", (u32)(used/1024), (u32)(m_hdr->size/1024),
+           atomic_load(&m_hdr->sites));
+  if (dropped) log_warning("Binary log was full, dropped %u records!", dropped);
+
+  m_map->unmap();
+  m_file->close();
+}
+
+u32 logbin_t::site(u32 &siteId, const char *file, u32 line, const char *fmt) {
+  const u32 id = atomic_add(&m_hdr->sites, 1u) + 1;
+
+  // The site record is written even if another thread wins, the decoder doesn't mind
+  const u32 size = sizeof(logbin_record_t) + log_packSize(line, file, fmt);
+  logbin_record_t *r = reserve(size);
+  if (r) {
+    r->site = id | LOGBIN_SITE;
+    r->time = 0;
+
+    u8 *p = (u8*)(r+1);
+    log_pack(p, line, file, fmt);
+
+    commit(*r, size);
+  }
+
+  u32 expected = 0;
+  if (!atomic_cas(&siteId, expected, id, ATOMIC_RELAXED)) return expected;
+
+  return id;
+}
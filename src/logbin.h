@@ -0,0 +1,131 @@
+// Binary log
+//
+// For messages logged too often to format, like per-tick stats. log_bin records
+// the time, a call site id and the packed arguments (the same packing as
+// asynchronous logging) into a memory mapped file, and nothing gets formatted
+// until logbin_decode turns the file back into text.
+//
+// Call sites are given ids the first time they log, and the id's file, line and
+// format are written into the file right then as a site record, so a file
+// from a run that crashed can still be decoded up to the last record written.
+// When nothing is recording log_bin is just a branch, once the file is full
+// records are dropped and counted.
+
+#ifndef LOGBIN_H
+#define LOGBIN_H
+
+#include "types.h"
+#include "log.h"
+#include "file.h"
+#include "countTimer.h"
+#include "atomic.h"
+
+static constexpr u32 LOGBIN_MAGIC = 0x4E49424C; // "LBIN"
+static constexpr u32 LOGBIN_VERSION = 1;
+
+// File size when -binlogsize isn't given, in mebibytes
+static constexpr u32 LOGBIN_DEFAULTSIZE = 16;
+
+// Set in logbin_record_t::site for site records
+static constexpr u32 LOGBIN_SITE = 0x80000000;
+
+// File header, records start right after it
+struct logbin_hdr_t {
+  u32 magic;
+  u32 version;
+
+  countTimer_counts_t resolution; // Counts per second
+  countTimer_counts_t start; // Record times are relative to this
+
+  u64 size; // Bytes for records after the header
+  u64 write; // Bytes reserved, can go past size when records are dropped, only accessed atomically
+
+  u32 sites; // Call sites given ids, only accessed atomically
+  u32 dropped; // Records that didn't fit, only accessed atomically
+};
+
+// Record header, followed by the packed arguments
+// Site records (site has LOGBIN_SITE set) have the line, file and format as arguments
+// size is written last, records with a size of 0 were never finished
+struct logbin_record_t {
+  u32 size; // Including the header and arguments, only accessed atomically
+  u32 site;
+
+  countTimer_counts_t time;
+};
+
+static_assert(!(sizeof(logbin_hdr_t) & 7) && !(sizeof(logbin_record_t) & 7), "Binary log records must keep 8-byte alignment!");
+
+class logbin_t {
+private:
+  file_system_t &m_fileSys;
+  countTimer_t &m_t;
+
+  // Recording file, NULL if we're not recording
+  file_handle_t *m_file;
+  file_mapping_t *m_map;
+
+  logbin_hdr_t *m_hdr;
+  u8 *m_data;
+
+public:
+  // Records into path if it isn't NULL, size is the file size in bytes
+  // Only one binary log can record at a time, and only once per run, since call site ids stay
+  logbin_t(file_system_t &fileSys, countTimer_t &t, const char *path, uptr size);
+  ~logbin_t();
+
+  logbin_t(const logbin_t &other) = delete;
+
+  FINLINE countTimer_counts_t time() {return m_t.time();}
+
+  // Reserve size bytes, returns NULL if the file is full
+  FINLINE logbin_record_t *reserve(u32 size) {
+    const u64 at = atomic_add(&m_hdr->write, (u64)size, ATOMIC_RELAXED);
+    if (at + size > m_hdr->size) {
+      atomic_add(&m_hdr->dropped, 1u, ATOMIC_RELAXED);
+      return NULL;
+    }
+
+    return (logbin_record_t*)(m_data + at);
+  }
+
+  FINLINE void commit(logbin_record_t &r, u32 size) {atomic_store(&r.size, size, ATOMIC_RELEASE);}
+
+  // Give a call site an id and write it's site record, returns the id
+  // siteId is set to the id, if two threads race the first one's id is kept
+  u32 site(u32 &siteId, const char *file, u32 line, const char *fmt);
+};
+
+// Recording binary log, NULL if there isn't one
+// Only accessed atomically
+extern logbin_t *logbin_cur;
+
+template<typename... A>
+FINLINE void logbin_push(u32 &site, const char *file, u32 line, const char *fmt, A... args) {
+  logbin_t *l = atomic_load(&logbin_cur, ATOMIC_ACQUIRE);
+  if (!l) return;
+
+  u32 id = atomic_load(&site, ATOMIC_RELAXED);
+  if (!id) id = l->site(site, file, line, fmt);
+
+  const u32 size = sizeof(logbin_record_t) + log_packSize(args...);
+  logbin_record_t *r = l->reserve(size);
+  if (!r) return;
+
+  r->site = id;
+  r->time = l->time();
+
+  u8 *p = (u8*)(r+1);
+  log_pack(p, args...);
+
+  l->commit(*r, size);
+}
+
+// Log to the binary log, the format has to be a string literal
+#define log_bin(...)                                                       \
+  do {                                                                     \
+    static u32 logbin_siteId = 0;                                          \
+    logbin_push(logbin_siteId, __FILE__, __LINE__, __VA_ARGS__);           \
+  } while (0)
+
+#endif //LOGBIN_H
@@ -0,0 +1,103 @@
+#include "types.h"
+#include "name.h"
+#include "atomic.h"
+#include "log.h"
+#include "util.h"
+
+#include <cstdio>
+#include <cstring>
+
+// Generated by gen/names, NAME_LITERALS ends with a NULL name
+#include "names.h"
+
+static_assert(NAME_SLOTS && !(NAME_SLOTS & (NAME_SLOTS-1)) && (NAME_SLOTS <= 65536),
+              "NAME_SLOTS must be a power of 2, at most 65536!");
+
+struct name_slot_t {
+  str_hash_t hash;
+  const char *name; // NULL if the slot is empty, only accessed atomically
+};
+
+static name_slot_t name_slots[NAME_SLOTS];
+
+static char name_pool[NAME_POOLSIZE];
+static u32 name_poolUsed = 0;
+
+// Find the slot of hash, or the empty slot it'd go in, NULL if the table is full
+static name_slot_t *findSlot(str_hash_t hash) {
+  const u32 i = str_hashProbe(hash, NAME_SLOTS, [hash](u32 slot) {
+    const name_slot_t &s = name_slots[slot];
+    return !atomic_load(&s.name, ATOMIC_ACQUIRE) || (s.hash == hash);
+  });
+
+  return (i < NAME_SLOTS) ? name_slots+i : NULL;
+}
+
+// Put the literals in before anything can look them up
+static struct name_literals_t {
+  name_literals_t() {
+    for (const name_lit_t *l = NAME_LITERALS; l->name; ++l) {
+      name_slot_t *s = findSlot(l->hash);
+      if (!s || atomic_load(&s->name, ATOMIC_RELAXED)) continue;
+
+      s->hash = l->hash;
+      atomic_store(&s->name, l->name, ATOMIC_RELEASE);
+    }
+  }
+} name_literals;
+
+// Copy a name that might not be terminated into buf, for messages
+static const char *termName(char (&buf)[64], const char *name, uptr len) {
+  len = util_min<uptr>(len, sizeof(buf)-1);
+  memcpy(buf, name, len);
+  buf[len] = 0;
+
+  return buf;
+}
+
+ubool name_add(str_hash_t hash, const char *name, uptr len) {
+  char buf[64];
+
+  name_slot_t *s = findSlot(hash);
+  if (!s) {
+    log_warning("Name table is full, cannot add %s! (increase NAME_SLOTS in name.h)", termName(buf, name, len));
+    return false;
+  }
+
+  // Already there, or another name has the hash
+  const char *cur = atomic_load(&s->name, ATOMIC_RELAXED);
+  if (cur) return !strncmp(cur, name, len) && !cur[len];
+
+  if (name_poolUsed + len+1 > NAME_POOLSIZE) {
+    log_warning("Name pool is full, cannot add %s! (increase NAME_POOLSIZE in name.h)", termName(buf, name, len));
+    return false;
+  }
+
+  char *copy = name_pool + name_poolUsed;
+  memcpy(copy, name, len);
+  copy[len] = 0;
+  name_poolUsed += len+1;
+
+  s->hash = hash;
+  atomic_store(&s->name, (const char*)copy, ATOMIC_RELEASE);
+
+  return true;
+}
+
+const char *name_get(str_hash_t hash) {
+  const name_slot_t *s = findSlot(hash);
+  return s ? atomic_load(&s->name, ATOMIC_ACQUIRE) : NULL;
+}
+
+const char *name_str(str_hash_t hash) {
+  const char *name = name_get(hash);
+  if (name) return name;
+
+  // A few buffers, so a message can have more than one unknown hash
+  static thread_local char bufs[4][12];
+  static thread_local u32 cur = 0;
+
+  char *buf = bufs[cur++ & 3];
+  snprintf(buf, sizeof(bufs[0]), "#%08x", hash);
+  return buf;
+}
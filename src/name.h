@@ -0,0 +1,42 @@
+// Name table
+//
+// Hashes are all that's kept of names at runtime, this maps them back to names for
+// warnings and traces. Every str_hash literal in the files gen/names.txt lists is in
+// it from the start (gen/names generates the list at build time), and paks add the
+// names of their entries as they're opened.
+//
+// Lookups are a masked index and a short probe, but they're only meant for
+// messages, nothing on a hot path should need a name.
+
+#ifndef NAME_H
+#define NAME_H
+
+#include "types.h"
+#include "str.h"
+
+// Slots in the table, a power of 2 at least twice as big as the names in it
+static constexpr u32 NAME_SLOTS = 2048;
+
+// Bytes for names added at runtime, null terminators included
+static constexpr u32 NAME_POOLSIZE = 16*1024;
+
+// Name of a literal, generated into names.h
+struct name_lit_t {
+  str_hash_t hash;
+  const char *name;
+};
+
+// Add a name, copying it
+// Returns false if the table or pool is full, or another name has the same hash
+// Names are only added from one thread at a time, lookups can come from any
+ubool name_add(str_hash_t hash, const char *name, uptr len);
+FINLINE ubool name_add(str_hash_t hash, const char *name) {return name_add(hash, name, strlen(name));}
+
+// Name of a hash, NULL if it isn't known
+const char *name_get(str_hash_t hash);
+
+// Name of a hash, or it's hash as hex if it isn't known
+// The hex string is only valid until a few more calls on this thread, log it right away
+const char *name_str(str_hash_t hash);
+
+#endif //NAME_H
@@ -1,7 +1,3 @@
-// TODO: Figure out what's going on with the audio and why
-//       it underrun's over and over if I don't add a delay in the actual buffer!
-//       Also add support for variable buffer sizes and frame sizes
-
 #define _XOPEN_SOURCE 500
 
 #include "types.h"
@@ -9,6 +5,7 @@
 #include "alsa.h"
 #include "log.h"
 #include "endianUtil.h"
+#include "str.h"
 
 #include <alsa/asoundlib.h>
 #include <pthread.h>
@@ -22,10 +19,10 @@
 #define SAMPLEFORMAT SND_PCM_FORMAT_S16_BE
 #endif
 
-// ALSA audio device
-// TODO: Should I make these configurable?
+// Default device configuration, about 35 ms of latency at 44100 Hz
 #define PCM_DEVICE "default"
-#define PCM_BUFSIZE 1024
+static constexpr u32 PCM_PERIOD = 512;
+static constexpr u32 PCM_PERIODS = 3;
 
 // ALSA initialization function
 // Returns NULL on failure
@@ -34,8 +31,7 @@ static snd_pcm_t *tInit(alsa_threadData_t &data) {
 #define alsaCheck(_ret, ...)											\
 	if ((err = (_ret)) < 0) {											\
 		data.err() = log_except(__VA_ARGS__, err, snd_strerror(err));	\
-		data.state = ALSA_THREAD_FAILED;								\
-		data.unlock();													\
+		data.setState(ALSA_THREAD_FAILED);								\
 																		\
 		snd_pcm_close(handle);											\
 																		\
@@ -45,8 +41,7 @@ static snd_pcm_t *tInit(alsa_threadData_t &data) {
 #define alsaCheckNoClose(_ret, ...)										\
 	if ((err = (_ret)) < 0) {											\
 		data.err() = log_except(__VA_ARGS__, err, snd_strerror(err));	\
-		data.state = ALSA_THREAD_FAILED;								\
-		data.unlock();													\
+		data.setState(ALSA_THREAD_FAILED);								\
 																		\
 		return NULL;													\
 	}
@@ -54,19 +49,20 @@ static snd_pcm_t *tInit(alsa_threadData_t &data) {
 #define condCheck(_cond, ...)					\
 	if (_cond) {								\
 		data.err() = log_except(__VA_ARGS__);	\
-		data.state = ALSA_THREAD_FAILED;		\
-		data.unlock();							\
+		data.setState(ALSA_THREAD_FAILED);		\
 												\
 		return NULL;							\
 	}
 	
 	snd_pcm_t *handle = NULL;
 	snd_pcm_hw_params_t *hw;
+	snd_pcm_sw_params_t *sw;
+	alsa_config_t &cfg = data.config;
 	int err;
 
 	// Initialize PCM device
-	alsaCheckNoClose(snd_pcm_open(&handle, PCM_DEVICE, SND_PCM_STREAM_PLAYBACK, 0),
-					 "Cannot open " PCM_DEVICE "! (%d, %s)\n");
+	alsaCheckNoClose(snd_pcm_open(&handle, cfg.device, SND_PCM_STREAM_PLAYBACK, 0),
+					 "Cannot open %s! (%d, %s)\n", cfg.device);
 
 	// Get default hardware configuration
 	snd_pcm_hw_params_alloca(&hw);
@@ -85,191 +81,284 @@ static snd_pcm_t *tInit(alsa_threadData_t &data) {
 	alsaCheck(snd_pcm_hw_params_set_format(handle, hw, SAMPLEFORMAT),
 			  "Cannot set sample format to 16-bit LE! (%d, %s)\n");
 
-	// Set buffer size
-	alsaCheck(snd_pcm_hw_params_set_buffer_size(handle,  hw, PCM_BUFSIZE),
-			  "Cannot set buffer size to %u frames! (%d, %s)\n", PCM_BUFSIZE);
-
 	// Set access mode
 	alsaCheck(snd_pcm_hw_params_set_access(handle, hw, SND_PCM_ACCESS_RW_INTERLEAVED),
 			  "Cannot set access mode to interleaved samples! (%d, %s)\n");
 
+	// Get as close to the requested period size and count as the device allows
+	snd_pcm_uframes_t period = cfg.period;
+	unsigned periods = cfg.periods;
+	int dir = 0;
+	alsaCheck(snd_pcm_hw_params_set_period_size_near(handle, hw, &period, &dir),
+			  "Cannot set period size near %u frames! (%d, %s)\n", cfg.period);
+
+	dir = 0;
+	alsaCheck(snd_pcm_hw_params_set_periods_near(handle, hw, &periods, &dir),
+			  "Cannot set period count near %u! (%d, %s)\n", cfg.periods);
+
 	// Apply hardware parameters
 	alsaCheck(snd_pcm_hw_params(handle, hw),
 			  "Cannot apply hardware configuration! (%d, %s)\n");
 
+	// Read back what was actually picked
+	snd_pcm_uframes_t bufSize;
+	dir = 0;
+	alsaCheck(snd_pcm_hw_params_get_period_size(hw, &period, &dir),
+			  "Cannot get period size! (%d, %s)\n");
+	alsaCheck(snd_pcm_hw_params_get_buffer_size(hw, &bufSize),
+			  "Cannot get buffer size! (%d, %s)\n");
+
+	if (period > ALSA_MAXPERIOD) {
+		data.err() = log_except("The device picked %u frame periods, the mixer can only do %u!", (u32)period, ALSA_MAXPERIOD);
+		data.setState(ALSA_THREAD_FAILED);
+
+		snd_pcm_close(handle);
+		return NULL;
+	}
+
+	cfg.period = (u32)period;
+	cfg.periods = periods;
+	cfg.bufSize = (u32)bufSize;
+
+	// Wake up once a period is free, and start once the buffer is full,
+	// unless asked otherwise
+	if (!cfg.availMin) cfg.availMin = cfg.period;
+	if (!cfg.start) cfg.start = cfg.bufSize;
+
+	snd_pcm_sw_params_alloca(&sw);
+	alsaCheck(snd_pcm_sw_params_current(handle, sw),
+			  "Cannot get software configuration! (%d, %s)\n");
+
+	alsaCheck(snd_pcm_sw_params_set_avail_min(handle, sw, cfg.availMin),
+			  "Cannot set minimum available frames to %u! (%d, %s)\n", cfg.availMin);
+
+	alsaCheck(snd_pcm_sw_params_set_start_threshold(handle, sw, cfg.start),
+			  "Cannot set start threshold to %u frames! (%d, %s)\n", cfg.start);
+
+	alsaCheck(snd_pcm_sw_params(handle, sw),
+			  "Cannot apply software configuration! (%d, %s)\n");
+
 	// PCM device successfully initialized
 	return handle;
 
 #undef condCheck
+#undef alsaCheckNoClose
 #undef alsaCheck
 }
 
+// Bump a counter only the audio thread writes
+static FINLINE void statAdd(u32 &stat) {
+	atomic_store(&stat, stat+1, ATOMIC_RELAXED);
+}
+
 // ALSA thread function
 static void *tFunc(void *ptr) {
 	alsa_threadData_t &data = *(alsa_threadData_t*)ptr;
 	int err;
 
-	// Free thread without required pthread_join
-	pthread_detach(data.tid);
-
 	// Initialize ALSA
-	data.lock();
 	snd_pcm_t *handle = tInit(data);
 
 	if (!handle) pthread_exit(NULL); // tInit handles all error reporting
 
+	snd_pcm_prepare(handle);
+
 	// Start sound loop
-	data.state = ALSA_THREAD_RUNNING;
+	// Nothing has to be written ahead, the device starts on it's own once
+	// the start threshold is queued
+	data.setState(ALSA_THREAD_RUNNING);
 
-	snd_pcm_prepare(handle);
-	
-	// Write dummy frames
-	if (((err = snd_pcm_writei(handle, data.buf, PCM_BUFSIZE)) < 0) ||
-		((err = snd_pcm_writei(handle, data.buf, PCM_BUFSIZE)) < 0))
-	{
-		data.err() = log_except("Error playing dummy samples! (%d, %s)\n", (int)err, snd_strerror(err));
-		data.state = ALSA_THREAD_FAILED;
-		data.unlock();
+	const u32 period = data.config.period;
+	alsa_stats_t &stats = data.stats;
 
-		snd_pcm_close(handle);
-		pthread_exit(NULL);
-	}
-	
-	data.unlock();
+	while (!atomic_load(&data.quit, ATOMIC_ACQUIRE)) {
+		// Apply every command sent since the last buffer
+		audio_cmd_t cmd;
+		while (data.cmds.pop(cmd)) data.mixer.apply(cmd);
 
-	snd_pcm_sframes_t frames;
-	for (;;) {
-		data.lock();
-		
-		if (data.quit) break;
+		data.mixer.mix(data.buf, period);
 
-		data.unlock();
-		
-		frames = snd_pcm_writei(handle, data.buf, PCM_BUFSIZE);
+		// Writes block until there's room, and can be cut short by a signal
+		const audio_frame_t *buf = data.buf;
+		snd_pcm_uframes_t left = period;
+		while (left) {
+			const snd_pcm_sframes_t frames = snd_pcm_writei(handle, buf, left);
 
-		if (frames == -EPIPE) {
-			log_note("Underrun!");
-			snd_pcm_prepare(handle);
-		} else if (frames < 0) {
-			// If an irrecoverable error occurred, fill transfer with error
-			snd_pcm_drain(handle);
+			if (frames >= 0) {
+				buf += frames;
+				left -= frames;
+				continue;
+			}
 
-			data.lock();
-			data.err() = log_except("Error playing samples! (%d, %s)\n", (int)frames, snd_strerror(frames));
-			data.state = ALSA_THREAD_FAILED;
+			// Underruns and suspends can be recovered from, the device is prepared again
+			if (frames == -EPIPE) statAdd(stats.underruns);
 
-			data.unlock();
+			if ((err = snd_pcm_recover(handle, (int)frames, 1)) < 0) {
+				// If an irrecoverable error occurred, fill transfer with error
+				snd_pcm_drain(handle);
 
-			snd_pcm_close(handle);
-			pthread_exit(NULL);
+				data.err() = log_except("Error playing samples! (%d, %s)\n", err, snd_strerror(err));
+				data.setState(ALSA_THREAD_FAILED);
+
+				snd_pcm_close(handle);
+				pthread_exit(NULL);
+			}
+
+			if ((frames == -EPIPE) || (frames == -ESTRPIPE)) statAdd(stats.recovered);
+		}
+
+		// How far behind the mix the speakers are
+		snd_pcm_sframes_t delay;
+		if ((snd_pcm_delay(handle, &delay) >= 0) && (delay >= 0)) {
+			atomic_store(&stats.delay, (u32)delay, ATOMIC_RELAXED);
+			if ((u32)delay > stats.maxDelay) atomic_store(&stats.maxDelay, (u32)delay, ATOMIC_RELAXED);
 		}
 	}
 
-	// Shut down
+	// Shut down, data isn't touched after the state is set since it's freed right away
 	snd_pcm_drain(handle);
-
-	data.signalDestruct();
-
 	snd_pcm_close(handle);
 
+	data.setState(ALSA_THREAD_SUCCESS);
+
 	pthread_exit(NULL);
 }
 
+// Wait for the audio thread to leave a state
+static alsa_threadState_t waitForState(const alsa_threadData_t &data, alsa_threadState_t s) {
+	alsa_threadState_t ret;
+	while ((ret = data.getState()) == s) usleep(1000);
+
+	return ret;
+}
+
+// Numeric argument, def if it's not there or not a number
+static u32 argNum(const args_t &args, str_hash_t arg, u32 def) {
+	const char *val = args.val(arg);
+	return val ? str_strnum_def<u32>(val, def) : def;
+}
+
 // ALSA audio backend constructor, create thread
 alsa_audio_t::alsa_audio_t(audio_init_t &init) :
 	m_m(init.i.mem), m_g(init.g)
 {
 	// Initialize data
-	m_data.sampleRate = init.sampleRate;
-
-	m_data.buf = (audio_frame_t*)m_m.alloc(PCM_BUFSIZE*sizeof(audio_frame_t));
-
-	memset(m_data.buf, 0, PCM_BUFSIZE*sizeof(audio_frame_t));
+	m_data = (alsa_threadData_t*)m_m.alloc(sizeof(alsa_threadData_t));
+	if (!m_data) throw log_except("Cannot allocate audio thread data!");
+
+	try {
+		(void)new(m_data) alsa_threadData_t(m_m);
+	} catch (...) {
+		m_m.free(m_data);
+		throw;
+	}
 
-	// Create mutex
-	int ret = pthread_mutex_init(&m_data.m, NULL);
-	if (ret)
-		throw log_except("Cannot initialize mutex! (%d, %s)", ret, strerror(ret));
+	m_data->sampleRate = init.sampleRate;
+
+	// Requested configuration, the audio thread negotiates the rest
+	const args_t &args = init.i.args;
+	alsa_config_t &cfg = m_data->config;
+	cfg.device = args.valDef(str_hash("-alsadevice"), PCM_DEVICE);
+	cfg.period = util_min(argNum(args, str_hash("-alsaperiod"), PCM_PERIOD), ALSA_MAXPERIOD);
+	cfg.periods = argNum(args, str_hash("-alsaperiods"), PCM_PERIODS);
+	cfg.bufSize = 0;
+	cfg.availMin = argNum(args, str_hash("-alsaavailmin"), 0);
+	cfg.start = argNum(args, str_hash("-alsastart"), 0);
+
+	memset((void*)&m_data->stats, 0, sizeof(m_data->stats));
+
+	m_data->buf = (audio_frame_t*)m_m.alloc(ALSA_MAXPERIOD*sizeof(audio_frame_t));
+	if (!m_data->buf) {
+		m_data->~alsa_threadData_t();
+		m_m.free(m_data);
+		throw log_except("Cannot allocate audio buffer!");
+	}
 
-	// Lock the mutex
-	pthread_mutex_lock(&m_data.m);
+	memset(m_data->buf, 0, ALSA_MAXPERIOD*sizeof(audio_frame_t));
 
-	// Create destruct condition
-	ret = pthread_cond_init(&m_data.destruct, NULL);
-	if (ret)
-		throw log_except("Cannot initialize destruction condition! (%d, %s)", ret, strerror(ret));
-	
-	m_data.state = ALSA_THREAD_INACTIVE;
-	m_data.quit = false;
+	m_data->state = ALSA_THREAD_INACTIVE;
+	m_data->quit = false;
 	
 	// Create audio handling thread
-	ret = pthread_create(&m_data.tid, NULL, tFunc, (void*)&m_data);
+	pthread_t tid;
+	int ret = pthread_create(&tid, NULL, tFunc, (void*)m_data);
 	if (ret) {
-		pthread_cond_destroy(&m_data.destruct);
-		pthread_mutex_unlock(&m_data.m);
-		pthread_mutex_destroy(&m_data.m);
+		m_m.free(m_data->buf);
+		m_data->~alsa_threadData_t();
+		m_m.free(m_data);
 		
 		throw log_except("Cannot create audio thread! (%d, %s)", ret, strerror(ret));
 	}
 
-	// Wait for thread to finish initialization
-	m_data.unlock();
-	usleep(1); // Give audio thread time to claim mutex
-	m_data.lock();
+	// Free thread without required pthread_join
+	pthread_detach(tid);
 
+	// Wait for thread to finish initialization
 	// If audio thread failed to initialize, error out
-	if (m_data.state == ALSA_THREAD_FAILED) {
-		// Don't destroy while locked
-		pthread_cond_destroy(&m_data.destruct);
-		pthread_mutex_unlock(&m_data.m);
-		pthread_mutex_destroy(&m_data.m);
+	if (waitForState(*m_data, ALSA_THREAD_INACTIVE) == ALSA_THREAD_FAILED) {
+		const log_except_t err = m_data->err();
 
 		// Free audio buffers
-		m_m.free(m_data.buf);
+		m_m.free(m_data->buf);
+		m_data->~alsa_threadData_t();
+		m_m.free(m_data);
 		
-		throw m_data.err();
+		throw err;
 	}
 
-	// Thread initialization completed successfully
-	m_data.unlock();
+	log_note("Opened %s with %u periods of %u frames, %u frames buffered (%.1f ms), waking at %u, starting at %u",
+			 cfg.device, cfg.periods, cfg.period, cfg.bufSize, cfg.bufSize*1000.0/m_data->sampleRate,
+			 cfg.availMin, cfg.start);
 }
 
 alsa_audio_t::~alsa_audio_t() {
-	m_data.lock();
-	
 	// Shut down audio thread, if it's currently running
-	if (m_data.state == ALSA_THREAD_RUNNING) {
-		m_data.quit = true;
+	const alsa_threadState_t state = m_data->getState();
+
+	if (state == ALSA_THREAD_RUNNING) {
+		atomic_store(&m_data->quit, (ubool)true, ATOMIC_RELEASE);
 
 		// Wait for audio thread to shut down
-		m_data.waitForDestruct();
-	} else if (m_data.state == ALSA_THREAD_FAILED) {
+		if (waitForState(*m_data, ALSA_THREAD_RUNNING) == ALSA_THREAD_FAILED)
+			log_warning("%s", m_data->err().str());
+	} else if (state == ALSA_THREAD_FAILED) {
 		// An error occurred, report it
-		log_warning(m_data.err().str());
+		log_warning("%s", m_data->err().str());
 	}
 
-	// Free audio buffer
-	m_m.free(m_data.buf);
+	const alsa_stats_t s = stats();
+	log_note("ALSA had %u underruns, recovered from %u, %u frames queued at most (%.1f ms)",
+			 s.underruns, s.recovered, s.maxDelay, s.maxDelay*1000.0/m_data->sampleRate);
 
-	// Free the mutex
-	pthread_cond_destroy(&m_data.destruct);
-	pthread_mutex_unlock(&m_data.m);
-	pthread_mutex_destroy(&m_data.m);
+	// Free audio buffer
+	m_m.free(m_data->buf);
+	m_data->~alsa_threadData_t();
+	m_m.free(m_data);
 }
 
 ubool alsa_audio_t::update() {
-	m_data.lock();
-
 	// If an error occurred, return false
 	// The destructor will free the resources when the time comes
-	if (m_data.state == ALSA_THREAD_FAILED) {
-		m_data.unlock();
-		
-		log_warning(m_data.err().str());
+	if (m_data->getState() == ALSA_THREAD_FAILED) {
+		log_warning("%s", m_data->err().str());
 		return false;
 	}
 
-	m_data.unlock();
-	
 	return true;
 }
+
+ubool alsa_audio_t::send(const audio_cmd_t &cmd) {
+	return m_data->cmds.push(cmd);
+}
+
+alsa_stats_t alsa_audio_t::stats() const {
+	const alsa_stats_t &s = m_data->stats;
+
+	alsa_stats_t ret;
+	ret.underruns = atomic_load(&s.underruns, ATOMIC_RELAXED);
+	ret.recovered = atomic_load(&s.recovered, ATOMIC_RELAXED);
+	ret.delay = atomic_load(&s.delay, ATOMIC_RELAXED);
+	ret.maxDelay = atomic_load(&s.maxDelay, ATOMIC_RELAXED);
+
+	return ret;
+}
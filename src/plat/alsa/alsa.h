@@ -7,12 +7,15 @@
 #include "module.h"
 #include "mem.h"
 #include "rng.h"
+#include "spsc.h"
+#include "mixer.h"
+#include "atomic.h"
 
 #include <alsa/asoundlib.h>
 #include <pthread.h>
 
 // Audio thread state
-enum alsa_threadState_t : ufast {
+enum alsa_threadState_t : u32 {
 	ALSA_THREAD_INACTIVE = 0, // The thread hasn't started yet
 	ALSA_THREAD_RUNNING,      // The thread is currently running
 	ALSA_THREAD_FAILED,       // An irrecoverable error has occurred in the thread
@@ -20,17 +23,48 @@ enum alsa_threadState_t : ufast {
 	ALSA_THREAD_SUCCESS       // The thread has shut down successfully
 };
 
-struct alsa_soundState_t {
-	u32 unused;
+// Number of commands that can be waiting for the audio thread
+static constexpr u32 ALSA_CMDCOUNT = 256;
+
+// Most frames in a period, a period is mixed at once
+static constexpr u32 ALSA_MAXPERIOD = MIXER_STREAMFRAMES;
+
+// Device configuration, set from the arguments, then negotiated by the audio thread
+// Only read by the main thread once the audio thread is running
+//   -alsadevice=<name>: PCM device to open, "default" by default
+//   -alsaperiod=<frames>: Frames per period
+//   -alsaperiods=<count>: Periods in the device buffer
+//   -alsaavailmin=<frames>: Free frames before a write wakes up, a period by default
+//   -alsastart=<frames>: Frames queued before the device starts, the whole buffer by default
+// Smaller and fewer periods have less latency, but underrun more easily
+struct alsa_config_t {
+	const char *device;
+
+	u32 period, periods;
+	u32 bufSize; // Only negotiated, period*periods if the device doesn't round it
+
+	u32 availMin, start; // 0 for the defaults
+};
+
+// Counters the audio thread keeps, so latency can be tuned against underruns
+// Each is written atomically, so they can be read while the thread runs
+struct alsa_stats_t {
+	u32 underruns; // Times the device ran out of frames
+	u32 recovered; // Underruns and suspends the device was recovered from
+	u32 delay; // Frames queued in the device after the last write
+	u32 maxDelay; // Most frames ever queued after a write
 };
 
 // Data used by the audio thread
+// Nothing here is locked, the audio thread never waits on the main thread
 struct alsa_threadData_t {
-	// Sound state, filled out by main thread
-	// You msut own the mutex to read/write this variable
-	volatile alsa_soundState_t snd;
-	
-	// The audio buffer, filled with sound state and written to pcm
+	// Commands from the main thread, applied by the audio thread before each buffer
+	spsc_queue_t<audio_cmd_t, ALSA_CMDCOUNT> cmds;
+
+	// Mixes the voices into buf, only touched by the audio thread
+	mixer_t mixer;
+
+	// The audio buffer, filled by the mixer and written to pcm
 	// by audio thread
 	// This buffer is initialized and freed by the main thread,
 	// but during runtime the audio thread has complete ownership over it
@@ -40,37 +74,28 @@ struct alsa_threadData_t {
 	// Constant value from initialization
 	uptr sampleRate;
 
-	// Data mutex
-	pthread_mutex_t m;
-
-	// Destruction condition
-	pthread_cond_t destruct;
+	// Requested by the main thread, the audio thread writes the negotiated values back
+	// before it starts running
+	alsa_config_t config;
 
-	// Audio thread ID
-	// Constant value from initialization
-	pthread_t tid;
+	alsa_stats_t stats;
 
-	// Thread state
-	// You must own the mutex to read/write this variable
-	volatile alsa_threadState_t state;
+	// Thread state, one of alsa_threadState_t
+	// Only set by the audio thread, err() is written before it's set to ALSA_THREAD_FAILED
+	u32 state;
 
 	// Set by main thread to close audio thread
-	// You must own the mutex to read/write this variable
-	volatile ubool quit;
+	ubool quit;
+
+	FINLINE alsa_threadData_t(mem_t &m) : mixer(m, ALSA_MAXPERIOD) {}
 
 	FINLINE log_except_t &err() {return *(log_except_t*)buf;}
 	FINLINE const log_except_t &err() const {return *(log_except_t*)buf;}
 
-	// Lock and unlock mutex for read/write access to some areas of struct
-	FINLINE void lock() {pthread_mutex_lock(&m);}
-	FINLINE void unlock() {pthread_mutex_unlock(&m);}
-
-	// Waiting on destruction condition
-	FINLINE void waitForDestruct() {pthread_cond_wait(&destruct, &m);}
-	FINLINE void signalDestruct() {
-		pthread_mutex_unlock(&m);
-		pthread_cond_signal(&destruct);
+	FINLINE alsa_threadState_t getState() const {
+		return (alsa_threadState_t)atomic_load(&state, ATOMIC_ACQUIRE);
 	}
+	FINLINE void setState(alsa_threadState_t s) {atomic_store(&state, (u32)s, ATOMIC_RELEASE);}
 };
 
 // Derived module class for ALSA API
@@ -80,7 +105,7 @@ private:
 	f32 m_ind = 0.f;
 
 	mem_t &m_m; // Memory interface
-	alsa_threadData_t m_data; // Thread data
+	alsa_threadData_t *m_data; // Thread data, too big for the module
 	const game_state_t &m_g; // Game state
 
 public:
@@ -88,6 +113,13 @@ public:
 	~alsa_audio_t();
 
 	ubool update();
+	ubool send(const audio_cmd_t &cmd);
+
+	// Counters of the audio thread so far
+	alsa_stats_t stats() const;
+
+	// Negotiated device configuration
+	FINLINE const alsa_config_t &config() const {return m_data->config;}
 };
 
 #endif //ALSA_H
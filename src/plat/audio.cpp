@@ -10,7 +10,8 @@
 #include "alsa.h"
 #endif
 
-// Dummy module backend is always included
+// Sink and dummy module backends are always included
+#include "sink_audio.h"
 #include "dummy_audio.h"
 
 // Backend construction functions
@@ -35,6 +36,38 @@ static ubool alsaConstruct(audio_base_t *out, audio_init_t &args) {
 
 #endif
 
+// The sinks only construct when they're asked for, so they aren't fallen back on
+static ubool wavConstruct(audio_base_t *out, audio_init_t &args) {
+	const char *wav = args.i.args.val(str_hash("-wav"));
+	if (!wav) return false;
+
+	log_note("Constructing audio module with WAV sink backend");
+
+	try {
+		(void)new(out) sink_audio_t(args, wav);
+		return true;
+	} catch (const log_except_t &err) {
+		log_warning("Cannot initialize audio module with WAV sink backend: %s", err.str());
+		return false;
+	}
+}
+
+static ubool nullConstruct(audio_base_t *out, audio_init_t &args) {
+	if (!args.i.args.check(str_hash("-nullaudio"))) return false;
+
+	log_note("Constructing audio module with null sink backend");
+
+	try {
+		(void)new(out) sink_audio_t(args, NULL);
+		return true;
+	} catch (const log_except_t &err) {
+		log_warning("Cannot initialize audio module with null sink backend: %s", err.str());
+		return false;
+	}
+}
+
+#define SINK_CONSTRUCT wavConstruct, nullConstruct,
+
 static ubool dummyConstruct(audio_base_t *out, audio_init_t &args) {
 	log_note("Constructing audio module with dummy backend");
 	
@@ -48,5 +81,6 @@ static ubool dummyConstruct(audio_base_t *out, audio_init_t &args) {
 const module_constructProc_t<audio_base_t, audio_init_t> audio_construct[AUDIO_COUNT] = {
 	// WARNING: This list is dependent on the order of audio_type_t in audio.h!
 	ALSA_CONSTRUCT
+	SINK_CONSTRUCT
 	DUMMY_CONSTRUCT
 };
@@ -7,6 +7,7 @@
 #include "endianUtil.h"
 #include "str.h"
 #include "game/state.h"
+#include "game/sound.h"
 #include "interfaces.h"
 #include "log.h"
 
@@ -15,10 +16,12 @@ enum audio_type_t {
 	// WARNING: The order of elements in this enum effect the audio_construct array,
 	//          if the order of this enum is changed, change the order of that array as well!
 	
-	// Dummy is always present
+	// Sinks and dummy are always present
 #ifdef PLAT_B_ALSA
 	AUDIO_ALSA,
 #endif
+	AUDIO_WAV,  // Sink writing to -wav=<file.wav>
+	AUDIO_NULL, // Sink that throws the mix away, with -nullaudio
 	AUDIO_DUMMY,
 
 	AUDIO_COUNT
@@ -29,6 +32,38 @@ struct audio_frame_t {
 	i16 left, right;
 };
 
+// Maximum number of voices playing at once
+static constexpr u32 AUDIO_MAXVOICES = 32;
+
+// Sound command types
+enum audio_cmdType_t : u32 {
+	AUDIO_CMD_PLAY = 0, // Start playing frames on a voice, replacing what it was playing
+	AUDIO_CMD_STOP,     // Stop a voice
+	AUDIO_CMD_VOLUME,   // Change the gain and pan of a voice
+	AUDIO_CMD_STREAM    // Start streaming a sound on a voice, replacing what it was playing
+};
+
+// Command sent from the game thread to the audio thread
+struct audio_cmd_t {
+	audio_cmdType_t type;
+	u32 voice; // Below AUDIO_MAXVOICES
+
+	// Only used by AUDIO_CMD_PLAY
+	// The frames have to stay valid until the voice is stopped or finishes
+	const audio_frame_t *frames;
+	uptr frameCount;
+	ubool loop;
+
+	// Used by AUDIO_CMD_PLAY, AUDIO_CMD_STREAM and AUDIO_CMD_VOLUME
+	f32 gain; // 1 is full volume
+	f32 pan; // -1 is left, 0 is center, 1 is right
+
+	// Only used by AUDIO_CMD_STREAM, loop is used as well
+	// The sound is decoded straight from it's pak mapping, which has to stay mapped
+	// until the voice is stopped or finishes
+	const sound_t *sound;
+};
+
 typedef ubool (*audio_writeCallback_t)(audio_frame_t */*frames*/, uptr /*frameCount*/, void */*data*/);
 
 // Initializer struct for audio backends
@@ -54,6 +89,32 @@ public:
 	// Update sound system
 	// Returns false if an error occurred
 	virtual ubool update() = 0;
+
+	// Send a command to the audio thread, it's applied before the next buffer is mixed
+	// Never blocks, returns false if the command queue is full
+	virtual ubool send(const audio_cmd_t &cmd) = 0;
+
+	FINLINE ubool play(u32 voice, const audio_frame_t *frames, uptr frameCount,
+	                   f32 gain = 1.f, f32 pan = 0.f, ubool loop = false)
+	{
+		audio_cmd_t cmd = {AUDIO_CMD_PLAY, voice, frames, frameCount, loop, gain, pan, NULL};
+		return send(cmd);
+	}
+
+	FINLINE ubool stop(u32 voice) {
+		audio_cmd_t cmd = {AUDIO_CMD_STOP, voice, NULL, 0, false, 0.f, 0.f, NULL};
+		return send(cmd);
+	}
+
+	FINLINE ubool volume(u32 voice, f32 gain, f32 pan) {
+		audio_cmd_t cmd = {AUDIO_CMD_VOLUME, voice, NULL, 0, false, gain, pan, NULL};
+		return send(cmd);
+	}
+
+	FINLINE ubool stream(u32 voice, const sound_t *sound, f32 gain = 1.f, f32 pan = 0.f, ubool loop = false) {
+		audio_cmd_t cmd = {AUDIO_CMD_STREAM, voice, NULL, 0, loop, gain, pan, sound};
+		return send(cmd);
+	}
 };
 
 // Audio module backend construction table
@@ -13,6 +13,7 @@ public:
 	~dummy_audio_t() {}
 
 	ubool update() {return true;}
+	ubool send(const audio_cmd_t &cmd) {(void)cmd; return true;}
 };
 
 #endif //DUMMY_AUDIO_H
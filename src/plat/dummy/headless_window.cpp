@@ -0,0 +1,120 @@
+#include "types.h"
+#include "headless_window.h"
+#include "game/synth.h"
+#include "soft_render.h"
+#include "rate.h"
+#include "str.h"
+
+#include <cstring>
+
+headless_window_t::headless_window_t(modules_t &m, interfaces_t &i) : m_m(m), m_i(i) {
+	if (!m_i.args.check(str_hash("-headless")))
+		throw log_except("The headless window is only used with -headless!");
+
+	m_tickCount = str_strnum_def<u64>(m_i.args.valDef(str_hash("-ticks"), "0"), 0);
+	m_fast = m_i.args.check(str_hash("-fast"));
+	m_seed = str_strnum_def<u64>(m_i.args.valDef(str_hash("-seed"), "1"), 1);
+
+	// Replays bring their own input
+	m_synth = !m_i.args.check(str_hash("-replay"));
+
+	m_dump = m_i.args.val(str_hash("-dump"));
+	m_soft = m_dump || m_i.args.check(str_hash("-soft"));
+
+	log_note("Running headless, %s", m_fast ? "as fast as possible" : "at the tick rate");
+}
+
+window_loop_ret_t headless_window_t::loop(game_t &game) {
+	game.wstate().width = HEADLESS_WIDTH;
+	game.wstate().height = HEADLESS_HEIGHT;
+
+	game_synth_t synth(m_seed);
+	rate_t tickRate(m_i.timer, GAME_TICKRATE);
+
+	// Software renderer, and the snapshot it draws
+	soft_render_t *render = NULL;
+	game_state_snapshot_t *snap = NULL;
+
+	if (m_soft) {
+		void *p = m_i.mem.alloc(sizeof(soft_render_t));
+		snap = (game_state_snapshot_t*)m_i.mem.alloc(sizeof(game_state_snapshot_t));
+		if (!p || !snap) {
+			if (p) m_i.mem.free(p);
+			if (snap) m_i.mem.free(snap);
+			throw log_except("Cannot allocate software renderer!");
+		}
+
+		memset((void*)snap, 0, sizeof(game_state_snapshot_t));
+
+		try {
+			render = new (p) soft_render_t(m_i.mem, m_i.jobs, game.state(), HEADLESS_WIDTH, HEADLESS_HEIGHT);
+		} catch (...) {
+			m_i.mem.free(snap);
+			m_i.mem.free(p);
+			throw;
+		}
+	}
+
+	window_loop_ret_t ret = WINDOW_LOOP_SUCCESS;
+	const countTimer_counts_t start = m_i.timer.time();
+	countTimer_counts_t renderTime = 0;
+	u64 tick = 0;
+
+	while (!m_tickCount || (tick < m_tickCount)) {
+		if (!m_fast && !tickRate.ready()) {
+			m_i.timer.sleep(tickRate.remaining());
+			continue;
+		}
+
+		if (m_synth) synth.next(m_i.input, HEADLESS_WIDTH, HEADLESS_HEIGHT);
+
+		const game_update_ret_t update = game.update();
+		m_i.input.k.update();
+		++tick;
+
+		if (update == GAME_UPDATE_RESET) ret = WINDOW_LOOP_RESET;
+		else if (update == GAME_UPDATE_FAILED) ret = WINDOW_LOOP_FAILED;
+		if (update != GAME_UPDATE_CONTINUE) break;
+
+		if (!m_m.audio->update()) {
+			ret = WINDOW_LOOP_FAILED;
+			break;
+		}
+
+		if (render) {
+			const countTimer_counts_t renderStart = m_i.timer.time();
+
+			game.releaseSnapshot(*snap);
+			game.snapshot(*snap, 1.f);
+
+			if (!render->render(*snap)) {
+				ret = WINDOW_LOOP_FAILED;
+				break;
+			}
+
+			renderTime += m_i.timer.time()-renderStart;
+		}
+	}
+
+	const f64 secs = (f64)(m_i.timer.time()-start)/(f64)m_i.timer.resolution();
+	log_note("Ran %llu ticks in %.3f seconds, %.1f ticks/s",
+	         (unsigned long long)tick, (double)secs, secs > 0 ? (double)(tick/secs) : 0.0);
+
+	if (render) {
+		log_note("Rendered %llu frames, %.3f ms per frame", (unsigned long long)tick,
+		         tick ? (double)renderTime*1000.0/(double)m_i.timer.resolution()/(double)tick : 0.0);
+
+		if (m_dump) {
+			if (render->dump(m_i.fileSys, m_dump)) log_note("Wrote last frame to %s", m_dump);
+			else log_warning("Cannot write last frame to %s!", m_dump);
+		}
+
+		render->~soft_render_t();
+		m_i.mem.free(render);
+
+		game.releaseSnapshot(*snap);
+		m_i.mem.free(snap);
+	}
+
+	return ret;
+}
@@ -0,0 +1,40 @@
+#ifndef HEADLESS_WINDOW_H
+#define HEADLESS_WINDOW_H
+
+// Headless window backend
+// Runs the game loop without a display, with synthetic input or a replay,
+// for running the game on machines without a GPU
+// With -soft or -dump=<file.bmp> every tick is drawn by the software renderer,
+// and the last frame is dumped
+
+#include "types.h"
+#include "window.h"
+#include "modules.h"
+#include "interfaces.h"
+#include "game/game.h"
+
+// Window size the game sees
+static constexpr u32 HEADLESS_WIDTH = 1280;
+static constexpr u32 HEADLESS_HEIGHT = 720;
+
+class headless_window_t : public window_base_t {
+private:
+	modules_t &m_m;
+	interfaces_t &m_i;
+
+	u64 m_tickCount; // Ticks to run, 0 to run until the game closes
+	ubool m_fast; // Tick as fast as possible, instead of at GAME_TICKRATE
+	u64 m_seed; // Synthetic input seed
+	ubool m_synth; // False when replaying recorded input
+	ubool m_soft; // Render every tick with soft_render_t
+	const char *m_dump; // BMP the last frame is written to, NULL to not write one
+
+public:
+	// Only constructs if -headless was passed, so it isn't fallen back on
+	headless_window_t(modules_t &m, interfaces_t &i);
+	~headless_window_t() {}
+
+	window_loop_ret_t loop(game_t &game);
+};
+
+#endif //HEADLESS_WINDOW_H
@@ -65,6 +65,10 @@ public:
 	// Returns -1 on error
 	iptr write(const void *in, uptr bytes);
 
+	// Wait for everything written so far to be on the disk
+	// Return false on error
+	ubool sync();
+
 	// Set cursor position in file
 	ubool seek(uptr offset, file_seek_t orig);
 
@@ -96,6 +100,12 @@ public:
 
 	// Check if directory exists
 	ubool dirExists(const char *dirname);
+
+	// Rename file, replacing the destination if it exists
+	// The destination is either the old file or the new one, even after a crash,
+	// and the rename is on the disk when this returns
+	// Return false on error
+	ubool rename(const char *from, const char *to);
 };
 
 #endif //FILE_H
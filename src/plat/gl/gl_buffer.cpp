@@ -1,32 +1,133 @@
 #include "types.h"
+#include "util.h"
 #include "gl_buffer.h"
+#include "gl_mesh.h"
 #include "gl_texture.h"
 #include "gl_glf.h"
 #include "opengl.h"
 #include "game/map.h"
+#include "game/state.h"
+#include "prof.h"
 
-gl_buffers_t::gl_buffers_t(mem_t &m, uptr vertCount, uptr indCount) : m_m(m) {
-  // Buffer sizes, used when orphaning buffers
-  m_vertSize = vertCount*sizeof(gl_vertex_t);
-  m_indSize = indCount*sizeof(u16);
+#include <cstring>
 
-  // Create VAO
-  GLF(GL::GenVertexArrays(1, &m_vao));
-  GLF(GL::BindVertexArray(m_vao));
+// Timeout for each wait on a region fence, in nanoseconds
+static constexpr GLuint64 GLBUFFER_FENCE_TIMEOUT = 1000000000ull;
 
-  // Create VBO
-  GLF(GL::GenBuffers(1, &m_vbo));
-  GLF(GL::BindBuffer(GL::ARRAY_BUFFER, m_vbo));
+// Where a cube of a chunk that's being rebuilt goes
+struct gl_buffers_cube_t {
+  const map_cube_t *cube;
+  uptr firstFace; // Prefix sum of face counts, over every rebuilt cube
+  uptr chunkVert; // First vertex of the cube's chunk, indices are from there
+};
 
-  // Create EBO
-  GLF(GL::GenBuffers(1, &m_ebo));
-  GLF(GL::BindBuffer(GL::ELEMENT_ARRAY_BUFFER, m_ebo));
+gl_buffers_t::gl_buffers_t(mem_t &m, uptr vertCount, uptr indCount) :
+  m_m(m), m_chunkCount(0),
+  m_verts(NULL), m_inds(NULL), m_curVert(0), m_curInd(0),
+  m_vertCount(vertCount), m_indCount(indCount), m_region(0), m_fences{}, m_ringMap(NULL)
+{
+  // Allocate the uniform block, chunks, chunk build vertices and indices,
+  // and the chunk build scratch in one buffer
+  const uptr chunksSize = MAP_MAXCHUNKS*sizeof(gl_chunk_t);
+  const uptr orderSize = GAME_SNAPSHOT_MAXCUBES*sizeof(gl_buffers_cube_t);
+  const uptr vertsSize = vertCount*sizeof(gl_vertex_t);
+
+  u8 *memory = (u8*)m_m.alloc(sizeof(gl_buffer_block_t) + chunksSize + orderSize +
+                              vertsSize + indCount*sizeof(u16) + GAME_SNAPSHOT_MAXCUBES);
+  if (!memory) throw log_except("Cannot allocate vertex buffers!");
+
+  m_block = (gl_buffer_block_t*)memory;
+  m_chunks = (gl_chunk_t*)(memory+sizeof(gl_buffer_block_t));
+  m_order = (gl_buffers_cube_t*)(memory+sizeof(gl_buffer_block_t)+chunksSize);
+  m_buildVerts = (gl_vertex_t*)(memory+sizeof(gl_buffer_block_t)+chunksSize+orderSize);
+  m_buildInds = (u16*)(memory+sizeof(gl_buffer_block_t)+chunksSize+orderSize+vertsSize);
+  m_cubeChunk = memory+sizeof(gl_buffer_block_t)+chunksSize+orderSize+vertsSize+indCount*sizeof(u16);
+
+  // Uniform block ranges have to be aligned, and vertices have to start on a whole vertex
+  // from the start of the ring for DrawElementsBaseVertex, so regions are aligned to both
+  GLint uboAlign = 0;
+  GLF(GL::GetIntegerv(GL::UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uboAlign));
+
+  uptr align = util_max<uptr>(uboAlign, 1);
+  while (align%sizeof(gl_vertex_t)) align += util_max<uptr>(uboAlign, 1);
+
+  m_vertOffset = util_alignUp<uptr>(sizeof(gl_buffer_block_t), sizeof(gl_vertex_t));
+  m_indOffset = m_vertOffset + vertCount*sizeof(gl_vertex_t);
+  m_regionSize = util_alignUp<uptr>(m_indOffset + indCount*sizeof(u16), align);
+
+  // Create chunk VAOs and buffers, they're empty until a chunk is built
+  for (uptr i = 0; i < MAP_MAXCHUNKS; ++i) {
+    gl_chunk_t &chunk = m_chunks[i];
+
+    GLF(GL::GenVertexArrays(1, &chunk.vao));
+    GLF(GL::BindVertexArray(chunk.vao));
+
+    GLF(GL::GenBuffers(1, &chunk.vbo));
+    GLF(GL::BindBuffer(GL::ARRAY_BUFFER, chunk.vbo));
+    GLF(GL::GenBuffers(1, &chunk.ebo));
+    GLF(GL::BindBuffer(GL::ELEMENT_ARRAY_BUFFER, chunk.ebo));
+
+    setupAttribs();
+
+    chunk.indCount = 0;
+    chunk.version = 0;
+  }
+
+  // Create ring VAO, the ring is used as the VBO, EBO and UBO
+  GLF(GL::GenVertexArrays(1, &m_ringVao));
+  GLF(GL::BindVertexArray(m_ringVao));
+
+  GLF(GL::GenBuffers(1, &m_ring));
+  GLF(GL::BindBuffer(GL::ARRAY_BUFFER, m_ring));
+  GLF(GL::BindBuffer(GL::ELEMENT_ARRAY_BUFFER, m_ring));
+
+  setupAttribs();
+
+  // Allocate ring, mapping it once if we can
+  const uptr ringSize = m_regionSize*GLBUFFER_REGIONS;
+  m_persistent = GL::BufferStorage && GL::hasExt("GL_ARB_buffer_storage");
+
+  if (m_persistent) {
+    const GLbitfield flags = GL::MAP_WRITE_BIT | GL::MAP_PERSISTENT_BIT | GL::MAP_COHERENT_BIT;
+
+    GLF(GL::BufferStorage(GL::ARRAY_BUFFER, ringSize, NULL, flags));
+    m_ringMap = (u8*)GLF(GL::MapBufferRange(GL::ARRAY_BUFFER, 0, ringSize, flags));
+    if (!m_ringMap) throw log_except("Cannot map %u byte vertex ring!", (unsigned)ringSize);
+
+    log_note("Streaming vertices through a persistently mapped %u byte ring", (unsigned)ringSize);
+  } else {
+    GLF(GL::BufferData(GL::ARRAY_BUFFER, ringSize, NULL, GL::STREAM_DRAW));
+
+    log_note("Streaming vertices through a %u byte ring, mapped every frame", (unsigned)ringSize);
+  }
+
+  beginRegion();
+}
+
+gl_buffers_t::~gl_buffers_t() {
+  // Unmap ring, a persistent mapping is always there, otherwise the current region is
+  if (m_persistent || m_verts) {
+    GLF(GL::BindBuffer(GL::ARRAY_BUFFER, m_ring));
+    GLF(GL::UnmapBuffer(GL::ARRAY_BUFFER));
+  }
 
-  // Create UBO
-  GLF(GL::GenBuffers(1, &m_ubo));
-  GLF(GL::BindBuffer(GL::UNIFORM_BUFFER, m_ubo));
+  for (u32 i = 0; i < GLBUFFER_REGIONS; ++i) {
+    if (m_fences[i]) GL::DeleteSync(m_fences[i]);
+  }
 
-  // Setup VAO attributes
+  GLF(GL::DeleteBuffers(1, &m_ring));
+  GLF(GL::DeleteVertexArrays(1, &m_ringVao));
+
+  for (uptr i = 0; i < MAP_MAXCHUNKS; ++i) {
+    GLF(GL::DeleteBuffers(1, &m_chunks[i].ebo));
+    GLF(GL::DeleteBuffers(1, &m_chunks[i].vbo));
+    GLF(GL::DeleteVertexArrays(1, &m_chunks[i].vao));
+  }
+
+  m_m.free(m_block);
+}
+
+void gl_buffers_t::setupAttribs() {
   GLF(GL::VertexAttribPointer(0,
                               4, GL::FLOAT, GL::FALSE,
                               sizeof(gl_vertex_t), (void*)0));
@@ -36,205 +137,270 @@ gl_buffers_t::gl_buffers_t(mem_t &m, uptr vertCount, uptr indCount) : m_m(m) {
   GLF(GL::VertexAttribPointer(2,
                               4, GL::UNSIGNED_BYTE, GL::TRUE,
                               sizeof(gl_vertex_t), GLVERTEX_COLOFFSET));
+  GLF(GL::VertexAttribPointer(3,
+                              1, GL::FLOAT, GL::FALSE,
+                              sizeof(gl_vertex_t), GLVERTEX_LAYEROFFSET));
   GLF(GL::EnableVertexAttribArray(0));
   GLF(GL::EnableVertexAttribArray(1));
   GLF(GL::EnableVertexAttribArray(2));
+  GLF(GL::EnableVertexAttribArray(3));
+}
 
-  // Bind uniform buffer range
-  GLF(GL::BindBufferRange(GL::UNIFORM_BUFFER, 0, m_ubo, 0, sizeof(gl_buffer_block_t)));
+void gl_buffers_t::beginRegion() {
+  // Wait until the GPU is done with the frame that last used this region,
+  // with 3 regions this is usually signaled already
+  GLsync &fence = m_fences[m_region];
+  if (fence) {
+    GLenum res;
+    do {
+      res = GLF(GL::ClientWaitSync(fence, GL::SYNC_FLUSH_COMMANDS_BIT, GLBUFFER_FENCE_TIMEOUT));
+    } while (res == GL::TIMEOUT_EXPIRED);
+
+    if (res == GL::WAIT_FAILED) log_warning("Waiting for ring region %u failed!", m_region);
+
+    GLF(GL::DeleteSync(fence));
+    fence = NULL;
+  }
+
+  // Map region, the fence already synchronized it
+  const uptr offset = m_region*m_regionSize;
+  u8 *region;
+
+  if (m_persistent) {
+    region = m_ringMap+offset;
+  } else {
+    const GLbitfield flags = GL::MAP_WRITE_BIT | GL::MAP_UNSYNCHRONIZED_BIT | GL::MAP_INVALIDATE_RANGE_BIT;
+
+    GLF(GL::BindBuffer(GL::ARRAY_BUFFER, m_ring));
+    region = (u8*)GLF(GL::MapBufferRange(GL::ARRAY_BUFFER, offset, m_regionSize, flags));
+    if (!region) throw log_except("Cannot map ring region %u!", m_region);
+  }
+
+  m_verts = (gl_vertex_t*)(region+m_vertOffset);
+  m_inds = (u16*)(region+m_indOffset);
+  m_curVert = m_curInd = 0;
+}
 
-  // Allocate vertices, indices and the uniform block in one buffer
-  const u8 *memory = (u8*)m_m.alloc(sizeof(gl_buffer_block_t)+m_vertSize+m_indSize);
-  m_block = (gl_buffer_block_t*)memory;
-  m_verts = (gl_vertex_t*)(memory+sizeof(gl_buffer_block_t));
-  m_inds = (u16*)(memory+sizeof(gl_buffer_block_t)+m_vertSize);
+void gl_buffers_t::copyVerts(gl_vertex_t *dstVerts, u16 *dstInds,
+                             uptr &curVert, uptr &curInd, uptr maxVert, uptr maxInd,
+                             uptr vertCount, const gl_vertex_t *verts,
+                             uptr indCount, const u16 *inds)
+{
+  if (!(vertCount+indCount)) return;
 
-  m_vertCount = vertCount;
-  m_indCount = indCount;
+  checkSpace(curVert, vertCount, maxVert, curInd, indCount, maxInd);
 
-  m_curVert = m_curInd = m_baseVert = m_baseInd = 0;
-}
+  memcpy((void*)(dstVerts+curVert), verts, vertCount*sizeof(gl_vertex_t));
 
-gl_buffers_t::~gl_buffers_t() {
-  m_m.free(m_block);
+  // We have to adjust the indices
+  for (uptr i = 0; i < indCount; ++i)
+    dstInds[curInd++] = inds[i]+curVert;
 
-  GLF(GL::DeleteBuffers(1, &m_ubo));
-  GLF(GL::DeleteBuffers(1, &m_ebo));
-  GLF(GL::DeleteBuffers(1, &m_vbo));
-  GLF(GL::DeleteVertexArrays(1, &m_vao));
+  curVert += vertCount;
 }
 
 void gl_buffers_t::addVerts(uptr vertCount, const gl_vertex_t *verts,
                             uptr indCount, const u16 *inds)
 {
-  if (!(vertCount+indCount)) return;
+  // Written straight into the ring
+  copyVerts(m_verts, m_inds, m_curVert, m_curInd, m_vertCount, m_indCount,
+            vertCount, verts, indCount, inds);
+}
 
-  if (m_curVert+vertCount > m_vertCount)
+void gl_buffers_t::checkSpace(uptr curVert, uptr vertCount, uptr maxVert,
+                              uptr curInd, uptr indCount, uptr maxInd)
+{
+  if (curVert+vertCount > maxVert)
     throw log_except("Out of vertex memory! (%u > %u)",
-                     (unsigned)(m_curVert+vertCount),
-                     (unsigned)m_vertCount);
+                     (unsigned)(curVert+vertCount),
+                     (unsigned)maxVert);
 
-  if (m_curInd+indCount > m_indCount)
+  if (curInd+indCount > maxInd)
     throw log_except("Out of index memory! (%u > %u)",
-                     (unsigned)(m_curInd+indCount),
-                     (unsigned)m_indCount);
+                     (unsigned)(curInd+indCount),
+                     (unsigned)maxInd);
+}
 
-  memcpy((void*)(m_verts+m_curVert), verts, vertCount*sizeof(gl_vertex_t));
+void gl_buffers_t::addCube(const gl_texture_t &tex, const map_cube_t &c, atlas_id_t atlas) {
+  const uptr faces = gl_mesh_cubeFaces(c);
 
-  // We have to adjust the indices
-  for (uptr i = 0; i < indCount; ++i)
-    m_inds[m_curInd++] = inds[i]+m_curVert;
+  f32 layer;
+  const vec2_2 coord = tex.imgCoord(atlas, c.img, layer);
 
-  m_curVert += vertCount;
+  // Written straight into the ring
+  checkSpace(m_curVert, faces*4, m_vertCount, m_curInd, faces*6, m_indCount);
+  gl_mesh_buildCube(c, coord, layer, m_verts+m_curVert, m_inds+m_curInd, m_curVert);
+
+  m_curVert += faces*4;
+  m_curInd += faces*6;
 }
 
-void gl_buffers_t::addBaseVerts(uptr vertCount, const gl_vertex_t *verts,
-                                uptr indCount, const u16 *inds)
+// Data for building cubes in parallel
+struct gl_buffers_build_t {
+  const gl_texture_t *tex;
+  const gl_buffers_cube_t *cubes;
+  gl_vertex_t *verts;
+  u16 *inds;
+};
+
+void gl_buffers_t::buildCubes(uptr begin, uptr end, void *data) {
+  const gl_buffers_build_t &b = *(const gl_buffers_build_t*)data;
+
+  for (uptr i = begin; i < end; ++i) {
+    const gl_buffers_cube_t &c = b.cubes[i];
+
+    f32 layer;
+    const vec2_2 coord = b.tex->imgCoord(ATLAS_LEVEL, c.cube->img, layer);
+
+    gl_mesh_buildCube(*c.cube, coord, layer,
+                      b.verts + c.firstFace*4, b.inds + c.firstFace*6, c.firstFace*4 - c.chunkVert);
+  }
+}
+
+void gl_buffers_t::buildChunks(job_system_t &js, const gl_texture_t &tex,
+                               const map_cube_t *cubes, uptr cubeCount,
+                               const map_chunks_t &chunks, ubool all)
 {
-  // Overwrite anything past m_baseVert
-  m_curVert = m_baseVert;
-  m_curInd = m_baseInd;
+  PROF_ZONE("buildChunks");
+
+  // Find which chunks changed, chunks past the end are emptied
+  ubool dirty[MAP_MAXCHUNKS];
+  uptr dirtyCount = 0;
+
+  for (uptr i = 0; i < chunks.chunkCount; ++i) {
+    dirty[i] = all || (i >= m_chunkCount) || (m_chunks[i].version != chunks.chunks[i].version);
+    if (dirty[i]) ++dirtyCount;
+  }
+
+  for (uptr i = chunks.chunkCount; i < m_chunkCount; ++i) m_chunks[i].indCount = 0;
+  m_chunkCount = chunks.chunkCount;
+
+  if (!dirtyCount) return;
+
+  // The build scratch is only as big as a snapshot
+  if (cubeCount > GAME_SNAPSHOT_MAXCUBES)
+    throw log_except("Too many cubes to build! (%u > %u)",
+                     (unsigned)cubeCount, (unsigned)GAME_SNAPSHOT_MAXCUBES);
+
+  // Chunk of every cube, and face count of every rebuilt chunk
+  static_assert(MAP_MAXCHUNKS <= 256, "Chunk indices don't fit in a byte!");
+
+  uptr chunkFaces[MAP_MAXCHUNKS] = {};
+  for (uptr i = 0; i < cubeCount; ++i) {
+    const uptr c = chunks.find(cubes[i]);
+    m_cubeChunk[i] = (u8)c;
+
+    if ((c < m_chunkCount) && dirty[c]) chunkFaces[c] += gl_mesh_cubeFaces(cubes[i]);
+  }
+
+  // Rebuilt chunks are one after another, each cube's faces go after
+  // the faces of the cubes before it in the chunk
+  uptr chunkFirst[MAP_MAXCHUNKS];
+  uptr faces = 0;
+
+  for (uptr i = 0; i < m_chunkCount; ++i) {
+    chunkFirst[i] = faces;
+    if (dirty[i]) faces += chunkFaces[i];
+  }
+
+  checkSpace(0, faces*4, m_vertCount, 0, faces*6, m_indCount);
 
-  addVerts(vertCount, verts, indCount, inds);
+  uptr chunkNext[MAP_MAXCHUNKS];
+  memcpy(chunkNext, chunkFirst, sizeof(chunkFirst));
 
-  m_baseVert = m_curVert;
-  m_baseInd = m_curInd;
+  uptr orderCount = 0;
+  for (uptr i = 0; i < cubeCount; ++i) {
+    const uptr c = m_cubeChunk[i];
+    if ((c >= m_chunkCount) || !dirty[c]) continue;
+
+    gl_buffers_cube_t &cube = m_order[orderCount++];
+    cube.cube = cubes+i;
+    cube.firstFace = chunkNext[c];
+    cube.chunkVert = chunkFirst[c]*4;
+
+    chunkNext[c] += gl_mesh_cubeFaces(cubes[i]);
+
+    // Grow chunk bounds, from the first cube with faces
+    gl_chunk_t &chunk = m_chunks[c];
+    const ubool first = (cube.firstFace == chunkFirst[c]);
+
+    for (uptr a = 0; a < 3; ++a) {
+      const f32 lo = util_min(cubes[i].min.f[a], cubes[i].max.f[a]);
+      const f32 hi = util_max(cubes[i].min.f[a], cubes[i].max.f[a]);
+
+      chunk.min.f[a] = first ? lo : util_min(chunk.min.f[a], lo);
+      chunk.max.f[a] = first ? hi : util_max(chunk.max.f[a], hi);
+    }
+  }
+
+  gl_buffers_build_t b = {&tex, m_order, m_buildVerts, m_buildInds};
+  js.parallelFor(orderCount, GLBUFFER_BUILDCHUNK, buildCubes, &b);
+
+  // Upload rebuilt chunks
+  for (uptr i = 0; i < m_chunkCount; ++i) {
+    if (!dirty[i]) continue;
+
+    gl_chunk_t &chunk = m_chunks[i];
+    const uptr vertCount = chunkFaces[i]*4;
+
+    chunk.indCount = chunkFaces[i]*6;
+    chunk.version = chunks.chunks[i].version;
+
+    if (!vertCount) continue;
+
+    GLF(GL::BindVertexArray(chunk.vao));
+    GLF(GL::BindBuffer(GL::ARRAY_BUFFER, chunk.vbo));
+    GLF(GL::BufferData(GL::ARRAY_BUFFER, vertCount*sizeof(gl_vertex_t),
+                       m_buildVerts + chunkFirst[i]*4, GL::STATIC_DRAW));
+    GLF(GL::BufferData(GL::ELEMENT_ARRAY_BUFFER, chunk.indCount*sizeof(u16),
+                       m_buildInds + chunkFirst[i]*6, GL::STATIC_DRAW));
+  }
 }
 
-void gl_buffers_t::addCube(const gl_texture_t &tex, const map_cube_t &c, ubool persistent, atlas_id_t atlas) {
-  gl_vertex_t verts[4]; // Quad vertices, drawn 4 times
-
-  // Setup texture coordinates
-  verts[0].coord = tex.imgCoord(atlas, c.img);
-  verts[1].coord = (verts[0].coord +
-                    (verts[0].coord.shuffle<0x2323>()&vec4(vec4_int_init(-1, 0, 0, 0))));
-  verts[2].coord = (verts[0].coord +
-                    (verts[0].coord.shuffle<0x2323>()&vec4(vec4_int_init(0, -1, 0, 0))));
-  verts[3].coord = (verts[0].coord +
-                    (verts[0].coord.shuffle<0x2323>()&vec4(vec4_int_init(-1, -1, 0, 0))));
-
-  // Left side
-  verts[0].pos = ((c.min&vec4(vec4_int_init(-1, 0, 0, -1))) |
-                  (c.max&vec4(vec4_int_init(0, -1, -1, 0))));
-  verts[1].pos = ((c.min&vec4(vec4_int_init(-1, 0, -1, -1))) |
-                  (c.max&vec4(vec4_int_init(0, -1, 0, 0))));
-  verts[2].pos = ((c.min&vec4(vec4_int_init(-1, -1, 0, -1))) |
-                  (c.max&vec4(vec4_int_init(0, 0, -1, 0))));
-  verts[3].pos = c.min;
-
-  // RGBA colors
-  verts[0].col() = endian_big32(0xc0c0c0ff);
-  verts[1].col() = endian_big32(0xffffffff);
-  verts[2].col() = endian_big32(0x808080ff);
-  verts[3].col() = endian_big32(0xc0c0c0ff);
-
-  if (persistent) addBaseQuad(verts);
-  else addQuad(verts);
-
-  // Right side
-  verts[0].pos = ((c.min&vec4(vec4_int_init(0, 0, -1, -1))) |
-                  (c.max&vec4(vec4_int_init(-1, -1, 0, 0))));
-  verts[1].pos = c.max;
-  verts[2].pos = ((c.min&vec4(vec4_int_init(0, -1, -1, -1))) |
-                  (c.max&vec4(vec4_int_init(-1, 0, 0, 0))));
-  verts[3].pos = ((c.min&vec4(vec4_int_init(0, -1, 0, -1))) |
-                  (c.max&vec4(vec4_int_init(-1, 0, -1, 0))));
-
-  // RGBA colors
-  verts[0].col() = endian_big32(0xc0c0c0ff);
-  verts[1].col() = endian_big32(0x808080ff);
-  verts[2].col() = endian_big32(0x808080ff);
-  verts[3].col() = endian_big32(0x404040ff);
-
-  if (persistent) addBaseQuad(verts);
-  else addQuad(verts);
-
-  // Bottom side
-  verts[0].pos = c.min;
-  verts[1].pos = ((c.min&vec4(vec4_int_init(0, -1, -1, -1))) |
-                  (c.max&vec4(vec4_int_init(-1, 0, 0, 0))));
-  verts[2].pos = ((c.min&vec4(vec4_int_init(-1, -1, 0, -1))) |
-                  (c.max&vec4(vec4_int_init(0, 0, -1, 0))));
-  verts[3].pos = ((c.min&vec4(vec4_int_init(0, -1, 0, -1))) |
-                  (c.max&vec4(vec4_int_init(-1, 0, -1, 0))));
-
-  // RGBA colors
-  verts[0].col() = endian_big32(0xc0c0c0ff);
-  verts[1].col() = endian_big32(0x808080ff);
-  verts[2].col() = endian_big32(0x808080ff);
-  verts[3].col() = endian_big32(0x404040ff);
-
-  if (persistent) addBaseQuad(verts);
-  else addQuad(verts);
-
-  // Top side
-  verts[0].pos = ((c.min&vec4(vec4_int_init(-1, 0, 0, -1))) |
-                  (c.max&vec4(vec4_int_init(0, -1, -1, 0))));
-  verts[1].pos = c.max;
-  verts[2].pos = ((c.min&vec4(vec4_int_init(-1, 0, -1, -1))) |
-                  (c.max&vec4(vec4_int_init(0, -1, 0, 0))));
-  verts[3].pos = ((c.min&vec4(vec4_int_init(0, 0, -1, -1))) |
-                  (c.max&vec4(vec4_int_init(-1, -1, 0, 0))));
-
-  // RGBA colors
-  verts[0].col() = endian_big32(0xc0c0c0ff);
-  verts[1].col() = endian_big32(0x808080ff);
-  verts[2].col() = endian_big32(0xffffffff);
-  verts[3].col() = endian_big32(0xc0c0c0ff);
-
-  if (persistent) addBaseQuad(verts);
-  else addQuad(verts);
-
-  // Front side
-  verts[0].pos = ((c.min&vec4(vec4_int_init(-1, 0, -1, -1))) |
-                  (c.max&vec4(vec4_int_init(0, -1, 0, 0))));
-  verts[1].pos = ((c.min&vec4(vec4_int_init(0, 0, -1, -1))) |
-                  (c.max&vec4(vec4_int_init(-1, -1, 0, 0))));
-  verts[2].pos = c.min;
-  verts[3].pos = ((c.min&vec4(vec4_int_init(0, -1, -1, -1))) |
-                  (c.max&vec4(vec4_int_init(-1, 0, 0, 0))));
-
-  // RGBA colors
-  verts[0].col() = endian_big32(0xffffffff);
-  verts[1].col() = endian_big32(0xc0c0c0ff);
-  verts[2].col() = endian_big32(0xc0c0c0ff);
-  verts[3].col() = endian_big32(0x808080ff);
-
-  if (persistent) addBaseQuad(verts);
-  else addQuad(verts);
-
-  // Back side
-  verts[0].pos = c.max;
-  verts[1].pos = ((c.min&vec4(vec4_int_init(-1, 0, 0, -1))) |
-                  (c.max&vec4(vec4_int_init(0, -1, -1, 0))));
-  verts[2].pos = ((c.min&vec4(vec4_int_init(0, -1, 0, -1))) |
-                  (c.max&vec4(vec4_int_init(-1, 0, -1, 0))));
-  verts[3].pos = ((c.min&vec4(vec4_int_init(-1, -1, 0, -1))) |
-                  (c.max&vec4(vec4_int_init(0, 0, -1, 0))));
-
-  // RGBA colors
-  verts[0].col() = endian_big32(0x808080ff);
-  verts[1].col() = endian_big32(0xc0c0c0ff);
-  verts[2].col() = endian_big32(0x404040ff);
-  verts[3].col() = endian_big32(0x808080ff);
-
-  if (persistent) addBaseQuad(verts);
-  else addQuad(verts);
+ubool gl_buffers_t::visible(const vec4 &min, const vec4 &max) const {
+  vec4 mvp[4];
+  gl_mesh_mvp(m_block->modelView, m_block->projection, mvp);
+
+  return gl_mesh_visible(mvp, min, max);
 }
 
 void gl_buffers_t::flushBuffers() {
-  // Orphan buffers
-  GLF(GL::BufferData(GL::ARRAY_BUFFER, m_vertSize, NULL, GL::STREAM_DRAW));
-  GLF(GL::BufferSubData(GL::ARRAY_BUFFER, 0, m_curVert*sizeof(gl_vertex_t), m_verts));
-  GLF(GL::BufferData(GL::ELEMENT_ARRAY_BUFFER, m_indSize, NULL, GL::STREAM_DRAW));
-  GLF(GL::BufferSubData(GL::ELEMENT_ARRAY_BUFFER, 0, m_curInd*sizeof(u16), m_inds));
-  GLF(GL::BufferData(GL::UNIFORM_BUFFER, sizeof(gl_buffer_block_t), NULL, GL::STREAM_DRAW));
-  GLF(GL::BufferSubData(GL::UNIFORM_BUFFER, 0, sizeof(gl_buffer_block_t), m_block));
-
-  // Render vertices
-  GLF(GL::DrawElements(GL::TRIANGLES, m_curInd, GL::UNSIGNED_SHORT, (void*)0));
-
-  // Reset buffers
-  m_curVert = m_baseVert;
-  m_curInd = m_baseInd;
+  PROF_ZONE("flushBuffers");
+
+  const uptr offset = m_region*m_regionSize;
+
+  // The uniform block goes at the start of the region
+  memcpy((u8*)m_verts-m_vertOffset, m_block, sizeof(gl_buffer_block_t));
+
+  if (!m_persistent) {
+    GLF(GL::BindBuffer(GL::ARRAY_BUFFER, m_ring));
+    GLF(GL::UnmapBuffer(GL::ARRAY_BUFFER));
+  }
+
+  GLF(GL::BindBufferRange(GL::UNIFORM_BUFFER, 0, m_ring, offset, sizeof(gl_buffer_block_t)));
+
+  // Render map chunks that can be on screen
+  for (uptr i = 0; i < m_chunkCount; ++i) {
+    const gl_chunk_t &chunk = m_chunks[i];
+    if (!chunk.indCount || !visible(chunk.min, chunk.max)) continue;
+
+    GLF(GL::BindVertexArray(chunk.vao));
+    GLF(GL::DrawElements(GL::TRIANGLES, chunk.indCount, GL::UNSIGNED_SHORT, (void*)0));
+  }
+
+  // Render streamed vertices, from this frame's region
+  if (m_curInd) {
+    GLF(GL::BindVertexArray(m_ringVao));
+    GLF(GL::DrawElementsBaseVertex(GL::TRIANGLES, m_curInd, GL::UNSIGNED_SHORT,
+                                   (void*)(offset+m_indOffset),
+                                   (offset+m_vertOffset)/sizeof(gl_vertex_t)));
+  }
+
+  // Move on to the next region, once the GPU is done with this one
+  m_fences[m_region] = GLF(GL::FenceSync(GL::SYNC_GPU_COMMANDS_COMPLETE, 0));
+  m_verts = NULL;
+  m_inds = NULL;
+
+  m_region = (m_region+1)%GLBUFFER_REGIONS;
+  beginRegion();
 }
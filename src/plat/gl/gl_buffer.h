@@ -4,8 +4,10 @@
 #include "types.h"
 #include "opengl.h"
 #include "gl_vertex.h"
+#include "gl_texture.h"
 #include "game/map.h"
 #include "game/atlas.h"
+#include "job.h"
 
 // Dither matrix size
 static constexpr u32 GLBUFFER_DITHER_SIZE = 16;
@@ -16,22 +18,89 @@ struct gl_buffer_block_t {
   vec4 projection[4];
 };
 
+// Number of frames the streamed vertices are buffered for, the CPU writes
+// one region of the ring while the GPU can still be reading the other two
+static constexpr u32 GLBUFFER_REGIONS = 3;
+
+// Number of cubes each job builds when building chunk meshes in parallel
+static constexpr uptr GLBUFFER_BUILDCHUNK = 32;
+
+// Where a cube of a chunk that's being rebuilt goes, defined in gl_buffer.cpp
+struct gl_buffers_cube_t;
+
+// Mesh of a map chunk, in it's own buffers
+struct gl_chunk_t {
+  vec4 min, max; // Bounds, for culling
+
+  GLuint vao, vbo, ebo;
+  uptr indCount;
+
+  u32 version; // Version of the map chunk the mesh was built from
+};
+
 class gl_buffers_t {
 private:
   mem_t &m_m;
 
+  // Map chunk meshes, only rebuilt when their chunk changes
+  gl_chunk_t *m_chunks;
+  uptr m_chunkCount;
+
+  // Chunk vertices are built here before they're uploaded
+  gl_vertex_t *m_buildVerts;
+  u16 *m_buildInds;
+
+  // Chunk of every cube, and the rebuilt cubes in build order
+  // Allocated up front, the render thread can't allocate while the game thread does
+  u8 *m_cubeChunk;
+  gl_buffers_cube_t *m_order;
+
+  // Streamed vertices, these point straight into the mapped ring region
+  // of the current frame, NULL when it isn't mapped
   gl_vertex_t *m_verts;
   u16 *m_inds;
+  uptr m_curVert, m_curInd;
 
   uptr m_vertCount, m_indCount;
-  uptr m_vertSize, m_indSize;
-  uptr m_curVert, m_curInd;
-  uptr m_baseVert, m_baseInd;
 
-  GLuint m_vao, m_vbo, m_ebo, m_ubo;
+  // Ring region layout, the uniform block is first, then vertices and indices
+  uptr m_regionSize;
+  uptr m_vertOffset, m_indOffset;
+
+  u32 m_region; // Current ring region
+  GLsync m_fences[GLBUFFER_REGIONS]; // Signaled when the GPU is done with each region
+
+  // If the ring is mapped once with ARB_buffer_storage, otherwise
+  // each region is mapped unsynchronized when the frame starts
+  ubool m_persistent;
+  u8 *m_ringMap; // Persistent mapping of the whole ring
+
+  GLuint m_ringVao, m_ring;
 
   gl_buffer_block_t *m_block;
 
+  // Setup VAO attributes for the bound VBO
+  void setupAttribs();
+
+  // Wait for the GPU to finish with the current region and map it
+  void beginRegion();
+
+  // Copy vertices and indices to dst, offsetting indices by curVert
+  static void copyVerts(gl_vertex_t *dstVerts, u16 *dstInds,
+                        uptr &curVert, uptr &curInd, uptr maxVert, uptr maxInd,
+                        uptr vertCount, const gl_vertex_t *verts,
+                        uptr indCount, const u16 *inds);
+
+  // Throw if there isn't space for vertCount more vertices and indCount more indices
+  static void checkSpace(uptr curVert, uptr vertCount, uptr maxVert,
+                         uptr curInd, uptr indCount, uptr maxInd);
+
+  // parallelFor function for buildChunks
+  static void buildCubes(uptr begin, uptr end, void *data);
+
+  // If any of a box can be on screen with the current matrices
+  ubool visible(const vec4 &min, const vec4 &max) const;
+
 public:
   gl_buffers_t(mem_t &m, uptr vertCount, uptr indCount);
   ~gl_buffers_t();
@@ -49,26 +118,15 @@ public:
     addVerts(4, verts, 6, quadInds);
   }
 
-  // Add persistent vertices to buffer
-  void addBaseVerts(uptr vertCount, const gl_vertex_t *verts, uptr indCount, const u16 *inds);
-
-  FINLINE void addBaseTriangle(const gl_vertex_t verts[3]) {
-    static const u16 triangleInds[3] = {0, 1, 2};
-    addBaseVerts(3, verts, 3, triangleInds);
-  }
-
-  FINLINE void addBaseQuad(const gl_vertex_t verts[4]) {
-    static const u16 quadInds[6] = {0, 1, 2, 3, 1, 2};
-    addBaseVerts(4, verts, 6, quadInds);
-  }
-
-  // Clear persistent vertices
-  FINLINE void clearBaseVerts() {
-    m_baseVert = m_baseInd = 0;
-  }
-
   // Add game cube to screen
-  void addCube(const gl_texture_t &tex, const map_cube_t &c, ubool base = true, atlas_id_t atlas = ATLAS_LEVEL);
+  void addCube(const gl_texture_t &tex, const map_cube_t &c, atlas_id_t atlas = ATLAS_LEVEL);
+
+  // Rebuild the meshes of map chunks that changed since they were built,
+  // or every chunk if all is set
+  // Cubes are built in parallel, each writing to it's own range of the buffers
+  // There can't be more than GAME_SNAPSHOT_MAXCUBES cubes, nothing is allocated here
+  void buildChunks(job_system_t &js, const gl_texture_t &tex,
+                   const map_cube_t *cubes, uptr cubeCount, const map_chunks_t &chunks, ubool all);
 
   // Render buffer contents
   void flushBuffers();
@@ -0,0 +1,247 @@
+#include "types.h"
+#include "endianUtil.h"
+#include "gl_mesh.h"
+
+#include <cstring>
+#include <math.h>
+
+static const vec4 identMat[4] = {
+  vec4(1.f, 0.f, 0.f, 0.f),
+  vec4(0.f, 1.f, 0.f, 0.f),
+  vec4(0.f, 0.f, 1.f, 0.f),
+  vec4(0.f, 0.f, 0.f, 1.f)
+};
+
+uptr gl_mesh_cubeFaces(const map_cube_t &c) {
+  const vec4 size = c.max-c.min;
+  const ubool x = size.f[0] != 0.f, y = size.f[1] != 0.f, z = size.f[2] != 0.f;
+
+  // Each pair of sides needs area
+  return 2*((y && z) + (x && z) + (x && y));
+}
+
+uptr gl_mesh_buildCube(const map_cube_t &c, const vec2_2 &coord, f32 layer,
+                       gl_vertex_t *outVerts, u16 *outInds, uptr firstVert)
+{
+  static const u16 quadInds[6] = {0, 1, 2, 3, 1, 2};
+
+  const vec4 size = c.max-c.min;
+  const ubool sizeX = size.f[0] != 0.f, sizeY = size.f[1] != 0.f, sizeZ = size.f[2] != 0.f;
+
+  uptr faces = 0;
+
+  // Write a face, if it has any area
+  auto addFace = [&](const gl_vertex_t verts[4], ubool visible) {
+    if (!visible) return;
+
+    memcpy((void*)(outVerts + faces*4), verts, 4*sizeof(gl_vertex_t));
+    for (uptr i = 0; i < 6; ++i)
+      outInds[faces*6 + i] = firstVert + faces*4 + quadInds[i];
+
+    ++faces;
+  };
+
+  gl_vertex_t verts[4]; // Quad vertices, drawn 4 times
+
+  // Setup texture coordinates
+  verts[0].coord = coord;
+  verts[1].coord = (verts[0].coord +
+                    (verts[0].coord.shuffle<0x2323>()&vec4(vec4_int_init(-1, 0, 0, 0))));
+  verts[2].coord = (verts[0].coord +
+                    (verts[0].coord.shuffle<0x2323>()&vec4(vec4_int_init(0, -1, 0, 0))));
+  verts[3].coord = (verts[0].coord +
+                    (verts[0].coord.shuffle<0x2323>()&vec4(vec4_int_init(-1, -1, 0, 0))));
+
+  // Texture layer, colors are set per side
+  for (uptr i = 0; i < 4; ++i) verts[i].layer() = layer;
+
+  // Left side
+  verts[0].pos = ((c.min&vec4(vec4_int_init(-1, 0, 0, -1))) |
+                  (c.max&vec4(vec4_int_init(0, -1, -1, 0))));
+  verts[1].pos = ((c.min&vec4(vec4_int_init(-1, 0, -1, -1))) |
+                  (c.max&vec4(vec4_int_init(0, -1, 0, 0))));
+  verts[2].pos = ((c.min&vec4(vec4_int_init(-1, -1, 0, -1))) |
+                  (c.max&vec4(vec4_int_init(0, 0, -1, 0))));
+  verts[3].pos = c.min;
+
+  // RGBA colors
+  verts[0].col() = endian_big32(0xc0c0c0ff);
+  verts[1].col() = endian_big32(0xffffffff);
+  verts[2].col() = endian_big32(0x808080ff);
+  verts[3].col() = endian_big32(0xc0c0c0ff);
+
+  addFace(verts, sizeY && sizeZ);
+
+  // Right side
+  verts[0].pos = ((c.min&vec4(vec4_int_init(0, 0, -1, -1))) |
+                  (c.max&vec4(vec4_int_init(-1, -1, 0, 0))));
+  verts[1].pos = c.max;
+  verts[2].pos = ((c.min&vec4(vec4_int_init(0, -1, -1, -1))) |
+                  (c.max&vec4(vec4_int_init(-1, 0, 0, 0))));
+  verts[3].pos = ((c.min&vec4(vec4_int_init(0, -1, 0, -1))) |
+                  (c.max&vec4(vec4_int_init(-1, 0, -1, 0))));
+
+  // RGBA colors
+  verts[0].col() = endian_big32(0xc0c0c0ff);
+  verts[1].col() = endian_big32(0x808080ff);
+  verts[2].col() = endian_big32(0x808080ff);
+  verts[3].col() = endian_big32(0x404040ff);
+
+  addFace(verts, sizeY && sizeZ);
+
+  // Bottom side
+  verts[0].pos = c.min;
+  verts[1].pos = ((c.min&vec4(vec4_int_init(0, -1, -1, -1))) |
+                  (c.max&vec4(vec4_int_init(-1, 0, 0, 0))));
+  verts[2].pos = ((c.min&vec4(vec4_int_init(-1, -1, 0, -1))) |
+                  (c.max&vec4(vec4_int_init(0, 0, -1, 0))));
+  verts[3].pos = ((c.min&vec4(vec4_int_init(0, -1, 0, -1))) |
+                  (c.max&vec4(vec4_int_init(-1, 0, -1, 0))));
+
+  // RGBA colors
+  verts[0].col() = endian_big32(0xc0c0c0ff);
+  verts[1].col() = endian_big32(0x808080ff);
+  verts[2].col() = endian_big32(0x808080ff);
+  verts[3].col() = endian_big32(0x404040ff);
+
+  addFace(verts, sizeX && sizeZ);
+
+  // Top side
+  verts[0].pos = ((c.min&vec4(vec4_int_init(-1, 0, 0, -1))) |
+                  (c.max&vec4(vec4_int_init(0, -1, -1, 0))));
+  verts[1].pos = c.max;
+  verts[2].pos = ((c.min&vec4(vec4_int_init(-1, 0, -1, -1))) |
+                  (c.max&vec4(vec4_int_init(0, -1, 0, 0))));
+  verts[3].pos = ((c.min&vec4(vec4_int_init(0, 0, -1, -1))) |
+                  (c.max&vec4(vec4_int_init(-1, -1, 0, 0))));
+
+  // RGBA colors
+  verts[0].col() = endian_big32(0xc0c0c0ff);
+  verts[1].col() = endian_big32(0x808080ff);
+  verts[2].col() = endian_big32(0xffffffff);
+  verts[3].col() = endian_big32(0xc0c0c0ff);
+
+  addFace(verts, sizeX && sizeZ);
+
+  // Front side
+  verts[0].pos = ((c.min&vec4(vec4_int_init(-1, 0, -1, -1))) |
+                  (c.max&vec4(vec4_int_init(0, -1, 0, 0))));
+  verts[1].pos = ((c.min&vec4(vec4_int_init(0, 0, -1, -1))) |
+                  (c.max&vec4(vec4_int_init(-1, -1, 0, 0))));
+  verts[2].pos = c.min;
+  verts[3].pos = ((c.min&vec4(vec4_int_init(0, -1, -1, -1))) |
+                  (c.max&vec4(vec4_int_init(-1, 0, 0, 0))));
+
+  // RGBA colors
+  verts[0].col() = endian_big32(0xffffffff);
+  verts[1].col() = endian_big32(0xc0c0c0ff);
+  verts[2].col() = endian_big32(0xc0c0c0ff);
+  verts[3].col() = endian_big32(0x808080ff);
+
+  addFace(verts, sizeX && sizeY);
+
+  // Back side
+  verts[0].pos = c.max;
+  verts[1].pos = ((c.min&vec4(vec4_int_init(-1, 0, 0, -1))) |
+                  (c.max&vec4(vec4_int_init(0, -1, -1, 0))));
+  verts[2].pos = ((c.min&vec4(vec4_int_init(0, -1, 0, -1))) |
+                  (c.max&vec4(vec4_int_init(-1, 0, -1, 0))));
+  verts[3].pos = ((c.min&vec4(vec4_int_init(-1, -1, 0, -1))) |
+                  (c.max&vec4(vec4_int_init(0, 0, -1, 0))));
+
+  // RGBA colors
+  verts[0].col() = endian_big32(0x808080ff);
+  verts[1].col() = endian_big32(0xc0c0c0ff);
+  verts[2].col() = endian_big32(0x404040ff);
+  verts[3].col() = endian_big32(0x808080ff);
+
+  addFace(verts, sizeX && sizeY);
+
+  return faces;
+}
+
+void gl_mesh_modelView(const game_state_view_t &view, vec4 modelView[4]) {
+  // The origin of the yaw is pointing right
+  const f32 c = cosf(view.yaw-(f32)M_PI*0.5f);
+  const f32 s = sinf(view.yaw-(f32)M_PI*0.5f);
+
+  const f32 pc = cosf(view.pitch);
+  const f32 ps = sinf(view.pitch);
+
+  const f32 x = view.pos.f[0];
+  const f32 y = view.pos.f[1];
+  const f32 z = view.pos.f[2];
+
+  // Setup model view matrix, contains
+  // transformation matrix, yaw rotation matrix and
+  // pitch rotation matrix, performed on the vertex
+  // in that order
+  //
+  // NOTE: This can be optimized by storing c, s,
+  // pc and ps in a vector, and x, y, z in another vector,
+  // and shuffling them around instead of referring to them
+  // as singular values. I don't know anyone insane enough
+  // to do that though.
+  //
+  // modelView =
+  // c     0   s    c*-x+s*-z
+  // ps*s  pc -ps*c ps*s*-x+pc*-y+ps*c*z
+  // pc*-s ps  pc*c pc*s*x+ps*-y+pc*c*-z
+  // 0     0   0    1
+  modelView[0] =
+    vec4(c, ps, pc, 0.f)*vec4(1.f, s, -s, 1.f);
+  modelView[1] =
+    vec4(0.f, pc, ps, 0.f);
+  modelView[2] =
+    vec4(s, -ps, pc, 0.f)*vec4(1.f, c, c, 1.f);
+  modelView[3] =
+    vec4(c, ps, pc, 1.f)*vec4(-x, s, s, 1.f)*vec4(1.f, -x, x, 1.f) +
+    vec4(s, pc, ps, 0.f)*vec4(-z, -y, -y, 0.f) +
+    vec4(0.f, ps, pc, 0.f)*vec4(0.f, c, c, 0.f)*vec4(0.f, z, -z, 0.f);
+}
+
+void gl_mesh_projection(f32 projDist, u32 width, u32 height, vec4 projection[4]) {
+  // projection =
+  // projDist*invAspect 0        0                            0
+  // 0                  projDist 0                            0
+  // 0                  0        (farClip+nearClip*2)/farClip nearClip*-2
+  // 0                  0        1                            0
+  memcpy((void*)projection, &identMat, sizeof(identMat));
+
+  const f32 invAspect = (f32)height/(f32)width;
+
+  projection[0].f[0] = projDist*invAspect;
+  projection[1].f[1] = projDist;
+  projection[2] = vec4(0.f, 0.f, (GLMESH_FARCLIP+GLMESH_NEARCLIP*2.f)/GLMESH_FARCLIP, 1.f);
+  projection[3] = vec4(0.f, 0.f, GLMESH_NEARCLIP*-2.f, 0.f);
+}
+
+void gl_mesh_mvp(const vec4 modelView[4], const vec4 projection[4], vec4 mvp[4]) {
+  for (uptr i = 0; i < 4; ++i) {
+    const vec4 &mv = modelView[i];
+    mvp[i] = projection[0]*mv.f[0] + projection[1]*mv.f[1] +
+             projection[2]*mv.f[2] + projection[3]*mv.f[3];
+  }
+}
+
+ubool gl_mesh_visible(const vec4 mvp[4], const vec4 &min, const vec4 &max) {
+  // The box is off screen if every corner is outside the same clip plane
+  u32 outside = 0x3f;
+  for (u32 i = 0; i < 8; ++i) {
+    const vec4 clip = mvp[0]*((i & 1) ? max.f[0] : min.f[0]) +
+                      mvp[1]*((i & 2) ? max.f[1] : min.f[1]) +
+                      mvp[2]*((i & 4) ? max.f[2] : min.f[2]) + mvp[3];
+    const f32 w = clip.f[3];
+
+    u32 out = 0;
+    for (uptr a = 0; a < 3; ++a) {
+      if (clip.f[a] < -w) out |= 1u << (a*2);
+      if (clip.f[a] > w) out |= 2u << (a*2);
+    }
+
+    outside &= out;
+    if (!outside) return true;
+  }
+
+  return false;
+}
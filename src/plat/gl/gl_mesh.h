@@ -0,0 +1,39 @@
+// Mesh building and view matrices
+// None of this uses GL, so the software renderer draws the same meshes from the same view
+
+#ifndef GL_MESH_H
+#define GL_MESH_H
+
+#include "types.h"
+#include "gl_vertex.h"
+#include "game/map.h"
+#include "game/state.h"
+
+// Clipping plane distances
+static constexpr f32 GLMESH_NEARCLIP = 8.f;
+static constexpr f32 GLMESH_FARCLIP = 2048.f;
+
+// Number of faces gl_mesh_buildCube writes for a cube, flat sides are skipped
+uptr gl_mesh_cubeFaces(const map_cube_t &c);
+
+// Write the faces of a cube, 4 vertices and 6 indices each,
+// indices start at firstVert, returns the number of faces
+// coord and layer are where the cube's image is in the texture
+uptr gl_mesh_buildCube(const map_cube_t &c, const vec2_2 &coord, f32 layer,
+                       gl_vertex_t *verts, u16 *inds, uptr firstVert);
+
+// NOTE: All matrices are column-major
+
+// Fill model view matrix of a view
+void gl_mesh_modelView(const game_state_view_t &view, vec4 modelView[4]);
+
+// Fill projection matrix, projDist is the distance to the projection plane
+void gl_mesh_projection(f32 projDist, u32 width, u32 height, vec4 projection[4]);
+
+// Combine model view and projection matrices
+void gl_mesh_mvp(const vec4 modelView[4], const vec4 projection[4], vec4 mvp[4]);
+
+// If any of a box can be on screen
+ubool gl_mesh_visible(const vec4 mvp[4], const vec4 &min, const vec4 &max);
+
+#endif //GL_MESH_H
@@ -4,7 +4,9 @@
 #include "gl_render.h"
 #include "gl_shader.h"
 #include "gl_buffer.h"
+#include "gl_mesh.h"
 #include "gl_glf.h"
+#include "prof.h"
 
 #include <math.h>
 
@@ -15,6 +17,7 @@ static const char vertexCode[] =
 	"layout(location = 0) in vec4 inPos;\n"
 	"layout(location = 1) in vec2 inCoord;\n"
   "layout(location = 2) in vec4 inCol;\n"
+  "layout(location = 3) in float inLayer;\n"
   "\n"
   "layout(std140) uniform block_t {\n"
   "  mat4 modelView;\n"
@@ -23,11 +26,13 @@ static const char vertexCode[] =
 	"\n"
 	"out vec2 coord;\n"
   "out vec4 col;\n"
+  "flat out float layer;\n"
 	"\n"
 	"void main() {\n"
 	"  gl_Position = block.projection*block.modelView * inPos;\n"
 	"  coord = inCoord;\n"
   "  col = inCol;\n"
+  "  layer = inLayer;\n"
 	"}\n";
 
 static const char fragmentCode[] =
@@ -35,30 +40,24 @@ static const char fragmentCode[] =
 	"\n"
 	"in vec2 coord;\n"
   "in vec4 col;\n"
+  "flat in float layer;\n"
   "\n"
   "layout(std140) uniform block_t {\n"
   "  mat4 modelView;\n"
   "  mat4 projection;\n"
   "} block;\n"
 	"\n"
-  "uniform sampler2D tex;\n"
+  "uniform sampler2DArray tex;\n"
 	"\n"
 	"out vec4 fragCol;\n"
 	"\n"
 	"void main() {\n"
-	"  fragCol = texture(tex, coord)*col;\n"
+	"  fragCol = texture(tex, vec3(coord, layer))*col;\n"
 	"}\n";
 
-static const vec4 identMat[4] = {
-  vec4(1.f, 0.f, 0.f, 0.f),
-  vec4(0.f, 1.f, 0.f, 0.f),
-  vec4(0.f, 0.f, 1.f, 0.f),
-  vec4(0.f, 0.f, 0.f, 1.f)
-};
-
-gl_render_t::gl_render_t(mem_t &m, const game_state_t &s, u32 width, u32 height) :
-	m_m(m), m_program(vertexCode, fragmentCode),
-  m_buf(m, 6144, 9216)
+gl_render_t::gl_render_t(mem_t &m, job_system_t &jobs, const game_state_t &s, u32 width, u32 height) :
+	m_m(m), m_jobs(jobs), m_program(vertexCode, fragmentCode),
+  m_buf(m, 6144, 9216), m_mapGen(0), m_atlas{}, m_atlasName{}
 {
 	// Log vendor info
 	const char * const vendor = (const char*)GLF(GL::GetString(GL::VENDOR));
@@ -84,29 +83,8 @@ gl_render_t::gl_render_t(mem_t &m, const game_state_t &s, u32 width, u32 height)
 	m_program.use();
 
   // Setup projection matrix
-  //
-  // projection =
-  // m_projDist*invAspect 0          0                            0
-  // 0                    m_projDist 0                            0
-  // 0                    0          (farClip+nearClip*2)/farClip nearClip*-2
-  // 0                    0          1                            0
-  memcpy((void*)m_buf.block().projection, &identMat, sizeof(identMat));
-
-  const f32 invAspect = (f32)height/(f32)width;
-
-  // Distance to projection plane
   m_projDist = 1.f/tanf(s.fovy*0.5f);
-
-  // Near clipping plane distance
-  static const f32 nearClip = 8.f;
-
-  // Far clipping plane distance
-  static const f32 farClip = 2048.f;
-
-  m_buf.block().projection[0].f[0] = m_projDist*invAspect;
-  m_buf.block().projection[1].f[1] = m_projDist;
-  m_buf.block().projection[2] = vec4(0.f, 0.f, (farClip+nearClip*2.f)/farClip, 1.f);
-  m_buf.block().projection[3] = vec4(0.f, 0.f, nearClip*-2.f, 0.f);
+  gl_mesh_projection(m_projDist, width, height, m_buf.block().projection);
 
   // Enable depth buffer
   GLF(GL::Enable(GL::DEPTH_TEST));
@@ -116,84 +94,43 @@ gl_render_t::gl_render_t(mem_t &m, const game_state_t &s, u32 width, u32 height)
 gl_render_t::~gl_render_t() {
 }
 
-ubool gl_render_t::render(game_state_render_t &state) {
-  // Check if we should load anything
-  if (state.load) {
-    for (atlas_id_t i = 0; i < ATLAS_COUNT; ++i) {
-      if (state.atlas[i])
-        m_texture.load(i, state.atlas[i]);
-    }
-
-    // Load map
-    m_buf.clearBaseVerts();
-    for (uptr i = 0; i < state.game->map.cubeCount; ++i)
-      m_buf.addCube(m_texture, state.game->map.cubes[i]);
+ubool gl_render_t::render(const game_state_snapshot_t &snap) {
+  PROF_ZONE("render");
 
-    state.load = false;
+  // Resize if the window changed size
+  if ((snap.width != m_width) || (snap.height != m_height)) {
+    if (!resize(snap.width, snap.height)) return false;
   }
 
-  // Setup model view matrix
-  memcpy((void*)m_buf.block().modelView, &identMat, sizeof(identMat));
-
-  // The origin of the yaw is pointing right
-  const f32 c = cosf(state.game->yaw-(f32)M_PI*0.5f);
-  const f32 s = sinf(state.game->yaw-(f32)M_PI*0.5f);
-
-  const f32 pc = cosf(state.game->pitch);
-  const f32 ps = sinf(state.game->pitch);
-
-  const f32 x = state.game->pos.f[0];
-  const f32 y = state.game->pos.f[1];
-  const f32 z = state.game->pos.f[2];
-
-  // Setup model view matrix, contains
-  // transformation matrix, yaw rotation matrix and
-  // pitch rotation matrix, performed on the vertex
-  // in that order
-  //
-  // NOTE: This can be optimized by storing c, s,
-  // pc and ps in a vector, and x, y, z in another vector,
-  // and shuffling them around instead of referring to them
-  // as singular values. I don't know anyone insane enough
-  // to do that though.
-  //
-  // modelView =
-  // c     0   s    c*-x+s*-z
-  // ps*s  pc -ps*c ps*s*-x+pc*-y+ps*c*z
-  // pc*-s ps  pc*c pc*s*x+ps*-y+pc*c*-z
-  // 0     0   0    1
-  m_buf.block().modelView[0] =
-    vec4(c, ps, pc, 0.f)*vec4(1.f, s, -s, 1.f);
-  m_buf.block().modelView[1] =
-    vec4(0.f, pc, ps, 0.f);
-  m_buf.block().modelView[2] =
-    vec4(s, -ps, pc, 0.f)*vec4(1.f, c, c, 1.f);
-  m_buf.block().modelView[3] =
-    vec4(c, ps, pc, 1.f)*vec4(-x, s, s, 1.f)*vec4(1.f, -x, x, 1.f) +
-    vec4(s, pc, ps, 0.f)*vec4(-z, -y, -y, 0.f) +
-    vec4(0.f, ps, pc, 0.f)*vec4(0.f, c, c, 0.f)*vec4(0.f, z, -z, 0.f);
-
-  GLF(GL::Clear(GL::COLOR_BUFFER_BIT|GL::DEPTH_BUFFER_BIT));
+  // Load atlases if they changed, the pointers are compared as well
+  // since an atlas can be mapped somewhere else after it's unmapped
+  ubool reload = (snap.mapGen != m_mapGen);
+  for (atlas_id_t i = 0; i < ATLAS_COUNT; ++i) {
+    if ((snap.atlas[i] != m_atlas[i]) || (snap.atlasName[i] != m_atlasName[i])) reload = true;
+  }
 
-#ifdef GAME_STATE_EDITOR
+  if (reload) {
+    for (atlas_id_t i = 0; i < ATLAS_COUNT; ++i) {
+      m_atlas[i] = snap.atlas[i];
+      m_atlasName[i] = snap.atlasName[i];
+    }
 
-  // Draw editor cubes
-  for (uptr i = 0; i <= state.game->curMap->cubeCount; ++i) {
-    m_buf.addCube(m_texture, state.game->curMap->cubes[i], false);
+    m_texture.load(snap.atlas, snap.atlasName);
+    m_mapGen = snap.mapGen;
   }
 
-  // Draw loading zones
-  map_cube_t cube;
+  // Rebuild map chunks that changed, image coordinates depend on the texture layers
+  // so every chunk is rebuilt after a load
+  m_buf.buildChunks(m_jobs, m_texture, snap.cubes, snap.cubeCount, snap.chunks, reload);
 
-  cube = state.game->curMap->prevLoad;
-  cube.img = str_hash("prevLoad");
-  m_buf.addCube(m_texture, cube, false, ATLAS_GLOBAL);
+  // Setup model view matrix
+  gl_mesh_modelView(snap.view, m_buf.block().modelView);
 
-  cube = state.game->curMap->nextLoad;
-  cube.img = str_hash("nextLoad");
-  m_buf.addCube(m_texture, cube, false, ATLAS_GLOBAL);
+  GLF(GL::Clear(GL::COLOR_BUFFER_BIT|GL::DEPTH_BUFFER_BIT));
 
-#endif
+  // Draw dynamic objects
+  for (uptr i = 0; i < snap.objCount; ++i)
+    m_buf.addCube(m_texture, snap.objs[i].cube, snap.objs[i].atlas);
 
   m_buf.flushBuffers();
 
@@ -201,6 +138,9 @@ ubool gl_render_t::render(game_state_render_t &state) {
 }
 
 ubool gl_render_t::resize(u32 width, u32 height) {
+  m_width = width;
+  m_height = height;
+
   // Resize projection matrix
   m_buf.block().projection[0].f[0] = (f32)height/(f32)width*m_projDist;
 
@@ -3,6 +3,7 @@
 
 #include "types.h"
 #include "mem.h"
+#include "job.h"
 #include "game/state.h"
 
 #include "opengl.h"
@@ -23,6 +24,7 @@ private:
 	} m_loadFuncs;
 	
 	mem_t &m_m;
+  job_system_t &m_jobs; // Used to build level meshes
 
 	gl_shader_program_t m_program;
 
@@ -32,12 +34,20 @@ private:
 
   f32 m_projDist; // Distance to the projection plane, used when resizing the window
 
+  u32 m_width, m_height; // Viewport size
+
+  // Map and atlases of the last snapshot, to tell when they have to be loaded
+  u32 m_mapGen;
+  const atlas_t *m_atlas[ATLAS_COUNT];
+  str_hash_t m_atlasName[ATLAS_COUNT];
+
 public:
-	gl_render_t(mem_t &m, const game_state_t &s, u32 width, u32 height);
+	gl_render_t(mem_t &m, job_system_t &jobs, const game_state_t &s, u32 width, u32 height);
 	~gl_render_t();
 
+	// Render a snapshot of the game
 	// Returns false if update/resize failed
-	ubool render(game_state_render_t &state);
+	ubool render(const game_state_snapshot_t &snap);
 	ubool resize(u32 width, u32 height);
 };
 
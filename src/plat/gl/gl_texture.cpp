@@ -1,32 +1,37 @@
 #include "types.h"
+#include "util.h"
+#include "log.h"
 #include "opengl.h"
 #include "gl_glf.h"
 #include "game/atlas.h"
 #include "gl_texture.h"
 
-const vec2_2 gl_texture_atlasOffset[ATLAS_COUNT] = {
-  vec2_2(0.f, 0.f, 0.f, 0.f),
-  vec2_2((f32)ATLAS_WIDTH/(f32)GLTEXTURE_WIDTH, 0.f, 0.f, 0.f),
-};
+#include <cstring>
 
 gl_texture_t::gl_texture_t() :
-  m_atlas{}
+  m_format(GL::NONE), m_layers{}, m_loadCount(0), m_atlas{}, m_atlasName{}
 {
+  m_s3tc = GL::hasExt("GL_EXT_texture_compression_s3tc");
+  if (!m_s3tc) log_note("S3TC isn't supported, compressed atlases will be decoded on upload");
+
+  for (atlas_id_t i = 0; i < ATLAS_COUNT; ++i) {
+    for (u32 p = 0; p < GLTEXTURE_MAXPAGES; ++p)
+      m_atlasLayer[i][p] = GLTEXTURE_NOLAYER;
+  }
+
   // Initialize texture object
   GLF(GL::GenTextures(1, &m_tex));
-  GLF(GL::BindTexture(GL::TEXTURE_2D, m_tex));
+  GLF(GL::BindTexture(GL::TEXTURE_2D_ARRAY, m_tex));
 
   // Set texture parameters
-  GLF(GL::TexParameteri(GL::TEXTURE_2D, GL::TEXTURE_WRAP_S, GL::CLAMP_TO_EDGE));
-  GLF(GL::TexParameteri(GL::TEXTURE_2D, GL::TEXTURE_WRAP_T, GL::CLAMP_TO_EDGE));
-  GLF(GL::TexParameteri(GL::TEXTURE_2D, GL::TEXTURE_MIN_FILTER, GL::LINEAR));
-  GLF(GL::TexParameteri(GL::TEXTURE_2D, GL::TEXTURE_MAG_FILTER, GL::LINEAR));
-  GLF(GL::TexParameteri(GL::TEXTURE_2D, GL::TEXTURE_MAX_LEVEL, 0));
+  GLF(GL::TexParameteri(GL::TEXTURE_2D_ARRAY, GL::TEXTURE_WRAP_S, GL::CLAMP_TO_EDGE));
+  GLF(GL::TexParameteri(GL::TEXTURE_2D_ARRAY, GL::TEXTURE_WRAP_T, GL::CLAMP_TO_EDGE));
+  GLF(GL::TexParameteri(GL::TEXTURE_2D_ARRAY, GL::TEXTURE_MIN_FILTER, GL::LINEAR_MIPMAP_LINEAR));
+  GLF(GL::TexParameteri(GL::TEXTURE_2D_ARRAY, GL::TEXTURE_MAG_FILTER, GL::LINEAR));
+  GLF(GL::TexParameteri(GL::TEXTURE_2D_ARRAY, GL::TEXTURE_MAX_LEVEL, ATLAS_LEVELS-1));
 
   // Initialize texture image
-  GLF(GL::TexImage2D(GL::TEXTURE_2D, 0, GL::RGBA8,
-                     GLTEXTURE_WIDTH, GLTEXTURE_HEIGHT, 0,
-                     GL::RGBA, GL::UNSIGNED_BYTE, NULL));
+  setFormat(m_s3tc ? (GLenum)GL::COMPRESSED_RGBA_S3TC_DXT5 : (GLenum)GL::RGBA8);
 }
 
 gl_texture_t::~gl_texture_t() {
@@ -34,10 +39,36 @@ gl_texture_t::~gl_texture_t() {
   GLF(GL::DeleteTextures(1, &m_tex));
 }
 
-vec2_2 gl_texture_t::imgCoord(atlas_id_t atlas, str_hash_t name) const {
+void gl_texture_t::setFormat(GLenum format) {
+  m_format = format;
+
+  // Initialize texture image, with every level
+  GLF(GL::BindTexture(GL::TEXTURE_2D_ARRAY, m_tex));
+  for (u32 l = 0; l < ATLAS_LEVELS; ++l) {
+    GLF(GL::TexImage3D(GL::TEXTURE_2D_ARRAY, l, format,
+                       atlas_levelWidth(l), atlas_levelHeight(l), GLTEXTURE_LAYERS, 0,
+                       GL::RGBA, GL::UNSIGNED_BYTE, NULL));
+  }
+
+  // Every layer is empty now
+  for (u32 i = 0; i < GLTEXTURE_LAYERS; ++i)
+    m_layers[i].name = 0;
+}
+
+u32 gl_texture_t::findLayer(str_hash_t name, u32 page) const {
+  for (u32 i = 0; i < GLTEXTURE_LAYERS; ++i) {
+    if ((m_layers[i].name == name) && (m_layers[i].page == page)) return i;
+  }
+
+  return GLTEXTURE_NOLAYER;
+}
+
+vec2_2 gl_texture_t::imgCoord(atlas_id_t atlas, str_hash_t name, f32 &layer) const {
   // Atlas coordinate normalizer
-  static const vec2_2 normMul(1.f/(f32)GLTEXTURE_WIDTH, 1.f/(f32)GLTEXTURE_HEIGHT,
-                              1.f/(f32)GLTEXTURE_WIDTH, 1.f/(f32)GLTEXTURE_HEIGHT);
+  static const vec2_2 normMul(1.f/(f32)ATLAS_WIDTH, 1.f/(f32)ATLAS_HEIGHT,
+                              1.f/(f32)ATLAS_WIDTH, 1.f/(f32)ATLAS_HEIGHT);
+
+  layer = 0.f;
 
   // If there's no atlas in this spot, return zeros
   if (!m_atlas[atlas]) return vec2_2(0.f);
@@ -46,27 +77,163 @@ vec2_2 gl_texture_t::imgCoord(atlas_id_t atlas, str_hash_t name) const {
   for (uptr i = m_atlas[atlas]->imageCount; i--;) {
     // atlas imgDim, normalized
     if (m_atlas[atlas]->imgNames[i] == name) {
-      return gl_texture_atlasOffset[atlas]+vec4_ivec4(m_atlas[atlas]->imgDim[i].v())*normMul;
+      const u32 page = m_atlas[atlas]->imgPage[i];
+      if ((page >= GLTEXTURE_MAXPAGES) || (m_atlasLayer[atlas][page] == GLTEXTURE_NOLAYER))
+        return vec2_2(0.f);
+
+      layer = (f32)m_atlasLayer[atlas][page];
+      return vec4_ivec4(m_atlas[atlas]->imgDim[i].v())*normMul;
     }
   }
 
   return vec2_2(0.f);
 }
 
-ubool gl_texture_t::load(atlas_id_t id, const atlas_t *atlas) {
-  static const u32 atlasIntOffset[ATLAS_COUNT][2] = {
-    {0, 0},
-    {ATLAS_WIDTH, 0},
-  };
-
-  if (atlas) {
-    GLF(GL::TexSubImage2D(GL::TEXTURE_2D, 0,
-                          atlasIntOffset[id][0], atlasIntOffset[id][1],
-                          ATLAS_WIDTH, ATLAS_HEIGHT,
-                          GL::RGBA, GL::UNSIGNED_BYTE, atlas->data));
+void gl_texture_t::upload(u32 layer, const atlas_t *atlas, u32 page) {
+  const atlas_format_t format = atlas->format;
+
+  // Upload every level
+  for (u32 l = 0; l < ATLAS_LEVELS; ++l) {
+    const u32 w = atlas_levelWidth(l), h = atlas_levelHeight(l);
+    const u8 *data = atlas->level(page, l);
+
+    if (format == ATLAS_FORMAT_RGBA8) {
+      // Can only be uploaded as is
+      GLF(GL::TexSubImage3D(GL::TEXTURE_2D_ARRAY, l, 0, 0, layer, w, h, 1,
+                            GL::RGBA, GL::UNSIGNED_BYTE, data));
+    } else if ((format == ATLAS_FORMAT_BC3) && (m_format != GL::RGBA8)) {
+      // Already in the texture's format
+      GLF(GL::CompressedTexSubImage3D(GL::TEXTURE_2D_ARRAY, l, 0, 0, layer, w, h, 1,
+                                      m_format, atlas_levelSize(format, l), data));
+    } else {
+      // Convert a row of blocks at a time, BC1 gets an opaque alpha block to make it BC3,
+      // and if the texture isn't compressed blocks get decoded
+      static u8 strip[ATLAS_WIDTH*ATLAS_BLOCK_SIZE*4];
+      static const u8 opaqueAlpha[8] = {0xff, 0xff};
+
+      const uptr blockSize = (format == ATLAS_FORMAT_BC1) ? 8 : 16;
+      const u32 blocksX = (w+ATLAS_BLOCK_SIZE-1)/ATLAS_BLOCK_SIZE;
+
+      for (u32 by = 0; by < h; by += ATLAS_BLOCK_SIZE) {
+        const u32 stripH = util_min<u32>(h-by, ATLAS_BLOCK_SIZE);
+
+        if (m_format == GL::RGBA8) {
+          atlas_col_t *out = (atlas_col_t*)strip;
+
+          for (u32 bx = 0; bx < blocksX; ++bx, data += blockSize) {
+            atlas_col_t dec[16];
+            atlas_decodeBlock(format, data, dec);
+
+            for (u32 py = 0; py < stripH; ++py) {
+              for (u32 px = 0; (px < ATLAS_BLOCK_SIZE) && (bx*ATLAS_BLOCK_SIZE+px < w); ++px)
+                out[py*w + bx*ATLAS_BLOCK_SIZE + px] = dec[py*4 + px];
+            }
+          }
+
+          GLF(GL::TexSubImage3D(GL::TEXTURE_2D_ARRAY, l, 0, by, layer, w, stripH, 1,
+                                GL::RGBA, GL::UNSIGNED_BYTE, strip));
+        } else {
+          for (u32 bx = 0; bx < blocksX; ++bx, data += 8) {
+            memcpy(strip + bx*16, opaqueAlpha, 8);
+            memcpy(strip + bx*16 + 8, data, 8);
+          }
+
+          GLF(GL::CompressedTexSubImage3D(GL::TEXTURE_2D_ARRAY, l, 0, by, layer, w, stripH, 1,
+                                          m_format, blocksX*16, strip));
+        }
+      }
+    }
   }
+}
+
+ubool gl_texture_t::load(const atlas_t *const atlas[ATLAS_COUNT], const str_hash_t name[ATLAS_COUNT]) {
+  ubool ret = true;
 
-  m_atlas[id] = atlas;
+  for (atlas_id_t i = 0; i < ATLAS_COUNT; ++i) {
+    m_atlas[i] = atlas[i];
+    m_atlasName[i] = atlas[i] ? name[i] : 0;
+
+    for (u32 p = 0; p < GLTEXTURE_MAXPAGES; ++p)
+      m_atlasLayer[i][p] = GLTEXTURE_NOLAYER;
+
+    if (!atlas[i]) continue;
+
+    // Atlases from before mipmapping, or with a partial mip chain, aren't supported
+    if ((atlas[i]->magic != ATLAS_MAGIC) || (atlas[i]->levelCount != ATLAS_LEVELS) ||
+        (atlas[i]->format >= ATLAS_FORMAT_COUNT)) {
+      log_warning("Invalid atlas format, or atlas has %u mip levels instead of %u!",
+                  (u32)atlas[i]->levelCount, ATLAS_LEVELS);
+      m_atlas[i] = NULL;
+      m_atlasName[i] = 0;
+      ret = false;
+      continue;
+    }
+
+    if (atlas[i]->pageCount > GLTEXTURE_MAXPAGES)
+      log_warning("Atlas has %u pages, only the first %u are loaded!",
+                  (u32)atlas[i]->pageCount, GLTEXTURE_MAXPAGES);
+  }
+
+  // The texture can only be compressed if every atlas is,
+  // changing the format empties every layer
+  ubool compressed = m_s3tc;
+  for (atlas_id_t i = 0; i < ATLAS_COUNT; ++i) {
+    if (m_atlas[i] && (m_atlas[i]->format == ATLAS_FORMAT_RGBA8)) compressed = false;
+  }
+
+  const GLenum format = compressed ? (GLenum)GL::COMPRESSED_RGBA_S3TC_DXT5 : (GLenum)GL::RGBA8;
+  if (format != m_format) setFormat(format);
+
+  GLF(GL::BindTexture(GL::TEXTURE_2D_ARRAY, m_tex));
+
+  // Layers used in this load are marked with the load count
+  const u32 cur = ++m_loadCount;
+
+  // Use pages that are already loaded first, so they don't get replaced
+  for (atlas_id_t i = 0; i < ATLAS_COUNT; ++i) {
+    if (!m_atlas[i]) continue;
+
+    for (u32 p = 0; p < util_min<u32>(m_atlas[i]->pageCount, GLTEXTURE_MAXPAGES); ++p) {
+      const u32 layer = findLayer(m_atlasName[i], p);
+      if (layer == GLTEXTURE_NOLAYER) continue;
+
+      m_layers[layer].lastUse = cur;
+      m_atlasLayer[i][p] = layer;
+    }
+  }
+
+  // Upload the rest into the least recently used layers
+  for (atlas_id_t i = 0; i < ATLAS_COUNT; ++i) {
+    if (!m_atlas[i]) continue;
+
+    for (u32 p = 0; p < util_min<u32>(m_atlas[i]->pageCount, GLTEXTURE_MAXPAGES); ++p) {
+      if (m_atlasLayer[i][p] != GLTEXTURE_NOLAYER) continue;
+
+      // Another spot could have the same atlas, and already uploaded it
+      u32 layer = findLayer(m_atlasName[i], p);
+
+      if (layer == GLTEXTURE_NOLAYER) {
+        for (u32 l = 0; l < GLTEXTURE_LAYERS; ++l) {
+          if ((m_layers[l].lastUse != cur) &&
+              ((layer == GLTEXTURE_NOLAYER) || (m_layers[l].lastUse < m_layers[layer].lastUse)))
+            layer = l;
+        }
+
+        if (layer == GLTEXTURE_NOLAYER) {
+          log_warning("Out of texture layers, page %u of atlas %d isn't loaded!", p, i);
+          ret = false;
+          continue;
+        }
+
+        m_layers[layer].name = m_atlasName[i];
+        m_layers[layer].page = p;
+        upload(layer, m_atlas[i], p);
+      }
+
+      m_layers[layer].lastUse = cur;
+      m_atlasLayer[i][p] = layer;
+    }
+  }
 
-  return true;
+  return ret;
 }
@@ -5,19 +5,50 @@
 #include "opengl.h"
 #include "game/atlas.h"
 
-// Pack multiple atlas's into single texture
-static constexpr u32 GLTEXTURE_WIDTH = ATLAS_WIDTH*2;
-static constexpr u32 GLTEXTURE_HEIGHT = ATLAS_HEIGHT;
+// Atlas pages are stored in layers of an array texture, which works like a cache:
+// pages stay in their layer until the layer is needed for another page,
+// so switching back to an atlas that was loaded recently doesn't upload anything
+static constexpr u32 GLTEXTURE_LAYERS = 6;
 
-// Atlas offset list
-extern const vec2_2 gl_texture_atlasOffset[ATLAS_COUNT];
+// Maximum number of pages of an atlas that can be loaded at once
+static constexpr u32 GLTEXTURE_MAXPAGES = 4;
+
+// Page isn't in any layer
+static constexpr u32 GLTEXTURE_NOLAYER = 0xffffffffu;
 
 class gl_texture_t {
 private:
   GLuint m_tex; // Texture object handle
 
+  // Texture internal format, either RGBA8 or DXT5
+  // The texture is DXT5 if S3TC is supported, and every atlas is compressed
+  GLenum m_format;
+  ubool m_s3tc; // If S3TC is supported
+
+  // Texture layer contents
+  struct layer_t {
+    str_hash_t name; // Name of atlas in layer, 0 if empty
+    u32 page; // Page of atlas in layer
+    u32 lastUse; // Last load the layer was used in, for finding the least recently used layer
+  } m_layers[GLTEXTURE_LAYERS];
+
+  u32 m_loadCount; // Number of times load was called
+
   // Atlas list
   const atlas_t *m_atlas[ATLAS_COUNT];
+  str_hash_t m_atlasName[ATLAS_COUNT];
+
+  // Layer each page of each atlas is in
+  u32 m_atlasLayer[ATLAS_COUNT][GLTEXTURE_MAXPAGES];
+
+  // Allocate texture storage in format, emptying every layer
+  void setFormat(GLenum format);
+
+  // Find layer that contains page of atlas, GLTEXTURE_NOLAYER if there's none
+  u32 findLayer(str_hash_t name, u32 page) const;
+
+  // Upload page of atlas into layer, converting it to the texture format
+  void upload(u32 layer, const atlas_t *atlas, u32 page);
 
 public:
   gl_texture_t();
@@ -30,13 +61,15 @@ public:
 
   // Get image offset in texture
   // 01 contains texture position, 23 contains texture size
-  vec2_2 imgCoord(atlas_id_t atlas, str_hash_t name) const;
+  // layer is set to the texture layer the image is in
+  vec2_2 imgCoord(atlas_id_t atlas, str_hash_t name, f32 &layer) const;
 
-  // Load atlas into texture
-  // Overwrites previous atlas in spot
-  // If atlas is NULL, frees atlas in spot
+  // Load every atlas into texture, atlas names identify which atlases
+  // are already loaded
+  // If an atlas is NULL, frees atlas in spot, but it stays loaded
+  // until another atlas needs it's layers
   // Returns false on failure
-  ubool load(atlas_id_t id, const atlas_t *atlas);
+  ubool load(const atlas_t *const atlas[ATLAS_COUNT], const str_hash_t name[ATLAS_COUNT]);
 };
 
 #endif //GL_TEXTURE_H
@@ -36,6 +36,7 @@ typedef iptr GLsizeiptr;
 typedef i64  GLint64;
 typedef u16  GLhalf;
 typedef u64  GLuint64;
+typedef struct __GLsync *GLsync;
 
 // Extension function list, define DEFEXT(_type, _name, ...) before using this macro
 #define OPENGL_EXTFUNC_LIST												\
@@ -76,7 +77,19 @@ typedef u64  GLuint64;
 	DEFEXT(void,            Uniform2f,                  GLint, GLfloat, GLfloat) \
 	DEFEXT(void,			GetBufferSubData,			GLenum, GLintptr, GLsizeiptr, void*) \
 	DEFEXT(void*,			MapBuffer,					GLenum, GLenum)	\
-	DEFEXT(GLboolean,		UnmapBuffer,				GLenum)
+	DEFEXT(GLboolean,		UnmapBuffer,				GLenum)			\
+	DEFEXT(void,			TexImage3D,					GLenum, GLint, GLint, GLsizei, GLsizei, GLsizei, GLint, GLenum, GLenum, const void*) \
+	DEFEXT(void,			TexSubImage3D,				GLenum, GLint, GLint, GLint, GLint, GLsizei, GLsizei, GLsizei, GLenum, GLenum, const void*) \
+	DEFEXT(void,			CompressedTexSubImage3D,	GLenum, GLint, GLint, GLint, GLint, GLsizei, GLsizei, GLsizei, GLenum, GLsizei, const void*) \
+	DEFEXT(void*,			MapBufferRange,				GLenum, GLintptr, GLsizeiptr, GLbitfield) \
+	DEFEXT(GLsync,			FenceSync,					GLenum, GLbitfield) \
+	DEFEXT(GLenum,			ClientWaitSync,				GLsync, GLbitfield, GLuint64) \
+	DEFEXT(void,			DeleteSync,					GLsync)			\
+	DEFEXT(void,			DrawElementsBaseVertex,		GLenum, GLsizei, GLenum, const void*, GLint)
+
+// Optional extension function list, these are NULL if they're not supported
+#define OPENGL_OPTEXTFUNC_LIST											\
+	DEFEXT(void,			BufferStorage,				GLenum, GLsizeiptr, const void*, GLbitfield)
 
 namespace GL {
 	// ******************
@@ -146,6 +159,28 @@ namespace GL {
 		STREAM_DRAW		= 0x88e0,
 		STREAM_READ		= 0x88e1,
 		STREAM_COPY		= 0x88e2,
+
+		////////////////////////////////////
+		// Buffer mapping and storage bits
+		MAP_READ_BIT				= 0x0001,
+		MAP_WRITE_BIT				= 0x0002,
+		MAP_INVALIDATE_RANGE_BIT	= 0x0004,
+		MAP_INVALIDATE_BUFFER_BIT	= 0x0008,
+		MAP_FLUSH_EXPLICIT_BIT		= 0x0010,
+		MAP_UNSYNCHRONIZED_BIT		= 0x0020,
+		MAP_PERSISTENT_BIT			= 0x0040,
+		MAP_COHERENT_BIT			= 0x0080,
+		DYNAMIC_STORAGE_BIT			= 0x0100,
+		CLIENT_STORAGE_BIT			= 0x0200,
+
+		////////////////////
+		// Sync objects
+		SYNC_GPU_COMMANDS_COMPLETE	= 0x9117,
+		SYNC_FLUSH_COMMANDS_BIT		= 0x0001,
+		ALREADY_SIGNALED			= 0x911a,
+		TIMEOUT_EXPIRED				= 0x911b,
+		CONDITION_SATISFIED			= 0x911c,
+		WAIT_FAILED					= 0x911d,
 		
 		////////////////////
 		// Primitives
@@ -216,6 +251,7 @@ namespace GL {
 		RENDERER                 = 0x1f01,
 		VERSION                  = 0x1f02,
 		SHADING_LANGUAGE_VERSION = 0x8b8c,
+		EXTENSIONS               = 0x1f03,
 
 		////////////////////////////////
 		// GetIntegerv parameters
@@ -225,6 +261,10 @@ namespace GL {
 		ELEMENT_ARRAY_BUFFER_BINDING = 0x8895,
 		PIXEL_UNPACK_BUFFER_BINDING  = 0x88ef,
 		UNIFORM_BUFFER_BINDING       = 0x8a28,
+
+		// Limits
+		NUM_EXTENSIONS               = 0x821d,
+		UNIFORM_BUFFER_OFFSET_ALIGNMENT = 0x8a34,
 		
 		//////////////////////////////////
 		// 2-dimensional texture targets
@@ -241,6 +281,12 @@ namespace GL {
 		TEXTURE_CUBE_MAP_POSITIVE_Z	= 0x8519,
 		TEXTURE_CUBE_MAP_NEGATIVE_Z	= 0x851a,
 		PROXY_TEXTURE_CUBE_MAP		= 0x851b,
+
+		//////////////////////////////////
+		// 3-dimensional texture targets
+		TEXTURE_3D					= 0x806f,
+		TEXTURE_2D_ARRAY			= 0x8c1a,
+		PROXY_TEXTURE_2D_ARRAY		= 0x8c1b,
 		
 		////////////////////////////////
 		// Texture parameters
@@ -393,6 +439,12 @@ namespace GL {
 		COMPRESSED_SRGB_ALPHA_BPTC_UNORM	= 0x8e8d,
 		COMPRESSED_RGB_BPTC_SIGNED_FLOAT	= 0x8e8e,
 		COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT	= 0x8e8f,
+
+		// EXT_texture_compression_s3tc
+		COMPRESSED_RGB_S3TC_DXT1			= 0x83f0,
+		COMPRESSED_RGBA_S3TC_DXT1			= 0x83f1,
+		COMPRESSED_RGBA_S3TC_DXT3			= 0x83f2,
+		COMPRESSED_RGBA_S3TC_DXT5			= 0x83f3,
 		
 		////////////////////////////
 		// Texel types
@@ -564,14 +616,19 @@ namespace GL {
 		extern _name ## _t _name;
 	
 	OPENGL_EXTFUNC_LIST
+	OPENGL_OPTEXTFUNC_LIST
 	
 #	undef DEFEXT
 	
 	// Extension loading function, platform dependent
-	// Returns false if functions failed to load
+	// Returns false if functions failed to load, optional functions are left NULL
 	// TODO: I should look into putting the extension functions
 	//       into a structure, instead of leaving them global.
 	ubool loadExt();
+
+	// Check if the context supports an extension, like "GL_EXT_texture_compression_s3tc"
+	// Platform dependent, only valid after loadExt
+	ubool hasExt(const char *name);
 }
 
 #endif //OPENGL_H
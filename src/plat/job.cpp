@@ -0,0 +1,342 @@
+#include "types.h"
+#include "util.h"
+#include "atomic.h"
+#include "job.h"
+
+#include <cstring>
+
+static_assert((JOB_POOLSIZE & (JOB_POOLSIZE-1)) == 0, "JOB_POOLSIZE must be a power of 2!");
+
+// Number of times an idle worker looks for jobs before it sleeps
+static constexpr u32 JOB_SPINCOUNT = 256;
+
+// Most jobs a parallelFor splits into, chunks are made bigger past that
+// It's well under JOB_POOLSIZE, so the jobs in flight around it aren't reused
+static constexpr uptr JOB_FORMAXJOBS = JOB_POOLSIZE/4;
+
+// Thread data, on separate cache lines since the ends of the deque
+// are written by different threads
+struct alignas(64) job_system_t::thread_t {
+  // Deque ends, the owner pushes and pops at bottom, thieves steal at top
+  // Only accessed atomically
+  i64 top;
+  alignas(64) i64 bottom;
+
+  // Deque entries, only accessed atomically
+  alignas(64) job_t *deque[JOB_POOLSIZE];
+
+  // Job pool, only used by the owner
+  job_t jobs[JOB_POOLSIZE];
+  u32 nextJob;
+
+  // Random state for picking who to steal from
+  u32 rng;
+
+  // Set while an external thread has the slot, only accessed atomically
+  ubool taken;
+};
+
+// Job system and index of the calling thread
+// An external thread gives it's slot back when it exits, so it has to exit
+// before the job system is destroyed
+static thread_local struct job_thread_t {
+  const job_system_t *sys;
+  u32 index;
+  ubool *taken; // NULL unless it's an external thread
+
+  ~job_thread_t() {
+    if (taken) atomic_store(taken, (ubool)false, ATOMIC_RELEASE);
+    taken = NULL;
+  }
+} job_thread = {NULL, 0, NULL};
+
+// Deque operations, this is the Chase-Lev deque with C11 atomics from
+// "Correct and Efficient Work-Stealing for Weak Memory Models" (Le et al. 2013)
+// with a fixed size
+
+// Push job on the bottom, returns false if the deque is full
+static ubool deque_push(i64 &top, i64 &bottom, job_t **deque, job_t *job) {
+  const i64 b = atomic_load(&bottom, ATOMIC_RELAXED);
+  const i64 t = atomic_load(&top, ATOMIC_ACQUIRE);
+
+  if (b-t >= (i64)JOB_POOLSIZE) return false;
+
+  atomic_store(deque + (b & (JOB_POOLSIZE-1)), job, ATOMIC_RELAXED);
+  atomic_fence(ATOMIC_RELEASE);
+  atomic_store(&bottom, b+1, ATOMIC_RELAXED);
+
+  return true;
+}
+
+// Pop job from the bottom, only done by the owner
+static job_t *deque_take(i64 &top, i64 &bottom, job_t **deque) {
+  const i64 b = atomic_load(&bottom, ATOMIC_RELAXED)-1;
+  atomic_store(&bottom, b, ATOMIC_RELAXED);
+  atomic_fence(ATOMIC_SEQCST);
+  i64 t = atomic_load(&top, ATOMIC_RELAXED);
+
+  if (t > b) {
+    // Empty
+    atomic_store(&bottom, b+1, ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  job_t *job = atomic_load(deque + (b & (JOB_POOLSIZE-1)), ATOMIC_RELAXED);
+
+  if (t == b) {
+    // Last job, race thieves for it
+    if (!atomic_cas(&top, t, t+1, ATOMIC_SEQCST)) job = NULL;
+    atomic_store(&bottom, b+1, ATOMIC_RELAXED);
+  }
+
+  return job;
+}
+
+// Steal job from the top, done by every other thread
+static job_t *deque_steal(i64 &top, i64 &bottom, job_t **deque) {
+  i64 t = atomic_load(&top, ATOMIC_ACQUIRE);
+  atomic_fence(ATOMIC_SEQCST);
+  const i64 b = atomic_load(&bottom, ATOMIC_ACQUIRE);
+
+  if (t >= b) return NULL;
+
+  job_t *job = atomic_load(deque + (t & (JOB_POOLSIZE-1)), ATOMIC_RELAXED);
+
+  // Lost the race to another thief, or the owner
+  if (!atomic_cas(&top, t, t+1, ATOMIC_SEQCST)) return NULL;
+
+  return job;
+}
+
+job_system_t::job_system_t(mem_t &m, u32 workerCount) :
+  m_m(m), m_queued(0), m_sleeping(0), m_quit(false), m_plat(NULL)
+{
+  if (workerCount == JOB_AUTO) {
+    const u32 cores = coreCount();
+    workerCount = cores ? cores-1 : 0;
+  }
+
+  m_workerCount = util_min(workerCount, JOB_MAXWORKERS);
+  m_threadCount = 1 + m_workerCount + JOB_MAXEXTERNAL;
+
+  // Allocate thread data, aligned to a cache line
+  const uptr size = m_threadCount*sizeof(thread_t);
+  m_threadMem = m_m.alloc(size+64);
+  if (!m_threadMem) throw log_except("Cannot allocate job system threads!");
+
+  m_threads = (thread_t*)util_alignUp<uptr>((uptr)m_threadMem, 64);
+  memset((void*)m_threads, 0, size);
+
+  for (u32 i = 0; i < m_threadCount; ++i)
+    m_threads[i].rng = 0x9e3779b9u*(i+1);
+
+  // We're thread 0
+  job_thread.sys = this;
+  job_thread.index = 0;
+  job_thread.taken = NULL;
+
+  if (!startWorkers()) {
+    m_m.free(m_threadMem);
+    throw log_except("Cannot start job workers!");
+  }
+
+  log_note("Job system running with %u workers", m_workerCount);
+}
+
+job_system_t::~job_system_t() {
+  atomic_store(&m_quit, (ubool)true);
+  stopWorkers();
+
+  if (job_thread.sys == this) {
+    job_thread.sys = NULL;
+    job_thread.taken = NULL;
+  }
+
+  m_m.free(m_threadMem);
+}
+
+job_system_t::thread_t &job_system_t::self() {
+  if (job_thread.sys != this) {
+    // First time this thread uses the job system, give it a free external slot
+    u32 index = 1 + m_workerCount;
+    for (; index < m_threadCount; ++index) {
+      ubool expected = false;
+      if (!atomic_load(&m_threads[index].taken, ATOMIC_RELAXED) &&
+          atomic_cas(&m_threads[index].taken, expected, (ubool)true, ATOMIC_ACQUIRE))
+        break;
+    }
+
+    if (index == m_threadCount)
+      throw log_except("Too many threads are using the job system! (increase JOB_MAXEXTERNAL in job.h)");
+
+    // Give back the slot of the job system we used before
+    if (job_thread.taken) atomic_store(job_thread.taken, (ubool)false, ATOMIC_RELEASE);
+
+    job_thread.sys = this;
+    job_thread.index = index;
+    job_thread.taken = &m_threads[index].taken;
+  }
+
+  return m_threads[job_thread.index];
+}
+
+job_t *job_system_t::get(thread_t &t) {
+  job_t *job = deque_take(t.top, t.bottom, t.deque);
+
+  if (!job) {
+    // Steal from everyone else, starting from a random thread
+    t.rng ^= t.rng << 13;
+    t.rng ^= t.rng >> 17;
+    t.rng ^= t.rng << 5;
+
+    const u32 start = t.rng % m_threadCount;
+    for (u32 i = 0; i < m_threadCount; ++i) {
+      thread_t &victim = m_threads[(start+i) % m_threadCount];
+      if (&victim == &t) continue;
+
+      job = deque_steal(victim.top, victim.bottom, victim.deque);
+      if (job) break;
+    }
+  }
+
+  if (job) atomic_sub(&m_queued, 1u);
+
+  return job;
+}
+
+void job_system_t::execute(job_t *job) {
+  job->func(*this, job, job->data);
+  finish(job);
+}
+
+void job_system_t::finish(job_t *job) {
+  // The parent is done when it's last child is
+  // It's read first, once job is finished create can reuse it for another job
+  while (job) {
+    job_t *parent = job->parent;
+    if (atomic_sub(&job->unfinished, 1u, ATOMIC_ACQREL) != 1) break;
+    job = parent;
+  }
+}
+
+void job_system_t::workerLoop(u32 index) {
+  job_thread.sys = this;
+  job_thread.index = index;
+  job_thread.taken = NULL;
+
+  thread_t &t = m_threads[index];
+
+  u32 idle = 0;
+  while (!atomic_load(&m_quit, ATOMIC_ACQUIRE)) {
+    job_t *job = get(t);
+
+    if (job) {
+      execute(job);
+      idle = 0;
+    } else if (++idle < JOB_SPINCOUNT) {
+      // Jobs tend to come in bursts, so look again before sleeping
+      atomic_pause();
+    } else {
+      sleep();
+      idle = 0;
+    }
+  }
+}
+
+job_t *job_system_t::create(job_func_t func, const void *data, uptr size, job_t *parent) {
+  log_assert(size <= JOB_DATASIZE, "Job data is too big!");
+
+  thread_t &t = self();
+  job_t *job = t.jobs + (t.nextJob++ & (JOB_POOLSIZE-1));
+
+  // Every job in the pool is in flight, wait for the oldest one before reusing it
+  if (atomic_load(&job->unfinished, ATOMIC_ACQUIRE)) {
+    for (const job_t *p = parent; p; p = p->parent)
+      log_assert(p != job, "Job pool is full of a job's own parents! (increase JOB_POOLSIZE in job.h)");
+
+    wait(job);
+  }
+
+  job->func = func;
+  job->parent = parent;
+  atomic_store(&job->unfinished, 1u, ATOMIC_RELAXED);
+
+  if (size) memcpy(job->data, data, size);
+  if (parent) atomic_add(&parent->unfinished, 1u, ATOMIC_RELAXED);
+
+  return job;
+}
+
+void job_system_t::run(job_t *job) {
+  thread_t &t = self();
+
+  // Count the job before it can be taken, so m_queued never wraps around
+  atomic_add(&m_queued, 1u);
+
+  // If our deque is full, just run it now
+  if (!deque_push(t.top, t.bottom, t.deque, job)) {
+    atomic_sub(&m_queued, 1u);
+    execute(job);
+    return;
+  }
+
+  // Both of these are sequentially consistent, so either we see a worker that's
+  // about to sleep, or it sees the job
+  if (atomic_load(&m_sleeping)) wake();
+}
+
+void job_system_t::wait(const job_t *job) {
+  thread_t &t = self();
+
+  while (atomic_load(&job->unfinished, ATOMIC_ACQUIRE)) {
+    job_t *other = get(t);
+
+    if (other) execute(other);
+    else atomic_pause();
+  }
+}
+
+// parallelFor job data
+struct job_forData_t {
+  job_forFunc_t func;
+  void *data;
+  uptr begin, end;
+};
+
+static void job_forJob(job_system_t &js, job_t *job, const void *data) {
+  (void)js;
+  (void)job;
+
+  const job_forData_t &d = *(const job_forData_t*)data;
+  d.func(d.begin, d.end, d.data);
+}
+
+static void job_emptyJob(job_system_t &js, job_t *job, const void *data) {
+  (void)js;
+  (void)job;
+  (void)data;
+}
+
+void job_system_t::parallelFor(uptr count, uptr chunk, job_forFunc_t func, void *data) {
+  if (!count) return;
+
+  // Not worth splitting
+  if (!chunk || (count <= chunk) || !m_workerCount) {
+    func(0, count, data);
+    return;
+  }
+
+  // Keep the number of jobs under JOB_FORMAXJOBS
+  chunk = util_max(chunk, (count + JOB_FORMAXJOBS-1)/JOB_FORMAXJOBS);
+
+  job_t *root = create(job_emptyJob);
+
+  for (uptr begin = 0; begin < count; begin += chunk) {
+    const job_forData_t d = {func, data, begin, util_min(begin+chunk, count)};
+    run(create(job_forJob, d, root));
+  }
+
+  // The root never runs, it finishes with its children
+  finish(root);
+  wait(root);
+}
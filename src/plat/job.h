@@ -0,0 +1,145 @@
+// Job system
+//
+// Work is split into jobs, which run on worker threads. Every thread has a deque of jobs,
+// it pushes and pops jobs on one end, while idle threads steal jobs from the other end
+// of other threads' deques, so threads mostly work on jobs they made themselves.
+//
+// Jobs can have a parent, a parent isn't finished until every child is,
+// so waiting on a parent waits for everything it fanned out into.
+// Threads waiting on a job run other jobs meanwhile.
+
+#ifndef JOB_H
+#define JOB_H
+
+#include "types.h"
+#include "mem.h"
+#include "log.h"
+
+class job_system_t;
+struct job_t;
+
+// Job function, job is the running job so children can be added to it,
+// data is a copy of the data the job was created with
+typedef void (*job_func_t)(job_system_t &js, job_t *job, const void *data);
+
+// Function for job_system_t::parallelFor, runs items [begin, end)
+typedef void (*job_forFunc_t)(uptr begin, uptr end, void *data);
+
+// Maximum data size of a job
+static constexpr uptr JOB_DATASIZE = 40;
+
+// Number of jobs each thread can have in flight
+// Creating more waits for the oldest one to finish, so it can be reused
+static constexpr u32 JOB_POOLSIZE = 1024;
+
+// Number of threads outside of the job system that can create jobs at once,
+// besides the one that created the job system
+// Threads give their slot back when they exit
+static constexpr u32 JOB_MAXEXTERNAL = 4;
+
+// Use a worker for each core, besides the one the main thread runs on
+static constexpr u32 JOB_AUTO = 0xffffffffu;
+
+// Maximum number of worker threads
+static constexpr u32 JOB_MAXWORKERS = 15;
+
+struct alignas(64) job_t {
+  job_func_t func;
+  job_t *parent;
+
+  // This job and it's unfinished children, the job is finished at 0
+  // Only accessed atomically
+  u32 unfinished;
+
+  u8 data[JOB_DATASIZE];
+};
+
+class job_system_t {
+private:
+  mem_t &m_m;
+
+  struct thread_t;
+
+  // Per thread data, the thread that made the job system is 0, workers are next,
+  // then slots for threads that use the job system later
+  thread_t *m_threads;
+  void *m_threadMem; // Unaligned m_threads allocation
+  u32 m_workerCount, m_threadCount;
+
+  // Number of jobs in deques, and number of sleeping workers
+  // Only accessed atomically
+  u32 m_queued, m_sleeping;
+
+  // Set when workers should exit
+  ubool m_quit;
+
+  // Platform data
+  void *m_plat;
+
+  // Get the data of the calling thread
+  thread_t &self();
+
+  // Pop a job from our deque, or steal one from someone elses
+  // Returns NULL if there's no jobs
+  job_t *get(thread_t &t);
+
+  // Run job, and finish it
+  void execute(job_t *job);
+  void finish(job_t *job);
+
+  // Worker thread main loop
+  void workerLoop(u32 index);
+
+  // Functions defined by the platform layer
+  // Worker threads are started by job_worker_t, which runs workerLoop
+  friend struct job_worker_t;
+
+  // Get the number of cores
+  static u32 coreCount();
+
+  // Start and stop worker threads, startWorkers returns false on failure
+  ubool startWorkers();
+  void stopWorkers();
+
+  // Wait until there's jobs in the deques, or we should quit
+  // Has to handle wake being called right before it
+  void sleep();
+
+  // Wake up sleeping workers
+  void wake();
+
+public:
+  job_system_t(mem_t &m, u32 workerCount = JOB_AUTO);
+  ~job_system_t();
+
+  job_system_t(const job_system_t &other) = delete;
+
+  // Create a job, it isn't run until run is called
+  // data is copied into the job, parent is NULL if there's none
+  job_t *create(job_func_t func, const void *data, uptr size, job_t *parent = NULL);
+
+  FINLINE job_t *create(job_func_t func, job_t *parent = NULL) {
+    return create(func, NULL, 0, parent);
+  }
+
+  template<typename T>
+  FINLINE job_t *create(job_func_t func, const T &data, job_t *parent = NULL) {
+    static_assert(sizeof(T) <= JOB_DATASIZE, "Job data is too big!");
+    return create(func, &data, sizeof(T), parent);
+  }
+
+  // Push job on the calling thread's deque
+  void run(job_t *job);
+
+  // Wait until job is finished, running jobs while waiting
+  void wait(const job_t *job);
+
+  // Split [0, count) into jobs of chunk items, run them and wait for them
+  // chunk is made bigger if there'd be too many jobs
+  void parallelFor(uptr count, uptr chunk, job_forFunc_t func, void *data);
+
+  // Number of worker threads, the thread that waits also runs jobs
+  FINLINE u32 workerCount() const {return m_workerCount;}
+};
+
+#endif //JOB_H
@@ -2,8 +2,18 @@
 #include "linux_window.h"
 #include "linux_gl_window.h"
 #include "linux_key.h"
+#include "rate.h"
+#include "util.h"
+#include "str.h"
+#include "prof.h"
+
+#include <poll.h>
+#include <cstring>
 
 linux_gl_window_t::x_t::x_t() {
+	// The render thread swaps buffers while the main thread handles events
+	if (!XInitThreads()) throw log_except("Couldn't initialize Xlib for threads!");
+
 	// Open display
 	dis = XOpenDisplay(NULL);
 	if (!dis) throw log_except("Couldn't open display!");
@@ -155,7 +165,7 @@ linux_gl_window_t::x_t::~x_t() {
 }
 
 linux_gl_window_t::linux_gl_window_t(window_init_t &init) :
-	m_m(init.m), m_i(init.i), m_gl(m_i.mem, init.g.state(), x.width, x.height)
+	m_m(init.m), m_i(init.i), m_gl(m_i.mem, m_i.jobs, init.g.state(), x.width, x.height)
 {
 	// Enable detectable autorepeat
 	Bool supported;
@@ -193,50 +203,160 @@ linux_gl_window_t::~linux_gl_window_t() {
 	XkbSetDetectableAutoRepeat(x.dis, false, NULL);
 }
 
-// TODO: I should separate this into it's own file at some point
-// Rate manager
-class rate_t {
-private:
-	countTimer_t &m_t;
-	
-	// Time at which last frame was processed
-	u64 m_lastFrame;
+// Frames further away than this are waited for with poll, since it only has
+// millisecond resolution, the rest is left to countTimer_t::sleep
+static constexpr countTimer_counts_t POLL_MIN_MS = 2;
+
+// Block until there's an X event, or the next frame is ready
+static void waitFrame(Display *dis, countTimer_t &timer, rate_t &rate) {
+	const countTimer_counts_t ms = timer.resolution()/1000;
+	countTimer_counts_t left = rate.remaining();
+
+	if (left >= POLL_MIN_MS*ms) {
+		struct pollfd pfd;
+		pfd.fd = ConnectionNumber(dis);
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		// Wake up a millisecond early, so oversleeping doesn't make us miss the frame
+		if (poll(&pfd, 1, (int)(left/ms - 1)) > 0) return;
 
-	// Counts between each occurrence
-	u64 m_freq;
+		left = rate.remaining();
+	}
+
+	// Sleeps, then spins for the last fraction of a millisecond
+	if (left) timer.sleep(left);
+}
 
-	// Inverse of m_freq
-	f32 m_freqInv;
+void *linux_gl_window_t::renderThread(void *self) {
+	linux_gl_window_t &w = *(linux_gl_window_t*)self;
+	render_t &r = w.m_r;
+
+	prof_threadName("render");
+	glXMakeCurrent(w.x.dis, w.x.win, w.x.ctx);
+
+	pthread_mutex_lock(&r.m);
+	for (;;) {
+		// Wait for a snapshot we haven't rendered
+		while (!r.fresh && !r.quit) pthread_cond_wait(&r.published, &r.m);
+		if (r.quit) break;
+
+		// Take it, leaving the one we rendered last for the main thread to fill
+		const u32 read = r.latest;
+		r.latest = r.read;
+		r.read = read;
+		r.fresh = false;
+
+		pthread_cond_signal(&r.taken);
+		pthread_mutex_unlock(&r.m);
+
+		ubool ok;
+		try {
+			ok = w.m_gl.render(*r.snaps[read]);
+
+			PROF_ZONE("swap");
+			glXSwapBuffers(w.x.dis, w.x.win);
+		} catch (const log_except_t &err) {
+			log_warning("Render thread failed: %s", err.str());
+			ok = false;
+		}
 
-public:
-	FINLINE rate_t(countTimer_t &t, u64 rate) : m_t(t) {
-		// Round to nearest
-		m_freq = (t.resolution() + (rate>>1))/rate;
-		m_freqInv = 1.f/(f32)m_freq;
-		m_lastFrame = 0;
+		pthread_mutex_lock(&r.m);
+		if (!ok) {
+			r.failed = true;
+			pthread_cond_signal(&r.taken);
+			break;
+		}
 	}
+	pthread_mutex_unlock(&r.m);
+
+	// Give the context back
+	glXMakeCurrent(w.x.dis, None, NULL);
 
-	// Have freq counts passed since last frame?
-	FINLINE ubool ready() {
-		const u64 t = m_t.time();
-		if (t-m_lastFrame >= m_freq) {
-			m_lastFrame = t;
-			return true;
+	return NULL;
+}
+
+void linux_gl_window_t::startRender() {
+	// Allocate snapshots, zeroed so they don't hold anything
+	for (u32 i = 0; i < LINUX_GL_SNAPSHOTS; ++i) {
+		m_r.snaps[i] = (game_state_snapshot_t*)m_i.mem.alloc(sizeof(game_state_snapshot_t));
+		if (!m_r.snaps[i]) {
+			while (i--) m_i.mem.free(m_r.snaps[i]);
+			throw log_except("Cannot allocate game snapshots!");
 		}
 
-		return false;
+		memset((void*)m_r.snaps[i], 0, sizeof(game_state_snapshot_t));
+	}
+
+	m_r.write = 0;
+	m_r.latest = 1;
+	m_r.read = 2;
+	m_r.fresh = m_r.quit = m_r.failed = false;
+
+	pthread_mutex_init(&m_r.m, NULL);
+	pthread_cond_init(&m_r.published, NULL);
+	pthread_cond_init(&m_r.taken, NULL);
+
+	// The context can only be current in one thread
+	glXMakeCurrent(x.dis, None, NULL);
+
+	if (pthread_create(&m_r.tid, NULL, renderThread, this)) {
+		glXMakeCurrent(x.dis, x.win, x.ctx);
+
+		pthread_cond_destroy(&m_r.taken);
+		pthread_cond_destroy(&m_r.published);
+		pthread_mutex_destroy(&m_r.m);
+
+		for (u32 i = 0; i < LINUX_GL_SNAPSHOTS; ++i) m_i.mem.free(m_r.snaps[i]);
+		throw log_except("Cannot create render thread!");
 	}
+}
+
+void linux_gl_window_t::stopRender(game_t &game) {
+	pthread_mutex_lock(&m_r.m);
+	m_r.quit = true;
+	pthread_cond_signal(&m_r.published);
+	pthread_mutex_unlock(&m_r.m);
+
+	pthread_join(m_r.tid, NULL);
 
-	FINLINE f32 delta() {
-		// Divide by m_freq
-		return (f32)(m_t.time()-m_lastFrame) * m_freqInv;
+	// Take the context back, gl_render_t is destroyed on this thread
+	glXMakeCurrent(x.dis, x.win, x.ctx);
+
+	pthread_cond_destroy(&m_r.taken);
+	pthread_cond_destroy(&m_r.published);
+	pthread_mutex_destroy(&m_r.m);
+
+	for (u32 i = 0; i < LINUX_GL_SNAPSHOTS; ++i) {
+		game.releaseSnapshot(*m_r.snaps[i]);
+		m_i.mem.free(m_r.snaps[i]);
 	}
-};
+}
 
 // X11 OpenGL main loop
 window_loop_ret_t linux_gl_window_t::loop(game_t &game) {
+	startRender();
+
+	window_loop_ret_t ret;
+	try {
+		ret = tickLoop(game);
+	} catch (...) {
+		stopRender(game);
+		throw;
+	}
+
+	stopRender(game);
+	return ret;
+}
+
+window_loop_ret_t linux_gl_window_t::tickLoop(game_t &game) {
 	XEvent evt;
-	rate_t framerate(m_i.timer, 60);
+
+	// The game ticks at a fixed rate, and snapshots are published at -fps,
+	// or as fast as the render thread takes them if it's 0
+	step_t ticks(m_i.timer, GAME_TICKRATE, GAME_MAXTICKS);
+	const u32 fps = str_strnum_def<u32>(m_i.args.valDef(str_hash("-fps"), "240"), 240);
+	rate_t framerate(m_i.timer, util_max<u32>(fps, 1));
 	unsigned int lastPressed = 0; // Last keycode pressed, detects autorepeat
 
   XWindowAttributes attribs;
@@ -255,6 +375,9 @@ window_loop_ret_t linux_gl_window_t::loop(game_t &game) {
   };
 
 	for (;;) {
+		// Handle every pending event
+		prof_zone_t eventZone("X events");
+
 		while (XPending(x.dis)) {
 			XNextEvent(x.dis, &evt);
 
@@ -314,11 +437,10 @@ window_loop_ret_t linux_gl_window_t::loop(game_t &game) {
         if ((game.wstate().width != (u32)evt.xconfigure.width) ||
             (game.wstate().height != (u32)evt.xconfigure.height))
         {
+          // The render thread resizes when it gets a snapshot with the new size
           game.wstate().width = evt.xconfigure.width;
           game.wstate().height = evt.xconfigure.height;
 
-          m_gl.resize(game.wstate().width, game.wstate().height);
-
           log_note("Resized");
         }
 
@@ -328,7 +450,18 @@ window_loop_ret_t linux_gl_window_t::loop(game_t &game) {
 			}
 		}
 
-		if (framerate.ready()) {
+		eventZone.end();
+
+		if (fps && !framerate.ready()) {
+			// XPending flushed our requests and the event queue is empty,
+			// so we can sleep until something happens
+			waitFrame(x.dis, m_i.timer, framerate);
+			continue;
+		}
+
+		// Run every tick that's due, several after a stall
+		const u32 tickCount = ticks.steps();
+		for (u32 i = 0; i < tickCount; ++i) {
 			game_update_ret_t ret = game.update();
 			m_i.input.k.update();
 
@@ -339,13 +472,40 @@ window_loop_ret_t linux_gl_window_t::loop(game_t &game) {
 			case GAME_UPDATE_FAILED: return WINDOW_LOOP_FAILED;
 			}
 
-      // Reset mouse pointer back to center of screen
-      XWarpPointer(x.dis, None, x.win, 0, 0, 0, 0, x.width>>1, x.height>>1);
+			// The mouse movement was used up, the pointer is put back in the center
+			m_i.input.mx = x.width>>1;
+			m_i.input.my = x.height>>1;
+		}
+
+		if (tickCount) {
+			// Reset mouse pointer back to center of screen
+			XWarpPointer(x.dis, None, x.win, 0, 0, 0, 0, x.width>>1, x.height>>1);
+		}
+
+		// Publish a snapshot between the last two ticks for the render thread,
+		// the one we fill is never being rendered
+		game_state_snapshot_t &snap = *m_r.snaps[m_r.write];
+		game.releaseSnapshot(snap);
+		game.snapshot(snap, ticks.alpha());
+
+		pthread_mutex_lock(&m_r.m);
 
-			if (!m_gl.render(game.rstate())) return WINDOW_LOOP_FAILED;
-			glXSwapBuffers(x.dis, x.win);
+		const u32 write = m_r.latest;
+		m_r.latest = m_r.write;
+		m_r.write = write;
+		m_r.fresh = true;
+		pthread_cond_signal(&m_r.published);
 
-			if (!m_m.audio->update()) return WINDOW_LOOP_FAILED;
+		// Without a cap, the render thread sets the pace by taking snapshots
+		if (!fps) {
+			while (m_r.fresh && !m_r.failed) pthread_cond_wait(&m_r.taken, &m_r.m);
 		}
+
+		const ubool failed = m_r.failed;
+		pthread_mutex_unlock(&m_r.m);
+
+		if (failed) return WINDOW_LOOP_FAILED;
+
+		if (!m_m.audio->update()) return WINDOW_LOOP_FAILED;
 	}
 }
@@ -22,6 +22,12 @@
 #include <GL/glx.h>
 #include <GL/glxext.h>
 
+#include <pthread.h>
+
+// Number of game snapshots, one is filled by the main thread,
+// one is the latest filled one, and one is being rendered
+static constexpr u32 LINUX_GL_SNAPSHOTS = 3;
+
 class linux_gl_window_t : public window_base_t {
 private:
 	modules_t &m_m;
@@ -47,6 +53,38 @@ private:
 
 	gl_render_t m_gl;
 
+	// Render thread, owns the OpenGL context while the main loop runs
+	struct render_t {
+		pthread_t tid;
+
+		// Data mutex
+		pthread_mutex_t m;
+
+		// Signaled when a snapshot is published, and when one is taken
+		pthread_cond_t published, taken;
+
+		// Snapshot buffers
+		// write is only used by the main thread, read only by the render thread
+		game_state_snapshot_t *snaps[LINUX_GL_SNAPSHOTS];
+		u32 write, read;
+
+		// You must own the mutex to read/write these variables
+		u32 latest; // Latest published snapshot
+		ubool fresh; // If latest hasn't been taken by the render thread yet
+		ubool quit; // Set by main thread to close render thread
+		ubool failed; // Set by render thread when rendering fails
+	} m_r;
+
+	// Render thread entry point
+	static void *renderThread(void *self);
+
+	// Give the context to a new render thread, and take it back
+	void startRender();
+	void stopRender(game_t &game);
+
+	// Main loop, runs while the render thread does
+	window_loop_ret_t tickLoop(game_t &game);
+
 	// Keyboard keycode map
 	KeySym *m_map;
 	int m_minCode, m_maxCode;
@@ -4,10 +4,13 @@
 #include <GL/glx.h>
 #include <GL/glxext.h>
 
+#include <cstring>
+
 #define DEFEXT(_type, _name, ...)				\
 	GL::_name ## _t GL::_name = NULL;
 
 OPENGL_EXTFUNC_LIST
+OPENGL_OPTEXTFUNC_LIST
 
 #undef DEFEXT
 
@@ -21,7 +24,26 @@ ubool GL::loadExt() {
 
 	OPENGL_EXTFUNC_LIST
 
+#undef DEFEXT
+
+#define DEFEXT(_type, _name, ...)				\
+	GL::_name = (GL::_name ## _t)glXGetProcAddress((const GLubyte*)"gl" #_name);
+
+	OPENGL_OPTEXTFUNC_LIST
+
 #undef DEFEXT
 
 	return true;
 }
+
+ubool GL::hasExt(const char *name) {
+	GLint count = 0;
+	GL::GetIntegerv(GL::NUM_EXTENSIONS, &count);
+
+	for (GLint i = 0; i < count; ++i) {
+		const char *ext = (const char*)GL::GetStringi(GL::EXTENSIONS, i);
+		if (ext && !strcmp(ext, name)) return true;
+	}
+
+	return false;
+}
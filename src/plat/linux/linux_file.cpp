@@ -10,6 +10,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <cstdio>
 #include <cerrno>
 #include <cstring>
 
@@ -136,6 +137,17 @@ iptr file_handle_t::write(const void *in, uptr bytes) {
 	return ret;
 }
 
+ubool file_handle_t::sync() {
+	linux_file_handle_t &me = *(linux_file_handle_t*)this;
+
+	if (fsync(me.m_fd) < 0) {
+		log_warning("Cannot sync file to disk! (%d, %s)", errno, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
 ubool file_handle_t::seek(uptr offset, file_seek_t orig) {
 	// Lookup table for file_seek_t
 	const int whenceTable[] = {
@@ -213,8 +225,8 @@ ubool file_system_t::fileExists(const char *filename) {
 }
 
 ubool file_system_t::makeDir(const char *dirname) {
-	if (mkdir(dirname, 0664) < 0) {
-		if ((errno == EEXIST) && !fileExists(dirname)) return true;
+	if (mkdir(dirname, 0775) < 0) {
+		if ((errno == EEXIST) && dirExists(dirname)) return true;
 
 		log_warning("Cannot create directory %s! (%d, %s)", dirname, errno, strerror(errno));
 		return false;
@@ -237,3 +249,34 @@ ubool file_system_t::dirExists(const char *dirname) {
 	
 	return (s.st_mode&S_IFDIR) != 0;
 }
+
+ubool file_system_t::rename(const char *from, const char *to) {
+	if (::rename(from, to) < 0) {
+		log_warning("Cannot rename %s to %s! (%d, %s)", from, to, errno, strerror(errno));
+		return false;
+	}
+
+	// The rename is only on the disk once the directory it's in is
+	char dir[512];
+	const char *slash = strrchr(to, '/');
+
+	if (!slash) strcpy(dir, ".");
+	else if (slash == to) strcpy(dir, "/");
+	else if ((uptr)(slash-to) < sizeof(dir)) {
+		memcpy(dir, to, slash-to);
+		dir[slash-to] = 0;
+	} else {
+		log_warning("Directory of %s is too long to sync!", to);
+		return false;
+	}
+
+	const int fd = ::open(dir, O_RDONLY|O_DIRECTORY);
+	if ((fd < 0) || (fsync(fd) < 0)) {
+		log_warning("Cannot sync directory %s to disk! (%d, %s)", dir, errno, strerror(errno));
+		if (fd >= 0) ::close(fd);
+		return false;
+	}
+
+	::close(fd);
+	return true;
+}
@@ -0,0 +1,102 @@
+#include "types.h"
+#include "atomic.h"
+#include "job.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+// Worker thread data
+struct job_worker_t {
+  job_system_t *js;
+  u32 index;
+
+  static void *main(void *self) {
+    const job_worker_t &w = *(const job_worker_t*)self;
+    w.js->workerLoop(w.index);
+
+    return NULL;
+  }
+};
+
+struct job_plat_t {
+  pthread_t tids[JOB_MAXWORKERS];
+  job_worker_t workers[JOB_MAXWORKERS];
+  u32 started;
+
+  // Sleeping workers wait on wakeup
+  pthread_mutex_t m;
+  pthread_cond_t wakeup;
+};
+
+u32 job_system_t::coreCount() {
+  const long ret = sysconf(_SC_NPROCESSORS_ONLN);
+  return (ret > 0) ? (u32)ret : 1;
+}
+
+ubool job_system_t::startWorkers() {
+  job_plat_t *plat = (job_plat_t*)m_m.alloc(sizeof(job_plat_t));
+  if (!plat) return false;
+
+  m_plat = plat;
+  plat->started = 0;
+
+  pthread_mutex_init(&plat->m, NULL);
+  pthread_cond_init(&plat->wakeup, NULL);
+
+  for (u32 i = 0; i < m_workerCount; ++i) {
+    plat->workers[i].js = this;
+    plat->workers[i].index = 1+i;
+
+    if (pthread_create(plat->tids+i, NULL, job_worker_t::main, plat->workers+i)) {
+      log_warning("Cannot create job worker %u!", i);
+
+      atomic_store(&m_quit, (ubool)true);
+      stopWorkers();
+      return false;
+    }
+
+    ++plat->started;
+  }
+
+  return true;
+}
+
+void job_system_t::stopWorkers() {
+  job_plat_t *plat = (job_plat_t*)m_plat;
+  if (!plat) return;
+
+  // m_quit is set, wake everyone up so they see it
+  pthread_mutex_lock(&plat->m);
+  pthread_cond_broadcast(&plat->wakeup);
+  pthread_mutex_unlock(&plat->m);
+
+  for (u32 i = 0; i < plat->started; ++i) pthread_join(plat->tids[i], NULL);
+
+  pthread_cond_destroy(&plat->wakeup);
+  pthread_mutex_destroy(&plat->m);
+
+  m_m.free(plat);
+  m_plat = NULL;
+}
+
+void job_system_t::sleep() {
+  job_plat_t &plat = *(job_plat_t*)m_plat;
+
+  pthread_mutex_lock(&plat.m);
+
+  atomic_add(&m_sleeping, 1u);
+  while (!atomic_load(&m_queued) && !atomic_load(&m_quit))
+    pthread_cond_wait(&plat.wakeup, &plat.m);
+  atomic_sub(&m_sleeping, 1u);
+
+  pthread_mutex_unlock(&plat.m);
+}
+
+void job_system_t::wake() {
+  job_plat_t &plat = *(job_plat_t*)m_plat;
+
+  pthread_mutex_lock(&plat.m);
+  pthread_cond_signal(&plat.wakeup);
+  pthread_mutex_unlock(&plat.m);
+}
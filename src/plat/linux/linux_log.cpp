@@ -1,61 +1,60 @@
+#define _XOPEN_SOURCE 500
+
+#include "types.h"
 #include "log.h"
+#include "atomic.h"
 
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
-
-#include <cstdio>
-#include <cstdlib>
 #include <cstring>
-#include <cstdarg>
-
-void log_warning(const char *str, ...) {
-	// Append to error log
-	// TODO: Implement an error message box at some point!
-	
-	int fd = open("err.log", O_WRONLY|O_CREAT|O_APPEND);
 
-	// Can't exactly log an error here...
-	if (fd < 0) return;
+// How long the log thread sleeps when there's nothing to write, in microseconds
+// Logging threads never wake it up, so they never make a system call
+static constexpr useconds_t LOG_IDLESLEEP = 1000;
 
-	va_list args;
-	va_start(args, str);
+struct linux_logThread_t {
+	pthread_t tid;
+	ubool quit; // Only accessed atomically
+};
 
-	char s[1024];
-	vsnprintf(s, sizeof(s), str, args);
+// Only one log thread exists at once
+static linux_logThread_t linux_logThread;
 
-	va_end(args);
+static void *tFunc(void *ptr) {
+	linux_logThread_t &t = *(linux_logThread_t*)ptr;
 
-	write(fd, "!! ", sizeof("!! "));
-	write(fd, s, strlen(s));
-	write(fd, " !!\n", sizeof(" !!\n"));
+	while (!atomic_load(&t.quit, ATOMIC_ACQUIRE)) {
+		if (!log_drain()) usleep(LOG_IDLESLEEP);
+	}
 
-	close(fd);
+	return NULL;
 }
 
-[[noreturn]] void log_error(const char *str, ...) {
-	// Append to error log and quit
-	// TODO: Implement an error message box at some point!
+log_thread_t::log_thread_t() : m_plat(NULL) {
+	linux_logThread_t &t = linux_logThread;
+	t.quit = false;
 
-	int fd = open("err.log", O_WRONLY|O_CREAT|O_APPEND);
+	// Logging has to be asynchronous before anything could be left in the rings
+	atomic_store(&log_async, (ubool)true, ATOMIC_RELEASE);
 
-	// Can't exactly log an error here...
-	if (fd < 0) exit(1);
+	const int ret = pthread_create(&t.tid, NULL, tFunc, (void*)&t);
+	if (ret) {
+		atomic_store(&log_async, (ubool)false, ATOMIC_RELEASE);
+		log_warning("Cannot create log thread, logging synchronously! (%d, %s)", ret, strerror(ret));
+		return;
+	}
 
-	va_list args;
-	va_start(args, str);
-
-	char s[1024];
-	vsnprintf(s, sizeof(s), str, args);
-
-	va_end(args);
+	m_plat = &t;
+}
 
-	write(fd, "!! ", sizeof("!! "));
-	write(fd, s, strlen(s));
-	write(fd, " !!\n", sizeof(" !!\n"));
+log_thread_t::~log_thread_t() {
+	if (!m_plat) return;
+	linux_logThread_t &t = *(linux_logThread_t*)m_plat;
 
-	close(fd);
+	atomic_store(&t.quit, (ubool)true, ATOMIC_RELEASE);
+	pthread_join(t.tid, NULL);
 
-	exit(1);
+	// Anything logged from here on is written right away, write out what's left first
+	atomic_store(&log_async, (ubool)false, ATOMIC_RELEASE);
+	log_drain();
 }
@@ -10,6 +10,9 @@
 //  to run it on said platform)
 #include "mem.h"
 #include "file.h"
+#include "job.h"
+#include "prof.h"
+#include "logbin.h"
 #include "linux_file.h"
 #include "interfaces.h"
 
@@ -41,13 +44,18 @@ window_loop_ret_t loop(interfaces_t i, game_t &game) {
 		// Initialize window
 		window_init_t winInit(m, i, game);
 
-		if (m.win.setFallback((window_type_t)0, winInit) == WINDOW_COUNT) return WINDOW_LOOP_FAILED;
+		// -headless runs without a display
+		const window_type_t winType = i.args.check(str_hash("-headless")) ? WINDOW_HEADLESS : (window_type_t)0;
+		if (m.win.setFallback(winType, winInit) == WINDOW_COUNT) return WINDOW_LOOP_FAILED;
 
 		// Initialize audio
 		audio_init_t audioInit(m, i, game.state(), 44100);
 
+		// -wav=<file.wav> and -nullaudio mix into a sink, the sinks skip themselves otherwise
+		const ubool sink = i.args.check(str_hash("-wav")) || i.args.check(str_hash("-nullaudio"));
+
 //		if (m.audio.setFallback((audio_type_t)0, audioInit) == AUDIO_COUNT) return WINDOW_LOOP_FAILED;
-    if (m.audio.setFallback(AUDIO_DUMMY, audioInit) == AUDIO_COUNT) return WINDOW_LOOP_FAILED;
+    if (m.audio.setFallback(sink ? AUDIO_WAV : AUDIO_DUMMY, audioInit) == AUDIO_COUNT) return WINDOW_LOOP_FAILED;
 
 		// Run game loop
 		return m.win->loop(game);
@@ -60,14 +68,31 @@ window_loop_ret_t loop(interfaces_t i, game_t &game) {
 int main(int argc, char **argv) {
 	// Initialize everything that stays between resets
   try {
+    // Format and write logs on their own thread, so logging never stalls a tick or the audio
+    log_thread_t logThread;
+
     // Interfaces
     mem_t mem(32*1024*1024); // Allocate 32 mebibytes
     linux_file_system_t fileSys(mem);
     timer_t timer;
+    job_system_t jobs(mem);
     args_t args(argc, argv, mem);
     game_input_t input;
     rng_t rng;
-    interfaces_t inter(&mem, &fileSys, &timer, &args, &input, &rng);
+    interfaces_t inter(&mem, &fileSys, &timer, &jobs, &args, &input, &rng);
+
+    // -loglevel=warning only logs warnings
+    const char *level = args.val(str_hash("-loglevel"));
+    if (level && (str_hashR(level) == str_hash("warning"))) log_setLevel(LOG_LEVEL_WARNING);
+
+    // Profile into -prof, the trace is written when it's destroyed after the game
+    prof_t prof(inter.mem, inter.fileSys, inter.timer, args.val(str_hash("-prof")));
+    prof_threadName("game");
+
+    // Binary log into -binlog, -binlogsize mebibytes big
+    const char *binlogArg = args.val(str_hash("-binlogsize"));
+    const uptr binlogSize = binlogArg ? str_strnum_def<uptr>(binlogArg, LOGBIN_DEFAULTSIZE) : LOGBIN_DEFAULTSIZE;
+    logbin_t binlog(inter.fileSys, inter.timer, args.val(str_hash("-binlog")), binlogSize*1024*1024);
 
     // Game
     game_t game(inter, args);
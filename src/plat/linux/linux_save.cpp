@@ -1,27 +1,76 @@
+#define _XOPEN_SOURCE 500
+
 #include "types.h"
 #include "save.h"
-#include "endianUtil.h"
-#include "util.h"
+#include "atomic.h"
 #include "log.h"
+#include "linux_file.h"
 
-#include <sys/types.h>
-#include <sys/stat.h>
+#include <pthread.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <errno.h>
-#include <string.h>
+#include <cstring>
+
+// How long the save thread sleeps when there's nothing to write, in microseconds
+// Saving never wakes it up, so saving never makes a system call
+static constexpr useconds_t SAVE_IDLESLEEP = 5000;
+
+struct linux_saveThread_t {
+	pthread_t tid;
+	ubool quit; // Only accessed atomically
+
+	save_t *save;
+
+	// The save thread's own file system, the game's isn't safe to use from another thread
+	linux_file_system_t f;
+
+	FINLINE linux_saveThread_t(mem_t &m, save_t &s) : quit(false), save(&s), f(m) {}
+};
+
+static void *tFunc(void *ptr) {
+	linux_saveThread_t &t = *(linux_saveThread_t*)ptr;
+
+	while (!atomic_load(&t.quit, ATOMIC_ACQUIRE)) {
+		if (!t.save->drain(*(file_system_t*)&t.f)) usleep(SAVE_IDLESLEEP);
+	}
 
-static FINLINE void makeFilename(char *out, uptr id) {
-	log_assert(id < 10, "ID too big!");
+	return NULL;
+}
+
+save_thread_t::save_thread_t(mem_t &m, save_t &save) : m_save(save), m_plat(NULL) {
+	log_assert(!m_save.m_thread, "save_t already has a save thread!");
+
+	void *mem = m.alloc(sizeof(linux_saveThread_t));
+	linux_saveThread_t *t = new(mem) linux_saveThread_t(m, m_save);
+
+	const int ret = pthread_create(&t->tid, NULL, tFunc, (void*)t);
+	if (ret) {
+		log_warning("Cannot create save thread, saving synchronously! (%d, %s)", ret, strerror(ret));
 
-	memcpy(out, "save .dat", sizeof("save .dat"));
-	out[4] = '0'+id;
+		t->~linux_saveThread_t();
+		m.free(mem);
+		return;
+	}
+
+	m_plat = t;
+	m_save.m_thread = this;
 }
 
-ubool save_t::loadGlobal() {
-	// 
+save_thread_t::~save_thread_t() {
+	if (!m_plat) return;
+	linux_saveThread_t &t = *(linux_saveThread_t*)m_plat;
+
+	atomic_store(&t.quit, (ubool)true, ATOMIC_RELEASE);
+	pthread_join(t.tid, NULL);
+
+	// Saves are written right away from here on, write out what's left first
+	m_save.m_thread = NULL;
+	m_save.drain(*(file_system_t*)&t.f);
+
+	mem_t &m = t.f.m;
+	t.~linux_saveThread_t();
+	m.free(m_plat);
 }
 
-ubool save_t::load(uptr id) {
-	// 
+void save_thread_t::wait() {
+	while (m_save.pending()) usleep(SAVE_IDLESLEEP/4);
 }
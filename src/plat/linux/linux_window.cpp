@@ -7,6 +7,8 @@
 #include "linux_gl_window.h"
 #endif
 
+#include "headless_window.h"
+
 // Backend construction functions
 #define GL_CONSTRUCT
 
@@ -29,7 +31,23 @@ static ubool glConstruct(window_base_t *out, window_init_t &args) {
 
 #endif
 
+static ubool headlessConstruct(window_base_t *out, window_init_t &args) {
+	log_note("Constructing window module with headless backend");
+
+	try {
+		(void)new(out) headless_window_t(args.m, args.i);
+		return true;
+	} catch (const log_except_t &err) {
+		log_warning("Cannot initialize window module with headless backend: %s", err.str());
+		return false;
+	}
+}
+
+#define HEADLESS_CONSTRUCT headlessConstruct,
+
 // Backend constructor table
 const module_constructProc_t<window_base_t, window_init_t> window_construct[WINDOW_COUNT] = {
+	// WARNING: This list is dependent on the order of window_type_t in window.h!
 	GL_CONSTRUCT
+	HEADLESS_CONSTRUCT
 };
@@ -95,6 +95,7 @@ void *mem_t::alloc(uptr size) {
 		next->prev = i;
 		next->active = false;
 		
+		if (i->next) i->next->prev = next;
 		i->next = next;
 	}
 
@@ -121,12 +122,15 @@ void mem_t::free(void *addr) {
 	if (ent->prev && !ent->prev->active) {
 		// Since the previous entry is free, we must act like this entry doesn't exist
 		ent->prev->next = ent->next;
+		if (ent->next) ent->next->prev = ent->prev;
 		ent = ent->prev;
 	}
 	
 	// If the next entry is free, act as if it doesn't exist.
-	if (ent->next && !ent->next->active)
+	if (ent->next && !ent->next->active) {
 		ent->next = ent->next->next;
+		if (ent->next) ent->next->prev = ent;
+	}
 	
 	// Mark the entry as free
 	ent->active = false;
@@ -0,0 +1,251 @@
+#include "types.h"
+#include "util.h"
+#include "log.h"
+#include "mixer.h"
+
+#include <cstring>
+#include <math.h>
+
+#ifdef PLAT_S_SSE2
+#include <emmintrin.h>
+#endif
+
+// Range of a 16-bit sample
+static constexpr f32 MIXER_MIN = -32768.f, MIXER_MAX = 32767.f;
+
+// Add frames into the bus, scaled by left and right gains
+static FINLINE void addFrames(f32 *bus, const audio_frame_t *frames, uptr count, f32 left, f32 right) {
+  uptr i = 0;
+
+#ifdef PLAT_S_SSE2
+
+  const __m128 gain = _mm_setr_ps(left, right, left, right);
+
+  // 4 frames at a time, 2 per float vector
+  for (; i+4 <= count; i += 4) {
+    const __m128i s = _mm_loadu_si128((const __m128i*)(frames+i));
+
+    // Sign extend samples to 32 bits
+    const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+    const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+
+    f32 *b = bus + i*2;
+    _mm_storeu_ps(b, _mm_add_ps(_mm_loadu_ps(b), _mm_mul_ps(_mm_cvtepi32_ps(lo), gain)));
+    _mm_storeu_ps(b+4, _mm_add_ps(_mm_loadu_ps(b+4), _mm_mul_ps(_mm_cvtepi32_ps(hi), gain)));
+  }
+
+#endif
+
+  for (; i < count; ++i) {
+    bus[i*2] += (f32)frames[i].left*left;
+    bus[i*2+1] += (f32)frames[i].right*right;
+  }
+}
+
+static_assert(MIXER_STREAMFRAMES && !(MIXER_STREAMFRAMES & (MIXER_STREAMFRAMES-1)), "Stream ring size must be a power of 2!");
+
+mixer_t::mixer_t(mem_t &m, uptr maxFrames) : m_m(m), m_maxFrames(maxFrames) {
+  // A stream has to be able to keep up with a whole mix
+  if (maxFrames > MIXER_STREAMFRAMES)
+    throw log_except("Mixing %u frames at once, streams only hold %u!", (u32)maxFrames, MIXER_STREAMFRAMES);
+
+  m_bus = (f32*)m_m.alloc(util_max<uptr>(maxFrames, 1)*2*sizeof(f32));
+  if (!m_bus) throw log_except("Cannot allocate mixing bus of %u frames!", (u32)maxFrames);
+
+  // Every ring comes out of one allocation
+  audio_frame_t *rings = (audio_frame_t*)m_m.alloc(MIXER_MAXSTREAMS*MIXER_STREAMFRAMES*sizeof(audio_frame_t));
+  if (!rings) {
+    m_m.free(m_bus);
+    throw log_except("Cannot allocate %u stream rings!", MIXER_MAXSTREAMS);
+  }
+
+  memset((void*)m_voices, 0, sizeof(m_voices));
+  for (u32 i = 0; i < AUDIO_MAXVOICES; ++i) m_voices[i].stream = -1;
+
+  for (u32 i = 0; i < MIXER_MAXSTREAMS; ++i) {
+    m_streams[i].sound = NULL;
+    m_streams[i].ring = rings + i*MIXER_STREAMFRAMES;
+    m_streams[i].read = m_streams[i].write = 0;
+  }
+}
+
+mixer_t::~mixer_t() {
+  m_m.free(m_streams[0].ring);
+  m_m.free(m_bus);
+}
+
+void mixer_t::release(mixer_voice_t &v) {
+  if (v.stream >= 0) m_streams[v.stream].sound = NULL;
+  v.stream = -1;
+}
+
+void mixer_t::apply(const audio_cmd_t &cmd) {
+  if (cmd.voice >= AUDIO_MAXVOICES) return;
+  mixer_voice_t &v = m_voices[cmd.voice];
+
+  switch (cmd.type) {
+    case AUDIO_CMD_PLAY:
+      release(v);
+      v.frames = cmd.frameCount ? cmd.frames : NULL;
+      v.frameCount = cmd.frameCount;
+      v.pos = 0;
+      v.loop = cmd.loop;
+      v.gain = cmd.gain;
+      v.pan = cmd.pan;
+      break;
+
+    case AUDIO_CMD_STOP:
+      release(v);
+      v.frames = NULL;
+      break;
+
+    case AUDIO_CMD_STREAM: {
+      release(v);
+      v.frames = NULL;
+
+      if (!sound_valid(cmd.sound)) {
+        log_warning("Voice %u can't stream an invalid sound!", cmd.voice);
+        break;
+      }
+
+      i32 free = -1;
+      for (u32 i = 0; i < MIXER_MAXSTREAMS; ++i) {
+        if (!m_streams[i].sound) {
+          free = i;
+          break;
+        }
+      }
+      if (free < 0) {
+        log_warning("Voice %u can't stream, all %u streams are playing!", cmd.voice, MIXER_MAXSTREAMS);
+        break;
+      }
+
+      mixer_stream_t &s = m_streams[free];
+      s.sound = cmd.sound;
+      s.dec.start(cmd.sound);
+      s.read = s.write = 0;
+
+      // frames only marks the voice as playing, everything else comes from the ring
+      v.frames = s.ring;
+      v.frameCount = cmd.sound->frameCount;
+      v.pos = 0;
+      v.loop = cmd.loop;
+      v.gain = cmd.gain;
+      v.pan = cmd.pan;
+      v.stream = free;
+    } break;
+
+    case AUDIO_CMD_VOLUME:
+      v.gain = cmd.gain;
+      v.pan = cmd.pan;
+      break;
+  }
+}
+
+void mixer_t::mixVoice(mixer_voice_t &v, uptr frameCount) {
+  // Linear pan, the center is at full volume on both sides
+  const f32 left = v.gain*util_min(1.f - v.pan, 1.f);
+  const f32 right = v.gain*util_min(1.f + v.pan, 1.f);
+
+  f32 *bus = m_bus;
+
+  // Mix up to the end of the voice, and again from the start if it loops
+  while (frameCount && v.frames) {
+    const uptr count = util_min(frameCount, v.frameCount - v.pos);
+    addFrames(bus, v.frames + v.pos, count, left, right);
+
+    bus += count*2;
+    frameCount -= count;
+    v.pos += count;
+
+    if (v.pos >= v.frameCount) {
+      v.pos = 0;
+      if (!v.loop) v.frames = NULL;
+    }
+  }
+}
+
+void mixer_t::fill(mixer_stream_t &s, ubool loop) {
+  while (s.write - s.read < MIXER_STREAMFRAMES) {
+    // Only decode up to the end of the ring at once, the rest goes at the start
+    const u32 at = s.write & (MIXER_STREAMFRAMES-1);
+    const u32 space = util_min(MIXER_STREAMFRAMES - at, MIXER_STREAMFRAMES - (s.write - s.read));
+
+    s.write += (u32)s.dec.decode((i16*)(s.ring + at), space);
+
+    if (s.dec.done()) {
+      if (!loop) break;
+      s.dec.start(s.sound);
+    }
+  }
+}
+
+void mixer_t::mixStream(mixer_voice_t &v, uptr frameCount) {
+  mixer_stream_t &s = m_streams[v.stream];
+  fill(s, v.loop);
+
+  const f32 left = v.gain*util_min(1.f - v.pan, 1.f);
+  const f32 right = v.gain*util_min(1.f + v.pan, 1.f);
+
+  f32 *bus = m_bus;
+
+  // Mix what's in the ring, in at most two pieces since it wraps around
+  while (frameCount && (s.write != s.read)) {
+    const u32 at = s.read & (MIXER_STREAMFRAMES-1);
+    const uptr count = util_min<uptr>(util_min<uptr>(frameCount, s.write - s.read), MIXER_STREAMFRAMES - at);
+    addFrames(bus, s.ring + at, count, left, right);
+
+    bus += count*2;
+    frameCount -= count;
+    s.read += (u32)count;
+  }
+
+  // The sound is over once everything it decoded has been mixed
+  if ((s.write == s.read) && s.dec.done()) {
+    release(v);
+    v.frames = NULL;
+  }
+}
+
+void mixer_t::mix(audio_frame_t *out, uptr frameCount) {
+  log_assert(frameCount <= m_maxFrames, "Mixing %u frames, more than %u!", (u32)frameCount, (u32)m_maxFrames);
+
+  memset((void*)m_bus, 0, frameCount*2*sizeof(f32));
+
+  for (u32 i = 0; i < AUDIO_MAXVOICES; ++i) {
+    if (!m_voices[i].frames) continue;
+
+    if (m_voices[i].stream >= 0) mixStream(m_voices[i], frameCount);
+    else mixVoice(m_voices[i], frameCount);
+  }
+
+  // Convert the bus back to 16 bits
+  uptr i = 0;
+
+#ifdef PLAT_S_SSE2
+
+  // Clamped first, since floats past 32 bits don't convert to anything sensible,
+  // then packed with saturation
+  const __m128 min = _mm_set1_ps(MIXER_MIN), max = _mm_set1_ps(MIXER_MAX);
+
+  for (; i+4 <= frameCount; i += 4) {
+    const __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(m_bus + i*2), min), max);
+    const __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(m_bus + i*2 + 4), min), max);
+
+    _mm_storeu_si128((__m128i*)(out+i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+  }
+
+#endif
+
+  for (; i < frameCount; ++i) {
+    out[i].left = (i16)lrintf(util_min(util_max(m_bus[i*2], MIXER_MIN), MIXER_MAX));
+    out[i].right = (i16)lrintf(util_min(util_max(m_bus[i*2+1], MIXER_MIN), MIXER_MAX));
+  }
+}
+
+u32 mixer_t::activeCount() const {
+  u32 count = 0;
+  for (u32 i = 0; i < AUDIO_MAXVOICES; ++i) count += m_voices[i].frames != NULL;
+
+  return count;
+}
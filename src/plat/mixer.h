@@ -0,0 +1,85 @@
+// Software audio mixer
+//
+// Mixes a pool of voices into interleaved 16-bit frames, on the audio thread.
+// Voices are added into a float bus, which is only converted back to 16 bits,
+// with saturation, once every voice is in, so loud voices don't clip each other early.
+//
+// Streamed sounds are decoded a little ahead into a small ring per stream, right
+// before they're mixed, so only MIXER_STREAMFRAMES frames of each are ever decoded at once.
+
+#ifndef MIXER_H
+#define MIXER_H
+
+#include "types.h"
+#include "mem.h"
+#include "audio.h"
+
+// Most sounds streamed at once
+static constexpr u32 MIXER_MAXSTREAMS = 4;
+
+// Frames in the ring of each stream, must be a power of 2 and at least maxFrames
+static constexpr u32 MIXER_STREAMFRAMES = 4096;
+
+// Voice state
+struct mixer_voice_t {
+  const audio_frame_t *frames; // NULL if the voice isn't playing
+  uptr frameCount, pos;
+  ubool loop;
+
+  f32 gain, pan;
+
+  i32 stream; // Index of the voice's stream, -1 if it plays frames from memory
+};
+
+// Streamed sound state
+struct mixer_stream_t {
+  sound_decoder_t dec;
+  const sound_t *sound; // NULL if the stream is free
+
+  // Decoded frames, read and write only count up and are masked when used
+  audio_frame_t *ring;
+  u32 read, write;
+};
+
+class mixer_t {
+private:
+  mem_t &m_m;
+
+  mixer_voice_t m_voices[AUDIO_MAXVOICES];
+  mixer_stream_t m_streams[MIXER_MAXSTREAMS];
+
+  // Bus the voices are mixed into, left and right interleaved
+  f32 *m_bus;
+  uptr m_maxFrames;
+
+  // Add frameCount frames of a voice into the bus, stopping it if it ends
+  void mixVoice(mixer_voice_t &v, uptr frameCount);
+  void mixStream(mixer_voice_t &v, uptr frameCount);
+
+  // Decode into a stream's ring until it's full or the sound ends
+  void fill(mixer_stream_t &s, ubool loop);
+
+  // Free the stream of a voice, if it has one
+  void release(mixer_voice_t &v);
+
+public:
+  // maxFrames is the most frames mixed at once
+  mixer_t(mem_t &m, uptr maxFrames);
+  ~mixer_t();
+
+  mixer_t(const mixer_t &other) = delete;
+
+  // Apply a command from the game thread
+  void apply(const audio_cmd_t &cmd);
+
+  // Mix the next frameCount frames of every voice into out
+  // frameCount can't be above maxFrames
+  void mix(audio_frame_t *out, uptr frameCount);
+
+  // Number of voices playing
+  u32 activeCount() const;
+
+  FINLINE uptr maxFrames() const {return m_maxFrames;}
+};
+
+#endif //MIXER_H
@@ -0,0 +1,169 @@
+#include "types.h"
+#include "util.h"
+#include "log.h"
+#include "prof.h"
+#include "name.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+static_assert((PROF_EVENTS & (PROF_EVENTS-1)) == 0, "PROF_EVENTS must be a power of 2!");
+
+// Size of the buffer the trace is written through
+static constexpr uptr PROF_WRITEBUF = 64*1024;
+
+prof_t *prof_cur = NULL;
+
+struct prof_t::thread_t {
+  prof_event_t events[PROF_EVENTS];
+
+  // Number of zones recorded, only written by the owner, accessed atomically
+  u32 count;
+
+  const char *name; // Only accessed atomically
+};
+
+// Profiler and ring index of the calling thread, the index is PROF_MAXTHREADS
+// if the thread didn't get a ring
+static thread_local const prof_t *prof_threadProf = NULL;
+static thread_local u32 prof_threadIndex;
+
+prof_t::prof_t(mem_t &m, file_system_t &fileSys, countTimer_t &t, const char *path) :
+  m_m(m), m_fileSys(fileSys), m_t(t), m_path(path), m_threads(NULL), m_nextThread(0), m_start(0)
+{
+  if (!m_path) return;
+
+  if (atomic_load(&prof_cur)) throw log_except("A profiler is already recording!");
+
+  m_threads = (thread_t*)m_m.alloc(PROF_MAXTHREADS*sizeof(thread_t));
+  if (!m_threads) throw log_except("Cannot allocate profiler rings!");
+
+  memset((void*)m_threads, 0, PROF_MAXTHREADS*sizeof(thread_t));
+
+  m_start = m_t.time();
+  atomic_store(&prof_cur, this, ATOMIC_RELEASE);
+
+  log_note("Profiling into %s", m_path);
+}
+
+prof_t::~prof_t() {
+  if (!m_threads) return;
+
+  // Threads that record zones should be done by now
+  atomic_store(&prof_cur, (prof_t*)NULL, ATOMIC_RELEASE);
+
+  if (!write()) log_warning("Cannot write trace to %s!", m_path);
+
+  m_m.free(m_threads);
+}
+
+prof_t::thread_t *prof_t::self() {
+  if (prof_threadProf != this) {
+    const u32 index = atomic_add(&m_nextThread, 1u);
+    if (index >= PROF_MAXTHREADS) log_warning("Too many threads to profile!");
+
+    prof_threadProf = this;
+    prof_threadIndex = util_min(index, PROF_MAXTHREADS);
+  }
+
+  return (prof_threadIndex < PROF_MAXTHREADS) ? m_threads+prof_threadIndex : NULL;
+}
+
+void prof_t::record(const char *name, countTimer_counts_t start, countTimer_counts_t end, str_hash_t arg) {
+  thread_t *t = self();
+  if (!t) return;
+
+  const u32 count = atomic_load(&t->count, ATOMIC_RELAXED);
+
+  prof_event_t &e = t->events[count & (PROF_EVENTS-1)];
+  e.name = name;
+  e.start = start;
+  e.end = end;
+  e.arg = arg;
+
+  atomic_store(&t->count, count+1, ATOMIC_RELEASE);
+}
+
+void prof_t::threadName(const char *name) {
+  thread_t *t = self();
+  if (t) atomic_store(&t->name, name, ATOMIC_RELEASE);
+}
+
+// Writes formatted text through a buffer
+struct prof_writer_t {
+  file_handle_t *f;
+  char *buf;
+  uptr len;
+  ubool ok;
+
+  void flush() {
+    if (len && (f->write(buf, len) != (iptr)len)) ok = false;
+    len = 0;
+  }
+
+  // Lines are short, so there's always space after flushing when it's almost full
+  void put(const char *fmt, ...) {
+    if (len+256 > PROF_WRITEBUF) flush();
+
+    va_list args;
+    va_start(args, fmt);
+    const int ret = vsnprintf(buf+len, PROF_WRITEBUF-len, fmt, args);
+    va_end(args);
+
+    if (ret > 0) len += util_min<uptr>(ret, PROF_WRITEBUF-len-1);
+  }
+};
+
+ubool prof_t::write() {
+  file_handle_t *f = m_fileSys.open(m_path, FILE_MODE_WRITE);
+  if (!f) return false;
+
+  char *buf = (char*)m_m.alloc(PROF_WRITEBUF);
+  if (!buf) {
+    f->close();
+    return false;
+  }
+
+  prof_writer_t w = {f, buf, 0, true};
+
+  // Timestamps and durations are in microseconds
+  const double usPerCount = 1000000.0/(double)m_t.resolution();
+  const u32 threadCount = util_min(atomic_load(&m_nextThread), PROF_MAXTHREADS);
+
+  w.put("{\"traceEvents\":[\n");
+
+  ubool first = true;
+  for (u32 i = 0; i < threadCount; ++i) {
+    const thread_t &t = m_threads[i];
+    const char *name = atomic_load(&t.name, ATOMIC_ACQUIRE);
+
+    if (name) {
+      w.put("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", i, name);
+      first = false;
+    }
+
+    // Only the last PROF_EVENTS zones are still there
+    const u32 count = atomic_load(&t.count, ATOMIC_ACQUIRE);
+    for (u32 e = (count > PROF_EVENTS) ? count-PROF_EVENTS : 0; e < count; ++e) {
+      const prof_event_t &ev = t.events[e & (PROF_EVENTS-1)];
+
+      w.put("%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+            first ? "" : ",\n", ev.name, i,
+            (double)(ev.start-m_start)*usPerCount, (double)(ev.end-ev.start)*usPerCount);
+      if (ev.arg) w.put(",\"args\":{\"name\":\"%s\"}}", name_str(ev.arg));
+      else w.put("}");
+      first = false;
+    }
+  }
+
+  w.put("\n]}\n");
+
+  w.flush();
+
+  m_m.free(buf);
+  f->close();
+
+  return w.ok;
+}
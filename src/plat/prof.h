@@ -0,0 +1,115 @@
+// Profiler
+//
+// Zones mark where a piece of code starts and ends. They're recorded into a ring buffer
+// for each thread, and written out as Chrome trace_event JSON when the profiler is
+// destroyed, which chrome://tracing and Perfetto can open.
+//
+// When nothing is recording a zone is just a branch.
+
+#ifndef PROF_H
+#define PROF_H
+
+#include "types.h"
+#include "mem.h"
+#include "file.h"
+#include "countTimer.h"
+#include "atomic.h"
+#include "str.h"
+
+// Number of zones each thread keeps, older ones are overwritten
+static constexpr u32 PROF_EVENTS = 4096;
+
+// Maximum number of threads that can record zones
+static constexpr u32 PROF_MAXTHREADS = 24;
+
+// Recorded zone
+struct prof_event_t {
+  const char *name;
+  countTimer_counts_t start, end;
+
+  str_hash_t arg; // Name of what the zone worked on, looked up when the trace is written, 0 if none
+};
+
+class prof_t {
+private:
+  mem_t &m_m;
+  file_system_t &m_fileSys;
+  countTimer_t &m_t;
+
+  // Trace file, NULL if we're not recording
+  const char *m_path;
+
+  struct thread_t;
+
+  // Per thread rings, given out in the order threads record their first zone
+  thread_t *m_threads;
+  u32 m_nextThread; // Only accessed atomically
+
+  countTimer_counts_t m_start; // Trace timestamps start here
+
+  // Get the ring of the calling thread, NULL if we're out of rings
+  thread_t *self();
+
+  // Write trace to m_path
+  ubool write();
+
+public:
+  // Records if path isn't NULL, only one profiler can record at a time
+  prof_t(mem_t &m, file_system_t &fileSys, countTimer_t &t, const char *path);
+  ~prof_t();
+
+  prof_t(const prof_t &other) = delete;
+
+  FINLINE countTimer_counts_t time() {return m_t.time();}
+
+  // Record zone on the calling thread
+  void record(const char *name, countTimer_counts_t start, countTimer_counts_t end, str_hash_t arg = 0);
+
+  // Name the calling thread in the trace, name has to stay valid
+  void threadName(const char *name);
+};
+
+// Recording profiler, NULL if there isn't one
+// Only accessed atomically
+extern prof_t *prof_cur;
+
+FINLINE void prof_threadName(const char *name) {
+  prof_t *p = atomic_load(&prof_cur, ATOMIC_ACQUIRE);
+  if (p) p->threadName(name);
+}
+
+// Records from construction until destruction, or until end is called
+class prof_zone_t {
+private:
+  const char *m_name;
+  countTimer_counts_t m_start;
+  str_hash_t m_arg;
+
+public:
+  FINLINE prof_zone_t(const char *name, str_hash_t arg = 0) : m_name(name), m_start(0), m_arg(arg) {
+    prof_t *p = atomic_load(&prof_cur, ATOMIC_ACQUIRE);
+    if (p) m_start = p->time();
+  }
+
+  FINLINE ~prof_zone_t() {end();}
+
+  // End the zone before the scope does
+  FINLINE void end() {
+    prof_t *p = atomic_load(&prof_cur, ATOMIC_ACQUIRE);
+    if (p && m_start) p->record(m_name, m_start, p->time(), m_arg);
+    m_start = 0;
+  }
+
+  prof_zone_t(const prof_zone_t &other) = delete;
+};
+
+#define PROF_CONCAT_(a, b) a##b
+#define PROF_CONCAT(a, b) PROF_CONCAT_(a, b)
+
+// Profile the rest of the scope, name has to be a string literal
+#define PROF_ZONE(name) prof_zone_t PROF_CONCAT(prof_zone, __LINE__)(name)
+
+// Profile the rest of the scope, with the name of what it works on (a str_hash_t) in the trace
+#define PROF_ZONE_NAME(name, hash) prof_zone_t PROF_CONCAT(prof_zone, __LINE__)(name, hash)
+
+#endif //PROF_H
@@ -0,0 +1,222 @@
+#include "types.h"
+#include "sink_audio.h"
+#include "util.h"
+#include "log.h"
+#include "str.h"
+#include "endianUtil.h"
+#include "atomic.h"
+
+#include <cstring>
+
+// WAV file header, everything before the samples
+// The sizes are written as 0 and filled in once the sink is done
+struct sink_wavHdr_t {
+  char riff[4];
+  u32 riffSize; // File size minus 8
+  char wave[4];
+
+  char fmt[4];
+  u32 fmtSize; // 16
+  u16 format; // 1 is PCM
+  u16 channels;
+  u32 sampleRate;
+  u32 byteRate;
+  u16 blockAlign;
+  u16 bits;
+
+  char data[4];
+  u32 dataSize;
+};
+static_assert(sizeof(sink_wavHdr_t) == 44, "");
+
+static void writeWAVHdr(file_handle_t *f, uptr sampleRate, u32 dataSize) {
+  sink_wavHdr_t hdr;
+  memcpy(hdr.riff, "RIFF", 4);
+  hdr.riffSize = endian_little32(sizeof(hdr) - 8 + dataSize);
+  memcpy(hdr.wave, "WAVE", 4);
+
+  memcpy(hdr.fmt, "fmt ", 4);
+  hdr.fmtSize = endian_little32(16);
+  hdr.format = endian_little16(1);
+  hdr.channels = endian_little16(2);
+  hdr.sampleRate = endian_little32((u32)sampleRate);
+  hdr.byteRate = endian_little32((u32)sampleRate*sizeof(audio_frame_t));
+  hdr.blockAlign = endian_little16(sizeof(audio_frame_t));
+  hdr.bits = endian_little16(16);
+
+  memcpy(hdr.data, "data", 4);
+  hdr.dataSize = endian_little32(dataSize);
+
+  f->seek(0, FILE_SEEK_SET);
+  f->write(&hdr, sizeof(hdr));
+}
+
+// Sink thread function
+static void *tFunc(void *ptr) {
+  sink_threadData_t &data = *(sink_threadData_t*)ptr;
+  countTimer_t &timer = data.timer;
+
+  const countTimer_counts_t period =
+    (countTimer_counts_t)((f64)timer.resolution()*SINK_BUFSIZE/((f64)data.sampleRate*data.speed));
+
+  // The pretend device asks for buffer n once buffer n-SINK_QUEUE starts playing,
+  // so buffer n is due at start + n periods, and plays SINK_QUEUE periods later
+  countTimer_counts_t start = timer.time();
+  u64 n = 0;
+
+  while (!atomic_load(&data.quit, ATOMIC_ACQUIRE)) {
+    const countTimer_counts_t due = start + n*period;
+    const countTimer_counts_t now = timer.time();
+    if (now < due) timer.sleep(due-now);
+
+    const countTimer_counts_t mixStart = timer.time();
+
+    // Apply every command sent since the last buffer
+    sink_cmd_t c;
+    u32 cmdCount = 0;
+    countTimer_counts_t sentTotal = 0, sentFirst = 0;
+    while (data.cmds.pop(c)) {
+      data.mixer.apply(c.cmd);
+
+      if (!cmdCount++) sentFirst = c.sent;
+      sentTotal += c.sent;
+    }
+
+    data.mixer.mix(data.buf, SINK_BUFSIZE);
+
+    const countTimer_counts_t mixEnd = timer.time();
+    const countTimer_counts_t mixTime = mixEnd - mixStart;
+
+    // A buffer done after it should've played is an underrun, the device
+    // ran dry and starts over, playing this buffer once it's queued back up
+    countTimer_counts_t play = start + (n+SINK_QUEUE)*period;
+    if (mixEnd > play) {
+      ++data.stats.underruns;
+
+      start = mixEnd;
+      n = 0;
+      play = start + SINK_QUEUE*period;
+    }
+    ++n;
+
+    sink_stats_t &s = data.stats;
+    ++s.buffers;
+    s.mixTotal += mixTime;
+    s.mixMax = util_max(s.mixMax, mixTime);
+
+    if (cmdCount) {
+      s.cmds += cmdCount;
+      s.latencyTotal += cmdCount*play - sentTotal;
+      s.latencyMax = util_max(s.latencyMax, play - sentFirst);
+    }
+
+#ifndef PLAT_E_LITTLE
+    // WAV samples are little endian
+    if (data.wav) {
+      for (u32 i = 0; i < SINK_BUFSIZE; ++i) {
+        data.buf[i].left = endian_little16i(data.buf[i].left);
+        data.buf[i].right = endian_little16i(data.buf[i].right);
+      }
+    }
+#endif
+
+    if (data.wav && (data.wav->write(data.buf, SINK_BUFSIZE*sizeof(audio_frame_t)) < (iptr)(SINK_BUFSIZE*sizeof(audio_frame_t)))) {
+      atomic_store(&data.failed, (ubool)true, ATOMIC_RELEASE);
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+void sink_audio_t::freeData() {
+  if (m_data->wav) m_data->wav->close();
+  if (m_data->buf) m_m.free(m_data->buf);
+  m_data->~sink_threadData_t();
+  m_m.free(m_data);
+}
+
+sink_audio_t::sink_audio_t(audio_init_t &init, const char *wavName) :
+  m_m(init.i.mem), m_timer(init.i.timer)
+{
+  const u32 speed = str_strnum_def<u32>(init.i.args.valDef(str_hash("-sinkspeed"), "1"), 1);
+  if (!speed) throw log_except("The sink speed has to be above 0!");
+
+  m_data = (sink_threadData_t*)m_m.alloc(sizeof(sink_threadData_t));
+  if (!m_data) throw log_except("Cannot allocate audio thread data!");
+
+  try {
+    (void)new(m_data) sink_threadData_t(m_m, m_timer);
+  } catch (...) {
+    m_m.free(m_data);
+    throw;
+  }
+
+  m_data->sampleRate = init.sampleRate;
+  m_data->speed = speed;
+  m_data->quit = false;
+  m_data->failed = false;
+  memset((void*)&m_data->stats, 0, sizeof(m_data->stats));
+  m_data->wav = NULL;
+
+  m_data->buf = (audio_frame_t*)m_m.alloc(SINK_BUFSIZE*sizeof(audio_frame_t));
+  if (!m_data->buf) {
+    freeData();
+    throw log_except("Cannot allocate audio buffer!");
+  }
+
+  if (wavName) {
+    m_data->wav = init.i.fileSys.open(wavName, FILE_MODE_WRITE);
+    if (!m_data->wav) {
+      freeData();
+      throw log_except("Cannot open %s!", wavName);
+    }
+
+    // Sizes are filled in at the end
+    writeWAVHdr(m_data->wav, m_data->sampleRate, 0);
+  }
+
+  const int ret = pthread_create(&m_thread, NULL, tFunc, (void*)m_data);
+  if (ret) {
+    freeData();
+    throw log_except("Cannot create audio thread! (%d, %s)", ret, strerror(ret));
+  }
+
+  if (wavName) log_note("Audio sink writing %s, at %ux real time", wavName, speed);
+  else log_note("Audio sink discarding everything, at %ux real time", speed);
+}
+
+sink_audio_t::~sink_audio_t() {
+  atomic_store(&m_data->quit, (ubool)true, ATOMIC_RELEASE);
+  pthread_join(m_thread, NULL);
+
+  const sink_stats_t &s = m_data->stats;
+  const f64 us = 1000000.0/(f64)m_timer.resolution();
+
+  log_note("Audio sink mixed %llu buffers, %.1f us per buffer, %.1f us at most, %llu underruns",
+           (unsigned long long)s.buffers, s.buffers ? s.mixTotal*us/s.buffers : 0.0, s.mixMax*us,
+           (unsigned long long)s.underruns);
+  if (s.cmds) {
+    log_note("Audio sink latency %.2f ms, %.2f ms at most, over %llu commands",
+             s.latencyTotal*us/1000.0/s.cmds, s.latencyMax*us/1000.0, (unsigned long long)s.cmds);
+  }
+
+  // Fill in the sizes now that they're known
+  if (m_data->wav) writeWAVHdr(m_data->wav, m_data->sampleRate, (u32)(s.buffers*SINK_BUFSIZE*sizeof(audio_frame_t)));
+
+  freeData();
+}
+
+ubool sink_audio_t::update() {
+  if (atomic_load(&m_data->failed, ATOMIC_ACQUIRE)) {
+    log_warning("Cannot write audio to the WAV file!");
+    return false;
+  }
+
+  return true;
+}
+
+ubool sink_audio_t::send(const audio_cmd_t &cmd) {
+  sink_cmd_t c = {cmd, m_timer.time()};
+  return m_data->cmds.push(c);
+}
@@ -0,0 +1,92 @@
+// Sink audio backends
+//
+// Mix on an audio thread like the ALSA backend, but without a device: the file
+// sink writes the mix into a WAV file, the null sink throws it away.
+// The thread is paced like a device with SINK_QUEUE buffers queued would pace it,
+// in real time or -sinkspeed=<n> times faster, so it measures what a device would see:
+// how long mixing a buffer takes, how often a buffer would've been late (an underrun),
+// and how long a command takes from send to the device playing it (the latency).
+// The numbers are logged when the backend is destroyed.
+
+#ifndef SINK_AUDIO_H
+#define SINK_AUDIO_H
+
+#include "types.h"
+#include "audio.h"
+#include "mixer.h"
+#include "spsc.h"
+#include "file.h"
+#include "countTimer.h"
+
+#include <pthread.h>
+
+// Frames per buffer, about 23 ms at 44.1 kHz
+// It doesn't follow the ALSA backend, which negotiates it's period with the device
+static constexpr u32 SINK_BUFSIZE = 1024;
+
+// Buffers queued in the pretend device
+static constexpr u32 SINK_QUEUE = 2;
+
+// Number of commands that can be waiting for the audio thread
+static constexpr u32 SINK_CMDCOUNT = 256;
+
+// Command, with when it was sent for the latency
+struct sink_cmd_t {
+  audio_cmd_t cmd;
+  countTimer_counts_t sent;
+};
+
+// Numbers gathered by the audio thread, only read once it's stopped
+struct sink_stats_t {
+  u64 buffers;
+  u64 underruns;
+
+  countTimer_counts_t mixTotal, mixMax; // Mixing time per buffer
+
+  u64 cmds;
+  countTimer_counts_t latencyTotal, latencyMax; // Send to play time per command
+};
+
+// Data used by the audio thread
+struct sink_threadData_t {
+  spsc_queue_t<sink_cmd_t, SINK_CMDCOUNT> cmds;
+
+  mixer_t mixer;
+  audio_frame_t *buf;
+
+  countTimer_t &timer;
+  file_handle_t *wav; // NULL for the null sink
+  uptr sampleRate;
+  u32 speed; // Times real time
+
+  sink_stats_t stats;
+
+  // Set by main thread to close audio thread
+  ubool quit;
+
+  // Set by the audio thread if writing the WAV file fails, it stops right after
+  ubool failed;
+
+  FINLINE sink_threadData_t(mem_t &m, countTimer_t &t) : mixer(m, SINK_BUFSIZE), timer(t) {}
+};
+
+class sink_audio_t : public audio_base_t {
+private:
+  mem_t &m_m;
+  countTimer_t &m_timer;
+  sink_threadData_t *m_data; // Thread data, too big for the module
+  pthread_t m_thread;
+
+  // Free everything the constructor made, besides the thread
+  void freeData();
+
+public:
+  // wavName is the WAV file written, NULL for the null sink
+  sink_audio_t(audio_init_t &init, const char *wavName);
+  ~sink_audio_t();
+
+  ubool update();
+  ubool send(const audio_cmd_t &cmd);
+};
+
+#endif //SINK_AUDIO_H
@@ -0,0 +1,840 @@
+#include "types.h"
+#include "util.h"
+#include "log.h"
+#include "soft_render.h"
+#include "soft_texture.h"
+#include "gl_mesh.h"
+#include "prof.h"
+
+#include <cstring>
+#include <math.h>
+
+// Vertex positions are snapped to this many steps per pixel, so triangles
+// that share an edge agree on which pixels it covers
+static constexpr f32 SOFTRENDER_SUBPIXEL = 16.f;
+
+// A triangle clipped by the near and far planes has at most this many vertices
+static constexpr uptr SOFTRENDER_MAXCLIPPED = 8;
+
+// Vertex in clip space
+struct soft_clipVert_t {
+  vec4 pos;
+  vec4 coord; // Texture coordinates in 01
+  vec4 col; // Color, from 0 to 1
+};
+
+struct alignas(16) soft_tri_t {
+  // Values interpolated across the triangle are planes,
+  // value = a*x + b*y + c, at pixel centers
+  // [0] is depth, 1/w, u/w and v/w, [1] is the color over w
+  vec4 a[2], b[2], c[2];
+
+  // Edge functions, same as planes, a pixel is inside if all of them are positive,
+  // or zero on an edge that's set in topLeft
+  f32 ea[3], eb[3], ec[3];
+  u32 topLeft;
+
+  i32 minX, minY, maxX, maxY; // Bounds in pixels, max is exclusive
+  u32 layer; // Texture layer
+};
+
+// Clip polygon by a plane, keeping the side where w+z*sign >= 0
+// Returns the number of vertices in out
+static uptr clipPlane(const soft_clipVert_t *in, uptr count, soft_clipVert_t *out, f32 sign) {
+  uptr outCount = 0;
+
+  for (uptr i = 0; i < count; ++i) {
+    const soft_clipVert_t &a = in[i], &b = in[(i+1)%count];
+    const f32 da = a.pos.f[3] + a.pos.f[2]*sign, db = b.pos.f[3] + b.pos.f[2]*sign;
+
+    if (da >= 0.f) out[outCount++] = a;
+
+    if ((da >= 0.f) != (db >= 0.f)) {
+      const f32 t = da/(da-db);
+
+      soft_clipVert_t &v = out[outCount++];
+      v.pos = a.pos + (b.pos-a.pos)*t;
+      v.coord = a.coord + (b.coord-a.coord)*t;
+      v.col = a.col + (b.col-a.col)*t;
+    }
+  }
+
+  return outCount;
+}
+
+#ifndef PLAT_S_SSE2
+
+// Set up triangle for rasterizing, returns false if it doesn't cover any pixels
+static ubool setupTri(const soft_clipVert_t &v0, const soft_clipVert_t &v1, const soft_clipVert_t &v2,
+                      u32 layer, u32 width, u32 height, soft_tri_t &t)
+{
+  const soft_clipVert_t *v[3] = {&v0, &v1, &v2};
+
+  // Project to the screen, rows go down
+  f32 x[3], y[3];
+  vec4 q[3], col[3];
+
+  for (uptr i = 0; i < 3; ++i) {
+    const vec4 &p = v[i]->pos;
+    const f32 iw = 1.f/p.f[3];
+
+    x[i] = floorf((p.f[0]*iw*0.5f + 0.5f)*(f32)width*SOFTRENDER_SUBPIXEL + 0.5f)/SOFTRENDER_SUBPIXEL;
+    y[i] = floorf((0.5f - p.f[1]*iw*0.5f)*(f32)height*SOFTRENDER_SUBPIXEL + 0.5f)/SOFTRENDER_SUBPIXEL;
+
+    // Perspective correct values are interpolated over w
+    q[i] = vec4(p.f[2]*iw, iw, v[i]->coord.f[0]*iw, v[i]->coord.f[1]*iw);
+    col[i] = v[i]->col*iw;
+  }
+
+  // Bounds, clamped to the screen
+  t.minX = util_max<i32>((i32)floorf(util_min(x[0], util_min(x[1], x[2]))), 0);
+  t.minY = util_max<i32>((i32)floorf(util_min(y[0], util_min(y[1], y[2]))), 0);
+  t.maxX = util_min<i32>((i32)ceilf(util_max(x[0], util_max(x[1], x[2]))), width);
+  t.maxY = util_min<i32>((i32)ceilf(util_max(y[0], util_max(y[1], y[2]))), height);
+
+  if ((t.minX >= t.maxX) || (t.minY >= t.maxY)) return false;
+
+  // Edge i is opposite of vertex i
+  for (uptr i = 0; i < 3; ++i) {
+    const uptr a = (i+1)%3, b = (i+2)%3;
+
+    t.ea[i] = y[a]-y[b];
+    t.eb[i] = x[b]-x[a];
+    t.ec[i] = (y[b]-y[a])*x[a] - (x[b]-x[a])*y[a];
+  }
+
+  // Twice the area, triangles aren't culled so it's flipped to be positive
+  f32 area = t.ea[2]*x[2] + t.eb[2]*y[2] + t.ec[2];
+  if (area == 0.f) return false;
+
+  if (area < 0.f) {
+    for (uptr i = 0; i < 3; ++i) {
+      t.ea[i] = -t.ea[i];
+      t.eb[i] = -t.eb[i];
+      t.ec[i] = -t.ec[i];
+    }
+
+    area = -area;
+  }
+
+  // Pixels exactly on an edge belong to one of the two triangles that share it
+  t.topLeft = 0;
+  for (uptr i = 0; i < 3; ++i) {
+    if ((t.ea[i] > 0.f) || ((t.ea[i] == 0.f) && (t.eb[i] < 0.f))) t.topLeft |= 1u << i;
+  }
+
+  // Planes, from the edge functions weighing each vertex
+  const f32 invArea = 1.f/area;
+
+  t.a[0] = (q[0]*t.ea[0] + q[1]*t.ea[1] + q[2]*t.ea[2])*invArea;
+  t.b[0] = (q[0]*t.eb[0] + q[1]*t.eb[1] + q[2]*t.eb[2])*invArea;
+  t.c[0] = (q[0]*t.ec[0] + q[1]*t.ec[1] + q[2]*t.ec[2])*invArea;
+
+  t.a[1] = (col[0]*t.ea[0] + col[1]*t.ea[1] + col[2]*t.ea[2])*invArea;
+  t.b[1] = (col[0]*t.eb[0] + col[1]*t.eb[1] + col[2]*t.eb[2])*invArea;
+  t.c[1] = (col[0]*t.ec[0] + col[1]*t.ec[1] + col[2]*t.ec[2])*invArea;
+
+  t.layer = layer;
+
+  return true;
+}
+
+#endif
+
+// Triangles waiting to be set up, they're set up 4 at a time
+struct soft_setupBatch_t {
+  const soft_clipVert_t *v[4][3];
+  u32 layer[4];
+  uptr count;
+};
+
+#ifdef PLAT_S_SSE2
+
+// Round down 4 floats
+static FINLINE __m128 floor4(__m128 x) {
+  // Truncate, then step down where that rounded up
+  const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+  const __m128 f = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.f)));
+
+  // Floats past 2^23 are whole already, and might not fit in an i32
+  const __m128 big = _mm_cmpge_ps(_mm_andnot_ps(_mm_set1_ps(-0.f), x), _mm_set1_ps(8388608.f));
+  return _mm_or_ps(_mm_and_ps(big, x), _mm_andnot_ps(big, f));
+}
+
+#endif
+
+// Set up the triangles in batch, the ones that cover pixels are written to out
+// Returns how many were written
+static uptr setupTris(const soft_setupBatch_t &batch, u32 width, u32 height, soft_tri_t *out) {
+#ifdef PLAT_S_SSE2
+
+  // Same as setupTri, with a triangle in each lane
+  // Lanes past count repeat the first triangle, and aren't written
+  const soft_clipVert_t *const *v[4];
+  for (uptr l = 0; l < 4; ++l) v[l] = batch.v[(l < batch.count) ? l : 0];
+
+  const __m128 half = _mm_set1_ps(0.5f), zero = _mm_setzero_ps(), sign = _mm_set1_ps(-0.f);
+  const __m128 w = _mm_set1_ps((f32)width), h = _mm_set1_ps((f32)height);
+  const __m128 sub = _mm_set1_ps(SOFTRENDER_SUBPIXEL);
+
+  // Project to the screen, rows go down
+  // q is depth, 1/w, u/w and v/w, col is the color over w
+  __m128 x[3], y[3], q[3][4], col[3][4];
+
+  for (uptr i = 0; i < 3; ++i) {
+    __m128 p[4] = {v[0][i]->pos.pf, v[1][i]->pos.pf, v[2][i]->pos.pf, v[3][i]->pos.pf};
+    __m128 c[4] = {v[0][i]->coord.pf, v[1][i]->coord.pf, v[2][i]->coord.pf, v[3][i]->coord.pf};
+    __m128 *cl = col[i];
+    cl[0] = v[0][i]->col.pf;
+    cl[1] = v[1][i]->col.pf;
+    cl[2] = v[2][i]->col.pf;
+    cl[3] = v[3][i]->col.pf;
+
+    _MM_TRANSPOSE4_PS(p[0], p[1], p[2], p[3]);
+    _MM_TRANSPOSE4_PS(c[0], c[1], c[2], c[3]);
+    _MM_TRANSPOSE4_PS(cl[0], cl[1], cl[2], cl[3]);
+
+    const __m128 iw = _mm_div_ps(_mm_set1_ps(1.f), p[3]);
+
+    x[i] = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(p[0], iw), half), half), w), sub), half);
+    y[i] = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_sub_ps(half, _mm_mul_ps(_mm_mul_ps(p[1], iw), half)), h), sub), half);
+    x[i] = _mm_div_ps(floor4(x[i]), sub);
+    y[i] = _mm_div_ps(floor4(y[i]), sub);
+
+    q[i][0] = _mm_mul_ps(p[2], iw);
+    q[i][1] = iw;
+    q[i][2] = _mm_mul_ps(c[0], iw);
+    q[i][3] = _mm_mul_ps(c[1], iw);
+
+    for (uptr k = 0; k < 4; ++k) cl[k] = _mm_mul_ps(cl[k], iw);
+  }
+
+  // Bounds, clamped to the screen
+  const __m128 minX = _mm_max_ps(floor4(_mm_min_ps(x[0], _mm_min_ps(x[1], x[2]))), zero);
+  const __m128 minY = _mm_max_ps(floor4(_mm_min_ps(y[0], _mm_min_ps(y[1], y[2]))), zero);
+  const __m128 maxX = _mm_min_ps(_mm_sub_ps(zero, floor4(_mm_sub_ps(zero, _mm_max_ps(x[0], _mm_max_ps(x[1], x[2]))))), w);
+  const __m128 maxY = _mm_min_ps(_mm_sub_ps(zero, floor4(_mm_sub_ps(zero, _mm_max_ps(y[0], _mm_max_ps(y[1], y[2]))))), h);
+
+  __m128 valid = _mm_and_ps(_mm_cmplt_ps(minX, maxX), _mm_cmplt_ps(minY, maxY));
+
+  // Edge i is opposite of vertex i
+  __m128 ea[3], eb[3], ec[3];
+  for (uptr i = 0; i < 3; ++i) {
+    const uptr a = (i+1)%3, b = (i+2)%3;
+
+    ea[i] = _mm_sub_ps(y[a], y[b]);
+    eb[i] = _mm_sub_ps(x[b], x[a]);
+    ec[i] = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(y[b], y[a]), x[a]), _mm_mul_ps(_mm_sub_ps(x[b], x[a]), y[a]));
+  }
+
+  // Twice the area, triangles aren't culled so it's flipped to be positive
+  __m128 area = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ea[2], x[2]), _mm_mul_ps(eb[2], y[2])), ec[2]);
+  valid = _mm_and_ps(valid, _mm_cmpneq_ps(area, zero));
+
+  const __m128 flip = _mm_and_ps(_mm_cmplt_ps(area, zero), sign);
+  for (uptr i = 0; i < 3; ++i) {
+    ea[i] = _mm_xor_ps(ea[i], flip);
+    eb[i] = _mm_xor_ps(eb[i], flip);
+    ec[i] = _mm_xor_ps(ec[i], flip);
+  }
+
+  area = _mm_xor_ps(area, flip);
+
+  // Pixels exactly on an edge belong to one of the two triangles that share it
+  u32 topLeft[3];
+  for (uptr i = 0; i < 3; ++i) {
+    topLeft[i] = (u32)_mm_movemask_ps(_mm_or_ps(_mm_cmpgt_ps(ea[i], zero),
+                                                _mm_and_ps(_mm_cmpeq_ps(ea[i], zero), _mm_cmplt_ps(eb[i], zero))));
+  }
+
+  // Planes, from the edge functions weighing each vertex
+  // The planes of every value of a lane are transposed back into a vec4
+  const __m128 invArea = _mm_div_ps(_mm_set1_ps(1.f), area);
+
+  auto plane = [&](const __m128 (*val)[4], uptr k, const __m128 *e) -> __m128 {
+    return _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(val[0][k], e[0]), _mm_mul_ps(val[1][k], e[1])),
+                                 _mm_mul_ps(val[2][k], e[2])), invArea);
+  };
+
+  __m128 planes[2][3][4];
+  for (uptr k = 0; k < 4; ++k) {
+    planes[0][0][k] = plane(q, k, ea);
+    planes[0][1][k] = plane(q, k, eb);
+    planes[0][2][k] = plane(q, k, ec);
+
+    planes[1][0][k] = plane(col, k, ea);
+    planes[1][1][k] = plane(col, k, eb);
+    planes[1][2][k] = plane(col, k, ec);
+  }
+
+  for (uptr p = 0; p < 2; ++p) {
+    for (uptr e = 0; e < 3; ++e) {
+      __m128 *pl = planes[p][e];
+      _MM_TRANSPOSE4_PS(pl[0], pl[1], pl[2], pl[3]);
+    }
+  }
+
+  alignas(16) f32 eaOut[3][4], ebOut[3][4], ecOut[3][4];
+  alignas(16) i32 bounds[4][4];
+
+  for (uptr i = 0; i < 3; ++i) {
+    _mm_store_ps(eaOut[i], ea[i]);
+    _mm_store_ps(ebOut[i], eb[i]);
+    _mm_store_ps(ecOut[i], ec[i]);
+  }
+
+  _mm_store_si128((__m128i*)bounds[0], _mm_cvttps_epi32(minX));
+  _mm_store_si128((__m128i*)bounds[1], _mm_cvttps_epi32(minY));
+  _mm_store_si128((__m128i*)bounds[2], _mm_cvttps_epi32(maxX));
+  _mm_store_si128((__m128i*)bounds[3], _mm_cvttps_epi32(maxY));
+
+  // Write the lanes that cover pixels
+  u32 mask = (u32)_mm_movemask_ps(valid) & ((1u << batch.count)-1);
+  uptr count = 0;
+
+  while (mask) {
+    const u32 l = __builtin_ctz(mask);
+    mask &= mask-1;
+
+    soft_tri_t &t = out[count++];
+
+    for (uptr p = 0; p < 2; ++p) {
+      t.a[p].pf = planes[p][0][l];
+      t.b[p].pf = planes[p][1][l];
+      t.c[p].pf = planes[p][2][l];
+    }
+
+    t.topLeft = 0;
+    for (uptr i = 0; i < 3; ++i) {
+      t.ea[i] = eaOut[i][l];
+      t.eb[i] = ebOut[i][l];
+      t.ec[i] = ecOut[i][l];
+      t.topLeft |= ((topLeft[i] >> l) & 1) << i;
+    }
+
+    t.minX = bounds[0][l];
+    t.minY = bounds[1][l];
+    t.maxX = bounds[2][l];
+    t.maxY = bounds[3][l];
+    t.layer = batch.layer[l];
+  }
+
+  return count;
+
+#else
+
+  uptr count = 0;
+  for (uptr i = 0; i < batch.count; ++i) {
+    const soft_clipVert_t *const *v = batch.v[i];
+    if (setupTri(*v[0], *v[1], *v[2], batch.layer[i], width, height, out[count])) ++count;
+  }
+
+  return count;
+
+#endif
+}
+
+// Coverage and depth test of 4 pixels in a row, starting at pixel center px
+// eRow and zRow are the edge functions and depth at the start of the row,
+// pixels at xEnd or after aren't covered
+// Returns a mask of the pixels that pass
+static FINLINE u32 coverage4(const soft_tri_t &t, f32 px, const f32 eRow[3], f32 zRow,
+                             f32 xEnd, const f32 *depth)
+{
+#ifdef PLAT_S_SSE2
+
+  const __m128 x = _mm_add_ps(_mm_set1_ps(px), VEC4_SSE2_SET(0.f, 1.f, 2.f, 3.f));
+  const __m128 zero = _mm_setzero_ps();
+
+  __m128 mask = _mm_cmplt_ps(x, _mm_set1_ps(xEnd));
+
+  for (uptr i = 0; i < 3; ++i) {
+    const __m128 e = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.ea[i]), x), _mm_set1_ps(eRow[i]));
+
+    __m128 inside = _mm_cmpgt_ps(e, zero);
+    if (t.topLeft & (1u << i)) inside = _mm_or_ps(inside, _mm_cmpeq_ps(e, zero));
+
+    mask = _mm_and_ps(mask, inside);
+  }
+
+  const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.a[0].f[0]), x), _mm_set1_ps(zRow));
+  mask = _mm_and_ps(mask, _mm_cmplt_ps(z, _mm_loadu_ps(depth)));
+
+  return (u32)_mm_movemask_ps(mask);
+
+#else
+
+  u32 mask = 0;
+
+  for (u32 l = 0; l < 4; ++l) {
+    const f32 x = px + (f32)l;
+    if (!(x < xEnd)) continue;
+
+    ubool inside = true;
+    for (uptr i = 0; i < 3; ++i) {
+      const f32 e = t.ea[i]*x + eRow[i];
+      inside = inside && ((e > 0.f) || ((e == 0.f) && (t.topLeft & (1u << i))));
+    }
+
+    if (inside && (t.a[0].f[0]*x + zRow < depth[l])) mask |= 1u << l;
+  }
+
+  return mask;
+
+#endif
+}
+
+// Cheap log2, the exponent plus the mantissa as a linear fraction,
+// close enough for picking mip levels
+static FINLINE f32 fastLog2(f32 x) {
+  u32 bits;
+  memcpy(&bits, &x, sizeof(bits));
+
+  return (f32)bits*(1.f/(f32)(1 << 23)) - 127.f;
+}
+
+// Shade the pixels in mask of 4 pixels in a row, starting at x
+// Every lane is interpolated at once, only texture sampling is done per pixel
+static FINLINE void shade4(const soft_texture_t &texture, const soft_tri_t &t, i32 x, f32 py, u32 mask,
+                           atlas_col_t *col, f32 *depth, soft_texture_cache_t &cache)
+{
+  const vec4 px = vec4((f32)x + 0.5f) + vec4(0.f, 1.f, 2.f, 3.f);
+
+  // Value k of a plane at each lane
+  auto lanes = [&](uptr p, uptr k) -> vec4 {
+    return px*t.a[p].f[k] + vec4(t.b[p].f[k]*py + t.c[p].f[k]);
+  };
+
+  const vec4 z = lanes(0, 0);
+  const vec4 w = vec4(1.f)/lanes(0, 1);
+  const vec4 u = lanes(0, 2)*w, v = lanes(0, 3)*w;
+
+  // Level of detail, from how far a pixel moves the texture coordinates
+  const vec4 dudx = (vec4(t.a[0].f[2]) - u*t.a[0].f[1])*w*(f32)ATLAS_WIDTH;
+  const vec4 dvdx = (vec4(t.a[0].f[3]) - v*t.a[0].f[1])*w*(f32)ATLAS_HEIGHT;
+  const vec4 dudy = (vec4(t.b[0].f[2]) - u*t.b[0].f[1])*w*(f32)ATLAS_WIDTH;
+  const vec4 dvdy = (vec4(t.b[0].f[3]) - v*t.b[0].f[1])*w*(f32)ATLAS_HEIGHT;
+  const vec4 dx2 = dudx*dudx + dvdx*dvdx, dy2 = dudy*dudy + dvdy*dvdy;
+
+  // Color channels, scaled so 256 is 1
+  const vec4 colScale = w*256.f;
+  const vec4 c[4] = {lanes(1, 0)*colScale, lanes(1, 1)*colScale, lanes(1, 2)*colScale, lanes(1, 3)*colScale};
+
+  while (mask) {
+    const u32 l = __builtin_ctz(mask);
+    mask &= mask-1;
+
+    const f32 lod = 0.5f*fastLog2(util_max(dx2.f[l], dy2.f[l]));
+    const atlas_col_t tex = texture.sample(t.layer, u.f[l], v.f[l], lod, cache);
+
+    atlas_col_t &out = col[l];
+    for (uptr i = 0; i < 4; ++i)
+      out.c[i] = (u8)((tex.c[i]*(u32)util_min(util_max(c[i].f[l], 0.f), 256.f)) >> 8);
+
+    depth[l] = z.f[l];
+  }
+}
+
+soft_render_t::soft_render_t(mem_t &m, job_system_t &jobs, const game_state_t &s, u32 width, u32 height) :
+  m_m(m), m_jobs(jobs), m_color(NULL), m_depth(NULL), m_binStart(NULL), m_binNext(NULL),
+  m_width(0), m_height(0), m_vertCount(0), m_indCount(0), m_clip(NULL), m_tris(NULL), m_bins(NULL),
+  m_clipCap(0), m_triCap(0), m_binCap(0), m_mapGen(0), m_atlas{}, m_atlasName{}
+{
+  m_verts = (gl_vertex_t*)m_m.alloc(SOFTRENDER_MAXVERTS*sizeof(gl_vertex_t) + SOFTRENDER_MAXINDS*sizeof(u16));
+  if (!m_verts) throw log_except("Cannot allocate software renderer vertices!");
+
+  m_inds = (u16*)(m_verts+SOFTRENDER_MAXVERTS);
+
+  // Setup projection matrix, the same one gl_render_t uses
+  m_projDist = 1.f/tanf(s.fovy*0.5f);
+  gl_mesh_projection(m_projDist, width, height, m_projection);
+
+  if (!resize(width, height)) {
+    m_m.free(m_verts);
+    throw log_except("Cannot allocate %ux%u framebuffer!", width, height);
+  }
+
+  log_note("Software rendering %ux%u pixels in %ux%u tiles", width, height,
+           SOFTRENDER_TILESIZE, SOFTRENDER_TILESIZE);
+}
+
+soft_render_t::~soft_render_t() {
+  if (m_bins) m_m.free(m_bins);
+  if (m_tris) m_m.free(m_tris);
+  if (m_color) m_m.free(m_color);
+  m_m.free(m_verts);
+}
+
+ubool soft_render_t::resize(u32 width, u32 height) {
+  if (m_color) m_m.free(m_color);
+
+  m_width = width;
+  m_height = height;
+  m_tilesX = (width+SOFTRENDER_TILESIZE-1)/SOFTRENDER_TILESIZE;
+  m_tilesY = (height+SOFTRENDER_TILESIZE-1)/SOFTRENDER_TILESIZE;
+
+  // Depths are read 4 at a time, so there's padding after the last row
+  const uptr pixels = (uptr)width*height, tileCount = (uptr)m_tilesX*m_tilesY;
+  m_color = (atlas_col_t*)m_m.alloc(pixels*sizeof(atlas_col_t) + (pixels+4)*sizeof(f32) +
+                                    (2*tileCount+1)*sizeof(u32));
+  if (!m_color) {
+    m_depth = NULL;
+    m_binStart = m_binNext = NULL;
+    m_width = m_height = 0;
+    m_tilesX = m_tilesY = 0;
+    return false;
+  }
+
+  m_depth = (f32*)(m_color+pixels);
+  m_binStart = (u32*)(m_depth+pixels+4);
+  m_binNext = m_binStart+tileCount+1;
+  memset((void*)m_color, 0, pixels*sizeof(atlas_col_t));
+
+  // Resize projection matrix
+  m_projection[0].f[0] = (f32)height/(f32)width*m_projDist;
+
+  return true;
+}
+
+// Scratch grows to at least twice it's size, so it's rarely reallocated
+void soft_render_t::growScratch() {
+  // Triangles can be split in 3 when clipped
+  const uptr triCount = m_indCount/3*3;
+  if ((m_vertCount <= m_clipCap) && (triCount <= m_triCap)) return;
+
+  const uptr clipCap = util_max(m_vertCount, 2*m_clipCap), triCap = util_max(triCount, 2*m_triCap);
+
+  // Triangles first, they're the ones that have to be aligned
+  void *p = m_m.alloc(triCap*sizeof(soft_tri_t) + clipCap*sizeof(soft_clipVert_t));
+  if (!p) throw log_except("Cannot allocate software renderer triangles!");
+
+  if (m_tris) m_m.free(m_tris);
+
+  m_tris = (soft_tri_t*)p;
+  m_clip = (soft_clipVert_t*)(m_tris+triCap);
+  m_clipCap = clipCap;
+  m_triCap = triCap;
+}
+
+void soft_render_t::growBins(uptr count) {
+  if (count <= m_binCap) return;
+
+  const uptr cap = util_max(count, 2*m_binCap);
+
+  u32 *bins = (u32*)m_m.alloc(cap*sizeof(u32));
+  if (!bins) throw log_except("Cannot allocate software renderer bins!");
+
+  if (m_bins) m_m.free(m_bins);
+
+  m_bins = bins;
+  m_binCap = cap;
+}
+
+void soft_render_t::addCube(const map_cube_t &c, atlas_id_t atlas) {
+  const uptr faces = gl_mesh_cubeFaces(c);
+  if ((m_vertCount+faces*4 > SOFTRENDER_MAXVERTS) || (m_indCount+faces*6 > SOFTRENDER_MAXINDS))
+    throw log_except("Out of software renderer vertices!");
+
+  f32 layer;
+  const vec2_2 coord = m_texture.imgCoord(atlas, c.img, layer);
+
+  gl_mesh_buildCube(c, coord, layer, m_verts+m_vertCount, m_inds+m_indCount, m_vertCount);
+
+  m_vertCount += faces*4;
+  m_indCount += faces*6;
+}
+
+ubool soft_render_t::render(const game_state_snapshot_t &snap) {
+  PROF_ZONE("render");
+
+  // Resize if the window changed size
+  if ((snap.width != m_width) || (snap.height != m_height)) {
+    if (!resize(snap.width, snap.height)) return false;
+  }
+
+  // Load atlases if they changed
+  ubool reload = (snap.mapGen != m_mapGen);
+  for (atlas_id_t i = 0; i < ATLAS_COUNT; ++i) {
+    if ((snap.atlas[i] != m_atlas[i]) || (snap.atlasName[i] != m_atlasName[i])) reload = true;
+  }
+
+  if (reload) {
+    for (atlas_id_t i = 0; i < ATLAS_COUNT; ++i) {
+      m_atlas[i] = snap.atlas[i];
+      m_atlasName[i] = snap.atlasName[i];
+    }
+
+    // The atlases that didn't load are drawn without a texture
+    if (!m_texture.load(snap.atlas))
+      log_warning("Cannot load every atlas, some cubes are drawn untextured!");
+
+    m_mapGen = snap.mapGen;
+  }
+
+  gl_mesh_modelView(snap.view, m_modelView);
+
+  vec4 mvp[4];
+  gl_mesh_mvp(m_modelView, m_projection, mvp);
+
+  // Meshes are cheap to build on the CPU, so they're built every frame,
+  // only from the cubes that can be on screen
+  m_vertCount = m_indCount = 0;
+
+  for (uptr i = 0; i < snap.cubeCount; ++i) {
+    const map_cube_t &c = snap.cubes[i];
+
+    vec4 min, max;
+    for (uptr a = 0; a < 4; ++a) {
+      min.f[a] = util_min(c.min.f[a], c.max.f[a]);
+      max.f[a] = util_max(c.min.f[a], c.max.f[a]);
+    }
+
+    if (gl_mesh_visible(mvp, min, max)) addCube(c, ATLAS_LEVEL);
+  }
+
+  // Draw dynamic objects
+  for (uptr i = 0; i < snap.objCount; ++i)
+    addCube(snap.objs[i].cube, snap.objs[i].atlas);
+
+  growScratch();
+  draw();
+
+  return true;
+}
+
+// Data for rasterizing tiles in parallel
+struct soft_render_raster_t {
+  const soft_render_t *r;
+  const soft_tri_t *tris;
+
+  // Triangles in each tile, tile i's are from bins[binStart[i]] to bins[binStart[i+1]]
+  const u32 *binStart, *bins;
+};
+
+void soft_render_t::draw() {
+  PROF_ZONE("draw");
+
+  vec4 mvp[4];
+  gl_mesh_mvp(m_modelView, m_projection, mvp);
+
+  const uptr tileCount = (uptr)m_tilesX*m_tilesY;
+
+  // Transform vertices
+  for (uptr i = 0; i < m_vertCount; ++i) {
+    const gl_vertex_t &v = m_verts[i];
+    soft_clipVert_t &c = m_clip[i];
+
+    c.pos = mvp[0]*v.pos.f[0] + mvp[1]*v.pos.f[1] + mvp[2]*v.pos.f[2] + mvp[3]*v.pos.f[3];
+    c.coord = v.coord;
+
+    const u8 *col = (const u8*)&v.col();
+    c.col = vec4((f32)col[0], (f32)col[1], (f32)col[2], (f32)col[3])*(1.f/255.f);
+  }
+
+  // Clip and set up triangles, in the order they're drawn
+  uptr triCount = 0;
+
+  soft_setupBatch_t batch;
+  batch.count = 0;
+
+  auto queue = [&](const soft_clipVert_t &v0, const soft_clipVert_t &v1, const soft_clipVert_t &v2, u32 layer) {
+    batch.v[batch.count][0] = &v0;
+    batch.v[batch.count][1] = &v1;
+    batch.v[batch.count][2] = &v2;
+    batch.layer[batch.count] = layer;
+
+    if (++batch.count == 4) {
+      triCount += setupTris(batch, m_width, m_height, m_tris+triCount);
+      batch.count = 0;
+    }
+  };
+
+  auto flush = [&]() {
+    if (batch.count) triCount += setupTris(batch, m_width, m_height, m_tris+triCount);
+    batch.count = 0;
+  };
+
+  for (uptr i = 0; i+2 < m_indCount; i += 3) {
+    const soft_clipVert_t *v[3] = {m_clip+m_inds[i], m_clip+m_inds[i+1], m_clip+m_inds[i+2]};
+    const u32 layer = (u32)m_verts[m_inds[i]].layer();
+
+    // Skip triangles that are entirely outside one plane, and clip the rest
+    // by the near and far planes, x and y are clipped by the bounds
+    u32 outside = 0x3f, clipNeeded = 0;
+    for (uptr j = 0; j < 3; ++j) {
+      const vec4 &p = v[j]->pos;
+
+      u32 out = 0;
+      for (uptr a = 0; a < 3; ++a) {
+        if (p.f[a] < -p.f[3]) out |= 1u << (a*2);
+        if (p.f[a] > p.f[3]) out |= 2u << (a*2);
+      }
+
+      outside &= out;
+      clipNeeded |= out & 0x30;
+    }
+
+    if (outside) continue;
+
+    if (!clipNeeded) {
+      queue(*v[0], *v[1], *v[2], layer);
+      continue;
+    }
+
+    // Clipped vertices only last this iteration, so the triangles from them
+    // are set up in their own batch, they're rare
+    flush();
+
+    soft_clipVert_t poly[SOFTRENDER_MAXCLIPPED], clipped[SOFTRENDER_MAXCLIPPED];
+    for (uptr j = 0; j < 3; ++j) poly[j] = *v[j];
+
+    uptr count = clipPlane(poly, 3, clipped, 1.f);
+    count = clipPlane(clipped, count, poly, -1.f);
+
+    for (uptr j = 1; j+1 < count; ++j) queue(poly[0], poly[j], poly[j+1], layer);
+    flush();
+  }
+
+  flush();
+
+  // Bin triangles into the tiles they touch, counting first so each tile's
+  // triangles are together and in the order they were drawn
+  memset(m_binStart, 0, (tileCount+1)*sizeof(u32));
+
+  uptr binCount = 0;
+  for (uptr i = 0; i < triCount; ++i) {
+    const soft_tri_t &t = m_tris[i];
+
+    for (i32 ty = t.minY/SOFTRENDER_TILESIZE; ty <= (t.maxY-1)/(i32)SOFTRENDER_TILESIZE; ++ty) {
+      for (i32 tx = t.minX/SOFTRENDER_TILESIZE; tx <= (t.maxX-1)/(i32)SOFTRENDER_TILESIZE; ++tx) {
+        ++m_binStart[ty*m_tilesX + tx + 1];
+        ++binCount;
+      }
+    }
+  }
+
+  for (uptr i = 0; i < tileCount; ++i) m_binStart[i+1] += m_binStart[i];
+
+  growBins(binCount);
+  memcpy(m_binNext, m_binStart, tileCount*sizeof(u32));
+
+  for (uptr i = 0; i < triCount; ++i) {
+    const soft_tri_t &t = m_tris[i];
+
+    for (i32 ty = t.minY/SOFTRENDER_TILESIZE; ty <= (t.maxY-1)/(i32)SOFTRENDER_TILESIZE; ++ty) {
+      for (i32 tx = t.minX/SOFTRENDER_TILESIZE; tx <= (t.maxX-1)/(i32)SOFTRENDER_TILESIZE; ++tx)
+        m_bins[m_binNext[ty*m_tilesX + tx]++] = (u32)i;
+    }
+  }
+
+  soft_render_raster_t data = {this, m_tris, m_binStart, m_bins};
+  // A few chunks of tiles per thread, so big windows don't make a job per tile
+  const uptr chunk = util_max<uptr>(1, tileCount/(4*(m_jobs.workerCount()+1)));
+  m_jobs.parallelFor(tileCount, chunk, rasterTiles, &data);
+}
+
+void soft_render_t::rasterTiles(uptr begin, uptr end, void *data) {
+  PROF_ZONE("raster tiles");
+
+  const soft_render_raster_t &d = *(const soft_render_raster_t*)data;
+  const soft_render_t &r = *d.r;
+
+  soft_texture_cache_t cache;
+
+  for (uptr tile = begin; tile < end; ++tile) {
+    const i32 x0 = (i32)((tile%r.m_tilesX)*SOFTRENDER_TILESIZE);
+    const i32 y0 = (i32)((tile/r.m_tilesX)*SOFTRENDER_TILESIZE);
+    const i32 x1 = util_min<i32>(x0+SOFTRENDER_TILESIZE, r.m_width);
+    const i32 y1 = util_min<i32>(y0+SOFTRENDER_TILESIZE, r.m_height);
+
+    // Clear tile
+    for (i32 y = y0; y < y1; ++y) {
+      memset((void*)(r.m_color + y*r.m_width + x0), 0, (x1-x0)*sizeof(atlas_col_t));
+      for (i32 x = x0; x < x1; ++x) r.m_depth[y*r.m_width + x] = 1.f;
+    }
+
+    for (u32 b = d.binStart[tile]; b < d.binStart[tile+1]; ++b) {
+      const soft_tri_t &t = d.tris[d.bins[b]];
+
+      const i32 minX = util_max(t.minX, x0), maxX = util_min(t.maxX, x1);
+      const i32 minY = util_max(t.minY, y0), maxY = util_min(t.maxY, y1);
+
+      for (i32 y = minY; y < maxY; ++y) {
+        const f32 py = (f32)y + 0.5f;
+
+        f32 eRow[3];
+        for (uptr i = 0; i < 3; ++i) eRow[i] = t.eb[i]*py + t.ec[i];
+
+        const f32 zRow = t.b[0].f[0]*py + t.c[0].f[0];
+
+        atlas_col_t *colRow = r.m_color + y*r.m_width;
+        f32 *depthRow = r.m_depth + y*r.m_width;
+
+        for (i32 x = minX; x < maxX; x += 4) {
+          const u32 mask = coverage4(t, (f32)x + 0.5f, eRow, zRow, (f32)maxX, depthRow+x);
+
+          if (mask) shade4(r.m_texture, t, x, py, mask, colRow+x, depthRow+x, cache);
+        }
+      }
+    }
+  }
+}
+
+// Write a little endian value
+static FINLINE void put16(u8 *p, u16 v) {
+  p[0] = (u8)v;
+  p[1] = (u8)(v >> 8);
+}
+
+static FINLINE void put32(u8 *p, u32 v) {
+  put16(p, (u16)v);
+  put16(p+2, (u16)(v >> 16));
+}
+
+ubool soft_render_t::dump(file_system_t &f, const char *path) const {
+  // BMP header, then a BITMAPINFOHEADER
+  static constexpr uptr HDR_SIZE = 14+40;
+  const u32 imageSize = m_width*m_height*4;
+
+  u8 hdr[HDR_SIZE] = {'B', 'M'};
+  put32(hdr+2, HDR_SIZE+imageSize); // File size
+  put32(hdr+10, HDR_SIZE); // Pixel offset
+  put32(hdr+14, 40); // Info header size
+  put32(hdr+18, m_width);
+  put32(hdr+22, m_height); // Positive, rows are bottom to top
+  put16(hdr+26, 1); // Planes
+  put16(hdr+28, 32); // Bits per pixel
+  put32(hdr+34, imageSize);
+  put32(hdr+38, 2835); // 72 DPI
+  put32(hdr+42, 2835);
+
+  file_handle_t *file = f.open(path, FILE_MODE_WRITE);
+  if (!file) return false;
+
+  ubool ok = file->write(hdr, HDR_SIZE) == (iptr)HDR_SIZE;
+
+  // BMP's are BGRA, rows are converted and written a chunk of pixels at a time
+  static constexpr u32 CHUNK_PIXELS = 256;
+  u8 chunk[CHUNK_PIXELS*4];
+
+  for (u32 y = m_height; ok && y--;) {
+    const atlas_col_t *src = m_color + y*m_width;
+
+    for (u32 x = 0; ok && (x < m_width); x += CHUNK_PIXELS) {
+      const u32 count = util_min(m_width-x, CHUNK_PIXELS);
+
+      for (u32 i = 0; i < count; ++i) {
+        chunk[i*4] = src[x+i].c[2];
+        chunk[i*4+1] = src[x+i].c[1];
+        chunk[i*4+2] = src[x+i].c[0];
+        chunk[i*4+3] = src[x+i].c[3];
+      }
+
+      ok = file->write(chunk, count*4) == (iptr)(count*4);
+    }
+  }
+
+  file->close();
+
+  return ok;
+}
@@ -0,0 +1,103 @@
+// Software renderer
+//
+// Draws the same meshes gl_render_t does, into a framebuffer in memory.
+// The screen is split into tiles, triangles are set up and binned into the tiles
+// they touch, then every tile is rasterized by it's own job, with a depth buffer.
+
+#ifndef SOFT_RENDER_H
+#define SOFT_RENDER_H
+
+#include "types.h"
+#include "mem.h"
+#include "file.h"
+#include "job.h"
+#include "game/state.h"
+#include "game/atlas.h"
+#include "gl_vertex.h"
+#include "soft_texture.h"
+
+// Size of a tile, in pixels
+static constexpr u32 SOFTRENDER_TILESIZE = 64;
+
+// Maximum number of vertices and indices drawn in a frame,
+// every cube in a snapshot with every side
+static constexpr uptr SOFTRENDER_MAXVERTS = (GAME_SNAPSHOT_MAXCUBES+GAME_SNAPSHOT_MAXOBJS)*6*4;
+static constexpr uptr SOFTRENDER_MAXINDS = (GAME_SNAPSHOT_MAXCUBES+GAME_SNAPSHOT_MAXOBJS)*6*6;
+
+// Vertex in clip space, and triangle that's set up for rasterizing
+struct soft_clipVert_t;
+struct soft_tri_t;
+
+class soft_render_t {
+private:
+  mem_t &m_m;
+  job_system_t &m_jobs; // Tiles are rasterized in parallel
+
+  soft_texture_t m_texture;
+
+  // Framebuffer, RGBA8 colors and depths, rows are top to bottom
+  atlas_col_t *m_color;
+  f32 *m_depth;
+
+  // First bin of each tile, and where the next one is written when binning
+  // Allocated with the framebuffer
+  u32 *m_binStart, *m_binNext;
+
+  u32 m_width, m_height; // Framebuffer size
+  u32 m_tilesX, m_tilesY;
+
+  f32 m_projDist; // Distance to the projection plane, used when resizing
+
+  // NOTE: All matrices are column-major
+  vec4 m_modelView[4];
+  vec4 m_projection[4];
+
+  // Vertices drawn this frame
+  gl_vertex_t *m_verts;
+  u16 *m_inds;
+  uptr m_vertCount, m_indCount;
+
+  // Scratch for drawing, only grown when a frame has more vertices or bins than before
+  soft_clipVert_t *m_clip;
+  soft_tri_t *m_tris;
+  u32 *m_bins;
+  uptr m_clipCap, m_triCap, m_binCap;
+
+  // Map and atlases of the last snapshot, to tell when they have to be loaded
+  u32 m_mapGen;
+  const atlas_t *m_atlas[ATLAS_COUNT];
+  str_hash_t m_atlasName[ATLAS_COUNT];
+
+  // Add the faces of a cube to this frame's vertices
+  void addCube(const map_cube_t &c, atlas_id_t atlas);
+
+  // Grow the scratch to fit this frame's vertices, or count bins
+  void growScratch();
+  void growBins(uptr count);
+
+  // Set up, bin and rasterize this frame's vertices
+  void draw();
+
+  // parallelFor function for rasterizing tiles
+  static void rasterTiles(uptr begin, uptr end, void *data);
+
+public:
+  soft_render_t(mem_t &m, job_system_t &jobs, const game_state_t &s, u32 width, u32 height);
+  ~soft_render_t();
+
+  soft_render_t(const soft_render_t &other) = delete;
+
+  // Render a snapshot of the game
+  // Returns false if update/resize failed
+  ubool render(const game_state_snapshot_t &snap);
+  ubool resize(u32 width, u32 height);
+
+  FINLINE const atlas_col_t *color() const {return m_color;}
+  FINLINE u32 width() const {return m_width;}
+  FINLINE u32 height() const {return m_height;}
+
+  // Write the framebuffer into a 32-bit BMP, returns false on failure
+  ubool dump(file_system_t &f, const char *path) const;
+};
+
+#endif //SOFT_RENDER_H
@@ -0,0 +1,199 @@
+#include "types.h"
+#include "util.h"
+#include "log.h"
+#include "game/atlas.h"
+#include "soft_texture.h"
+
+#include <math.h>
+
+soft_texture_t::soft_texture_t() : m_atlas{}, m_levels{}, m_format{} {}
+
+vec2_2 soft_texture_t::imgCoord(atlas_id_t atlas, str_hash_t name, f32 &layer) const {
+  // Atlas coordinate normalizer
+  static const vec2_2 normMul(1.f/(f32)ATLAS_WIDTH, 1.f/(f32)ATLAS_HEIGHT,
+                              1.f/(f32)ATLAS_WIDTH, 1.f/(f32)ATLAS_HEIGHT);
+
+  layer = 0.f;
+
+  // If there's no atlas in this spot, return zeros
+  if (!m_atlas[atlas]) return vec2_2(0.f);
+
+  for (uptr i = m_atlas[atlas]->imageCount; i--;) {
+    if (m_atlas[atlas]->imgNames[i] == name) {
+      const u32 page = m_atlas[atlas]->imgPage[i];
+      if (page >= SOFTTEXTURE_MAXPAGES) return vec2_2(0.f);
+
+      layer = (f32)(atlas*SOFTTEXTURE_MAXPAGES + page);
+      return vec4_ivec4(m_atlas[atlas]->imgDim[i].v())*normMul;
+    }
+  }
+
+  return vec2_2(0.f);
+}
+
+ubool soft_texture_t::load(const atlas_t *const atlas[ATLAS_COUNT]) {
+  ubool ret = true;
+
+  for (atlas_id_t i = 0; i < ATLAS_COUNT; ++i) {
+    m_atlas[i] = atlas[i];
+
+    for (u32 p = 0; p < SOFTTEXTURE_MAXPAGES; ++p) {
+      for (u32 l = 0; l < ATLAS_LEVELS; ++l) m_levels[i*SOFTTEXTURE_MAXPAGES + p][l] = NULL;
+    }
+
+    if (!atlas[i]) continue;
+
+    // Same restrictions as the GL texture
+    if ((atlas[i]->magic != ATLAS_MAGIC) || (atlas[i]->levelCount != ATLAS_LEVELS) ||
+        (atlas[i]->format >= ATLAS_FORMAT_COUNT)) {
+      log_warning("Invalid atlas format, or atlas has %u mip levels instead of %u!",
+                  (u32)atlas[i]->levelCount, ATLAS_LEVELS);
+      m_atlas[i] = NULL;
+      ret = false;
+      continue;
+    }
+
+    if (atlas[i]->pageCount > SOFTTEXTURE_MAXPAGES)
+      log_warning("Atlas has %u pages, only the first %u are sampled!",
+                  (u32)atlas[i]->pageCount, SOFTTEXTURE_MAXPAGES);
+
+    m_format[i] = atlas[i]->format;
+
+    const u32 pages = util_min<u32>(atlas[i]->pageCount, SOFTTEXTURE_MAXPAGES);
+    for (u32 p = 0; p < pages; ++p) {
+      for (u32 l = 0; l < ATLAS_LEVELS; ++l) m_levels[i*SOFTTEXTURE_MAXPAGES + p][l] = atlas[i]->level(p, l);
+    }
+  }
+
+  return ret;
+}
+
+const atlas_col_t *soft_texture_t::block(const u8 *data, atlas_format_t format, u32 width, u32 x, u32 y,
+                                         soft_texture_cache_t &cache) const
+{
+  const uptr blockSize = (format == ATLAS_FORMAT_BC1) ? 8 : 16;
+  const u32 blocksX = (width+ATLAS_BLOCK_SIZE-1)/ATLAS_BLOCK_SIZE;
+  const u8 *b = data + ((y/ATLAS_BLOCK_SIZE)*blocksX + x/ATLAS_BLOCK_SIZE)*blockSize;
+
+  // Neighbouring texels are usually sampled next, so blocks are kept decoded
+  // The top bits of the hash are used, the bottom ones are the same for blocks above each other
+  const uptr entry = ((u32)((uptr)b/blockSize)*2654435761u) >> (32-SOFTTEXTURE_CACHEBITS);
+  if (cache.block[entry] != b) {
+    atlas_decodeBlock(format, b, cache.texels[entry]);
+    cache.block[entry] = b;
+  }
+
+  return cache.texels[entry];
+}
+
+atlas_col_t soft_texture_t::bilinear(const u8 *data, atlas_format_t format, u32 level, f32 x, f32 y,
+                                     soft_texture_cache_t &cache) const
+{
+  const i32 w = atlas_levelWidth(level), h = atlas_levelHeight(level);
+
+  // Texel centers are at .5
+  x -= 0.5f;
+  y -= 0.5f;
+
+  // Floored, floorf is a call without SSE4.1
+  i32 ix = (i32)x, iy = (i32)y;
+  ix -= (x < (f32)ix);
+  iy -= (y < (f32)iy);
+
+  const u32 wx = (u32)((x-(f32)ix)*256.f), wy = (u32)((y-(f32)iy)*256.f);
+
+  // Clamp to the edge
+  const u32 x0 = util_min<i32>(util_max<i32>(ix, 0), w-1), x1 = util_min<i32>(util_max<i32>(ix+1, 0), w-1);
+  const u32 y0 = util_min<i32>(util_max<i32>(iy, 0), h-1), y1 = util_min<i32>(util_max<i32>(iy+1, 0), h-1);
+
+  atlas_col_t t00, t10, t01, t11;
+
+  if (format == ATLAS_FORMAT_RGBA8) {
+    const atlas_col_t *texels = (const atlas_col_t*)data;
+
+    t00 = texels[y0*w + x0];
+    t10 = texels[y0*w + x1];
+    t01 = texels[y1*w + x0];
+    t11 = texels[y1*w + x1];
+  } else {
+    static constexpr u32 MASK = ATLAS_BLOCK_SIZE-1;
+
+    // Most of the time all 4 texels are in the same block
+    const atlas_col_t *b00 = block(data, format, w, x0, y0, cache);
+    const atlas_col_t *b10 = ((x0^x1) & ~MASK) ? block(data, format, w, x1, y0, cache) : b00;
+    const atlas_col_t *b01 = ((y0^y1) & ~MASK) ? block(data, format, w, x0, y1, cache) : b00;
+    const atlas_col_t *b11 = ((x0^x1) & ~MASK) ?
+      (((y0^y1) & ~MASK) ? block(data, format, w, x1, y1, cache) : b10) : b01;
+
+    t00 = b00[(y0&MASK)*ATLAS_BLOCK_SIZE + (x0&MASK)];
+    t10 = b10[(y0&MASK)*ATLAS_BLOCK_SIZE + (x1&MASK)];
+    t01 = b01[(y1&MASK)*ATLAS_BLOCK_SIZE + (x0&MASK)];
+    t11 = b11[(y1&MASK)*ATLAS_BLOCK_SIZE + (x1&MASK)];
+  }
+
+  atlas_col_t ret;
+
+#ifdef PLAT_S_SSE2
+
+  // Rows of 2 texels, 16 bits per channel, blended by wy then wx
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i top = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128(t00.p),
+                                                           _mm_cvtsi32_si128(t10.p)), zero);
+  const __m128i bottom = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128(t01.p),
+                                                              _mm_cvtsi32_si128(t11.p)), zero);
+
+  const __m128i row = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(top, _mm_set1_epi16(256-wy)),
+                                                   _mm_mullo_epi16(bottom, _mm_set1_epi16(wy))), 8);
+
+  const i16 wl = (i16)(256-wx), wr = (i16)wx;
+  const __m128i col = _mm_mullo_epi16(row, _mm_setr_epi16(wl, wl, wl, wl, wr, wr, wr, wr));
+  const __m128i sum = _mm_srli_epi16(_mm_add_epi16(col, _mm_srli_si128(col, 8)), 8);
+
+  ret.p = (u32)_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+
+#else
+
+  for (uptr c = 0; c < 4; ++c) {
+    // Same order as SSE2, so both round the same
+    const u32 left = (t00.c[c]*(256-wy) + t01.c[c]*wy) >> 8;
+    const u32 right = (t10.c[c]*(256-wy) + t11.c[c]*wy) >> 8;
+    ret.c[c] = (u8)((left*(256-wx) + right*wx) >> 8);
+  }
+
+#endif
+
+  return ret;
+}
+
+atlas_col_t soft_texture_t::sample(u32 layer, f32 u, f32 v, f32 lod, soft_texture_cache_t &cache) const {
+  atlas_col_t ret;
+  ret.p = 0;
+
+  if (layer >= ATLAS_COUNT*SOFTTEXTURE_MAXPAGES) return ret;
+
+  const u8 *const *levels = m_levels[layer];
+  const atlas_format_t format = m_format[layer/SOFTTEXTURE_MAXPAGES];
+
+  // Pages past the atlas' last are black
+  if (!levels[0]) return ret;
+
+  // Magnified, only the top level is sampled
+  if (!(lod > 0.f)) return bilinear(levels[0], format, 0, u*ATLAS_WIDTH, v*ATLAS_HEIGHT, cache);
+
+  lod = util_min(lod, (f32)(ATLAS_LEVELS-1));
+
+  const u32 level = (u32)lod;
+  const u32 next = util_min<u32>(level+1, ATLAS_LEVELS-1);
+  const u32 w = (u32)((lod-(f32)level)*256.f);
+
+  const atlas_col_t c0 = bilinear(levels[level], format, level,
+                                  u*atlas_levelWidth(level), v*atlas_levelHeight(level), cache);
+  if (!w) return c0;
+
+  const atlas_col_t c1 = bilinear(levels[next], format, next,
+                                  u*atlas_levelWidth(next), v*atlas_levelHeight(next), cache);
+
+  for (uptr c = 0; c < 4; ++c) ret.c[c] = (u8)((c0.c[c]*(256-w) + c1.c[c]*w) >> 8);
+
+  return ret;
+}
@@ -0,0 +1,62 @@
+#ifndef SOFT_TEXTURE_H
+#define SOFT_TEXTURE_H
+
+#include "types.h"
+#include "game/atlas.h"
+
+// Maximum number of pages of an atlas that can be sampled
+static constexpr u32 SOFTTEXTURE_MAXPAGES = 4;
+
+// Number of decoded blocks each sampling thread keeps, as a power of 2
+static constexpr u32 SOFTTEXTURE_CACHEBITS = 8;
+static constexpr uptr SOFTTEXTURE_CACHESIZE = (uptr)1 << SOFTTEXTURE_CACHEBITS;
+
+// Recently decoded blocks of block compressed atlases
+// Each thread that samples has it's own
+struct soft_texture_cache_t {
+  const u8 *block[SOFTTEXTURE_CACHESIZE]; // Block in the atlas, NULL if the entry is empty
+  atlas_col_t texels[SOFTTEXTURE_CACHESIZE][16];
+
+  FINLINE soft_texture_cache_t() {
+    for (uptr i = 0; i < SOFTTEXTURE_CACHESIZE; ++i) block[i] = NULL;
+  }
+};
+
+// Samples atlases straight from the pak, the same way gl_texture_t's texture array is sampled
+// Layers aren't a cache like they are with GL, every page of an atlas has a fixed layer
+class soft_texture_t {
+private:
+  // Atlas list
+  const atlas_t *m_atlas[ATLAS_COUNT];
+
+  // Data of every level of every layer, and each atlas' format,
+  // found when loading since atlas_t::level is slow to call per texel
+  const u8 *m_levels[ATLAS_COUNT*SOFTTEXTURE_MAXPAGES][ATLAS_LEVELS];
+  atlas_format_t m_format[ATLAS_COUNT];
+
+  // Get the decoded block containing a texel of a block compressed level
+  const atlas_col_t *block(const u8 *data, atlas_format_t format, u32 width, u32 x, u32 y,
+                           soft_texture_cache_t &cache) const;
+
+  // Bilinearly sample a level, coordinates are in texels and clamped to the edge
+  atlas_col_t bilinear(const u8 *data, atlas_format_t format, u32 level, f32 x, f32 y,
+                       soft_texture_cache_t &cache) const;
+
+public:
+  soft_texture_t();
+
+  // Get image offset in texture, like gl_texture_t::imgCoord
+  // 01 contains texture position, 23 contains texture size
+  // layer is set to the texture layer the image is in
+  vec2_2 imgCoord(atlas_id_t atlas, str_hash_t name, f32 &layer) const;
+
+  // Load every atlas, if an atlas is NULL it's spot is emptied
+  // Returns false if an atlas can't be sampled
+  ubool load(const atlas_t *const atlas[ATLAS_COUNT]);
+
+  // Trilinearly sample a layer, u and v are normalized,
+  // lod is the log2 of texels per pixel
+  atlas_col_t sample(u32 layer, f32 u, f32 v, f32 lod, soft_texture_cache_t &cache) const;
+};
+
+#endif //SOFT_TEXTURE_H
@@ -12,6 +12,9 @@ enum window_type_t : ufast {
 	WINDOW_OPENGL,
 #endif
 
+	// Headless is always present
+	WINDOW_HEADLESS,
+
 	WINDOW_COUNT
 };
 
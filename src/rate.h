@@ -0,0 +1,106 @@
+#ifndef RATE_H
+#define RATE_H
+
+#include "types.h"
+#include "countTimer.h"
+
+// Rate manager
+class rate_t {
+private:
+	countTimer_t &m_t;
+	
+	// Time at which last frame was processed
+	u64 m_lastFrame;
+
+	// Counts between each occurrence
+	u64 m_freq;
+
+	// Inverse of m_freq
+	f32 m_freqInv;
+
+public:
+	FINLINE rate_t(countTimer_t &t, u64 rate) : m_t(t) {
+		// Round to nearest
+		m_freq = (t.resolution() + (rate>>1))/rate;
+		m_freqInv = 1.f/(f32)m_freq;
+		m_lastFrame = 0;
+	}
+
+	// Have freq counts passed since last frame?
+	FINLINE ubool ready() {
+		const u64 t = m_t.time();
+		if (t-m_lastFrame >= m_freq) {
+			m_lastFrame = t;
+			return true;
+		}
+
+		return false;
+	}
+
+	// Counts left until the next frame is ready, 0 if it already is
+	FINLINE countTimer_counts_t remaining() {
+		const u64 passed = m_t.time()-m_lastFrame;
+		return (passed >= m_freq) ? 0 : m_freq-passed;
+	}
+
+	FINLINE f32 delta() {
+		// Divide by m_freq
+		return (f32)(m_t.time()-m_lastFrame) * m_freqInv;
+	}
+};
+
+// Fixed timestep accumulator
+// Time is accumulated between calls to steps, and spent on fixed steps
+class step_t {
+private:
+	countTimer_t &m_t;
+
+	// Time of last call to steps
+	u64 m_last;
+
+	// Accumulated counts not spent on steps yet
+	u64 m_acc;
+
+	// Counts in each step
+	u64 m_step;
+
+	// Inverse of m_step
+	f32 m_stepInv;
+
+	// Maximum number of steps to catch up with at once
+	u32 m_maxSteps;
+
+public:
+	FINLINE step_t(countTimer_t &t, u64 rate, u32 maxSteps) : m_t(t), m_maxSteps(maxSteps) {
+		// Round to nearest
+		m_step = (t.resolution() + (rate>>1))/rate;
+		m_stepInv = 1.f/(f32)m_step;
+		m_last = t.time();
+		m_acc = 0;
+	}
+
+	// Accumulate time since the last call, and get the number of steps to run
+	// After a long stall only maxSteps are run, and the rest of the time is dropped
+	FINLINE u32 steps() {
+		const u64 t = m_t.time();
+		m_acc += t-m_last;
+		m_last = t;
+
+		u64 steps = m_acc/m_step;
+		if (steps > m_maxSteps) {
+			steps = m_maxSteps;
+			m_acc %= m_step;
+		} else {
+			m_acc -= steps*m_step;
+		}
+
+		return (u32)steps;
+	}
+
+	// Time accumulated towards the next step, as a fraction of a step
+	FINLINE f32 alpha() const {
+		return (f32)m_acc * m_stepInv;
+	}
+};
+
+#endif //RATE_H
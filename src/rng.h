@@ -16,6 +16,9 @@ public:
 	// Set the RNG seed
 	FINLINE void set(u64 seed) {s = seed;}
 
+	// Get the RNG seed, setting it back repeats the same values
+	FINLINE u64 get() const {return s;}
+
 	// Get random value from s
 	FINLINE u64 rand_base() {
 		s ^= s<<13;
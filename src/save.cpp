@@ -7,77 +7,117 @@
 #include "file.h"
 #include "save.h"
 #include "stack.h"
+#include "atomic.h"
 
 #include <cstring>
 
-// Save buffer to file
-ubool save_t::saveFile(const char *filename, stack_t<save_var_t> &buf) const {
-	// Open save file
-	file_handle_t *f = m_f.open(filename, FILE_MODE_WRITE);
-	if (!f) {
-		log_warning("Failed to open %s!", filename);
-		return false;
+static_assert(SAVE_INDEXSLOTS && !(SAVE_INDEXSLOTS & (SAVE_INDEXSLOTS-1)) && (SAVE_INDEXSLOTS >= 2*SAVE_MAXVARS),
+              "SAVE_INDEXSLOTS must be a power of 2, at least twice SAVE_MAXVARS!");
+static_assert(SAVE_MAXVARS < 65536, "Variable indices must fit in the index!");
+
+save_var_t *save_vars_t::find(str_hash_t name) {
+	// The index is never full, so there's always an empty slot to stop at
+	const u32 i = str_hashProbe(name, SAVE_INDEXSLOTS, [this, name](u32 slot) {
+		return !index[slot] || (vars.ptr()[index[slot]-1].name == name);
+	});
+
+	return index[i] ? vars.ptr() + index[i]-1 : NULL;
+}
+
+save_var_t *save_vars_t::add(str_hash_t name) {
+	if (vars.size() >= SAVE_MAXVARS) {
+		log_warning("Too many save variables! (increase SAVE_MAXVARS in save.h)");
+		return NULL;
 	}
 
-	// Write header
+	const u32 i = str_hashProbe(name, SAVE_INDEXSLOTS, [this](u32 slot) {return !index[slot];});
+
+	save_var_t &v = vars.push();
+	v.name = name;
+	index[i] = (u16)vars.size();
+
+	return &v;
+}
+
+void save_vars_t::clear() {
+	vars.clear();
+	memset(index, 0, sizeof(index));
+}
+
+// Save buffer to file layout
+uptr save_t::buildFile(const save_vars_t &vars, u8 *out) const {
+	u8 *p = out;
+
+	// Header
 	save_data_magic_t magic;
+	memset((void*)&magic, 0, sizeof(magic));
 	magic.magic = SAVE_DATA1_MAGIC;
 
-	if (f->write(&magic, sizeof(magic)) != (iptr)sizeof(magic)) {
-		log_warning("Cannot write save magic to %s!", filename);
-		f->close();
-		return false;
+	memcpy(p, &magic, sizeof(magic));
+	p += sizeof(magic);
+
+	// Variable list, every variable's data is padded to a 16-byte boundary
+	save_data1_var_t var;
+	memset((void*)&var, 0, sizeof(var));
+
+	for (const save_var_t *i = vars.vars.ptr(); i != vars.vars.end(); ++i) {
+		const uptr size = util_alignUp<uptr>(i->size, 16);
+
+		var.size = size;
+		var.name = i->name;
+
+		memcpy(p, &var, sizeof(var));
+		p += sizeof(var);
+
+		memcpy(p, i->val, i->size);
+		memset(p + i->size, 0, size - i->size);
+		p += size;
 	}
 
-	// Padding for variable data
-	const u8 zero[15] = {0};
+	// Variable list terminator
+	var.size = 0;
+	var.name = 0;
+	memcpy(p, &var, sizeof(var));
+	p += sizeof(var);
 
-	// Write variable list
-	save_data1_var_t out;
-	for (save_var_t *i = buf.ptr(); i != buf.end(); ++i) {
-		out.size = i->size;
-		out.name = i->name;
+	log_assert((uptr)(p-out) <= SAVE_MAXFILE, "Save file is bigger than SAVE_MAXFILE!");
+	return p-out;
+}
 
-		if ((f->write(&out, sizeof(out)) < (iptr)sizeof(out)) ||
-			(f->write(i->val, i->size)  < (iptr)i->size))
-		{
-			log_warning("Cannot write save variable to %s!", filename);
-			f->close();
-			return false;
-		}
+// The new file is written next to the old one, then renamed over it,
+// so a crash while saving leaves one or the other, never half of the new one
+ubool save_t::writeFile(file_system_t &f, const save_file_t &file) {
+	char tmp[SAVE_PATHLEN+4];
+	strcpy(tmp, file.path);
+	strcat(tmp, ".tmp");
 
-		// Add padding if necessary
-		if (i->size&0xf) {
-			const iptr zeros = 16-(i->size&0xf);
-			if (f->write(zero, zeros) < zeros) {
-				log_warning("Cannot write save variable padding to %s!", filename);
+	file_handle_t *h = f.open(tmp, FILE_MODE_WRITE);
+	if (!h) {
+		log_warning("Failed to open %s!", tmp);
+		return false;
+	}
 
-				f->close();
-				return false;
-			}
-		}
+	// The whole file goes out in one write
+	const ubool ok = (h->write(file.data, file.size) == (iptr)file.size) && h->sync();
+	h->close();
+
+	if (!ok) {
+		log_warning("Cannot write save file %s!", tmp);
+		return false;
 	}
 
-	// Write variable list terminator
-	out.size = 0;
-	if (f->write(&out, sizeof(out)) < (iptr)sizeof(out)) {
-		log_warning("Cannot write variable list terminator to %s!", filename);
-		f->close();
+	if (!f.rename(tmp, file.path)) {
+		log_warning("Cannot replace save file %s!", file.path);
 		return false;
 	}
-	
-	f->close();
 
 	return true;
 }
 
-ubool save_t::loadFile(const char *filename, stack_t<save_var_t> &buf) {
-	// Clean variable memory
-	cleanVarMem();
-
+ubool save_t::loadFile(const char *filename, save_vars_t &vars) {
 	// Save m_varMemCur
 	u8 *varMemCur = m_varMemCur;
-	
+
 	// Open save file
 	file_handle_t *f = m_f.open(filename, FILE_MODE_READ);
 	if (!f) {
@@ -85,60 +125,79 @@ ubool save_t::loadFile(const char *filename, stack_t<save_var_t> &buf) {
 		return false;
 	}
 
+	// The whole file is read in one go, into the file memory of the set
+	save_file_t &file = m_queues[&vars == &m_gvars].files[m_queues[&vars == &m_gvars].back];
+
+	const iptr size = f->read(file.data, SAVE_MAXFILE+1);
+	f->close();
+
+	if (size < 0) {
+		log_warning("Cannot read save file %s!", filename);
+		return false;
+	}
+
+	if (size > (iptr)SAVE_MAXFILE) {
+		log_warning("Save file %s is too big! (increase SAVE_MAXFILE in save.h)", filename);
+		return false;
+	}
+
 	// Make sure this is a save file
 	save_data_magic_t magic;
-	if (f->read(&magic, sizeof(magic)) < (iptr)sizeof(magic)) {
+	if (size < (iptr)sizeof(magic)) {
 		log_warning("Cannot read save file magic from %s!", filename);
-		f->close();
 		return false;
 	}
 
+	memcpy(&magic, file.data, sizeof(magic));
+
+	const u8 *p = file.data + sizeof(magic);
+	const u8 *end = file.data + size;
+
 	// Read differently depending on save file version
 	switch (magic.magic) {
 
 		// Save file format, version 1
 	case SAVE_DATA1_MAGIC: {
 		save_data1_var_t in;
-		save_var_t *out;
-
-		// Variable memory
-		u8 varMem[1024];
 
 		// Read variable list
-		for (; !in.end();) {
-			if (f->read(&in, sizeof(in)) < (iptr)sizeof(in)) {
+		for (;;) {
+			if (p+sizeof(in) > end) {
 				log_warning("Early end of file in %s!", filename);
 
 				// Just assume that was the end
-				f->close();
 				return true;
 			}
 
-			// Add variable to memory
-			if (f->read(varMem, in.size) < (iptr)in.size) {
-				log_warning("Cannot read variable memory in %s!", filename);
+			memcpy((void*)&in, p, sizeof(in));
+			p += sizeof(in);
 
-				buf.clear();
-				f->close();
+			if (in.end()) break;
+
+			if ((in.size & 0xf) || (p+in.size > end)) {
+				log_warning("Invalid variable size %u in %s!", (u32)in.size, filename);
+
+				vars.clear();
 				m_varMemCur = varMemCur;
 				return false;
 			}
-			
-			out = &buf.push();
-			out->val = pushVarMem(varMem, in.size);
-			out->size = in.size;
-			out->name = in.name;
 
-			// Was variable memory push successful?
-			if (!out->val) {
+			// Add variable to memory
+			void *val = pushVarMem(p, in.size);
+			save_var_t *out = (val && !vars.find(in.name)) ? vars.add(in.name) : NULL;
+
+			if (!out) {
 				// TODO: Attempt to resize variable memory stack instead of throwing error!
-				log_warning("Out of variable memory!");
-				
-				buf.clear();
-				f->close();
+				log_warning("Cannot add variable %08x from %s!", in.name, filename);
+
+				vars.clear();
 				m_varMemCur = varMemCur;
 				return false;
 			}
+
+			out->val = val;
+			out->size = in.size;
+			p += in.size;
 		}
 
 		// Return success
@@ -148,14 +207,10 @@ ubool save_t::loadFile(const char *filename, stack_t<save_var_t> &buf) {
 		// Unknown format
 	default:
 		magic.pad[0] = 0; // NULL terminator for "string"
-		log_warning("Invalid save file format %s in %s!", (char*)&magic.magic);
+		log_warning("Invalid save file format %s in %s!", (char*)&magic.magic, filename);
 
-		f->close();
 		return false;
 	}
-
-	f->close();
-	return true;
 }
 
 // Push variable memory to memory stack
@@ -165,7 +220,11 @@ void *save_t::pushVarMem(const u8 *ptr, uptr size, uptr realSize) {
 		return NULL;
 	}
 
-	memcpy(m_varMemCur, ptr, size);
+	// Variables made without a value are zeros
+	if (ptr) memcpy(m_varMemCur, ptr, size);
+	else memset(m_varMemCur, 0, size);
+	memset(m_varMemCur+size, 0, realSize-size);
+
 	void *ret = (void*)m_varMemCur;
 	m_varMemCur += realSize;
 
@@ -178,15 +237,15 @@ void save_t::cleanVarMem() {
 	m_varMemCur = m_varMem;
 
 	// Loop through m_gvars, adding just global variables to the variable memory stack
-	for (save_var_t *i = m_gvars.ptr(); i != m_gvars.end(); ++i) {
+	for (save_var_t *i = m_gvars.vars.ptr(); i != m_gvars.vars.end(); ++i) {
 		// Write variable to current pointer
 		log_assert((i->size&0xf) == 0, "Misaligned global variable size!");
 
 		// Considering we're working with the same variables, we shouldn't run out of memory
-		log_assert(m_varMemCur+i->size < m_varMemEnd, "Out of variable copy memory!");
+		log_assert(m_varMemCur+i->size <= m_varMemEnd, "Out of variable copy memory!");
 
 		// We shouldn't be reading data that's already written
-		log_assert(m_varMemCur < (u8*)i->val, "Outran global variable data pointers!");
+		log_assert(m_varMemCur <= (u8*)i->val, "Outran global variable data pointers!");
 
 		// memcpy doesn't support memory area overlap, so use memmove
 		memmove(m_varMemCur, i->val, i->size);
@@ -195,116 +254,177 @@ void save_t::cleanVarMem() {
 	}
 }
 
+void save_t::slotPath(char *out, u32 id) {
+	// Create save file name
+	memcpy(out, "save/save", 9);
+
+	strcpy((out+9) + str_numstr(out+9, id), ".dat");
+}
+
+ubool save_t::drain(file_system_t &f) {
+	ubool wrote = false;
+
+	for (u32 s = 0; s < 2; ++s) {
+		save_queue_t &q = m_queues[s];
+		if (!(atomic_load(&q.pending, ATOMIC_ACQUIRE) & SAVE_FRESH)) continue;
+
+		// Busy before the file leaves pending, so pending() never misses it
+		atomic_store(&m_busy, (ubool)true);
+		q.front = atomic_exchange(&q.pending, q.front, ATOMIC_ACQREL) & ~SAVE_FRESH;
+
+		writeFile(f, q.files[q.front]);
+		atomic_store(&m_busy, (ubool)false, ATOMIC_RELEASE);
+
+		wrote = true;
+	}
+
+	return wrote;
+}
+
+ubool save_t::pending() const {
+	for (u32 s = 0; s < 2; ++s) {
+		if (atomic_load(&m_queues[s].pending) & SAVE_FRESH) return true;
+	}
+
+	return atomic_load(&m_busy);
+}
+
 save_t::save_t(mem_t &m, file_system_t &f)
 	: m_m(m), m_f(f),
-	  m_gvars(m_m, 256), m_vars(m_m, 256)
+	  m_gvars(m_m), m_vars(m_m), m_thread(NULL), m_busy(false)
 {
 	// Create save directory, if it doesn't exist
 	if (!m_f.makeDir("save")) throw log_except("Cannot create save directory!");
-	
+
 	// Allocate variable memory
-	constexpr uptr varMemSize = 32768;
-	m_varMemCur = m_varMem = (u8*)m_m.alloc(varMemSize);
-	m_varMemEnd = m_varMem+varMemSize;
+	m_varMemCur = m_varMem = (u8*)m_m.alloc(SAVE_VARMEM);
+	m_varMemEnd = m_varMem+SAVE_VARMEM;
+
+	// Allocate file memory, 3 files for each set for the save thread
+	m_fileMem = (u8*)m_m.alloc(6*SAVE_MAXFILE);
+
+	for (u32 s = 0; s < 2; ++s) {
+		save_queue_t &q = m_queues[s];
+
+		for (u32 i = 0; i < 3; ++i) {
+			q.files[i].data = m_fileMem + (s*3 + i)*SAVE_MAXFILE;
+			q.files[i].size = 0;
+			q.files[i].path[0] = 0;
+		}
+
+		q.back = 0;
+		q.pending = 1;
+		q.front = 2;
+	}
 
 	// Load global save file into memory
-	loadFile("save/global.dat", m_gvars);
+	if (m_f.fileExists("save/global.dat")) loadFile("save/global.dat", m_gvars);
 
 	// No save file is currently loaded
 	m_curSave = -1;
 }
 
 save_t::~save_t() {
-	// Free variable memory
+	log_assert(!m_thread, "Save thread outlived it's save_t!");
+
+	// Free variable and file memory
+	m_m.free(m_fileMem);
 	m_m.free(m_varMem);
 
 	// Stacks will deconstruct by themselves
 }
 
 uptr save_t::get(str_hash_t name, void *out, uptr outSize, ubool global) const {
-	const save_var_t *i, *end;
-
 	// If global is true, search global variables
 	// Otherwise, search loaded save variables
-	if (global) {
-		i = m_gvars.ptr();
-		end = m_gvars.end();
-	} else {
-		i = m_vars.ptr();
-		end = m_vars.end();
-	}
-
-	for (; i != end; ++i) {
-		if (i->name == name) {
-			memcpy(out, i->val, util_min(i->size, outSize));
-			return i->size;
-		}
-	}
+	const save_var_t *v = (global ? m_gvars : m_vars).find(name);
+	if (!v) return 0;
 
-	return 0;
+	if (out) memcpy(out, v->val, util_min(v->size, outSize));
+	return v->size;
 }
 
 ubool save_t::set(str_hash_t name, const void *in, uptr inSize, ubool global) {
-	save_var_t *i, *end;
+	// Return false if there's no save file loaded,
+	// don't wanna create a variable in an invalid save file
+	if (!global && (m_curSave < 0)) {
+		log_warning("Setting variable in invalid save file!");
+		return false;
+	}
 
 	// If global is true, search global variables
 	// Otherwise, search loaded save variables
-	if (global) {
-		i = m_gvars.ptr();
-		end = m_gvars.end();
-	} else {
-		i = m_vars.ptr();
-		end = m_vars.end();
-
-		// Return false if there's no save file loaded,
-		// don't wanna create a variable in an invalid save file
-		if (m_curSave < 0) {
-			log_warning("Setting variable in invalid save file!");
+	save_vars_t &vars = global ? m_gvars : m_vars;
+
+	save_var_t *v = vars.find(name);
+	if (v) {
+		if (inSize > v->size) {
+			log_warning("%u is bigger than variable's size of %u!", (u32)inSize, (u32)v->size);
 			return false;
 		}
-	}
 
-	for (; i != end; ++i) {
-		if (i->name == name) {
-			if (inSize > i->size) {
-				log_warning("%u is bigger than variable's size of %u!", (u32)inSize, (u32)i->size);
-				return false;
-			}
-
-			// Write into data buffer
-			memcpy(i->val, in, inSize);
-			return true;
-		}
+		// Write into data buffer
+		if (in) memcpy(v->val, in, inSize);
+		return true;
 	}
 
 	// Variable not found, create it
-	stack_t<save_var_t> &buf = global ? m_gvars : m_vars;
-	save_var_t &v = buf.push();
-
-	v.size = util_alignUp<uptr>(inSize, 16);
-	v.val = pushVarMem((const u8*)in, inSize, v.size);
-	v.name = name;
+	// The memory comes first, so there's no variable to take back if it runs out
+	const uptr size = util_alignUp<uptr>(util_max<uptr>(inSize, 1), 16);
 
-	// Did pushVarMem succeed?
-	if (!v.val) {
-		log_warning("Out of variable memory!");
+	void *val = pushVarMem((const u8*)in, inSize, size);
+	if (!val) return false;
 
-		buf.pop();
+	v = vars.add(name);
+	if (!v) {
+		m_varMemCur -= size;
 		return false;
 	}
 
-	// pushVarMem succeeded, return true
+	v->val = val;
+	v->size = size;
+
 	return true;
 }
 
 ubool save_t::load(u32 id) {
-	char name[64];
+	char name[SAVE_PATHLEN];
+	slotPath(name, id);
 
-	// Create save file name
-	memcpy(name, "save/save", 9);
+	// The save thread might still be writing the last save file
+	if (m_thread) m_thread->wait();
 
-	strcat((name+9) + str_numstr(name+9, id), ".dat");
+	// Unload the previous save file
+	m_vars.clear();
+	cleanVarMem();
+	m_curSave = -1;
+
+	// Load file, a new save file has no variables yet
+	if (m_f.fileExists(name) && !loadFile(name, m_vars)) return false;
+
+	m_curSave = id;
+	return true;
+}
+
+ubool save_t::save(ubool global) {
+	if (!global && (m_curSave < 0)) {
+		log_warning("Saving with no save file loaded!");
+		return false;
+	}
+
+	save_queue_t &q = m_queues[global];
+	save_file_t &file = q.files[q.back];
+
+	if (global) strcpy(file.path, "save/global.dat");
+	else slotPath(file.path, m_curSave);
+
+	file.size = buildFile(global ? m_gvars : m_vars, file.data);
 
-	// Load file
-	return loadFile(name, m_vars);
+	// Without a save thread, write it now
+	if (!m_thread) return writeFile(m_f, file);
+
+	// Hand it to the save thread, taking back whichever file it doesn't have
+	q.back = atomic_exchange(&q.pending, q.back | SAVE_FRESH, ATOMIC_ACQREL) & ~SAVE_FRESH;
+
+	return true;
 }
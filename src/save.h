@@ -13,6 +13,8 @@
 #include "file.h"
 #include "stack.h"
 
+#include <cstring>
+
 //////////////////////////////////
 // BEGIN SAVE DATA FILE FORMATS
 //////////////////////////////////
@@ -50,8 +52,7 @@ struct alignas(16) save_data1_var_t {
 	u32 pad[1];
 
 	FINLINE ubool end() const {
-		log_assert((size&0xf) == 0, "Invalid variable size %u!", size);
-		return size != 0;
+		return size == 0;
 	}
 };
 
@@ -59,6 +60,22 @@ struct alignas(16) save_data1_var_t {
 // END SAVE DATA FILE FORMATS
 ///////////////////////////////
 
+// Most variables in each variable set
+static constexpr u32 SAVE_MAXVARS = 256;
+
+// Slots in a variable set's index, a power of 2 at least twice SAVE_MAXVARS
+static constexpr u32 SAVE_INDEXSLOTS = 512;
+
+// Bytes of variable memory, shared by both variable sets
+static constexpr uptr SAVE_VARMEM = 32768;
+
+// Biggest save file: the magic, every variable and the terminator
+static constexpr uptr SAVE_MAXFILE = sizeof(save_data_magic_t) +
+                                     (SAVE_MAXVARS+1)*sizeof(save_data1_var_t) + SAVE_VARMEM;
+
+// Longest save file path, null terminator included
+static constexpr uptr SAVE_PATHLEN = 64;
+
 // Save variable, in memory
 struct save_var_t {
 	void *val;
@@ -67,7 +84,58 @@ struct save_var_t {
 	str_hash_t name;
 };
 
+// Variables of one save file, indexed by name
+struct save_vars_t {
+	stack_t<save_var_t> vars;
+
+	// Open addressing on the name hash, each slot is a variable's index+1, or 0 if it's empty
+	// Variables are only ever removed all at once, so there's nothing to mark deleted slots
+	u16 index[SAVE_INDEXSLOTS];
+
+	FINLINE save_vars_t(mem_t &m) : vars(m, SAVE_MAXVARS) {
+		memset(index, 0, sizeof(index));
+	}
+
+	// Find a variable, NULL if it isn't there
+	save_var_t *find(str_hash_t name);
+	FINLINE const save_var_t *find(str_hash_t name) const {
+		return ((save_vars_t*)this)->find(name);
+	}
+
+	// Add a variable that isn't there yet, NULL if the set is full
+	save_var_t *add(str_hash_t name);
+
+	void clear();
+};
+
+// A save file, as it's written
+struct save_file_t {
+	u8 *data;
+	uptr size;
+
+	char path[SAVE_PATHLEN];
+};
+
+// Save files of one variable set, on their way to the save thread
+//
+// The game builds the newest file in back, then swaps it with pending, the save thread
+// swaps pending with front and writes front. Neither waits on the other, and a file
+// that isn't written yet is replaced by the newer one.
+struct save_queue_t {
+	save_file_t files[3];
+
+	u32 back; // Only touched by the game
+	u32 front; // Only touched by the save thread
+	u32 pending; // File index, with SAVE_FRESH set until the save thread takes it, only accessed atomically
+};
+
+static constexpr u32 SAVE_FRESH = 0x80000000;
+
+class save_thread_t;
+
 class save_t {
+	friend class save_thread_t;
+
 private:
 	mem_t &m_m;
 	file_system_t &m_f;
@@ -75,18 +143,36 @@ private:
 	// Memory to store variable data (every variable is aligned to a 16-byte boundary)
 	u8 *m_varMem, *m_varMemCur, *m_varMemEnd;
 
-	// Variable buffers
-	stack_t<save_var_t> m_gvars; // Global save variables: These are present until destruction
-	stack_t<save_var_t> m_vars; // Save variables: These are loaded from a save slot
+	// Variable sets
+	save_vars_t m_gvars; // Global save variables: These are present until destruction
+	save_vars_t m_vars; // Save variables: These are loaded from a save slot
 
 	// Currently loaded save file
 	i32 m_curSave;
 
-	// Save vars to file
-	ubool saveFile(const char *filename, stack_t<save_var_t> &buf) const;
+	// Save files for each variable set, [0] for the loaded save file, [1] for the global one
+	// Without a save thread, only back is used
+	save_queue_t m_queues[2];
+	u8 *m_fileMem;
+
+	// Running save thread, NULL if there's none
+	save_thread_t *m_thread;
+
+	// True while the save thread is writing a file, only accessed atomically
+	ubool m_busy;
+
+	// Put vars in the layout of a save file
+	// Returns the file size
+	uptr buildFile(const save_vars_t &vars, u8 *out) const;
+
+	// Write a file, replacing the old one only once it's completely on disk
+	static ubool writeFile(file_system_t &f, const save_file_t &file);
 
 	// Load vars from file
-	ubool loadFile(const char *filename, stack_t<save_var_t> &buf);
+	ubool loadFile(const char *filename, save_vars_t &vars);
+
+	// Path of a save slot's file
+	static void slotPath(char *out, u32 id);
 
 	// Add variable memory
 	void *pushVarMem(const u8 *ptr, uptr size, uptr realSize);
@@ -101,6 +187,8 @@ public:
 	save_t(mem_t &m, file_system_t &f);
 	~save_t();
 
+	save_t(const save_t &other) = delete;
+
 	// Get value from save data
 	//
 	// If global is true, variable is taken from the global save file,
@@ -125,12 +213,12 @@ public:
 	// Templated overloads
 	template<typename T>
 	FINLINE uptr get(str_hash_t name, T &out, ubool global) const {
-		return get(name, (void*)out, sizeof(T), global);
+		return get(name, (void*)&out, sizeof(T), global);
 	}
 
 	template<typename T>
 	FINLINE ubool set(str_hash_t name, const T &in, ubool global) {
-		return set(name, (void*)in, sizeof(T), global);
+		return set(name, (const void*)&in, sizeof(T), global);
 	}
 
 	template<typename T>
@@ -140,7 +228,7 @@ public:
 
 	template<typename T>
 	FINLINE ubool set(str_hash_t name, const T *in, uptr inCount, ubool global) {
-		return set(name, (void*)in, sizeof(T) * inCount, global);
+		return set(name, (const void*)in, sizeof(T) * inCount, global);
 	}
 
 	// Check if variable is present
@@ -155,7 +243,40 @@ public:
 
 	// Load vars from save file
 	// Unloads previous save file, can only load one save file at a time, apart from the global save file
+	// A save file that doesn't exist yet loads with no variables
+	// Waits for the save thread to write what was saved before, so it loads the newest file
 	ubool load(u32 id);
+
+	// Only called by the save thread, writes the newest file of each set if there's a new one
+	// Returns false if there was nothing to write
+	ubool drain(file_system_t &f);
+
+	// Whether a file is waiting for the save thread or being written
+	ubool pending() const;
+
+	// Save vars to the global save file, or to the loaded save file
+	// With a save thread, the variables are copied and the file is written later,
+	// otherwise it's written right away
+	// Either way, the old file is there until the new one is completely written
+	ubool save(ubool global);
+};
+
+// Save thread, defined by the platform layer
+// While one exists, save_t::save never waits on the disk
+// Only one should exist for a save_t, anything left is written when it's destroyed
+class save_thread_t {
+private:
+	save_t &m_save;
+	void *m_plat;
+
+public:
+	save_thread_t(mem_t &m, save_t &save);
+	~save_thread_t();
+
+	save_thread_t(const save_thread_t &other) = delete;
+
+	// Wait until the save thread wrote everything that was saved
+	void wait();
 };
 
 #endif //SAVE_H
@@ -0,0 +1,66 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include "types.h"
+#include "atomic.h"
+
+// Size of a cache line, the two indices are kept on different ones
+// so the producer and consumer don't keep stealing the same line from each other
+static constexpr uptr SPSC_CACHELINE = 64;
+
+// Wait-free single producer, single consumer queue
+// One thread pushes and another pops, neither ever blocks on the other
+// N is the number of items, it must be a power of 2
+template<typename T, u32 N>
+class spsc_queue_t {
+private:
+  static_assert(N && !(N & (N-1)), "Queue size must be a power of 2!");
+
+  // Indices only ever count up and wrap around, they're masked when used
+  // Each is only written by it's own thread
+  u32 m_write; // Next item to push, written by the producer
+  u8 m_writePad[SPSC_CACHELINE-sizeof(u32)];
+
+  u32 m_read; // Next item to pop, written by the consumer
+  u8 m_readPad[SPSC_CACHELINE-sizeof(u32)];
+
+  T m_items[N];
+
+public:
+  FINLINE spsc_queue_t() : m_write(0), m_read(0) {}
+
+  spsc_queue_t(const spsc_queue_t &other) = delete;
+
+  // Push an item, only from the producer thread
+  // Returns false if the queue is full
+  FINLINE ubool push(const T &item) {
+    const u32 write = m_write;
+    if (write - atomic_load(&m_read, ATOMIC_ACQUIRE) >= N) return false;
+
+    m_items[write & (N-1)] = item;
+    atomic_store(&m_write, write+1, ATOMIC_RELEASE);
+
+    return true;
+  }
+
+  // Pop an item, only from the consumer thread
+  // Returns false if the queue is empty
+  FINLINE ubool pop(T &item) {
+    const u32 read = m_read;
+    if (atomic_load(&m_write, ATOMIC_ACQUIRE) == read) return false;
+
+    item = m_items[read & (N-1)];
+    atomic_store(&m_read, read+1, ATOMIC_RELEASE);
+
+    return true;
+  }
+
+  // Number of items in the queue, it can change right after it's read
+  FINLINE u32 count() const {
+    // Read first, so it can't pass the write index
+    const u32 read = atomic_load(&m_read, ATOMIC_ACQUIRE);
+    return atomic_load(&m_write, ATOMIC_ACQUIRE) - read;
+  }
+};
+
+#endif //SPSC_H
@@ -33,6 +33,7 @@ private:
 		
 		m_m.free(m_buf);
 		m_buf = newBuf;
+		m_size = newSize;
 
 		return true;
 	}
@@ -45,6 +46,13 @@ public:
 		m_cur = m_buf = (T*)m_m.alloc(m_size*sizeof(T));
 	}
 
+	FINLINE ~stack_t() {
+		clear();
+		m_m.free(m_buf);
+	}
+
+	stack_t(const stack_t &other) = delete;
+
 	// Index stack
 	FINLINE T &operator[](int i) {
 		log_assert(i < m_count, "Index out of bounds!");
@@ -54,7 +62,7 @@ public:
 	// Push new object onto stack
 	T &push() {
 		// Resize buffer if needed
-		if (++m_count > m_size) {
+		if (m_count == m_size) {
 			if (!resize(m_size*2)) throw log_except("Out of memory!");
 		}
 		
@@ -75,7 +83,7 @@ public:
 		--m_count;
 	}
 
-	FINLINE uptr size() {return m_count;}
+	FINLINE uptr size() const {return m_count;}
 	
 	FINLINE T *ptr() {return m_buf;}
 	FINLINE const T *ptr() const {return m_buf;}
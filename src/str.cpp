@@ -6,10 +6,29 @@
 
 #include <cstring>
 
+#ifdef PLAT_S_SSE2
+#include <emmintrin.h>
+#endif
+
 #define P 127
 #define M 2147483647
 
-str_hash_t str_hashR(const char *str) {
+// P^4 % M, the power each SIMD lane steps by
+#define P4 260144641
+
+// Blocks of 4 characters the SIMD sums take before they have to be reduced
+#define CHUNK (1 << 20)
+
+// Reduce mod M without dividing, M is 2^31-1 so 2^31 is 1 mod M
+// x has to be below 2^62
+static FINLINE u64 reduce(u64 x) {
+	x = (x & M) + (x >> 31);
+	x = (x & M) + (x >> 31);
+	return (x >= M) ? x-M : x;
+}
+
+// The hash exactly as str_hash computes it, characters sign extended if char is signed
+static str_hash_t hashExact(const char *str) {
 	u64 curHash, pow;
 
 	curHash = 0;
@@ -22,8 +41,85 @@ str_hash_t str_hashR(const char *str) {
 	return endian_little32((u32)curHash);
 }
 
+#ifdef PLAT_S_SSE2
+// Partly reduce 2 64-bit lanes below 2^62 mod M, the result is at most 2^31
+static FINLINE __m128i reduce2(__m128i x) {
+	const __m128i m = _mm_set_epi32(0, M, 0, M);
+
+	x = _mm_add_epi64(_mm_and_si128(x, m), _mm_srli_epi64(x, 31));
+	return _mm_add_epi64(_mm_and_si128(x, m), _mm_srli_epi64(x, 31));
+}
+#endif
+
+str_hash_t str_hashR(const char *str) {
+	const uptr len = strlen(str);
+	const u8 *s = (const u8*)str;
+
+	u64 curHash = 0, pow = 1;
+	u32 high = 0; // Every character or'd together, to find characters above 127
+	uptr i = 0;
+
+#ifdef PLAT_S_SSE2
+	// 4 lanes each sum every 4th character times it's power, and step their power by P^4
+	if (len >= 8) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i p4 = _mm_set_epi32(0, P4, 0, P4);
+
+		__m128i pow01 = _mm_set_epi32(0, P, 0, 1);
+		__m128i pow23 = _mm_set_epi32(0, P*P*P, 0, P*P);
+		__m128i sum01 = zero, sum23 = zero;
+
+		while (i+4 <= len) {
+			const uptr end = i + util_min<uptr>((len-i) & ~(uptr)3, CHUNK*4);
+
+			for (; i < end; i += 4) {
+				u32 c4;
+				memcpy(&c4, s+i, 4);
+				high |= c4;
+
+				// Widen the characters to 32 bits, then to a 64-bit lane each
+				__m128i c = _mm_cvtsi32_si128((int)c4);
+				c = _mm_unpacklo_epi16(_mm_unpacklo_epi8(c, zero), zero);
+
+				sum01 = _mm_add_epi64(sum01, _mm_mul_epu32(_mm_unpacklo_epi32(c, zero), pow01));
+				sum23 = _mm_add_epi64(sum23, _mm_mul_epu32(_mm_unpackhi_epi32(c, zero), pow23));
+
+				pow01 = reduce2(_mm_mul_epu32(pow01, p4));
+				pow23 = reduce2(_mm_mul_epu32(pow23, p4));
+			}
+
+			sum01 = reduce2(sum01);
+			sum23 = reduce2(sum23);
+		}
+
+		u64 sums[4], pows[2];
+		_mm_storeu_si128((__m128i*)sums, sum01);
+		_mm_storeu_si128((__m128i*)(sums+2), sum23);
+		_mm_storeu_si128((__m128i*)pows, pow01);
+
+		curHash = reduce(sums[0] + sums[1] + sums[2] + sums[3]);
+		pow = reduce(pows[0]);
+	}
+#endif
+
+	// What's left, one character at a time
+	for (; i < len; ++i) {
+		high |= s[i];
+
+		curHash = reduce(curHash + (u64)s[i]*pow);
+		pow = reduce(pow*P);
+	}
+
+	// str_hash sign extends characters above 127 if char is signed, which the sums can't do
+	if ((high & 0x80808080) && (CHAR_MIN < 0)) return hashExact(str);
+
+	return endian_little32((u32)curHash);
+}
+
 #undef P
 #undef M
+#undef P4
+#undef CHUNK
 
 // Table containing powers of 10
 static const u64 pow10[] = {
@@ -61,7 +61,13 @@ constexpr T util_max(T a, T b) {
 // Clamp function
 template<class T>
 constexpr T util_clamp(T v, T min, T max) {
-	return util_min(util_max(v, max), min);
+	return util_max(util_min(v, max), min);
+}
+
+// Absolute value
+template<class T>
+constexpr T util_abs(T v) {
+	return (v < 0) ? -v : v;
 }
 
 // Alignment mask
@@ -0,0 +1,26 @@
+/*
+ * Linux entry point for tools
+ */
+
+#include "types.h"
+
+#include "tool.h"
+#include "mem.h"
+#include "file.h"
+#include "linux_file.h"
+
+int main(int argc, char **argv) {
+	// Initialize memory pool
+	mem_t mem(8*1024*1024);
+
+	// Initialize file system
+	linux_file_system_t sys(mem);
+
+	try {
+		tool_main(mem, *(file_system_t*)&sys, argc-1, argv+1);
+		return 0;
+	} catch (const log_except_t &err) {
+		log_warning("Tool failed: %s", err.str());
+		return 1;
+	}
+}
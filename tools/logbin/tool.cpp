@@ -0,0 +1,169 @@
+/*
+ * Binary log decoder
+ *
+ * Turns a binary log written with -binlog back into text, one line per record
+ * like the text log, with the time since the log started in front
+ *
+ * Stops at the first record that was never finished, so the log of a run that
+ * crashed decodes up to where it crashed
+ *
+ * Usage: logbin_tool <binary log>
+ */
+
+#include "tool.h"
+#include "logbin.h"
+#include "util.h"
+
+#include <cstring>
+
+// Call site, pointing into the mapped file
+struct site_t {
+  const char *file;
+  const char *fmt;
+  u32 line;
+};
+
+// Count the packed arguments between p and end, false if they don't fit exactly
+static ubool countArgs(const u8 *p, const u8 *end, u32 &count) {
+  count = 0;
+
+  while (p < end) {
+    if ((uptr)(end-p) < sizeof(log_arg_t)) return false;
+
+    const log_arg_t &a = *(const log_arg_t*)p;
+    const uptr padded = ((uptr)a.size + 7) & ~(uptr)7;
+    if ((uptr)(end-p) - sizeof(log_arg_t) < padded) return false;
+
+    const u8 *v = p + sizeof(log_arg_t);
+    switch (a.type) {
+      case LOG_ARG_INT:
+      case LOG_ARG_UINT:
+      case LOG_ARG_FLOAT:
+      case LOG_ARG_PTR:
+        if (a.size != 8) return false;
+        break;
+
+      case LOG_ARG_STR:
+        if (!a.size || v[a.size-1]) return false;
+        break;
+
+      default:
+        return false;
+    }
+
+    p = v + padded;
+    ++count;
+  }
+
+  return true;
+}
+
+void tool_main(mem_t &m, file_system_t &f, int argc, const char *const *argv) {
+  if (argc < 1) throw log_except("Usage: logbin_tool <binary log>");
+
+  file_handle_t *in = f.open(argv[0], FILE_MODE_READ);
+  if (!in) throw log_except("Cannot open %s!", argv[0]);
+
+  const iptr fileSize = (in->seek(0, FILE_SEEK_END)) ? in->tell() : -1;
+  if (fileSize < (iptr)sizeof(logbin_hdr_t)) {
+    in->close();
+    throw log_except("%s is too small to be a binary log!", argv[0]);
+  }
+
+  file_mapping_t *map = in->map(FILE_MAP_READ, 0, (uptr)fileSize);
+  if (!map) {
+    in->close();
+    throw log_except("Cannot map %s!", argv[0]);
+  }
+
+  const logbin_hdr_t &hdr = *(const logbin_hdr_t*)map->data;
+  const u8 *data = (const u8*)(&hdr+1);
+
+  if ((hdr.magic != LOGBIN_MAGIC) || (hdr.version != LOGBIN_VERSION) || !hdr.resolution) {
+    map->unmap();
+    in->close();
+    throw log_except("%s isn't a binary log, or it's from another version!", argv[0]);
+  }
+
+  // Records end where the last one was reserved, or at the end of the file if it filled up
+  const u64 end = util_min<u64>(util_min(hdr.write, hdr.size), (u64)fileSize - sizeof(logbin_hdr_t));
+  const u32 siteCount = util_min<u64>(hdr.sites, end/sizeof(logbin_record_t));
+
+  site_t *sites = (site_t*)m.alloc((siteCount+1)*sizeof(site_t));
+  if (!sites) {
+    map->unmap();
+    in->close();
+    throw log_except("Cannot allocate %u call sites!", siteCount);
+  }
+  memset((void*)sites, 0, (siteCount+1)*sizeof(site_t));
+
+  const f64 msPerCount = 1000.0/(f64)hdr.resolution;
+  static char line[4096];
+
+  u64 records = 0;
+  u64 at = 0;
+  const char *stopped = NULL;
+
+  while (at + sizeof(logbin_record_t) <= end) {
+    const logbin_record_t &r = *(const logbin_record_t*)(data+at);
+
+    // Once the log fills up, the space left over at the end stays empty
+    if (!r.size) {
+      if (hdr.write <= hdr.size) stopped = "an unfinished record";
+      break;
+    }
+    if ((r.size < sizeof(logbin_record_t)) || (r.size & 7) || (at + r.size > end)) {
+      stopped = "a broken record";
+      break;
+    }
+
+    const u8 *args = (const u8*)(&r+1);
+    u32 argCount;
+    if (!countArgs(args, data+at+r.size, argCount)) {
+      stopped = "a record with broken arguments";
+      break;
+    }
+
+    at += r.size;
+
+    if (r.site & LOGBIN_SITE) {
+      // The line, file and format
+      const u32 id = r.site & ~LOGBIN_SITE;
+      const log_arg_t *a = (const log_arg_t*)args;
+      if (!id || (id > siteCount) || (argCount != 3) || (a->type != LOG_ARG_UINT)) continue;
+
+      site_t &s = sites[id];
+      s.line = (u32)*(const u64*)(a+1);
+
+      a = (const log_arg_t*)((const u8*)(a+1) + 8);
+      if (a->type != LOG_ARG_STR) continue;
+      s.file = (const char*)(a+1);
+
+      a = (const log_arg_t*)((const u8*)(a+1) + ((a->size + 7) & ~7u));
+      if (a->type != LOG_ARG_STR) continue;
+      s.fmt = (const char*)(a+1);
+
+      continue;
+    }
+
+    const f64 ms = (r.time >= hdr.start) ? (f64)(r.time-hdr.start)*msPerCount : 0.0;
+    const site_t *s = ((r.site <= siteCount) && sites[r.site].fmt) ? sites+r.site : NULL;
+
+    if (s) {
+      log_format(line, sizeof(line), s->fmt, args, argCount);
+      printf("[%12.3f ms] %s, %u: %s\n", ms, s->file, s->line, line);
+    } else {
+      printf("[%12.3f ms] <unknown call site %u, %u arguments>\n", ms, r.site, argCount);
+    }
+
+    ++records;
+  }
+
+  if (stopped) log_warning("Stopped at %s, %llu bytes in", stopped, (unsigned long long)at);
+
+  log_note("%llu records from %u call sites, %u records dropped", (unsigned long long)records, siteCount, hdr.dropped);
+
+  m.free(sites);
+  map->unmap();
+  in->close();
+}
@@ -0,0 +1,21 @@
+/*
+ * Main header for tools, contains the tool entry point declaration
+ */
+#ifndef TOOL_H
+#define TOOL_H
+
+#include "types.h"
+
+#include "mem.h"
+#include "file.h"
+#include "log.h"
+
+#include <cstdio>
+
+// Throws log_except_t on error
+// m: Memory pool provided by platform layer
+// f: File system provided by platform layer
+// argc, argv: Arguments after the executable name
+void tool_main(mem_t &m, file_system_t &f, int argc, const char *const *argv);
+
+#endif //TOOL_H